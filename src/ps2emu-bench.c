@@ -0,0 +1,406 @@
+/*
+ * ps2emu-bench.c
+ * Copyright (C) 2015 Red Hat
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public License for more
+ * details.
+ */
+
+#include "ps2emu-log.h"
+#include "ps2emu-kmsg.h"
+#include "ps2emu-replayer.h"
+#include "ps2emu-replay-program.h"
+#include "ps2emu-replay-sim.h"
+#include "ps2emu-packet.h"
+#include "ps2emu-misc.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <glib.h>
+#include <sys/resource.h>
+
+/* Each benchmark runs once over the whole input, and returns how many events
+ * it went through */
+typedef gboolean (*BenchFunc)(const gchar *path,
+                              guint64 *events,
+                              GError **error);
+
+typedef struct {
+    const gchar *name;
+    BenchFunc    func;
+    const gchar *description;
+} Bench;
+
+static guint64 count_events(ParsedLog *log) {
+    LogSection *sections[] = { &log->init_section, &log->main_section };
+    guint64 count = 0;
+
+    for (gsize i = 0; i < G_N_ELEMENTS(sections); i++) {
+        GArray *events = sections[i]->events;
+
+        for (guint j = 0; j < events->len; j++) {
+            if (g_array_index(events, LogEvent, j).type !=
+                LOG_EVENT_TYPE_DELAY)
+                count++;
+        }
+    }
+
+    return count;
+}
+
+static gboolean bench_parse(const gchar *path,
+                            guint64 *events,
+                            GError **error) {
+    GIOChannel *channel;
+    ParsedLog *log = NULL;
+    gint log_version;
+
+    channel = g_io_channel_new_file(path, "r", error);
+    if (!channel)
+        return FALSE;
+
+    log_version = log_parse_version(channel, error);
+    if (log_version >= 0)
+        log = log_parse(channel, log_version, error);
+
+    g_io_channel_unref(channel);
+    if (!log)
+        return FALSE;
+
+    *events = count_events(log);
+    log_free(log);
+
+    return TRUE;
+}
+
+static gboolean bench_parse_file(const gchar *path,
+                                 guint64 *events,
+                                 GError **error) {
+    ParsedLog *log;
+    gint log_version;
+
+    log = log_parse_file(path, &log_version, error);
+    if (!log)
+        return FALSE;
+
+    *events = count_events(log);
+    log_free(log);
+
+    return TRUE;
+}
+
+static gboolean bench_kmsg(const gchar *path,
+                           guint64 *events,
+                           GError **error) {
+    KmsgReader *reader;
+    LogMsgParseResult res;
+    GIOStatus rc;
+
+    reader = kmsg_reader_open(path, error);
+    if (!reader)
+        return FALSE;
+
+    *events = 0;
+    while ((rc = parse_next_message(reader, &res, error)) ==
+           G_IO_STATUS_NORMAL) {
+        if (res.type == I8042_OUTPUT)
+            (*events)++;
+    }
+
+    kmsg_reader_free(reader);
+
+    return rc == G_IO_STATUS_EOF;
+}
+
+static gboolean bench_replay(const gchar *path,
+                             guint64 *events,
+                             GError **error) {
+    static ParsedLog *log = NULL;
+    ReplayBackend *backend;
+    ReplayClock clock;
+    ReplayOptions options = { .speed = 1.0 };
+    gint log_version;
+    gboolean ret;
+
+    /* Only the replay gets measured, so the warm up run just parses the log
+     * and keeps it around for the timed runs */
+    if (!log) {
+        log = log_parse_file(path, &log_version, error);
+        if (!log)
+            return FALSE;
+
+        return TRUE;
+    }
+
+    backend = replay_backend_null_new();
+
+    replay_clock_init(&clock, replay_backend_time(backend));
+    ret = replay_section(backend, &log->init_section, &clock, &options,
+                         error);
+
+    replay_clock_init(&clock, replay_backend_time(backend));
+    ret = ret && replay_section(backend, &log->main_section, &clock,
+                                &options, error);
+
+    replay_backend_free(backend);
+    *events = count_events(log);
+
+    return ret;
+}
+
+static gboolean bench_replay_program(const gchar *path,
+                                     guint64 *events,
+                                     GError **error) {
+    static ParsedLog *log = NULL;
+    static ReplayProgram *init_program,
+                         *main_program;
+    ReplayBackend *backend;
+    ReplayOptions options = { .speed = 1.0 };
+    gint log_version;
+    gboolean ret;
+
+    /* Compiling only happens once no matter how many times the program gets
+     * run, so it's left out of the measurements along with parsing */
+    if (!log) {
+        log = log_parse_file(path, &log_version, error);
+        if (!log)
+            return FALSE;
+
+        init_program = replay_program_compile(&log->init_section, &options);
+        main_program = replay_program_compile(&log->main_section, &options);
+
+        return TRUE;
+    }
+
+    backend = replay_backend_null_new();
+
+    ret = replay_program_run(backend, init_program, &options, error) &&
+          replay_program_run(backend, main_program, &options, error);
+
+    replay_backend_free(backend);
+    *events = count_events(log);
+
+    return ret;
+}
+
+static gboolean bench_replay_sim(const gchar *path,
+                                 guint64 *events,
+                                 GError **error) {
+    static ParsedLog *log = NULL;
+    ReplayBackend *backend;
+    ReplayClock clock;
+    ReplayStats stats;
+    ReplayOptions options = {
+        .speed = 1.0,
+        .receive_timeout = G_USEC_PER_SEC,
+        .stats = &stats,
+    };
+    gint log_version;
+    gboolean ret;
+
+    if (!log) {
+        log = log_parse_file(path, &log_version, error);
+        if (!log)
+            return FALSE;
+
+        return TRUE;
+    }
+
+    backend = replay_backend_sim_new(NULL);
+    replay_stats_init(&stats);
+
+    replay_clock_init(&clock, replay_backend_time(backend));
+    ret = replay_section(backend, &log->init_section, &clock, &options,
+                         error);
+
+    replay_clock_init(&clock, replay_backend_time(backend));
+    ret = ret && replay_section(backend, &log->main_section, &clock,
+                                &options, error);
+
+    replay_backend_free(backend);
+    *events = count_events(log);
+
+    return ret;
+}
+
+static guint64 decode_section(PacketDecoder *decoder,
+                              LogSection *section) {
+    Packet packet;
+    guint64 packets = 0;
+
+    packet_decoder_start_section(decoder);
+    for (guint i = 0; i < section->events->len; i++) {
+        packet_decoder_feed(decoder,
+                            &g_array_index(section->events, LogEvent, i));
+
+        while (packet_decoder_next(decoder, &packet))
+            packets++;
+    }
+
+    packet_decoder_flush(decoder);
+    while (packet_decoder_next(decoder, &packet))
+        packets++;
+
+    return packets;
+}
+
+static gboolean bench_packets(const gchar *path,
+                              guint64 *events,
+                              GError **error) {
+    static ParsedLog *log = NULL;
+    PacketDecoder decoder;
+    guint64 packets;
+    gint log_version;
+
+    if (!log) {
+        log = log_parse_file(path, &log_version, error);
+        if (!log)
+            return FALSE;
+
+        return TRUE;
+    }
+
+    packet_decoder_init(&decoder, log->port, 0);
+    packets = decode_section(&decoder, &log->init_section) +
+              decode_section(&decoder, &log->main_section);
+
+    if (packets == 0) {
+        g_set_error_literal(error, PS2EMU_ERROR, PS2EMU_ERROR_NO_EVENTS,
+                            "No packets found");
+        return FALSE;
+    }
+
+    *events = count_events(log);
+
+    return TRUE;
+}
+
+static const Bench benchmarks[] = {
+    { "parse", bench_parse, "log_parse() on a GIOChannel" },
+    { "parse-file", bench_parse_file, "log_parse_file()" },
+    { "kmsg", bench_kmsg, "parse_next_message() on a kernel message dump" },
+    { "replay", bench_replay, "replay_section() with the null backend" },
+    { "replay-program", bench_replay_program,
+      "replay_program_run() with the null backend" },
+    { "replay-sim", bench_replay_sim,
+      "replay_section() with the simulated backend, keeping to the log's "
+      "timing and recording statistics" },
+    { "packets", bench_packets, "packet_decoder_feed() over a parsed log" },
+};
+
+gint main(gint argc,
+          gchar *argv[]) {
+    GOptionContext *main_context =
+        g_option_context_new("<benchmark> <input> - benchmark ps2emu");
+    GString *description;
+    GError *error = NULL;
+    const Bench *bench = NULL;
+    struct rusage usage;
+    FILE *results;
+    gchar *input;
+    gint64 start,
+           best = G_MAXINT64;
+    guint64 events = 0;
+    gint runs = 5;
+
+    GOptionEntry options[] = {
+        { "version", 'V', G_OPTION_FLAG_NO_ARG, G_OPTION_ARG_CALLBACK,
+          print_version, "Show the version of the application", NULL },
+        { "runs", 'r', G_OPTION_FLAG_NONE, G_OPTION_ARG_INT,
+          &runs, "Run the benchmark n times and keep the fastest run "
+          "(defaults to 5)", "n" },
+        { 0 }
+    };
+
+    description = g_string_new("Benchmarks:\n");
+    for (gsize i = 0; i < G_N_ELEMENTS(benchmarks); i++)
+        g_string_append_printf(description, "  %-16s%s\n",
+                               benchmarks[i].name, benchmarks[i].description);
+    g_string_append(description,
+        "\n"
+        "Prints the results as a single line of JSON.\n");
+
+    g_option_context_add_main_entries(main_context, options, NULL);
+    g_option_context_set_help_enabled(main_context, TRUE);
+    g_option_context_set_description(main_context, description->str);
+
+    if (!g_option_context_parse(main_context, &argc, &argv, &error))
+        exit_on_bad_argument(main_context, TRUE, error->message);
+
+    if (argc < 3)
+        exit_on_bad_argument(main_context, TRUE,
+                             "A benchmark and an input file are required");
+
+    for (gsize i = 0; i < G_N_ELEMENTS(benchmarks); i++) {
+        if (strcmp(argv[1], benchmarks[i].name) == 0)
+            bench = &benchmarks[i];
+    }
+    if (!bench)
+        exit_on_bad_argument(main_context, TRUE, "Unknown benchmark: %s",
+                             argv[1]);
+
+    if (runs < 1)
+        exit_on_bad_argument(main_context, FALSE,
+                             "At least one run is required");
+
+    /* The replay prints user notes to stdout, keep them out of the
+     * results */
+    results = fdopen(dup(STDOUT_FILENO), "w");
+    if (!results || !freopen("/dev/null", "w", stdout)) {
+        g_set_error(&error, G_FILE_ERROR, g_file_error_from_errno(errno),
+                    "While redirecting stdout: %s", strerror(errno));
+        goto error;
+    }
+
+    /* An untimed warm up run, which also gets the input into the page
+     * cache */
+    if (!bench->func(argv[2], &events, &error))
+        goto error;
+
+    for (gint i = 0; i < runs; i++) {
+        start = g_get_monotonic_time();
+        if (!bench->func(argv[2], &events, &error))
+            goto error;
+
+        best = MIN(best, g_get_monotonic_time() - start);
+    }
+
+    getrusage(RUSAGE_SELF, &usage);
+    input = json_escape(argv[2]);
+
+    /* Sub-microsecond runs would otherwise divide by zero */
+    best = MAX(best, 1);
+
+    fprintf(results,
+            "{\"benchmark\": \"%s\", \"input\": \"%s\", "
+            "\"events\": %" G_GUINT64_FORMAT ", \"runs\": %d, "
+            "\"seconds\": %.6f, \"events_per_sec\": %.0f, "
+            "\"ns_per_event\": %.2f, \"peak_rss_kb\": %ld}\n",
+            bench->name, input, events, runs,
+            (gdouble)best / G_USEC_PER_SEC,
+            events * (gdouble)G_USEC_PER_SEC / best,
+            events ? best * 1000.0 / events : 0,
+            usage.ru_maxrss);
+    fclose(results);
+
+    g_free(input);
+    g_string_free(description, TRUE);
+    g_option_context_free(main_context);
+
+    return 0;
+
+error:
+    fprintf(stderr, "Error: %s: %s\n", bench->name, error->message);
+
+    return 1;
+}
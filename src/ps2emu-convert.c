@@ -0,0 +1,110 @@
+/*
+ * ps2emu-convert.c
+ * Copyright (C) 2015 Red Hat
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public License for more
+ * details.
+ */
+
+#include "ps2emu-log.h"
+#include "ps2emu-log-binary.h"
+#include "ps2emu-misc.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <glib.h>
+
+gint main(gint argc,
+          gchar *argv[]) {
+    GOptionContext *main_context =
+        g_option_context_new("<input_log> [output_log] - convert ps2emu logs");
+    GError *error = NULL;
+    ParsedLog *log;
+    FILE *output;
+    gint input_version,
+         output_version = PS2EMU_LOG_VERSION_BINARY;
+    gboolean ret;
+
+    GOptionEntry options[] = {
+        { "version", 'V', G_OPTION_FLAG_NO_ARG, G_OPTION_ARG_CALLBACK,
+          print_version, "Show the version of the application", NULL },
+        { "to", 't', G_OPTION_FLAG_NONE, G_OPTION_ARG_INT,
+          &output_version, "Log version to convert to (defaults to 2)", "n" },
+        { 0 }
+    };
+
+    g_option_context_add_main_entries(main_context, options, NULL);
+    g_option_context_set_help_enabled(main_context, TRUE);
+    g_option_context_set_description(main_context,
+        "Converts a log created with ps2emu-record between the V0 and V1 text\n"
+        "formats and the V2 binary format. If no output file is given, the\n"
+        "converted log is written to stdout.\n");
+
+    if (!g_option_context_parse(main_context, &argc, &argv, &error))
+        exit_on_bad_argument(main_context, TRUE, error->message);
+
+    if (argc < 2)
+        exit_on_bad_argument(main_context, FALSE,
+                             "No filename specified! Use --help for more "
+                             "information");
+
+    if (output_version < 0 || output_version > PS2EMU_LOG_VERSION_MAX)
+        exit_on_bad_argument(main_context, FALSE,
+                             "Can't convert to V%d logs, only V0 through V%d "
+                             "are supported", output_version,
+                             PS2EMU_LOG_VERSION_MAX);
+
+    log = log_parse_file(argv[1], &input_version, &error);
+    if (!log) {
+        g_prefix_error(&error, "While parsing %s: ", argv[1]);
+        goto error;
+    }
+
+    if (output_version == 0) {
+        if (log->init_section.notes->len || log->main_section.notes->len)
+            fprintf(stderr, "Warning: V0 logs don't support notes, they will "
+                            "be dropped\n");
+        if (log->port == PS2_PORT_KBD)
+            fprintf(stderr, "Warning: V0 logs can only be replayed as AUX "
+                            "devices\n");
+    }
+
+    if (argc > 2) {
+        output = fopen(argv[2], "w");
+        if (!output) {
+            g_set_error(&error, G_FILE_ERROR, g_file_error_from_errno(errno),
+                        "While opening %s: %s", argv[2], strerror(errno));
+            log_free(log);
+            goto error;
+        }
+    } else
+        output = stdout;
+
+    if (output_version >= PS2EMU_LOG_VERSION_BINARY)
+        ret = log_binary_write(output, log, &error);
+    else
+        ret = log_write_text(output, log, output_version, &error);
+
+    if (output != stdout)
+        fclose(output);
+    log_free(log);
+
+    if (!ret)
+        goto error;
+
+    return 0;
+
+error:
+    fprintf(stderr, "Error: %s\n", error->message);
+
+    return 1;
+}
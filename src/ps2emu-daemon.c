@@ -0,0 +1,225 @@
+/*
+ * ps2emu-daemon.c
+ * Copyright (C) 2015 Red Hat
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public License for more
+ * details.
+ */
+
+#include "ps2emu-daemon.h"
+#include "ps2emu-misc.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+gboolean daemon_read_line(gint fd,
+                          GString *line,
+                          GError **error) {
+    gchar buf[256];
+    gchar *newline = NULL;
+    gssize ret;
+
+    g_string_truncate(line, 0);
+
+    while (!newline) {
+        ret = read(fd, buf, sizeof(buf));
+        if (ret < 0) {
+            if (errno == EINTR)
+                continue;
+
+            g_set_error(error, G_FILE_ERROR, g_file_error_from_errno(errno),
+                        "%s", g_strerror(errno));
+            return FALSE;
+        }
+
+        if (ret == 0) {
+            g_set_error_literal(error, PS2EMU_ERROR, PS2EMU_ERROR_INPUT,
+                                "Connection closed before the end of the "
+                                "line");
+            return FALSE;
+        }
+
+        newline = memchr(buf, '\n', ret);
+        g_string_append_len(line, buf, newline ? newline - buf : ret);
+
+        if (line->len > DAEMON_LINE_MAX) {
+            g_set_error_literal(error, PS2EMU_ERROR, PS2EMU_ERROR_INPUT,
+                                "Line too long");
+            return FALSE;
+        }
+    }
+
+    return TRUE;
+}
+
+gboolean daemon_write_line(gint fd,
+                           const gchar *line,
+                           GError **error) {
+    gchar *buf = g_strconcat(line, "\n", NULL);
+    gsize len = strlen(buf),
+          written = 0;
+    gssize ret;
+
+    while (written < len) {
+        ret = write(fd, buf + written, len - written);
+        if (ret < 0) {
+            if (errno == EINTR)
+                continue;
+
+            g_set_error(error, G_FILE_ERROR, g_file_error_from_errno(errno),
+                        "%s", g_strerror(errno));
+            g_free(buf);
+            return FALSE;
+        }
+
+        written += ret;
+    }
+
+    g_free(buf);
+    return TRUE;
+}
+
+gchar * daemon_format_result(const DaemonResult *result) {
+    gchar seconds[G_ASCII_DTOSTR_BUF_SIZE];
+
+    g_ascii_formatd(seconds, sizeof(seconds), "%.3f", result->seconds);
+
+    return g_strdup_printf("OK %s sent=%" G_GUINT64_FORMAT
+                           " received=%" G_GUINT64_FORMAT
+                           " mismatches=%" G_GUINT64_FORMAT
+                           " timeouts=%" G_GUINT64_FORMAT " seconds=%s",
+                           result->warm ? "warm" : "cold", result->sent,
+                           result->received, result->mismatches,
+                           result->timeouts, seconds);
+}
+
+static gboolean parse_result(const gchar *line,
+                             DaemonResult *result,
+                             GError **error) {
+    gchar **fields;
+    gboolean ret = FALSE;
+
+    if (g_str_has_prefix(line, "ERROR ")) {
+        g_set_error_literal(error, PS2EMU_ERROR, PS2EMU_ERROR_MISC,
+                            line + strlen("ERROR "));
+        return FALSE;
+    }
+
+    fields = g_strsplit(line, " ", 0);
+    if (g_strv_length(fields) != 7 || strcmp(fields[0], "OK") != 0)
+        goto out;
+
+    memset(result, 0, sizeof(*result));
+    if (strcmp(fields[1], "warm") == 0)
+        result->warm = TRUE;
+    else if (strcmp(fields[1], "cold") != 0)
+        goto out;
+
+    if (!g_str_has_prefix(fields[2], "sent=") ||
+        !g_str_has_prefix(fields[3], "received=") ||
+        !g_str_has_prefix(fields[4], "mismatches=") ||
+        !g_str_has_prefix(fields[5], "timeouts=") ||
+        !g_str_has_prefix(fields[6], "seconds="))
+        goto out;
+
+    result->sent = g_ascii_strtoull(fields[2] + strlen("sent="), NULL, 10);
+    result->received = g_ascii_strtoull(fields[3] + strlen("received="),
+                                        NULL, 10);
+    result->mismatches = g_ascii_strtoull(fields[4] + strlen("mismatches="),
+                                          NULL, 10);
+    result->timeouts = g_ascii_strtoull(fields[5] + strlen("timeouts="),
+                                        NULL, 10);
+    result->seconds = g_ascii_strtod(fields[6] + strlen("seconds="), NULL);
+
+    ret = TRUE;
+
+out:
+    if (!ret && !(error && *error))
+        g_set_error(error, PS2EMU_ERROR, PS2EMU_ERROR_INPUT,
+                    "Invalid reply from the daemon: \"%s\"", line);
+
+    g_strfreev(fields);
+    return ret;
+}
+
+static gint daemon_connect(const gchar *socket_path,
+                           GError **error) {
+    struct sockaddr_un addr = { .sun_family = AF_UNIX };
+    gint fd;
+
+    if (strlen(socket_path) >= sizeof(addr.sun_path)) {
+        g_set_error(error, PS2EMU_ERROR, PS2EMU_ERROR_INPUT,
+                    "Socket path %s is too long", socket_path);
+        return -1;
+    }
+    strcpy(addr.sun_path, socket_path);
+
+    fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0 || connect(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0) {
+        g_set_error(error, G_FILE_ERROR, g_file_error_from_errno(errno),
+                    "While connecting to %s: %s", socket_path,
+                    g_strerror(errno));
+        if (fd >= 0)
+            close(fd);
+
+        return -1;
+    }
+
+    return fd;
+}
+
+gboolean daemon_submit(const gchar *socket_path,
+                       const gchar *log_path,
+                       DaemonResult *result,
+                       GError **error) {
+    GString *reply = g_string_new(NULL);
+    gchar *request,
+          *absolute_path;
+    gboolean ret = FALSE;
+    gint fd;
+
+    fd = daemon_connect(socket_path, error);
+    if (fd < 0)
+        goto out;
+
+    /* The daemon's working directory has nothing to do with ours */
+    if (g_path_is_absolute(log_path)) {
+        absolute_path = g_strdup(log_path);
+    } else {
+        gchar *cwd = g_get_current_dir();
+
+        absolute_path = g_build_filename(cwd, log_path, NULL);
+        g_free(cwd);
+    }
+
+    request = g_strconcat("REPLAY ", absolute_path, NULL);
+    ret = daemon_write_line(fd, request, error) &&
+          daemon_read_line(fd, reply, error);
+    g_free(request);
+    g_free(absolute_path);
+
+    if (!ret) {
+        g_prefix_error(error, "While talking to %s: ", socket_path);
+        goto out;
+    }
+
+    ret = parse_result(reply->str, result, error);
+
+out:
+    if (fd >= 0)
+        close(fd);
+    g_string_free(reply, TRUE);
+
+    return ret;
+}
@@ -0,0 +1,68 @@
+/*
+ * ps2emu-daemon.h
+ * Copyright (C) 2015 Red Hat
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public License for more
+ * details.
+ */
+
+#ifndef __PS2EMU_DAEMON_H__
+#define __PS2EMU_DAEMON_H__
+
+#include <glib.h>
+
+/* Talking to ps2emu-replayd. Each connection carries a single request line and
+ * a single reply line:
+ *
+ *   REPLAY <absolute path to a log>
+ *
+ * gets answered with either
+ *
+ *   OK <warm|cold> sent=n received=n mismatches=n timeouts=n seconds=n
+ *   ERROR <message>
+ *
+ * where warm means the main section got replayed on a device some earlier
+ * request had already initialized, and seconds only covers the main
+ * section. */
+
+#define PS2EMU_DAEMON_SOCKET "/run/ps2emu-replayd.sock"
+
+/* Requests and replies longer than this get rejected */
+#define DAEMON_LINE_MAX 4096
+
+typedef struct {
+    gboolean warm;
+    guint64  sent,
+             received,
+             mismatches,
+             timeouts;
+    gdouble  seconds;
+} DaemonResult;
+
+/* Reads up to the next newline, which doesn't end up in @line */
+gboolean daemon_read_line(gint fd,
+                          GString *line,
+                          GError **error);
+
+gboolean daemon_write_line(gint fd,
+                           const gchar *line,
+                           GError **error);
+
+gchar * daemon_format_result(const DaemonResult *result)
+G_GNUC_MALLOC;
+
+/* Has ps2emu-replayd listening on @socket_path replay the log at @log_path.
+ * An ERROR reply gets turned into @error. */
+gboolean daemon_submit(const gchar *socket_path,
+                       const gchar *log_path,
+                       DaemonResult *result,
+                       GError **error);
+
+#endif /* !__PS2EMU_DAEMON_H__ */
@@ -0,0 +1,544 @@
+/*
+ * ps2emu-gen.c
+ * Copyright (C) 2015 Red Hat
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public License for more
+ * details.
+ */
+
+#include "ps2emu-log.h"
+#include "ps2emu-misc.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <glib.h>
+
+/* Roughly how long it takes to clock a single byte over a PS/2 port */
+#define GEN_BYTE_TIME_MIN 600
+#define GEN_BYTE_TIME_MAX 1100
+
+/* Kernel timestamps start counting from boot, and i8042 prints jiffies along
+ * with each byte. Assume a kernel with HZ=250. */
+#define GEN_KMSG_BOOT_TIME       ((time_t)42 * G_USEC_PER_SEC)
+#define GEN_KMSG_USEC_PER_JIFFY  4000
+
+/* One kernel message in this many comes from something other than i8042 */
+#define GEN_KMSG_NOISE_RATIO 20
+
+/* ps2emu-record waits for the device to go quiet for a few seconds before it
+ * starts the main section, so leave a gap that's long enough for that */
+#define GEN_KMSG_INIT_GAP (6 * G_USEC_PER_SEC)
+
+typedef struct {
+    gchar  direction;
+    guchar data;
+} GenInitEvent;
+
+static const GenInitEvent gen_mouse_init[] = {
+    { 'S', 0xff }, { 'R', 0xfa }, { 'R', 0xaa }, { 'R', 0x00 },
+    { 'S', 0xf2 }, { 'R', 0xfa }, { 'R', 0x00 },
+    { 'S', 0xe8 }, { 'R', 0xfa }, { 'S', 0x03 }, { 'R', 0xfa },
+    { 'S', 0xf3 }, { 'R', 0xfa }, { 'S', 0x64 }, { 'R', 0xfa },
+    { 'S', 0xf4 }, { 'R', 0xfa },
+};
+
+/* Sample rates of 200, 100 and 80 in a row turn on the scroll wheel */
+static const GenInitEvent gen_intellimouse_init[] = {
+    { 'S', 0xff }, { 'R', 0xfa }, { 'R', 0xaa }, { 'R', 0x00 },
+    { 'S', 0xf3 }, { 'R', 0xfa }, { 'S', 0xc8 }, { 'R', 0xfa },
+    { 'S', 0xf3 }, { 'R', 0xfa }, { 'S', 0x64 }, { 'R', 0xfa },
+    { 'S', 0xf3 }, { 'R', 0xfa }, { 'S', 0x50 }, { 'R', 0xfa },
+    { 'S', 0xf2 }, { 'R', 0xfa }, { 'R', 0x03 },
+    { 'S', 0xe8 }, { 'R', 0xfa }, { 'S', 0x03 }, { 'R', 0xfa },
+    { 'S', 0xf3 }, { 'R', 0xfa }, { 'S', 0x64 }, { 'R', 0xfa },
+    { 'S', 0xf4 }, { 'R', 0xfa },
+};
+
+/* Synaptics identify query, then a sample rate of 20 to set the mode byte
+ * that's been encoded in the resolution commands before it */
+static const GenInitEvent gen_touchpad_init[] = {
+    { 'S', 0xff }, { 'R', 0xfa }, { 'R', 0xaa }, { 'R', 0x00 },
+    { 'S', 0xe8 }, { 'R', 0xfa }, { 'S', 0x00 }, { 'R', 0xfa },
+    { 'S', 0xe8 }, { 'R', 0xfa }, { 'S', 0x00 }, { 'R', 0xfa },
+    { 'S', 0xe8 }, { 'R', 0xfa }, { 'S', 0x00 }, { 'R', 0xfa },
+    { 'S', 0xe8 }, { 'R', 0xfa }, { 'S', 0x00 }, { 'R', 0xfa },
+    { 'S', 0xe9 }, { 'R', 0xfa }, { 'R', 0x01 }, { 'R', 0x47 }, { 'R', 0x18 },
+    { 'S', 0xe8 }, { 'R', 0xfa }, { 'S', 0x02 }, { 'R', 0xfa },
+    { 'S', 0xe8 }, { 'R', 0xfa }, { 'S', 0x00 }, { 'R', 0xfa },
+    { 'S', 0xe8 }, { 'R', 0xfa }, { 'S', 0x00 }, { 'R', 0xfa },
+    { 'S', 0xe8 }, { 'R', 0xfa }, { 'S', 0x01 }, { 'R', 0xfa },
+    { 'S', 0xf3 }, { 'R', 0xfa }, { 'S', 0x14 }, { 'R', 0xfa },
+    { 'S', 0xf4 }, { 'R', 0xfa },
+};
+
+static const GenInitEvent gen_kbd_init[] = {
+    { 'S', 0xff }, { 'R', 0xfa }, { 'R', 0xaa },
+    { 'S', 0xf2 }, { 'R', 0xfa }, { 'R', 0xab }, { 'R', 0x41 },
+    { 'S', 0xed }, { 'R', 0xfa }, { 'S', 0x00 }, { 'R', 0xfa },
+    { 'S', 0xf3 }, { 'R', 0xfa }, { 'S', 0x00 }, { 'R', 0xfa },
+    { 'S', 0xf4 }, { 'R', 0xfa },
+};
+
+static const guchar gen_kbd_arrow_keys[] = { 0x48, 0x4b, 0x4d, 0x50 };
+
+static const gchar *gen_notes[] = {
+    "Moving the cursor around",
+    "Clicking the left button",
+    "Scrolling with two fingers",
+    "Typing a few words",
+    "Leaving the device alone for a bit",
+    "Something went wrong here",
+};
+
+static const gchar *gen_kmsg_noise[] = {
+    "usb 1-1: new high-speed USB device number 5 using xhci_hcd",
+    "wlp3s0: associated",
+    "IPv6: ADDRCONF(NETDEV_CHANGE): wlp3s0: link becomes ready",
+    "audit: type=1400 audit(0.0:42): apparmor=\"STATUS\"",
+    "EXT4-fs (dm-1): re-mounted. Opts: (null)",
+};
+
+typedef struct {
+    FILE    *output;
+    GRand   *rand;
+    PS2Port  port;
+    gboolean kmsg;
+    guint    packet_size;
+    gdouble  rate;
+    guint    note_interval;
+
+    guint64  max_events,
+             max_size;
+
+    time_t   time,
+             section_start;
+    guint64  events,
+             bytes,
+             kmsg_seq,
+             next_note;
+
+    /* Where the pointer is, used to make the motion packets look plausible */
+    gint     x,
+             y;
+} Generator;
+
+static guint64 max_size = 0;
+
+static void gen_write(Generator *gen,
+                      const gchar *format,
+                      ...) G_GNUC_PRINTF(2, 3);
+
+static void gen_write(Generator *gen,
+                      const gchar *format,
+                      ...) {
+    va_list args;
+    int len;
+
+    va_start(args, format);
+    len = vfprintf(gen->output, format, args);
+    va_end(args);
+
+    if (len > 0)
+        gen->bytes += len;
+}
+
+static void gen_write_kmsg_header(Generator *gen,
+                                  gint priority) {
+    gen_write(gen, "%d,%" G_GUINT64_FORMAT ",%ld,-;",
+              priority, gen->kmsg_seq++, GEN_KMSG_BOOT_TIME + gen->time);
+}
+
+static void gen_write_kmsg_event(Generator *gen,
+                                 gchar direction,
+                                 guchar data) {
+    long jiffies = (GEN_KMSG_BOOT_TIME + gen->time) / GEN_KMSG_USEC_PER_JIFFY;
+
+    if (g_rand_int_range(gen->rand, 0, GEN_KMSG_NOISE_RATIO) == 0) {
+        gen_write_kmsg_header(gen, 6);
+        gen_write(gen, "%s\n",
+                  gen_kmsg_noise[g_rand_int_range(
+                      gen->rand, 0, G_N_ELEMENTS(gen_kmsg_noise))]);
+    }
+
+    gen_write_kmsg_header(gen, 7);
+
+    if (direction == 'R') {
+        gen_write(gen, "i8042: [%ld] %.2hhx <- i8042 (interrupt, %d, %d)\n",
+                  jiffies, data, gen->port == PS2_PORT_KBD ? 0 : 1,
+                  gen->port == PS2_PORT_KBD ? 1 : 12);
+    } else if (gen->port == PS2_PORT_KBD) {
+        gen_write(gen, "i8042: [%ld] %.2hhx -> i8042 (kbd-data)\n",
+                  jiffies, data);
+    } else {
+        gen_write(gen, "i8042: [%ld] d4 -> i8042 (command)\n", jiffies);
+        gen_write_kmsg_header(gen, 7);
+        gen_write(gen, "i8042: [%ld] %.2hhx -> i8042 (parameter)\n",
+                  jiffies, data);
+    }
+}
+
+/* Adds an event @delay microseconds after the last one */
+static void gen_event(Generator *gen,
+                      time_t delay,
+                      gchar direction,
+                      guchar data) {
+    gen->time += delay;
+    gen->events++;
+
+    if (gen->kmsg)
+        gen_write_kmsg_event(gen, direction, data);
+    else
+        gen_write(gen, "E: %-10ld %c %.2hhx\n",
+                  gen->time - gen->section_start, direction, data);
+}
+
+static inline time_t gen_byte_time(Generator *gen) {
+    return g_rand_int_range(gen->rand, GEN_BYTE_TIME_MIN, GEN_BYTE_TIME_MAX);
+}
+
+/* Returns @delay give or take up to @jitter, but never less than 0 */
+static time_t gen_jitter(Generator *gen,
+                         time_t delay,
+                         time_t jitter) {
+    delay += g_rand_int_range(gen->rand, -jitter, jitter + 1);
+
+    return MAX(delay, 0);
+}
+
+static void gen_section(Generator *gen,
+                        const gchar *name) {
+    if (!gen->kmsg)
+        gen_write(gen, "S: %s\n", name);
+
+    /* --events only counts the events in the main section */
+    gen->section_start = gen->time;
+    gen->events = 0;
+}
+
+static void gen_maybe_note(Generator *gen) {
+    if (gen->kmsg || !gen->note_interval || gen->events < gen->next_note)
+        return;
+
+    gen_write(gen, "N: %s\n",
+              gen_notes[g_rand_int_range(gen->rand, 0,
+                                         G_N_ELEMENTS(gen_notes))]);
+
+    /* Space them out unevenly, but keep the average at the interval */
+    gen->next_note = gen->events +
+        g_rand_int_range(gen->rand, gen->note_interval / 2 + 1,
+                         gen->note_interval * 3 / 2 + 1);
+}
+
+static gboolean gen_done(Generator *gen) {
+    return (gen->max_events && gen->events >= gen->max_events) ||
+           (gen->max_size && gen->bytes >= gen->max_size);
+}
+
+static void gen_init_section(Generator *gen) {
+    const GenInitEvent *init;
+    gsize count;
+
+    if (gen->port == PS2_PORT_KBD) {
+        init = gen_kbd_init;
+        count = G_N_ELEMENTS(gen_kbd_init);
+    } else if (gen->packet_size == 6) {
+        init = gen_touchpad_init;
+        count = G_N_ELEMENTS(gen_touchpad_init);
+    } else if (gen->packet_size == 4) {
+        init = gen_intellimouse_init;
+        count = G_N_ELEMENTS(gen_intellimouse_init);
+    } else {
+        init = gen_mouse_init;
+        count = G_N_ELEMENTS(gen_mouse_init);
+    }
+
+    gen_section(gen, "Init");
+
+    /* Devices take a moment to come back after a reset */
+    for (gsize i = 0; i < count; i++) {
+        gen_event(gen, i && init[i - 1].data == 0xff ?
+                       g_rand_int_range(gen->rand, 300000, 500000) :
+                       gen_byte_time(gen),
+                  init[i].direction, init[i].data);
+    }
+}
+
+static void gen_aux_packet(Generator *gen,
+                           guchar *packet) {
+    gint dx = g_rand_int_range(gen->rand, -12, 13),
+         dy = g_rand_int_range(gen->rand, -12, 13);
+    guchar buttons = g_rand_int_range(gen->rand, 0, 50) == 0 ? 0x01 : 0x00;
+
+    if (gen->packet_size == 6) {
+        /* Synaptics absolute mode, with the finger width fixed at 4 */
+        gint z = g_rand_int_range(gen->rand, 30, 80),
+             w = 4;
+
+        gen->x = CLAMP(gen->x + dx * 8, 1472, 5472);
+        gen->y = CLAMP(gen->y + dy * 8, 1408, 4448);
+
+        packet[0] = 0x80 | ((w & 0xc) << 2) | ((w & 0x2) << 1) | buttons;
+        packet[1] = ((gen->y >> 4) & 0xf0) | ((gen->x >> 8) & 0x0f);
+        packet[2] = z;
+        packet[3] = 0xc0 | ((gen->y >> 7) & 0x20) | ((gen->x >> 8) & 0x10) |
+                    ((w & 0x1) << 2) | buttons;
+        packet[4] = gen->x & 0xff;
+        packet[5] = gen->y & 0xff;
+        return;
+    }
+
+    packet[0] = 0x08 | buttons | (dx < 0 ? 0x10 : 0) | (dy < 0 ? 0x20 : 0);
+    packet[1] = dx & 0xff;
+    packet[2] = dy & 0xff;
+
+    /* Scroll wheel, which doesn't get used all that often */
+    if (gen->packet_size == 4)
+        packet[3] = g_rand_int_range(gen->rand, 0, 20) == 0 ?
+                    (g_rand_boolean(gen->rand) ? 0x01 : 0xff) : 0x00;
+}
+
+/* A burst of motion packets at the configured rate, with a bit of jitter
+ * since real devices don't keep perfect time either */
+static void gen_aux_burst(Generator *gen) {
+    time_t interval = G_USEC_PER_SEC / gen->rate;
+    guint packets = gen->rate * g_rand_double_range(gen->rand, 0.2, 3.0) + 1;
+    guchar packet[6];
+
+    for (guint i = 0; i < packets && !gen_done(gen); i++) {
+        time_t packet_time = 0;
+
+        gen_aux_packet(gen, packet);
+
+        for (guint j = 0; j < gen->packet_size; j++) {
+            time_t delay = gen_byte_time(gen);
+
+            packet_time += delay;
+            gen_event(gen, delay, 'R', packet[j]);
+        }
+
+        gen->time += gen_jitter(gen, interval - packet_time, interval / 10);
+    }
+}
+
+/* Typing, in scan code set 1 since that's what comes out of i8042 when
+ * translation is on */
+static void gen_kbd_burst(Generator *gen) {
+    guint keys = g_rand_int_range(gen->rand, 5, 40);
+    time_t interval = G_USEC_PER_SEC / gen->rate;
+
+    for (guint i = 0; i < keys && !gen_done(gen); i++) {
+        gboolean extended = g_rand_int_range(gen->rand, 0, 10) == 0;
+        guchar code = extended ?
+                      gen_kbd_arrow_keys[g_rand_int_range(
+                          gen->rand, 0, G_N_ELEMENTS(gen_kbd_arrow_keys))] :
+                      g_rand_int_range(gen->rand, 0x02, 0x3a);
+        time_t hold = g_rand_int_range(gen->rand, 60000, 150000);
+
+        if (extended)
+            gen_event(gen, gen_byte_time(gen), 'R', 0xe0);
+        gen_event(gen, gen_byte_time(gen), 'R', code);
+
+        if (extended)
+            gen_event(gen, hold, 'R', 0xe0);
+        gen_event(gen, extended ? gen_byte_time(gen) : hold, 'R',
+                  code | 0x80);
+
+        gen->time += gen_jitter(gen, interval - hold, interval / 4);
+    }
+}
+
+static void gen_main_section(Generator *gen) {
+    if (gen->kmsg)
+        gen->time += GEN_KMSG_INIT_GAP;
+
+    gen_section(gen, "Main");
+
+    gen->x = 3000;
+    gen->y = 3000;
+    gen->next_note = gen->note_interval;
+
+    while (!gen_done(gen)) {
+        gen_maybe_note(gen);
+
+        if (gen->port == PS2_PORT_KBD)
+            gen_kbd_burst(gen);
+        else
+            gen_aux_burst(gen);
+
+        /* Idle time between gestures */
+        gen->time += g_rand_int_range(gen->rand, 300000, 5000000);
+    }
+}
+
+static gboolean process_size_arg(const gchar *option_name,
+                                 const gchar *value,
+                                 gpointer data,
+                                 GError **error) {
+    gchar *end;
+    guint64 size;
+
+    errno = 0;
+    size = g_ascii_strtoull(value, &end, 10);
+    if (errno != 0 || end == value)
+        goto error;
+
+    switch (g_ascii_tolower(*end)) {
+        case 'g':
+            size *= 1024;
+            /* fall through */
+        case 'm':
+            size *= 1024;
+            /* fall through */
+        case 'k':
+            size *= 1024;
+            end++;
+            break;
+    }
+
+    if (*end != '\0')
+        goto error;
+
+    max_size = size;
+    return TRUE;
+
+error:
+    g_set_error(error, G_OPTION_ERROR, G_OPTION_ERROR_BAD_VALUE,
+                "Invalid size for %s: %s", option_name, value);
+    return FALSE;
+}
+
+gint main(gint argc,
+          gchar *argv[]) {
+    GOptionContext *main_context =
+        g_option_context_new("[output] - generate synthetic ps2emu logs");
+    GError *error = NULL;
+    Generator gen = { 0 };
+    gchar *target = NULL;
+    gint64 events = -1;
+    gint packet_size = 3,
+         note_interval = 5000,
+         seed = 0;
+    gdouble rate = 0;
+    gboolean kmsg = FALSE;
+
+    GOptionEntry options[] = {
+        { "version", 'V', G_OPTION_FLAG_NO_ARG, G_OPTION_ARG_CALLBACK,
+          print_version, "Show the version of the application", NULL },
+        { "target", 't', G_OPTION_FLAG_NONE, G_OPTION_ARG_STRING,
+          &target, "Type of device to generate events for", "<kbd|aux>" },
+        { "events", 'e', G_OPTION_FLAG_NONE, G_OPTION_ARG_INT64,
+          &events, "Stop after n events in the main section (defaults to "
+          "100000)", "n" },
+        { "size", 's', G_OPTION_FLAG_NONE, G_OPTION_ARG_CALLBACK,
+          process_size_arg, "Stop once the output is about n bytes long, a "
+          "K, M or G suffix can be used", "n" },
+        { "rate", 'r', G_OPTION_FLAG_NONE, G_OPTION_ARG_DOUBLE,
+          &rate, "Packets (or key presses) per second while the device is "
+          "in use", "n" },
+        { "packet-size", 'p', G_OPTION_FLAG_NONE, G_OPTION_ARG_INT,
+          &packet_size, "Size of AUX packets: 3 (mouse), 4 (wheel mouse) or "
+          "6 (touchpad)", "n" },
+        { "note-interval", 'n', G_OPTION_FLAG_NONE, G_OPTION_ARG_INT,
+          &note_interval, "Add a user note about every n events, 0 for none",
+          "n" },
+        { "kmsg", 'k', G_OPTION_FLAG_NONE, G_OPTION_ARG_NONE,
+          &kmsg, "Write the kernel messages ps2emu-record would read "
+          "instead of a log", NULL },
+        { "seed", 0, G_OPTION_FLAG_NONE, G_OPTION_ARG_INT,
+          &seed, "Seed for the random number generator", "n" },
+        { 0 }
+    };
+
+    g_option_context_add_main_entries(main_context, options, NULL);
+    g_option_context_set_help_enabled(main_context, TRUE);
+    g_option_context_set_description(main_context,
+        "Generates a V1 log full of made up, but plausible looking, events.\n"
+        "With --kmsg, the same kind of events are written out in the format\n"
+        "of /dev/kmsg instead. If no output file is given, the output is\n"
+        "written to stdout.\n");
+
+    if (!g_option_context_parse(main_context, &argc, &argv, &error))
+        exit_on_bad_argument(main_context, TRUE, error->message);
+
+    if (!target || g_ascii_strcasecmp(target, "AUX") == 0)
+        gen.port = PS2_PORT_AUX;
+    else if (g_ascii_strcasecmp(target, "KBD") == 0)
+        gen.port = PS2_PORT_KBD;
+    else
+        exit_on_bad_argument(main_context, FALSE, "Invalid target: %s",
+                             target);
+
+    if (packet_size != 3 && packet_size != 4 && packet_size != 6)
+        exit_on_bad_argument(main_context, FALSE,
+                             "Packet size must be 3, 4 or 6");
+
+    if (rate < 0 || note_interval < 0)
+        exit_on_bad_argument(main_context, FALSE,
+                             "Rates and intervals can't be negative");
+
+    if (events < 0)
+        events = max_size ? 0 : 100000;
+
+    if (rate == 0)
+        rate = gen.port == PS2_PORT_KBD ? 8 : 100;
+
+    gen.rand = g_rand_new_with_seed(seed);
+    gen.kmsg = kmsg;
+    gen.packet_size = packet_size;
+    gen.rate = rate;
+    gen.note_interval = note_interval;
+    gen.max_events = events;
+    gen.max_size = max_size;
+
+    if (argc > 1) {
+        gen.output = fopen(argv[1], "w");
+        if (!gen.output) {
+            g_set_error(&error, G_FILE_ERROR, g_file_error_from_errno(errno),
+                        "While opening %s: %s", argv[1], strerror(errno));
+            goto error;
+        }
+    } else
+        gen.output = stdout;
+
+    if (gen.kmsg) {
+        gen_write_kmsg_header(&gen, 12);
+        gen_write(&gen, "ps2emu: Start recording %ld\n",
+                  GEN_KMSG_BOOT_TIME);
+    } else {
+        gen_write(&gen, "# ps2emu-record V%d\n"
+                        "# Generated by ps2emu-gen (seed %d)\n"
+                        "T: %c\n",
+                  PS2EMU_LOG_VERSION, seed,
+                  gen.port == PS2_PORT_KBD ? 'K' : 'A');
+    }
+
+    gen_init_section(&gen);
+    gen_main_section(&gen);
+
+    if (fflush(gen.output) != 0 || ferror(gen.output)) {
+        g_set_error(&error, G_FILE_ERROR, g_file_error_from_errno(errno),
+                    "While writing output: %s", strerror(errno));
+        goto error;
+    }
+
+    if (gen.output != stdout)
+        fclose(gen.output);
+    g_rand_free(gen.rand);
+    g_free(target);
+
+    return 0;
+
+error:
+    fprintf(stderr, "Error: %s\n", error->message);
+
+    return 1;
+}
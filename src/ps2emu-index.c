@@ -0,0 +1,65 @@
+/*
+ * ps2emu-index.c
+ * Copyright (C) 2015 Red Hat
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public License for more
+ * details.
+ */
+
+#include "ps2emu-log-index.h"
+#include "ps2emu-misc.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <glib.h>
+
+gint main(gint argc,
+          gchar *argv[]) {
+    GOptionContext *main_context =
+        g_option_context_new("<event_log>... - index ps2emu logs for seeking");
+    GError *error = NULL;
+    LogIndex *index;
+    gint ret = 0;
+
+    GOptionEntry options[] = {
+        { "version", 'V', G_OPTION_FLAG_NO_ARG, G_OPTION_ARG_CALLBACK,
+          print_version, "Show the version of the application", NULL },
+        { 0 }
+    };
+
+    g_option_context_add_main_entries(main_context, options, NULL);
+    g_option_context_set_help_enabled(main_context, TRUE);
+    g_option_context_set_description(main_context,
+        "Writes a seek index next to each log, which lets ps2emu-replay jump\n"
+        "straight to the part of the log given with --start-at.\n");
+
+    if (!g_option_context_parse(main_context, &argc, &argv, &error))
+        exit_on_bad_argument(main_context, TRUE, error->message);
+
+    if (argc < 2)
+        exit_on_bad_argument(main_context, FALSE,
+                             "No filename specified! Use --help for more "
+                             "information");
+
+    for (int i = 1; i < argc; i++) {
+        index = log_index_build(argv[i], &error);
+        if (!index || !log_index_write(index, argv[i], &error)) {
+            fprintf(stderr, "Error: While indexing %s: %s\n", argv[i],
+                    error->message);
+            g_clear_error(&error);
+            ret = 1;
+        }
+
+        if (index)
+            log_index_free(index);
+    }
+
+    return ret;
+}
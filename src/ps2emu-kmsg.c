@@ -0,0 +1,370 @@
+/*
+ * ps2emu-kmsg.c
+ * Copyright (C) 2015 Red Hat
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public License for more
+ * details.
+ */
+
+#include "ps2emu-kmsg.h"
+#include "ps2emu-scanner.h"
+#include "ps2emu-misc.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <glib.h>
+
+KmsgReader * kmsg_reader_open(const gchar *path,
+                              GError **error) {
+    KmsgReader *reader;
+    gint fd;
+
+    fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        g_set_error(error, G_FILE_ERROR, g_file_error_from_errno(errno),
+                    "While opening %s: %s", path, g_strerror(errno));
+        return NULL;
+    }
+
+    reader = g_new(KmsgReader, 1);
+    reader->fd = fd;
+    reader->seen_seq = FALSE;
+    reader->last_seq = 0;
+    reader->lost = 0;
+    reader->pos = 0;
+    reader->len = 0;
+
+    return reader;
+}
+
+gboolean kmsg_reader_set_nonblocking(KmsgReader *reader,
+                                     GError **error) {
+    gint flags = fcntl(reader->fd, F_GETFL);
+
+    if (flags < 0 || fcntl(reader->fd, F_SETFL, flags | O_NONBLOCK) < 0) {
+        g_set_error(error, G_FILE_ERROR, g_file_error_from_errno(errno),
+                    "%s", g_strerror(errno));
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+void kmsg_reader_free(KmsgReader *reader) {
+    close(reader->fd);
+    g_free(reader);
+}
+
+/* Hands out the next line NUL terminated in place, without the newline */
+static GIOStatus kmsg_reader_next_line(KmsgReader *reader,
+                                       gchar **line,
+                                       gchar **line_end,
+                                       GError **error) {
+    gchar *newline;
+    gssize ret;
+
+    while (TRUE) {
+        newline = (gchar*)scanner_find_line_end(reader->buf + reader->pos,
+                                                reader->buf + reader->len);
+        if (newline < reader->buf + reader->len)
+            break;
+
+        /* Keep whatever's left of a partial line, and make sure there's
+         * always room for a whole record after it */
+        memmove(reader->buf, reader->buf + reader->pos,
+                reader->len - reader->pos);
+        reader->len -= reader->pos;
+        reader->pos = 0;
+
+        if (reader->len > sizeof(reader->buf) - 1 - KMSG_RECORD_MAX) {
+            g_set_error(error, PS2EMU_ERROR, PS2EMU_ERROR_INPUT,
+                        "Kernel message longer than %d bytes",
+                        KMSG_RECORD_MAX);
+            return G_IO_STATUS_ERROR;
+        }
+
+        ret = read(reader->fd, reader->buf + reader->len,
+                   sizeof(reader->buf) - 1 - reader->len);
+        if (ret < 0) {
+            /* EPIPE means the kernel overwrote some records before we got to
+             * them, it picks up from the oldest one left on the next read.
+             * The gap in the sequence numbers tells us how many we lost. */
+            if (errno == EINTR || errno == EPIPE)
+                continue;
+            if (errno == EAGAIN)
+                return G_IO_STATUS_AGAIN;
+
+            g_set_error(error, G_FILE_ERROR, g_file_error_from_errno(errno),
+                        "While reading kernel messages: %s",
+                        g_strerror(errno));
+            return G_IO_STATUS_ERROR;
+        }
+
+        if (ret == 0) {
+            if (reader->len == 0)
+                return G_IO_STATUS_EOF;
+
+            /* The last line of a file without a newline at the end */
+            newline = reader->buf + reader->len;
+            break;
+        }
+
+        reader->len += ret;
+    }
+
+    *newline = '\0';
+    *line = reader->buf + reader->pos;
+    *line_end = newline;
+
+    reader->pos = newline - reader->buf;
+    if (reader->pos < reader->len)
+        reader->pos++;
+
+    return G_IO_STATUS_NORMAL;
+}
+
+/* Equivalent to "%lu", for the numbers in kernel messages which are never
+ * negative */
+static const gchar * scan_ulong(const gchar *str,
+                                gulong *result) {
+    const gchar *digits_start = str;
+    gulong value = 0;
+
+    for (; g_ascii_isdigit(*str); str++) {
+        guint digit = *str - '0';
+
+        if (value > (G_MAXULONG - digit) / 10)
+            return NULL;
+
+        value = value * 10 + digit;
+    }
+    if (str == digits_start)
+        return NULL;
+
+    *result = value;
+    return str;
+}
+
+static inline const gchar * skip_space(const gchar *str) {
+    while (g_ascii_isspace(*str))
+        str++;
+
+    return str;
+}
+
+/* Parses the "priority,seq,timestamp" at the start of a record */
+static gboolean parse_record_header(const gchar *line,
+                                    gulong *seq,
+                                    time_t *time) {
+    const gchar *pos;
+    gulong priority,
+           timestamp;
+
+    pos = scan_ulong(line, &priority);
+    if (!pos || *pos++ != ',')
+        return FALSE;
+
+    pos = scan_ulong(pos, seq);
+    if (!pos || *pos++ != ',')
+        return FALSE;
+
+    pos = scan_ulong(pos, &timestamp);
+    if (!pos || (*pos != ',' && *pos != ';') || timestamp > G_MAXLONG)
+        return FALSE;
+
+    *time = timestamp;
+    return TRUE;
+}
+
+static GIOStatus get_next_module_line(KmsgReader *reader,
+                                      GQuark *match,
+                                      time_t *time,
+                                      gchar **start_pos,
+                                      GError **error) {
+    static const gchar *search_strings[] = { "i8042: ", "ps2emu: " };
+    int index;
+    gchar *current_line,
+          *line_end;
+    gboolean has_header;
+    gulong seq;
+    time_t line_time;
+    GIOStatus rc;
+
+    while ((rc = kmsg_reader_next_line(reader, &current_line, &line_end,
+                                       error)) == G_IO_STATUS_NORMAL) {
+        /* Every record gets its sequence number checked, so a gap means the
+         * kernel dropped some. Lines that don't have a header are the
+         * dictionaries that follow a record. */
+        has_header = parse_record_header(current_line, &seq, &line_time);
+        if (has_header) {
+            if (reader->seen_seq && seq > reader->last_seq + 1)
+                reader->lost += seq - reader->last_seq - 1;
+            reader->last_seq = seq;
+            reader->seen_seq = TRUE;
+        }
+
+        for (index = 0; index < G_N_ELEMENTS(search_strings); index++) {
+            *start_pos = (gchar*)scanner_find(current_line, line_end,
+                                              search_strings[index],
+                                              strlen(search_strings[index]));
+            if (*start_pos)
+                break;
+        }
+        if (*start_pos)
+            break;
+    }
+
+    if (rc != G_IO_STATUS_NORMAL) {
+        return rc;
+    }
+
+    if (!has_header) {
+        g_set_error(error, PS2EMU_ERROR, PS2EMU_ERROR_INPUT,
+                    "Invalid/no time value received: %s", current_line);
+        return G_IO_STATUS_ERROR;
+    }
+
+    /* Move the start position after the initial 'i8042: ' */
+    *start_pos += strlen(search_strings[index]);
+    *time = line_time;
+
+    *match = g_quark_from_static_string(search_strings[index]);
+
+    return rc;
+}
+
+gboolean parse_normal_event(const gchar *start_pos,
+                            PS2Event *event,
+                            GError **error) {
+    const gchar *pos = start_pos,
+                *type_str,
+                *type_end,
+                *arg_end;
+    gsize type_len;
+    gulong value;
+    guint data = 0;
+
+    /* "[%*d] %hhx %*1[-<]%*1[->] i8042 (" */
+    if (*pos++ != '[')
+        return FALSE;
+
+    pos = skip_space(pos);
+    if (*pos == '-' || *pos == '+')
+        pos++;
+    pos = scan_ulong(pos, &value);
+    if (!pos || *pos++ != ']')
+        return FALSE;
+
+    pos = skip_space(pos);
+    if (!g_ascii_isxdigit(*pos))
+        return FALSE;
+    for (; g_ascii_isxdigit(*pos); pos++)
+        data = ((data << 4) | g_ascii_xdigit_value(*pos)) & 0xff;
+
+    pos = skip_space(pos);
+    if ((pos[0] != '-' && pos[0] != '<') || (pos[1] != '-' && pos[1] != '>'))
+        return FALSE;
+
+    pos = skip_space(pos + 2);
+    if (!g_str_has_prefix(pos, "i8042"))
+        return FALSE;
+
+    pos = skip_space(pos + strlen("i8042"));
+    if (*pos++ != '(')
+        return FALSE;
+
+    type_str = pos;
+    type_end = strchr(type_str, ')');
+    if (!type_end || type_end == type_str)
+        return FALSE;
+
+    type_len = type_end - type_str;
+    arg_end = memchr(type_str, ',', type_len);
+
+#define TYPE_IS(str, len, name) \
+    ((len) == strlen(name) && memcmp((str), (name), (len)) == 0)
+
+    if (TYPE_IS(type_str, (arg_end ? arg_end : type_end) - type_str,
+                "interrupt")) {
+        event->type = PS2_EVENT_TYPE_INTERRUPT;
+
+        /* "interrupt, port, irq" */
+        pos = arg_end ? scan_ulong(skip_space(arg_end + 1), &value) : NULL;
+        if (!pos || !memchr(pos, ',', type_end - pos)) {
+            g_set_error(error, PS2EMU_ERROR, PS2EMU_ERROR_INPUT,
+                        "Got interrupt event, but had less arguments then "
+                        "expected");
+            return FALSE;
+        }
+
+        event->origin = value;
+    }
+    else if (TYPE_IS(type_str, type_len, "command"))
+        event->type = PS2_EVENT_TYPE_COMMAND;
+    else if (TYPE_IS(type_str, type_len, "parameter"))
+        event->type = PS2_EVENT_TYPE_PARAMETER;
+    else if (TYPE_IS(type_str, type_len, "return"))
+        event->type = PS2_EVENT_TYPE_RETURN;
+    else if (TYPE_IS(type_str, type_len, "kbd-data"))
+        event->type = PS2_EVENT_TYPE_KBD_DATA;
+    else
+        return FALSE;
+
+#undef TYPE_IS
+
+    event->data = data;
+    event->original_line = start_pos;
+
+    return TRUE;
+}
+
+gboolean parse_record_start_marker(const gchar *start_pos,
+                                   gint64 *start_time) {
+    gint parsed_count;
+
+    errno = 0;
+    parsed_count = sscanf(start_pos,
+                          "Start recording %ld\n",
+                          start_time);
+
+    if (errno != 0 || parsed_count != 1)
+        return FALSE;
+
+    return TRUE;
+}
+
+GIOStatus parse_next_message(KmsgReader *reader,
+                             LogMsgParseResult *res,
+                             GError **error) {
+    gchar *start_pos;
+    GIOStatus rc;
+
+    while ((rc = get_next_module_line(reader, &res->type, &res->dmesg_time,
+                                      &start_pos, error)) ==
+            G_IO_STATUS_NORMAL) {
+        if (res->type == I8042_OUTPUT) {
+            if (parse_normal_event(start_pos, &res->event, error))
+                break;
+
+            if (*error)
+                return G_IO_STATUS_ERROR;
+        }
+        else if (res->type == PS2EMU_OUTPUT) {
+            if (parse_record_start_marker(start_pos, &res->start_time))
+                break;
+        }
+    }
+
+    return rc;
+}
@@ -0,0 +1,79 @@
+/*
+ * ps2emu-kmsg.h
+ * Copyright (C) 2015 Red Hat
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public License for more
+ * details.
+ */
+
+#ifndef __PS2EMU_KMSG_H__
+#define __PS2EMU_KMSG_H__
+
+#include <glib.h>
+
+#include "ps2emu-log.h"
+
+#define I8042_OUTPUT  (g_quark_from_static_string("i8042: "))
+#define PS2EMU_OUTPUT (g_quark_from_static_string("ps2emu: "))
+
+/* The longest record the kernel will hand out from /dev/kmsg, header and
+ * dictionary included. Reads with less room than this fail with EINVAL. */
+#define KMSG_RECORD_MAX 8192
+
+/* Reads kernel messages a line at a time into a buffer that gets reused, so
+ * that skipping over all the messages we don't care about doesn't cost an
+ * allocation each. /dev/kmsg hands out exactly one record per read(2); plain
+ * files (such as a saved dump of /dev/kmsg) are read in larger chunks and
+ * split up into lines the same way. */
+typedef struct {
+    gint     fd;
+    gboolean seen_seq;
+    guint64  last_seq,
+             lost;      /* records the kernel overwrote before we got to
+                           them */
+    gsize    pos,
+             len;
+    gchar    buf[KMSG_RECORD_MAX * 2 + 1];
+} KmsgReader;
+
+typedef struct {
+    GQuark type;
+
+    time_t dmesg_time;
+
+    union {
+        PS2Event event;
+        gint64 start_time;
+    };
+} LogMsgParseResult;
+
+gboolean parse_normal_event(const gchar *start_pos,
+                            PS2Event *event,
+                            GError **error);
+
+gboolean parse_record_start_marker(const gchar *start_pos,
+                                   gint64 *start_time);
+
+KmsgReader * kmsg_reader_open(const gchar *path,
+                              GError **error);
+
+gboolean kmsg_reader_set_nonblocking(KmsgReader *reader,
+                                     GError **error);
+
+void kmsg_reader_free(KmsgReader *reader);
+
+/* Returns G_IO_STATUS_AGAIN once a nonblocking reader has caught up with the
+ * kernel. The original_line of an event points into the reader's buffer, and
+ * is only good until the next call. */
+GIOStatus parse_next_message(KmsgReader *reader,
+                             LogMsgParseResult *res,
+                             GError **error);
+
+#endif /* !__PS2EMU_KMSG_H__ */
@@ -0,0 +1,141 @@
+/*
+ * ps2emu-log-arena.c
+ * Copyright (C) 2015 Red Hat
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public License for more
+ * details.
+ */
+
+#include "ps2emu-log-arena.h"
+
+#include <string.h>
+#include <glib.h>
+
+/* Blocks form a list with the one we're currently allocating from at the
+ * head */
+struct _LogArenaBlock {
+    LogArenaBlock *next;
+    gsize          size,
+                   used;
+    gchar          data[];
+};
+
+void log_arena_init(LogArena *arena) {
+    arena->head = NULL;
+}
+
+void log_arena_clear(LogArena *arena) {
+    LogArenaBlock *block,
+                  *next;
+
+    for (block = arena->head; block; block = next) {
+        next = block->next;
+        g_free(block);
+    }
+
+    arena->head = NULL;
+}
+
+/* Like log_arena_clear(), but holds on to the current block so it can be
+ * used again */
+void log_arena_reset(LogArena *arena) {
+    LogArenaBlock *head = arena->head;
+
+    if (!head)
+        return;
+
+    arena->head = head->next;
+    log_arena_clear(arena);
+
+    head->next = NULL;
+    head->used = 0;
+    arena->head = head;
+}
+
+/* Nothing that goes into an arena needs to be aligned, so allocations are
+ * packed in back to back */
+gpointer log_arena_alloc(LogArena *arena,
+                         gsize size) {
+    LogArenaBlock *block = arena->head;
+    gpointer ret;
+
+    if (!block || block->size - block->used < size) {
+        gsize block_size = MAX(size, LOG_ARENA_BLOCK_SIZE);
+
+        block = g_malloc(sizeof(LogArenaBlock) + block_size);
+        block->size = block_size;
+        block->used = 0;
+
+        /* If the old block still has more room left than this one would,
+         * keep allocating from it and tuck the new block in behind it */
+        if (arena->head &&
+            arena->head->size - arena->head->used > block_size - size) {
+            block->next = arena->head->next;
+            arena->head->next = block;
+
+            block->used = size;
+            return block->data;
+        }
+
+        block->next = arena->head;
+        arena->head = block;
+    }
+
+    ret = block->data + block->used;
+    block->used += size;
+
+    return ret;
+}
+
+gchar * log_arena_strndup(LogArena *arena,
+                          const gchar *str,
+                          gsize length) {
+    gchar *ret = log_arena_alloc(arena, length + 1);
+
+    memcpy(ret, str, length);
+    ret[length] = '\0';
+
+    return ret;
+}
+
+/* Gives back everything allocated since @mark, which has to be the start of
+ * an earlier allocation. This only works if none of that memory has spilled
+ * over into another block, otherwise it's left alone until the arena gets
+ * cleared. */
+void log_arena_rewind(LogArena *arena,
+                      gconstpointer mark) {
+    LogArenaBlock *block = arena->head;
+    const gchar *pos = mark;
+
+    if (block && pos >= block->data && pos <= block->data + block->used)
+        block->used = pos - block->data;
+}
+
+/* Moves all of the memory in @src over to @dest, leaving @src empty */
+void log_arena_steal(LogArena *dest,
+                     LogArena *src) {
+    LogArenaBlock *tail;
+
+    if (!src->head)
+        return;
+
+    if (!dest->head) {
+        dest->head = src->head;
+        src->head = NULL;
+        return;
+    }
+
+    /* Keep allocating from the same block in @dest afterwards */
+    for (tail = src->head; tail->next; tail = tail->next);
+
+    tail->next = dest->head->next;
+    dest->head->next = src->head;
+    src->head = NULL;
+}
@@ -0,0 +1,53 @@
+/*
+ * ps2emu-log-arena.h
+ * Copyright (C) 2015 Red Hat
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public License for more
+ * details.
+ */
+
+#ifndef __PS2EMU_LOG_ARENA_H__
+#define __PS2EMU_LOG_ARENA_H__
+
+#include <glib.h>
+
+/* Anything smaller than this gets carved out of a shared block */
+#define LOG_ARENA_BLOCK_SIZE 4096
+
+typedef struct _LogArenaBlock LogArenaBlock;
+
+/* A bump allocator for things that live exactly as long as the section they
+ * belong to. Nothing allocated from an arena can be freed on its own, it all
+ * goes away at once with log_arena_clear(). An arena that's never been
+ * allocated from doesn't use any memory. */
+typedef struct {
+    LogArenaBlock *head;
+} LogArena;
+
+void log_arena_init(LogArena *arena);
+void log_arena_clear(LogArena *arena);
+void log_arena_reset(LogArena *arena);
+
+gpointer log_arena_alloc(LogArena *arena,
+                         gsize size)
+G_GNUC_MALLOC;
+
+gchar * log_arena_strndup(LogArena *arena,
+                          const gchar *str,
+                          gsize length)
+G_GNUC_MALLOC;
+
+void log_arena_rewind(LogArena *arena,
+                      gconstpointer mark);
+
+void log_arena_steal(LogArena *dest,
+                     LogArena *src);
+
+#endif /* !__PS2EMU_LOG_ARENA_H__ */
@@ -0,0 +1,266 @@
+/*
+ * ps2emu-log-binary.c
+ * Copyright (C) 2015 Red Hat
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public License for more
+ * details.
+ */
+
+#include "ps2emu-log-binary.h"
+#include "ps2emu-log.h"
+#include "ps2emu-misc.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <glib.h>
+
+/* Returns NULL if the varint doesn't fit in the buffer yet, and sets
+ * @overflow if it's longer than any varint we'd ever write */
+static const guchar * read_varint(const guchar *pos,
+                                  const guchar *end,
+                                  guint64 *value,
+                                  gboolean *overflow) {
+    guint shift = 0;
+
+    *value = 0;
+    for (; pos < end; pos++, shift += 7) {
+        if (shift > 63) {
+            *overflow = TRUE;
+            return pos;
+        }
+
+        *value |= (guint64)(*pos & 0x7f) << shift;
+        if (!(*pos & 0x80))
+            return pos + 1;
+    }
+
+    return NULL;
+}
+
+static void write_varint(FILE *output,
+                         guint64 value) {
+    while (value >= 0x80) {
+        fputc((value & 0x7f) | 0x80, output);
+        value >>= 7;
+    }
+
+    fputc(value, output);
+}
+
+static inline gint64 zigzag_decode(guint64 value) {
+    return (gint64)(value >> 1) ^ -(gint64)(value & 1);
+}
+
+static inline guint64 zigzag_encode(gint64 value) {
+    return ((guint64)value << 1) ^ (guint64)(value >> 63);
+}
+
+GIOStatus log_binary_parse_record(LogParseState *state,
+                                  const guchar **pos,
+                                  const guchar *end,
+                                  GError **error) {
+    const guchar *p = *pos;
+    gboolean overflow = FALSE;
+    guint64 value;
+    guchar tag;
+
+    if (p == end)
+        return G_IO_STATUS_EOF;
+
+    tag = *p++;
+    switch (tag) {
+        case LOG_BINARY_RECORD_PARAMETER:
+        case LOG_BINARY_RECORD_INTERRUPT:
+            p = read_varint(p, end, &value, &overflow);
+            if (!p || p == end)
+                return G_IO_STATUS_AGAIN;
+            if (overflow)
+                goto invalid;
+
+            if (!state->section) {
+                g_set_error_literal(error, PS2EMU_ERROR, PS2EMU_ERROR_INPUT,
+                                    "Event found before any section");
+                return G_IO_STATUS_ERROR;
+            }
+
+            if (!log_parse_add_event(state,
+                                     *state->section_time +
+                                     zigzag_decode(value),
+                                     tag == LOG_BINARY_RECORD_INTERRUPT ?
+                                         LOG_EVENT_TYPE_INTERRUPT :
+                                         LOG_EVENT_TYPE_PARAMETER,
+                                     *p++, error))
+                return G_IO_STATUS_ERROR;
+            break;
+        case LOG_BINARY_RECORD_SECTION:
+            if (p == end)
+                return G_IO_STATUS_AGAIN;
+
+            switch (*p++) {
+                case SECTION_TYPE_INIT:
+                    log_parse_set_section(state, SECTION_TYPE_INIT);
+                    break;
+                case SECTION_TYPE_MAIN:
+                    log_parse_set_section(state, SECTION_TYPE_MAIN);
+                    break;
+                default:
+                    goto invalid;
+            }
+            break;
+        case LOG_BINARY_RECORD_NOTE:
+            p = read_varint(p, end, &value, &overflow);
+            if (!p)
+                return G_IO_STATUS_AGAIN;
+            if (overflow || value > LOG_BINARY_MAX_NOTE_LENGTH)
+                goto invalid;
+            if (end - p < value)
+                return G_IO_STATUS_AGAIN;
+
+            if (!log_parse_add_note(state, (const gchar*)p, value, error))
+                return G_IO_STATUS_ERROR;
+
+            p += value;
+            break;
+        case LOG_BINARY_RECORD_PORT:
+            if (p == end)
+                return G_IO_STATUS_AGAIN;
+
+            switch (*p++) {
+                case PS2_PORT_KBD:
+                    state->parsed_log->port = PS2_PORT_KBD;
+                    break;
+                case PS2_PORT_AUX:
+                    state->parsed_log->port = PS2_PORT_AUX;
+                    break;
+                default:
+                    goto invalid;
+            }
+            break;
+        default:
+            goto invalid;
+    }
+
+    *pos = p;
+    return G_IO_STATUS_NORMAL;
+
+invalid:
+    g_set_error(error, PS2EMU_ERROR, PS2EMU_ERROR_INPUT,
+                "Invalid record with tag 0x%.2hhx", tag);
+    return G_IO_STATUS_ERROR;
+}
+
+gboolean log_binary_parse(LogParseState *state,
+                          const guchar *pos,
+                          const guchar *end,
+                          GError **error) {
+    GIOStatus rc;
+
+    do {
+        rc = log_binary_parse_record(state, &pos, end, error);
+    } while (rc == G_IO_STATUS_NORMAL && !state->window_done);
+
+    if (state->window_done)
+        return TRUE;
+
+    if (rc == G_IO_STATUS_AGAIN) {
+        g_set_error_literal(error, PS2EMU_ERROR, PS2EMU_ERROR_INPUT,
+                            "Log ends in the middle of a record");
+        return FALSE;
+    }
+
+    return rc == G_IO_STATUS_EOF;
+}
+
+static gboolean write_notes(FILE *output,
+                            LogSection *section,
+                            guint *note_idx,
+                            guint position,
+                            GError **error) {
+    for (; *note_idx < section->notes->len; (*note_idx)++) {
+        LogNote *note = &g_array_index(section->notes, LogNote, *note_idx);
+        gsize length;
+
+        if (note->position > position)
+            break;
+
+        length = strlen(note->text);
+        if (length > LOG_BINARY_MAX_NOTE_LENGTH) {
+            g_set_error(error, PS2EMU_ERROR, PS2EMU_ERROR_INPUT,
+                        "Note is longer than %d bytes",
+                        LOG_BINARY_MAX_NOTE_LENGTH);
+            return FALSE;
+        }
+
+        fputc(LOG_BINARY_RECORD_NOTE, output);
+        write_varint(output, length);
+        fwrite(note->text, 1, length, output);
+    }
+
+    return TRUE;
+}
+
+static gboolean write_section(FILE *output,
+                              LogSection *section,
+                              LogSectionType type,
+                              GError **error) {
+    gint64 delta = 0;
+    guint note_idx = 0;
+
+    fputc(LOG_BINARY_RECORD_SECTION, output);
+    fputc(type, output);
+
+    for (guint i = 0; i < section->events->len; i++) {
+        const LogEvent *event = &g_array_index(section->events, LogEvent, i);
+
+        if (!write_notes(output, section, &note_idx, i, error))
+            return FALSE;
+
+        /* Varints don't have a size limit, so delay events get folded back
+         * into the event that follows them */
+        delta += event->delta;
+        if (event->type == LOG_EVENT_TYPE_DELAY)
+            continue;
+
+        fputc(event->type == LOG_EVENT_TYPE_INTERRUPT ?
+                  LOG_BINARY_RECORD_INTERRUPT : LOG_BINARY_RECORD_PARAMETER,
+              output);
+        write_varint(output, zigzag_encode(delta));
+        fputc(event->data, output);
+
+        delta = 0;
+    }
+
+    return write_notes(output, section, &note_idx, section->events->len,
+                       error);
+}
+
+gboolean log_binary_write(FILE *output,
+                          ParsedLog *parsed_log,
+                          GError **error) {
+    fprintf(output, "# ps2emu-record V%d\n", PS2EMU_LOG_VERSION_BINARY);
+
+    fputc(LOG_BINARY_RECORD_PORT, output);
+    fputc(parsed_log->port, output);
+
+    if (!write_section(output, &parsed_log->init_section, SECTION_TYPE_INIT,
+                       error) ||
+        !write_section(output, &parsed_log->main_section, SECTION_TYPE_MAIN,
+                       error))
+        return FALSE;
+
+    if (fflush(output) != 0 || ferror(output)) {
+        g_set_error(error, G_FILE_ERROR, g_file_error_from_errno(errno),
+                    "While writing log: %s", strerror(errno));
+        return FALSE;
+    }
+
+    return TRUE;
+}
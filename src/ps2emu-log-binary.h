@@ -0,0 +1,60 @@
+/*
+ * ps2emu-log-binary.h
+ * Copyright (C) 2015 Red Hat
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public License for more
+ * details.
+ */
+
+#ifndef __PS2EMU_LOG_BINARY_H__
+#define __PS2EMU_LOG_BINARY_H__
+
+#include <stdio.h>
+#include <glib.h>
+
+#include "ps2emu-log.h"
+
+/* V2 logs start with the same "# ps2emu-record V2" line as the text formats,
+ * so log_parse_version() can still tell them apart. Everything after that line
+ * is a sequence of binary records, each starting with one of the tags below:
+ *
+ *   PARAMETER/INTERRUPT: varint time delta, data byte
+ *   SECTION:             one byte LogSectionType
+ *   NOTE:                varint length, followed by the text of the note
+ *   PORT:                one byte PS2Port
+ *
+ * Varints are LEB128 encoded, and time deltas are zigzag encoded before that
+ * since hand edited logs can go back in time. Deltas are relative to the
+ * previous event in the same section, just like in LogEvent. */
+typedef enum {
+    LOG_BINARY_RECORD_PARAMETER = 0x00,
+    LOG_BINARY_RECORD_INTERRUPT = 0x01,
+    LOG_BINARY_RECORD_SECTION   = 0x02,
+    LOG_BINARY_RECORD_NOTE      = 0x03,
+    LOG_BINARY_RECORD_PORT      = 0x04
+} LogBinaryRecordType;
+
+#define LOG_BINARY_MAX_NOTE_LENGTH 4096
+
+GIOStatus log_binary_parse_record(LogParseState *state,
+                                  const guchar **pos,
+                                  const guchar *end,
+                                  GError **error);
+
+gboolean log_binary_parse(LogParseState *state,
+                          const guchar *pos,
+                          const guchar *end,
+                          GError **error);
+
+gboolean log_binary_write(FILE *output,
+                          ParsedLog *parsed_log,
+                          GError **error);
+
+#endif /* !__PS2EMU_LOG_BINARY_H__ */
@@ -0,0 +1,203 @@
+/*
+ * ps2emu-log-gaps.c
+ * Copyright (C) 2015 Red Hat
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public License for more
+ * details.
+ */
+
+#include "ps2emu-log-gaps.h"
+#include "ps2emu-log.h"
+
+#include <glib.h>
+
+/* Four bins per power of two, which is plenty to tell the classes apart. 48
+ * octaves covers gaps below 2^48 microseconds, which is almost 9 years. */
+#define LOG_GAPS_BINS_PER_OCTAVE 4
+#define LOG_GAPS_BINS            (48 * LOG_GAPS_BINS_PER_OCTAVE)
+
+/* No matter what the recording looks like, anything shorter than this is
+ * never considered idle. Without it a recording that has no idle time at all
+ * would get its motion split in two instead. */
+#define LOG_GAPS_MIN_IDLE (100 * 1000)
+
+/* How much of the gaps between packets we expect to be motion, the rest
+ * being idle */
+#define LOG_GAPS_MOTION_PERCENTILE 0.9
+
+typedef void (*LogGapFunc)(time_t gap,
+                           gpointer user_data);
+
+static void for_each_gap(LogSection *section,
+                         LogGapFunc func,
+                         gpointer user_data) {
+    time_t event_time = 0,
+           last_event_time = 0;
+    gboolean first_event = TRUE;
+
+    for (guint i = 0; i < section->events->len; i++) {
+        const LogEvent *event = &g_array_index(section->events, LogEvent, i);
+
+        event_time += event->delta;
+        if (event->type == LOG_EVENT_TYPE_DELAY)
+            continue;
+
+        if (!first_event)
+            func(event_time - last_event_time, user_data);
+
+        last_event_time = event_time;
+        first_event = FALSE;
+    }
+}
+
+static guint gap_bin(time_t gap) {
+    guint msb, sub;
+
+    if (gap <= 0)
+        return 0;
+
+    msb = 63 - __builtin_clzll(gap);
+    if (msb >= 2)
+        sub = (gap >> (msb - 2)) & 3;
+    else
+        sub = (gap << (2 - msb)) & 3;
+
+    return MIN(msb * LOG_GAPS_BINS_PER_OCTAVE + sub, LOG_GAPS_BINS - 1);
+}
+
+static time_t gap_bin_start(guint bin) {
+    guint msb = bin / LOG_GAPS_BINS_PER_OCTAVE,
+          sub = bin % LOG_GAPS_BINS_PER_OCTAVE;
+
+    return ((time_t)(LOG_GAPS_BINS_PER_OCTAVE + sub) << msb) /
+           LOG_GAPS_BINS_PER_OCTAVE;
+}
+
+static void add_to_histogram(time_t gap,
+                             gpointer user_data) {
+    guint64 *histogram = user_data;
+
+    histogram[gap_bin(gap)]++;
+}
+
+static void add_to_stats(time_t gap,
+                         gpointer user_data) {
+    LogGapStats *stats = user_data;
+    LogGapClass class = log_gaps_classify(stats, gap);
+
+    stats->count[class]++;
+    stats->total[class] += gap;
+}
+
+/* Otsu's method: picks the bin that splits the histogram into the two
+ * tightest clumps, by maximizing the variance between them */
+static guint split_histogram(const guint64 *histogram,
+                             guint start) {
+    gdouble weight = 0,
+            sum = 0,
+            total_weight = 0,
+            total_sum = 0,
+            best = -1;
+    guint split = start;
+
+    for (guint i = start; i < LOG_GAPS_BINS; i++) {
+        total_weight += histogram[i];
+        total_sum += (gdouble)histogram[i] * i;
+    }
+
+    for (guint i = start; i < LOG_GAPS_BINS - 1; i++) {
+        gdouble mean_below, mean_above, score;
+
+        weight += histogram[i];
+        sum += (gdouble)histogram[i] * i;
+        if (weight == 0)
+            continue;
+        if (weight == total_weight)
+            break;
+
+        mean_below = sum / weight;
+        mean_above = (total_sum - sum) / (total_weight - weight);
+        score = weight * (total_weight - weight) *
+                (mean_below - mean_above) * (mean_below - mean_above);
+
+        if (score > best) {
+            best = score;
+            split = i + 1;
+        }
+    }
+
+    return split;
+}
+
+/* The start of the bin that the given fraction of the gaps from @start on
+ * fall into or below */
+static time_t histogram_percentile(const guint64 *histogram,
+                                   guint start,
+                                   gdouble fraction) {
+    guint64 total = 0,
+            seen = 0;
+
+    for (guint i = start; i < LOG_GAPS_BINS; i++)
+        total += histogram[i];
+
+    for (guint i = start; i < LOG_GAPS_BINS; i++) {
+        seen += histogram[i];
+        if (seen >= total * fraction)
+            return gap_bin_start(i);
+    }
+
+    return gap_bin_start(LOG_GAPS_BINS - 1);
+}
+
+/* Works out the thresholds between the classes of gaps in @section, returns
+ * FALSE if there aren't enough gaps to go on */
+gboolean log_gaps_analyze(LogSection *section,
+                          LogGapStats *stats) {
+    guint64 histogram[LOG_GAPS_BINS] = { 0 },
+            samples = 0;
+    guint split;
+
+    *stats = (LogGapStats) { 0 };
+
+    for_each_gap(section, add_to_histogram, histogram);
+    for (guint i = 0; i < LOG_GAPS_BINS; i++)
+        samples += histogram[i];
+
+    if (samples < LOG_GAPS_MIN_SAMPLES)
+        return FALSE;
+
+    /* Bytes within a packet come in back to back, so they make up a tight
+     * clump that's far away from everything else */
+    split = split_histogram(histogram, 0);
+
+    /* Everything else is mostly packets during motion, with the occasional
+     * idle gap in between. Idle gaps are far too rare to make a clump of their
+     * own, so anything well past the usual cadence of packets counts. */
+    stats->packet_threshold = gap_bin_start(split);
+    stats->motion_median = histogram_percentile(histogram, split, 0.5);
+    stats->idle_threshold =
+        histogram_percentile(histogram, split, LOG_GAPS_MOTION_PERCENTILE) *
+        LOG_GAPS_IDLE_FACTOR;
+    stats->idle_threshold = MAX(stats->idle_threshold, LOG_GAPS_MIN_IDLE);
+
+    for_each_gap(section, add_to_stats, stats);
+
+    return TRUE;
+}
+
+LogGapClass log_gaps_classify(const LogGapStats *stats,
+                              time_t gap) {
+    if (gap >= stats->idle_threshold)
+        return LOG_GAP_IDLE;
+    else if (gap >= stats->packet_threshold)
+        return LOG_GAP_MOTION;
+    else
+        return LOG_GAP_INTRA_PACKET;
+}
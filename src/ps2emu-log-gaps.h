@@ -0,0 +1,55 @@
+/*
+ * ps2emu-log-gaps.h
+ * Copyright (C) 2015 Red Hat
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public License for more
+ * details.
+ */
+
+#ifndef __PS2EMU_LOG_GAPS_H__
+#define __PS2EMU_LOG_GAPS_H__
+
+#include <glib.h>
+
+#include "ps2emu-log.h"
+
+/* Sections with fewer gaps than this don't say enough about themselves to be
+ * classified */
+#define LOG_GAPS_MIN_SAMPLES 16
+
+/* Idle gaps are always at least this many times longer than most of the gaps
+ * between packets during motion */
+#define LOG_GAPS_IDLE_FACTOR 4
+
+typedef enum {
+    LOG_GAP_INTRA_PACKET, /* between the bytes of a single packet */
+    LOG_GAP_MOTION,       /* between packets, while the device is in use */
+    LOG_GAP_IDLE,         /* between gestures, nothing happening */
+    LOG_GAP_CLASS_COUNT
+} LogGapClass;
+
+/* Thresholds between the classes of gaps, worked out from a histogram of the
+ * logarithms of all the gaps in a section, along with how much of the
+ * section's time each class takes up */
+typedef struct {
+    time_t  packet_threshold, /* shorter gaps are within a packet */
+            idle_threshold,   /* and gaps at least this long are idle */
+            motion_median;
+    guint64 count[LOG_GAP_CLASS_COUNT];
+    time_t  total[LOG_GAP_CLASS_COUNT];
+} LogGapStats;
+
+gboolean log_gaps_analyze(LogSection *section,
+                          LogGapStats *stats);
+
+LogGapClass log_gaps_classify(const LogGapStats *stats,
+                              time_t gap);
+
+#endif /* !__PS2EMU_LOG_GAPS_H__ */
@@ -0,0 +1,447 @@
+/*
+ * ps2emu-log-index.c
+ * Copyright (C) 2015 Red Hat
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public License for more
+ * details.
+ */
+
+#include "ps2emu-log-index.h"
+#include "ps2emu-log.h"
+#include "ps2emu-log-binary.h"
+#include "ps2emu-log-input.h"
+#include "ps2emu-misc.h"
+
+#include <string.h>
+#include <errno.h>
+#include <glib.h>
+#include <glib/gstdio.h>
+
+static const gchar index_magic[8] = "PS2EMUIX";
+
+#define LOG_INDEX_HEADER_SIZE \
+    (sizeof(index_magic) + 2 * sizeof(guint32) + 3 * sizeof(guint64))
+
+static gboolean log_index_stat(const gchar *log_path,
+                               guint64 *size,
+                               gint64 *mtime,
+                               GError **error) {
+    GStatBuf stat_buf;
+
+    if (g_stat(log_path, &stat_buf) != 0) {
+        g_set_error(error, G_FILE_ERROR, g_file_error_from_errno(errno),
+                    "While opening %s: %s", log_path, strerror(errno));
+        return FALSE;
+    }
+
+    *size = stat_buf.st_size;
+    *mtime = stat_buf.st_mtime;
+
+    return TRUE;
+}
+
+/* Maps the log and parses its version line. On return @pos points to the
+ * first byte after the version line. */
+static GMappedFile * log_index_map_log(const gchar *log_path,
+                                       const gchar **start,
+                                       const gchar **pos,
+                                       const gchar **end,
+                                       gint *log_version,
+                                       GError **error) {
+    GMappedFile *mapped_file;
+    const gchar *line_end;
+
+    mapped_file = g_mapped_file_new(log_path, FALSE, error);
+    if (!mapped_file)
+        return NULL;
+
+    *start = g_mapped_file_get_contents(mapped_file);
+    *end = *start + g_mapped_file_get_length(mapped_file);
+
+    if (*start == *end) {
+        g_set_error_literal(error, PS2EMU_ERROR, PS2EMU_ERROR_NO_EVENTS,
+                            "Reached unexpected EOF");
+        goto error;
+    }
+
+    if (log_input_detect_compression((const guchar*)*start,
+                                     *end - *start) != LOG_COMPRESSION_NONE) {
+        g_set_error_literal(error, PS2EMU_ERROR, PS2EMU_ERROR_INPUT,
+                            "Compressed logs can't be indexed, decompress the "
+                            "log first");
+        goto error;
+    }
+
+    line_end = log_find_line_end(*start, *end);
+    *log_version = log_parse_version_line(*start, line_end, error);
+    if (*log_version < 0)
+        goto error;
+
+    *pos = MIN(line_end + 1, *end);
+
+    return mapped_file;
+
+error:
+    g_mapped_file_unref(mapped_file);
+    return NULL;
+}
+
+static LogIndex * log_index_new(void) {
+    LogIndex *index = g_new0(LogIndex, 1);
+
+    index->entries = g_array_new(FALSE, FALSE, sizeof(LogIndexEntry));
+
+    return index;
+}
+
+LogIndex * log_index_build(const gchar *log_path,
+                           GError **error) {
+    LogIndex *index = log_index_new();
+    GMappedFile *mapped_file;
+    const gchar *start,
+                *pos,
+                *end,
+                *line_end;
+    const guchar *record;
+    LogParseState state;
+    ParsedLog *parsed_log = NULL;
+    LogSection *main_section;
+    time_t last_time = 0;
+    GIOStatus rc;
+
+    mapped_file = log_index_map_log(log_path, &start, &pos, &end,
+                                    &index->log_version, error);
+    if (!mapped_file)
+        goto error;
+
+    if (!log_index_stat(log_path, &index->log_size, &index->log_mtime, error))
+        goto error;
+
+    parsed_log = log_parse_begin(&state, index->log_version);
+    main_section = &parsed_log->main_section;
+
+    /* V0 logs don't have sections, everything is part of the main section */
+    if (index->log_version < 1)
+        log_parse_set_section(&state, SECTION_TYPE_MAIN);
+
+    while (pos < end) {
+        if (state.section == main_section &&
+            (index->entries->len == 0 ||
+             main_section->events->len >= LOG_INDEX_INTERVAL)) {
+            LogIndexEntry entry = {
+                .time = state.main_time,
+                .offset = pos - start,
+            };
+
+            g_array_append_val(index->entries, entry);
+
+            /* We only need to know how many events come after each entry,
+             * so the events themselves can be thrown out as we go */
+            log_section_reset(main_section);
+        }
+
+        if (index->log_version >= PS2EMU_LOG_VERSION_BINARY) {
+            record = (const guchar*)pos;
+            rc = log_binary_parse_record(&state, &record, (const guchar*)end,
+                                         error);
+            if (rc == G_IO_STATUS_AGAIN) {
+                g_set_error_literal(error, PS2EMU_ERROR, PS2EMU_ERROR_INPUT,
+                                    "Log ends in the middle of a record");
+                goto error;
+            } else if (rc != G_IO_STATUS_NORMAL) {
+                goto error;
+            }
+
+            pos = (const gchar*)record;
+        } else {
+            line_end = log_find_line_end(pos, end);
+            if (!log_parse_line(&state, pos, line_end, error))
+                goto error;
+
+            pos = line_end + 1;
+        }
+
+        if (index->entries->len &&
+            state.section == &parsed_log->init_section) {
+            g_set_error_literal(error, PS2EMU_ERROR, PS2EMU_ERROR_INPUT,
+                                "Logs that switch back to the init section "
+                                "can't be indexed");
+            goto error;
+        }
+
+        /* Seeking relies on the main section never going back in time */
+        if (state.section == main_section) {
+            if (state.main_time < last_time) {
+                g_set_error_literal(error, PS2EMU_ERROR, PS2EMU_ERROR_INPUT,
+                                    "Events in the main section are out of "
+                                    "order, the log can't be indexed");
+                goto error;
+            }
+
+            last_time = state.main_time;
+        }
+    }
+
+    /* The main section might not have anything in it */
+    if (index->entries->len == 0 && state.section == main_section) {
+        LogIndexEntry entry = {
+            .time = state.main_time,
+            .offset = end - start,
+        };
+
+        g_array_append_val(index->entries, entry);
+    }
+
+    if (index->entries->len == 0) {
+        g_set_error_literal(error, PS2EMU_ERROR, PS2EMU_ERROR_NO_EVENTS,
+                            "Log doesn't have a main section");
+        goto error;
+    }
+
+    log_free(parsed_log);
+    g_mapped_file_unref(mapped_file);
+
+    return index;
+
+error:
+    if (parsed_log)
+        log_free(parsed_log);
+    if (mapped_file)
+        g_mapped_file_unref(mapped_file);
+
+    log_index_free(index);
+    return NULL;
+}
+
+static inline guint32 read_u32(const gchar **pos) {
+    guint32 value;
+
+    memcpy(&value, *pos, sizeof(value));
+    *pos += sizeof(value);
+
+    return GUINT32_FROM_LE(value);
+}
+
+static inline guint64 read_u64(const gchar **pos) {
+    guint64 value;
+
+    memcpy(&value, *pos, sizeof(value));
+    *pos += sizeof(value);
+
+    return GUINT64_FROM_LE(value);
+}
+
+static inline void append_u32(GByteArray *array,
+                              guint32 value) {
+    value = GUINT32_TO_LE(value);
+    g_byte_array_append(array, (guint8*)&value, sizeof(value));
+}
+
+static inline void append_u64(GByteArray *array,
+                              guint64 value) {
+    value = GUINT64_TO_LE(value);
+    g_byte_array_append(array, (guint8*)&value, sizeof(value));
+}
+
+LogIndex * log_index_load(const gchar *log_path,
+                          GError **error) {
+    gchar *index_path = g_strconcat(log_path, LOG_INDEX_SUFFIX, NULL);
+    LogIndex *index = NULL;
+    gchar *contents = NULL;
+    const gchar *pos;
+    gsize length;
+    guint64 log_size = 0,
+            entry_count;
+    gint64 log_mtime = 0;
+
+    if (!g_file_get_contents(index_path, &contents, &length, error))
+        goto error;
+
+    pos = contents;
+    if (length < LOG_INDEX_HEADER_SIZE ||
+        memcmp(pos, index_magic, sizeof(index_magic)) != 0) {
+        g_set_error(error, PS2EMU_ERROR, PS2EMU_ERROR_INPUT,
+                    "%s isn't a ps2emu index", index_path);
+        goto error;
+    }
+    pos += sizeof(index_magic);
+
+    if (read_u32(&pos) != LOG_INDEX_VERSION) {
+        g_set_error(error, PS2EMU_ERROR, PS2EMU_ERROR_INPUT,
+                    "%s was made by a different version of ps2emu-index",
+                    index_path);
+        goto error;
+    }
+
+    index = log_index_new();
+    index->log_version = read_u32(&pos);
+    index->log_size = read_u64(&pos);
+    index->log_mtime = read_u64(&pos);
+    entry_count = read_u64(&pos);
+
+    if (entry_count == 0 ||
+        entry_count != (length - LOG_INDEX_HEADER_SIZE) /
+                       (2 * sizeof(guint64)) ||
+        (length - LOG_INDEX_HEADER_SIZE) % (2 * sizeof(guint64)) != 0) {
+        g_set_error(error, PS2EMU_ERROR, PS2EMU_ERROR_INPUT,
+                    "%s is corrupted", index_path);
+        goto error;
+    }
+
+    if (!log_index_stat(log_path, &log_size, &log_mtime, error))
+        goto error;
+
+    if (log_size != index->log_size || log_mtime != index->log_mtime) {
+        g_set_error(error, PS2EMU_ERROR, PS2EMU_ERROR_INPUT,
+                    "%s is out of date", index_path);
+        goto error;
+    }
+
+    g_array_set_size(index->entries, entry_count);
+    for (guint i = 0; i < entry_count; i++) {
+        LogIndexEntry *entry = &g_array_index(index->entries, LogIndexEntry,
+                                              i);
+
+        entry->time = read_u64(&pos);
+        entry->offset = read_u64(&pos);
+
+        if (entry->offset > log_size) {
+            g_set_error(error, PS2EMU_ERROR, PS2EMU_ERROR_INPUT,
+                        "%s is corrupted", index_path);
+            goto error;
+        }
+    }
+
+    g_free(contents);
+    g_free(index_path);
+
+    return index;
+
+error:
+    if (index)
+        log_index_free(index);
+
+    g_free(contents);
+    g_free(index_path);
+
+    return NULL;
+}
+
+gboolean log_index_write(LogIndex *index,
+                         const gchar *log_path,
+                         GError **error) {
+    gchar *index_path = g_strconcat(log_path, LOG_INDEX_SUFFIX, NULL);
+    GByteArray *contents = g_byte_array_new();
+    gboolean ret;
+
+    g_byte_array_append(contents, (guint8*)index_magic, sizeof(index_magic));
+    append_u32(contents, LOG_INDEX_VERSION);
+    append_u32(contents, index->log_version);
+    append_u64(contents, index->log_size);
+    append_u64(contents, index->log_mtime);
+    append_u64(contents, index->entries->len);
+
+    for (guint i = 0; i < index->entries->len; i++) {
+        LogIndexEntry *entry = &g_array_index(index->entries, LogIndexEntry,
+                                              i);
+
+        append_u64(contents, entry->time);
+        append_u64(contents, entry->offset);
+    }
+
+    ret = g_file_set_contents(index_path, (gchar*)contents->data,
+                              contents->len, error);
+
+    g_byte_array_free(contents, TRUE);
+    g_free(index_path);
+
+    return ret;
+}
+
+/* Finds the last entry that comes before @time, so that parsing from it won't
+ * miss any events at or after @time */
+static const LogIndexEntry * log_index_find(LogIndex *index,
+                                            time_t time) {
+    guint low = 0,
+          high = index->entries->len;
+
+    while (low < high) {
+        guint mid = low + (high - low) / 2;
+
+        if (g_array_index(index->entries, LogIndexEntry, mid).time < time)
+            low = mid + 1;
+        else
+            high = mid;
+    }
+
+    return &g_array_index(index->entries, LogIndexEntry, low ? low - 1 : 0);
+}
+
+/* Parses the init section of the log, along with the main section events
+ * between @start and @end. The main section gets shifted so that it starts at
+ * @start. */
+ParsedLog * log_index_parse_range(LogIndex *index,
+                                  const gchar *log_path,
+                                  time_t start,
+                                  time_t end,
+                                  gint *log_version,
+                                  GError **error) {
+    GMappedFile *mapped_file;
+    const gchar *log_start,
+                *pos,
+                *log_end;
+    const LogIndexEntry *main_entry,
+                        *entry;
+    LogParseState state;
+    ParsedLog *parsed_log = NULL;
+
+    mapped_file = log_index_map_log(log_path, &log_start, &pos, &log_end,
+                                    log_version, error);
+    if (!mapped_file)
+        return NULL;
+
+    if (*log_version != index->log_version ||
+        log_end - log_start != index->log_size) {
+        g_set_error(error, PS2EMU_ERROR, PS2EMU_ERROR_INPUT,
+                    "Index doesn't belong to %s", log_path);
+        goto out;
+    }
+
+    main_entry = &g_array_index(index->entries, LogIndexEntry, 0);
+    entry = log_index_find(index, start);
+
+    parsed_log = log_parse_begin(&state, *log_version);
+
+    /* Everything before the first entry belongs to the init section */
+    if (!log_parse_buffer(&state, pos, log_start + main_entry->offset, error))
+        goto error;
+
+    log_parse_set_section(&state, SECTION_TYPE_MAIN);
+    state.main_time = entry->time;
+    log_parse_set_window(&state, start, end);
+
+    if (!log_parse_buffer(&state, log_start + entry->offset, log_end, error))
+        goto error;
+
+    goto out;
+
+error:
+    log_free(parsed_log);
+    parsed_log = NULL;
+
+out:
+    g_mapped_file_unref(mapped_file);
+    return parsed_log;
+}
+
+void log_index_free(LogIndex *index) {
+    g_array_free(index->entries, TRUE);
+    g_free(index);
+}
@@ -0,0 +1,70 @@
+/*
+ * ps2emu-log-index.h
+ * Copyright (C) 2015 Red Hat
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public License for more
+ * details.
+ */
+
+#ifndef __PS2EMU_LOG_INDEX_H__
+#define __PS2EMU_LOG_INDEX_H__
+
+#include <glib.h>
+
+#include "ps2emu-log.h"
+
+/* Seek indexes live next to the log they belong to, in a file with the same
+ * name plus this suffix. They map times in the main section of the log to the
+ * byte offset of the line or record that comes after them, with one entry for
+ * every LOG_INDEX_INTERVAL events. The file itself is a header:
+ *
+ *   magic "PS2EMUIX", guint32 index version, guint32 log version,
+ *   guint64 log size, gint64 log mtime, guint64 entry count
+ *
+ * followed by the entries. Everything is stored in little endian. */
+#define LOG_INDEX_SUFFIX   ".idx"
+#define LOG_INDEX_VERSION  1
+#define LOG_INDEX_INTERVAL 1024
+
+typedef struct {
+    gint64  time;   /* time of the last main section event before offset */
+    guint64 offset;
+} LogIndexEntry;
+
+typedef struct {
+    gint    log_version;
+    guint64 log_size;
+    gint64  log_mtime;
+    GArray *entries;
+} LogIndex;
+
+LogIndex * log_index_build(const gchar *log_path,
+                           GError **error)
+G_GNUC_MALLOC;
+
+LogIndex * log_index_load(const gchar *log_path,
+                          GError **error)
+G_GNUC_MALLOC;
+
+gboolean log_index_write(LogIndex *index,
+                         const gchar *log_path,
+                         GError **error);
+
+ParsedLog * log_index_parse_range(LogIndex *index,
+                                  const gchar *log_path,
+                                  time_t start,
+                                  time_t end,
+                                  gint *log_version,
+                                  GError **error)
+G_GNUC_MALLOC;
+
+void log_index_free(LogIndex *index);
+
+#endif /* !__PS2EMU_LOG_INDEX_H__ */
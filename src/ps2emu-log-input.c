@@ -0,0 +1,409 @@
+/*
+ * ps2emu-log-input.c
+ * Copyright (C) 2015 Red Hat
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public License for more
+ * details.
+ */
+
+#include "config.h"
+
+#include "ps2emu-log-input.h"
+#include "ps2emu-log.h"
+#include "ps2emu-log-binary.h"
+#include "ps2emu-misc.h"
+
+#include <string.h>
+#include <glib.h>
+#include <gio/gio.h>
+
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+#define LOG_INPUT_MAGIC_LENGTH 4
+
+static const guchar gzip_magic[] = { 0x1f, 0x8b };
+static const guchar zstd_magic[] = { 0x28, 0xb5, 0x2f, 0xfd };
+
+struct _LogInput {
+    GInputStream  *stream;
+    LogCompression compression;
+
+#ifdef HAVE_ZSTD
+    /* GIO doesn't come with a zstd converter, so we have to feed the
+     * decompressor ourselves */
+    ZSTD_DStream *zstd;
+    guchar       *zstd_buffer;
+    gsize         zstd_buffer_size,
+                  zstd_start,
+                  zstd_len;
+    size_t        zstd_pending; /* last hint from ZSTD_decompressStream() */
+    gboolean      zstd_eof;
+#endif
+
+    gchar    buffer[LOG_INPUT_BUFFER_SIZE];
+    gsize    buffer_start,
+             buffer_len;
+    gboolean eof;
+};
+
+LogCompression log_input_detect_compression(const guchar *data,
+                                            gsize length) {
+    if (length >= sizeof(gzip_magic) &&
+        memcmp(data, gzip_magic, sizeof(gzip_magic)) == 0)
+        return LOG_COMPRESSION_GZIP;
+
+    if (length >= sizeof(zstd_magic) &&
+        memcmp(data, zstd_magic, sizeof(zstd_magic)) == 0)
+        return LOG_COMPRESSION_ZSTD;
+
+    return LOG_COMPRESSION_NONE;
+}
+
+#ifdef HAVE_ZSTD
+static GIOStatus log_input_read_zstd(LogInput *input,
+                                     gchar *dest,
+                                     gsize length,
+                                     gsize *bytes_read,
+                                     GError **error) {
+    ZSTD_outBuffer out = { dest, length, 0 };
+    ZSTD_inBuffer in;
+    gssize compressed_read;
+
+    while (out.pos == 0) {
+        if (input->zstd_start == input->zstd_len) {
+            if (input->zstd_eof) {
+                /* Anything but 0 means the decompressor either has output
+                 * left over that didn't fit last time, or is still in the
+                 * middle of a frame. Only the second one is a problem, and
+                 * it's the one where there's nothing left to flush. */
+                if (input->zstd_pending != 0) {
+                    in = (ZSTD_inBuffer) { NULL, 0, 0 };
+
+                    input->zstd_pending = ZSTD_decompressStream(input->zstd,
+                                                                &out, &in);
+                    if (ZSTD_isError(input->zstd_pending)) {
+                        g_set_error(error, PS2EMU_ERROR, PS2EMU_ERROR_INPUT,
+                                    "While decompressing log: %s",
+                                    ZSTD_getErrorName(input->zstd_pending));
+                        return G_IO_STATUS_ERROR;
+                    }
+
+                    if (out.pos != 0)
+                        continue;
+
+                    if (input->zstd_pending != 0) {
+                        g_set_error_literal(error, PS2EMU_ERROR,
+                                            PS2EMU_ERROR_INPUT,
+                                            "Compressed log is truncated");
+                        return G_IO_STATUS_ERROR;
+                    }
+                }
+
+                *bytes_read = 0;
+                return G_IO_STATUS_EOF;
+            }
+
+            compressed_read = g_input_stream_read(input->stream,
+                                                  input->zstd_buffer,
+                                                  input->zstd_buffer_size,
+                                                  NULL, error);
+            if (compressed_read < 0) {
+                return G_IO_STATUS_ERROR;
+            } else if (compressed_read == 0) {
+                input->zstd_eof = TRUE;
+                continue;
+            }
+
+            input->zstd_start = 0;
+            input->zstd_len = compressed_read;
+        }
+
+        in = (ZSTD_inBuffer) {
+            .src = input->zstd_buffer,
+            .size = input->zstd_len,
+            .pos = input->zstd_start,
+        };
+
+        input->zstd_pending = ZSTD_decompressStream(input->zstd, &out, &in);
+        if (ZSTD_isError(input->zstd_pending)) {
+            g_set_error(error, PS2EMU_ERROR, PS2EMU_ERROR_INPUT,
+                        "While decompressing log: %s",
+                        ZSTD_getErrorName(input->zstd_pending));
+            return G_IO_STATUS_ERROR;
+        }
+
+        input->zstd_start = in.pos;
+    }
+
+    *bytes_read = out.pos;
+    return G_IO_STATUS_NORMAL;
+}
+#endif /* HAVE_ZSTD */
+
+static GIOStatus log_input_read(LogInput *input,
+                                gchar *dest,
+                                gsize length,
+                                gsize *bytes_read,
+                                GError **error) {
+    gssize ret;
+
+#ifdef HAVE_ZSTD
+    if (input->compression == LOG_COMPRESSION_ZSTD)
+        return log_input_read_zstd(input, dest, length, bytes_read, error);
+#endif
+
+    /* gzip logs go through a GConverterInputStream, so they don't need any
+     * special handling here */
+    ret = g_input_stream_read(input->stream, dest, length, NULL, error);
+    if (ret < 0)
+        return G_IO_STATUS_ERROR;
+
+    *bytes_read = ret;
+    return ret ? G_IO_STATUS_NORMAL : G_IO_STATUS_EOF;
+}
+
+/* Moves whatever's left in the buffer to the start of it, and fills up the
+ * rest */
+static GIOStatus log_input_fill_buffer(LogInput *input,
+                                       GError **error) {
+    gchar *buffer = input->buffer;
+    gsize bytes_read = 0;
+    GIOStatus rc;
+
+    if (input->eof)
+        return G_IO_STATUS_EOF;
+
+    if (input->buffer_start == 0 &&
+        input->buffer_len == LOG_INPUT_BUFFER_SIZE) {
+        g_set_error(error, PS2EMU_ERROR, PS2EMU_ERROR_INPUT,
+                    "Line is longer than %d bytes", LOG_INPUT_BUFFER_SIZE);
+        return G_IO_STATUS_ERROR;
+    }
+
+    memmove(buffer, &buffer[input->buffer_start],
+            input->buffer_len - input->buffer_start);
+    input->buffer_len -= input->buffer_start;
+    input->buffer_start = 0;
+
+    rc = log_input_read(input, &buffer[input->buffer_len],
+                        LOG_INPUT_BUFFER_SIZE - input->buffer_len,
+                        &bytes_read, error);
+    if (rc == G_IO_STATUS_EOF)
+        input->eof = TRUE;
+    else if (rc != G_IO_STATUS_NORMAL)
+        return rc;
+
+    input->buffer_len += bytes_read;
+
+    return G_IO_STATUS_NORMAL;
+}
+
+static GIOStatus log_input_next_line(LogInput *input,
+                                     const gchar **line,
+                                     const gchar **line_end,
+                                     GError **error) {
+    gchar *buffer = input->buffer;
+    const gchar *end;
+    GIOStatus rc;
+
+    while (TRUE) {
+        end = log_find_line_end(&buffer[input->buffer_start],
+                                &buffer[input->buffer_len]);
+
+        if (end < &buffer[input->buffer_len] ||
+            (input->eof && input->buffer_start < input->buffer_len)) {
+            *line = &buffer[input->buffer_start];
+            *line_end = end;
+            input->buffer_start = MIN(end - buffer + 1, input->buffer_len);
+
+            return G_IO_STATUS_NORMAL;
+        }
+
+        rc = log_input_fill_buffer(input, error);
+        if (rc != G_IO_STATUS_NORMAL)
+            return rc;
+    }
+}
+
+/* Figures out what the file is compressed with (if anything) by peeking at the
+ * start of it, and stacks a decompressor on top of the stream if needed */
+static gboolean log_input_setup_decompression(LogInput *input,
+                                              GError **error) {
+    GBufferedInputStream *buffered = G_BUFFERED_INPUT_STREAM(input->stream);
+    const guchar *magic;
+    gsize available;
+    gssize ret;
+
+    while (g_buffered_input_stream_get_available(buffered) <
+           LOG_INPUT_MAGIC_LENGTH) {
+        ret = g_buffered_input_stream_fill(buffered, -1, NULL, error);
+        if (ret < 0)
+            return FALSE;
+        else if (ret == 0)
+            break;
+    }
+
+    magic = g_buffered_input_stream_peek_buffer(buffered, &available);
+    input->compression = log_input_detect_compression(magic, available);
+
+    switch (input->compression) {
+        case LOG_COMPRESSION_NONE:
+            break;
+        case LOG_COMPRESSION_GZIP: {
+            GZlibDecompressor *decompressor =
+                g_zlib_decompressor_new(G_ZLIB_COMPRESSOR_FORMAT_GZIP);
+            GInputStream *converted =
+                g_converter_input_stream_new(input->stream,
+                                             G_CONVERTER(decompressor));
+
+            g_object_unref(decompressor);
+            g_object_unref(input->stream);
+            input->stream = converted;
+            break;
+        }
+        case LOG_COMPRESSION_ZSTD:
+#ifdef HAVE_ZSTD
+            input->zstd = ZSTD_createDStream();
+            ZSTD_initDStream(input->zstd);
+
+            input->zstd_buffer_size = ZSTD_DStreamInSize();
+            input->zstd_buffer = g_malloc(input->zstd_buffer_size);
+            break;
+#else
+            g_set_error_literal(error, PS2EMU_ERROR, PS2EMU_ERROR_INPUT,
+                                "Log is compressed with zstd, but ps2emu was "
+                                "built without zstd support");
+            return FALSE;
+#endif
+    }
+
+    return TRUE;
+}
+
+LogInput * log_input_open(const gchar *path,
+                          GError **error) {
+    LogInput *input = g_new0(LogInput, 1);
+    GFile *file = g_file_new_for_path(path);
+    GFileInputStream *file_stream;
+
+    file_stream = g_file_read(file, NULL, error);
+    g_object_unref(file);
+    if (!file_stream)
+        goto error;
+
+    input->stream = g_buffered_input_stream_new(G_INPUT_STREAM(file_stream));
+    g_object_unref(file_stream);
+
+    if (!log_input_setup_decompression(input, error))
+        goto error;
+
+    return input;
+
+error:
+    log_input_free(input);
+    return NULL;
+}
+
+gint log_input_parse_version(LogInput *input,
+                             GError **error) {
+    const gchar *line,
+                *line_end;
+    GIOStatus rc;
+
+    rc = log_input_next_line(input, &line, &line_end, error);
+    if (rc != G_IO_STATUS_NORMAL) {
+        if (rc == G_IO_STATUS_EOF) {
+            g_set_error_literal(error, PS2EMU_ERROR, PS2EMU_ERROR_NO_EVENTS,
+                                "Reached unexpected EOF");
+        }
+
+        return -1;
+    }
+
+    return log_parse_version_line(line, line_end, error);
+}
+
+/* Parses the next line or binary record in the log */
+GIOStatus log_input_parse_next(LogInput *input,
+                               LogParseState *state,
+                               GError **error) {
+    const gchar *line,
+                *line_end;
+    const guchar *pos,
+                 *end;
+    GIOStatus rc;
+
+    if (state->log_version < PS2EMU_LOG_VERSION_BINARY) {
+        rc = log_input_next_line(input, &line, &line_end, error);
+        if (rc != G_IO_STATUS_NORMAL)
+            return rc;
+
+        if (!log_parse_line(state, line, line_end, error))
+            return G_IO_STATUS_ERROR;
+
+        return G_IO_STATUS_NORMAL;
+    }
+
+    while (TRUE) {
+        pos = (guchar*)&input->buffer[input->buffer_start];
+        end = (guchar*)&input->buffer[input->buffer_len];
+
+        rc = log_binary_parse_record(state, &pos, end, error);
+        if (rc == G_IO_STATUS_NORMAL)
+            input->buffer_start = (gchar*)pos - input->buffer;
+
+        if (rc != G_IO_STATUS_AGAIN && rc != G_IO_STATUS_EOF)
+            return rc;
+
+        rc = log_input_fill_buffer(input, error);
+        if (rc == G_IO_STATUS_EOF &&
+            input->buffer_start < input->buffer_len) {
+            g_set_error_literal(error, PS2EMU_ERROR, PS2EMU_ERROR_INPUT,
+                                "Log ends in the middle of a record");
+            return G_IO_STATUS_ERROR;
+        }
+        if (rc != G_IO_STATUS_NORMAL)
+            return rc;
+    }
+}
+
+/* Parses everything left in the log */
+ParsedLog * log_input_parse(LogInput *input,
+                            int log_version,
+                            GError **error) {
+    LogParseState state;
+    ParsedLog *parsed_log = log_parse_begin(&state, log_version);
+    GIOStatus rc;
+
+    while ((rc = log_input_parse_next(input, &state,
+                                      error)) == G_IO_STATUS_NORMAL);
+
+    if (rc != G_IO_STATUS_EOF) {
+        log_free(parsed_log);
+        return NULL;
+    }
+
+    return parsed_log;
+}
+
+void log_input_free(LogInput *input) {
+#ifdef HAVE_ZSTD
+    if (input->zstd)
+        ZSTD_freeDStream(input->zstd);
+    g_free(input->zstd_buffer);
+#endif
+
+    if (input->stream)
+        g_object_unref(input->stream);
+
+    g_free(input);
+}
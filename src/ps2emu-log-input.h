@@ -0,0 +1,58 @@
+/*
+ * ps2emu-log-input.h
+ * Copyright (C) 2015 Red Hat
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public License for more
+ * details.
+ */
+
+#ifndef __PS2EMU_LOG_INPUT_H__
+#define __PS2EMU_LOG_INPUT_H__
+
+#include <glib.h>
+
+#include "ps2emu-log.h"
+
+/* The longest line (or binary record) we can read from a log */
+#define LOG_INPUT_BUFFER_SIZE (64 * 1024)
+
+typedef enum {
+    LOG_COMPRESSION_NONE,
+    LOG_COMPRESSION_GZIP,
+    LOG_COMPRESSION_ZSTD
+} LogCompression;
+
+/* A buffered reader for logs that can't just be mapped into memory, such as
+ * compressed ones. Compressed logs are decompressed while they're being read,
+ * so they never have to be written out to disk. */
+typedef struct _LogInput LogInput;
+
+LogCompression log_input_detect_compression(const guchar *data,
+                                            gsize length);
+
+LogInput * log_input_open(const gchar *path,
+                          GError **error)
+G_GNUC_MALLOC;
+
+gint log_input_parse_version(LogInput *input,
+                             GError **error);
+
+GIOStatus log_input_parse_next(LogInput *input,
+                               LogParseState *state,
+                               GError **error);
+
+ParsedLog * log_input_parse(LogInput *input,
+                            int log_version,
+                            GError **error)
+G_GNUC_MALLOC;
+
+void log_input_free(LogInput *input);
+
+#endif /* !__PS2EMU_LOG_INPUT_H__ */
@@ -0,0 +1,221 @@
+/*
+ * ps2emu-log-parallel.c
+ * Copyright (C) 2015 Red Hat
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public License for more
+ * details.
+ */
+
+#include "ps2emu-log-parallel.h"
+#include "ps2emu-log.h"
+#include "ps2emu-misc.h"
+
+#include <string.h>
+#include <glib.h>
+
+/* Used to tell whether or not a chunk had any T: lines in it */
+#define PS2_PORT_UNSET ((PS2Port)-1)
+
+/* Each chunk is parsed on its own into a separate log. Since a chunk doesn't
+ * know which section the chunks before it ended up in, anything that comes
+ * before the first S: line in the chunk goes into the leading section, which
+ * gets sorted out once all of the chunks are stitched back together. */
+typedef struct {
+    const gchar  *start,
+                 *end;
+    LogParseState state;
+    LogSection    leading;
+    time_t        leading_time;
+    GError       *error;
+} LogParallelChunk;
+
+static void log_parallel_parse_chunk(gpointer data,
+                                     gpointer user_data) {
+    LogParallelChunk *chunk = data;
+    const gchar *pos,
+                *line_end;
+
+    for (pos = chunk->start; pos < chunk->end; pos = line_end + 1) {
+        line_end = log_find_line_end(pos, chunk->end);
+
+        if (!log_parse_line(&chunk->state, pos, line_end, &chunk->error))
+            break;
+    }
+}
+
+/* Moves everything in @src to the end of the current section of @state. All of
+ * the times in @src start from 0 instead of the last event in the section, so
+ * the first event has to be added again to get the right delta. */
+static void log_parallel_append(LogParseState *state,
+                                LogSection *src,
+                                time_t src_time) {
+    LogSection *dest = state->section;
+    const LogEvent *event;
+    guint base = dest->events->len,
+          first = 0,
+          first_end = base;
+    time_t first_time = 0;
+
+    if (src->events->len) {
+        do {
+            event = &g_array_index(src->events, LogEvent, first++);
+            first_time += event->delta;
+        } while (event->type == LOG_EVENT_TYPE_DELAY);
+
+        log_parse_add_event(state, first_time, event->type, event->data,
+                            NULL);
+        first_end = dest->events->len;
+
+        g_array_append_vals(dest->events,
+                            &g_array_index(src->events, LogEvent, first),
+                            src->events->len - first);
+        *state->section_time = src_time;
+    }
+
+    /* Notes at position 0 come before the first event, the rest come after
+     * it and need to be shifted along with it */
+    for (guint i = 0; i < src->notes->len; i++) {
+        LogNote note = g_array_index(src->notes, LogNote, i);
+
+        if (note.position == 0)
+            note.position = base;
+        else
+            note.position = note.position - first + first_end;
+
+        g_array_append_val(dest->notes, note);
+    }
+
+    /* The notes belong to @dest now, and so does their text */
+    g_array_set_size(src->notes, 0);
+    log_arena_steal(&dest->arena, &src->arena);
+}
+
+static gboolean log_parallel_stitch(LogParseState *state,
+                                    LogParallelChunk *chunk,
+                                    GError **error) {
+    LogParseState *chunk_state = &chunk->state;
+    ParsedLog *chunk_log = chunk_state->parsed_log;
+    LogSection *leading = &chunk->leading,
+               *section = state->section;
+    time_t *section_time = state->section_time;
+
+    if (leading->events->len || leading->notes->len) {
+        if (!state->section) {
+            /* Report whichever one the serial parser would have hit first */
+            gboolean note_first = leading->events->len == 0 ||
+                (leading->notes->len &&
+                 g_array_index(leading->notes, LogNote, 0).position == 0);
+
+            g_set_error(error, PS2EMU_ERROR, PS2EMU_ERROR_INPUT,
+                        "%s found before any section",
+                        note_first ? "Note" : "Event");
+            return FALSE;
+        }
+
+        log_parallel_append(state, leading, chunk->leading_time);
+    }
+
+    if (chunk->error) {
+        g_propagate_error(error, chunk->error);
+        chunk->error = NULL;
+        return FALSE;
+    }
+
+    if (chunk_log->port != PS2_PORT_UNSET)
+        state->parsed_log->port = chunk_log->port;
+
+    log_parse_set_section(state, SECTION_TYPE_INIT);
+    log_parallel_append(state, &chunk_log->init_section,
+                        chunk_state->init_time);
+
+    log_parse_set_section(state, SECTION_TYPE_MAIN);
+    log_parallel_append(state, &chunk_log->main_section,
+                        chunk_state->main_time);
+
+    /* Leave the state in whatever section the chunk ended in */
+    if (chunk_state->section == &chunk_log->init_section) {
+        log_parse_set_section(state, SECTION_TYPE_INIT);
+    } else if (chunk_state->section == leading) {
+        state->section = section;
+        state->section_time = section_time;
+    }
+
+    return TRUE;
+}
+
+/* Equivalent to log_parse_buffer() for text logs, except that the buffer gets
+ * split up at line boundaries and parsed across @n_threads threads. Doesn't
+ * support windows. */
+gboolean log_parse_text_parallel(LogParseState *state,
+                                 const gchar *pos,
+                                 const gchar *end,
+                                 guint n_threads,
+                                 GError **error) {
+    LogParallelChunk *chunks;
+    GThreadPool *pool;
+    gsize chunk_size;
+    guint n_chunks;
+    gboolean ret = TRUE;
+
+    n_chunks = MIN(n_threads * LOG_PARALLEL_CHUNKS_PER_THREAD,
+                   (end - pos) / LOG_PARALLEL_MIN_CHUNK_SIZE);
+    if (end - pos < LOG_PARALLEL_MIN_SIZE || n_threads < 2 || n_chunks < 2 ||
+        state->windowed)
+        return log_parse_buffer(state, pos, end, error);
+
+    chunks = g_new0(LogParallelChunk, n_chunks);
+    chunk_size = (end - pos) / n_chunks;
+
+    for (guint i = 0; i < n_chunks; i++) {
+        LogParallelChunk *chunk = &chunks[i];
+        const gchar *split,
+                    *newline;
+
+        chunk->start = i ? chunks[i - 1].end : pos;
+
+        /* Anything that comes right after a newline is the start of a line,
+         * no matter what came before it */
+        split = MAX(chunk->start, pos + chunk_size * (i + 1));
+        newline = i < n_chunks - 1 ? memchr(split, '\n', end - split) : NULL;
+        chunk->end = newline ? newline + 1 : end;
+
+        log_parse_begin(&chunk->state, state->log_version);
+        chunk->state.parsed_log->port = PS2_PORT_UNSET;
+
+        log_section_init(&chunk->leading);
+        chunk->state.section = &chunk->leading;
+        chunk->state.section_time = &chunk->leading_time;
+    }
+
+    pool = g_thread_pool_new(log_parallel_parse_chunk, NULL, n_threads, FALSE,
+                             error);
+    if (!pool) {
+        ret = FALSE;
+        goto out;
+    }
+
+    for (guint i = 0; i < n_chunks; i++)
+        g_thread_pool_push(pool, &chunks[i], NULL);
+
+    g_thread_pool_free(pool, FALSE, TRUE);
+
+    for (guint i = 0; i < n_chunks && ret; i++)
+        ret = log_parallel_stitch(state, &chunks[i], error);
+
+out:
+    for (guint i = 0; i < n_chunks; i++) {
+        log_free(chunks[i].state.parsed_log);
+        log_section_clear(&chunks[i].leading);
+        g_clear_error(&chunks[i].error);
+    }
+    g_free(chunks);
+
+    return ret;
+}
@@ -0,0 +1,34 @@
+/*
+ * ps2emu-log-parallel.h
+ * Copyright (C) 2015 Red Hat
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public License for more
+ * details.
+ */
+
+#ifndef __PS2EMU_LOG_PARALLEL_H__
+#define __PS2EMU_LOG_PARALLEL_H__
+
+#include <glib.h>
+
+#include "ps2emu-log.h"
+
+/* Text logs smaller than this aren't worth splitting up */
+#define LOG_PARALLEL_MIN_SIZE       (4 * 1024 * 1024)
+#define LOG_PARALLEL_MIN_CHUNK_SIZE (1024 * 1024)
+#define LOG_PARALLEL_CHUNKS_PER_THREAD 4
+
+gboolean log_parse_text_parallel(LogParseState *state,
+                                 const gchar *pos,
+                                 const gchar *end,
+                                 guint n_threads,
+                                 GError **error);
+
+#endif /* !__PS2EMU_LOG_PARALLEL_H__ */
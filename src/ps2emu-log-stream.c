@@ -0,0 +1,198 @@
+/*
+ * ps2emu-log-stream.c
+ * Copyright (C) 2015 Red Hat
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public License for more
+ * details.
+ */
+
+#include "ps2emu-log-stream.h"
+#include "ps2emu-log.h"
+#include "ps2emu-log-input.h"
+#include "ps2emu-misc.h"
+
+#include <string.h>
+#include <glib.h>
+
+typedef struct {
+    LogSection section; /* must come first */
+    gboolean   last;
+    GError    *error;
+} LogStreamChunk;
+
+/* The init section of the log is parsed up front when the stream is opened,
+ * everything after that is parsed by a producer thread into a fixed set of
+ * chunks that get recycled once they've been replayed. This keeps the amount
+ * of memory we use the same no matter how long the log is. */
+struct _LogStream {
+    LogInput     *input;
+    LogParseState state;
+    ParsedLog    *parsed_log;
+
+    LogStreamChunk chunks[LOG_STREAM_CHUNK_COUNT];
+    GAsyncQueue   *free_chunks,
+                  *filled_chunks;
+    GThread       *producer;
+    gint           cancelled;
+    gboolean       finished;
+};
+
+/* Swap the events the producer has parsed so far into a free chunk, and pass
+ * that chunk on to the consumer */
+static void log_stream_hand_off(LogStream *stream,
+                                gboolean last,
+                                GError *error) {
+    LogStreamChunk *chunk = g_async_queue_pop(stream->free_chunks);
+    LogSection empty_section = chunk->section;
+
+    chunk->section = stream->parsed_log->main_section;
+    chunk->last = last;
+    chunk->error = error;
+    stream->parsed_log->main_section = empty_section;
+
+    g_async_queue_push(stream->filled_chunks, chunk);
+}
+
+static gpointer log_stream_produce(gpointer data) {
+    LogStream *stream = data;
+    LogSection *main_section = &stream->parsed_log->main_section;
+    GError *error = NULL;
+
+    while (!g_atomic_int_get(&stream->cancelled)) {
+        if (log_input_parse_next(stream->input, &stream->state,
+                                 &error) != G_IO_STATUS_NORMAL)
+            break;
+
+        if (stream->state.section == &stream->parsed_log->init_section) {
+            g_set_error_literal(&error, PS2EMU_ERROR, PS2EMU_ERROR_INPUT,
+                                "Logs that switch back to the init section "
+                                "can't be streamed");
+            break;
+        }
+
+        if (main_section->events->len >= LOG_STREAM_CHUNK_EVENTS)
+            log_stream_hand_off(stream, FALSE, NULL);
+    }
+
+    log_stream_hand_off(stream, TRUE, error);
+
+    return NULL;
+}
+
+LogStream * log_stream_open(const gchar *path,
+                            gint *log_version,
+                            GError **error) {
+    LogStream *stream = g_new0(LogStream, 1);
+    GIOStatus rc;
+
+    stream->free_chunks = g_async_queue_new();
+    stream->filled_chunks = g_async_queue_new();
+    for (int i = 0; i < LOG_STREAM_CHUNK_COUNT; i++) {
+        log_section_init(&stream->chunks[i].section);
+        g_async_queue_push(stream->free_chunks, &stream->chunks[i]);
+    }
+
+    stream->input = log_input_open(path, error);
+    if (!stream->input)
+        goto error;
+
+    *log_version = log_input_parse_version(stream->input, error);
+    if (*log_version < 0)
+        goto error;
+
+    stream->parsed_log = log_parse_begin(&stream->state, *log_version);
+
+    /* V0 logs don't have an init section, so everything goes to the producer
+     * right away */
+    while (*log_version >= 1 &&
+           stream->state.section != &stream->parsed_log->main_section) {
+        rc = log_input_parse_next(stream->input, &stream->state, error);
+        if (rc == G_IO_STATUS_EOF)
+            break;
+        else if (rc != G_IO_STATUS_NORMAL)
+            goto error;
+    }
+
+    stream->producer = g_thread_new("log-stream", log_stream_produce, stream);
+
+    return stream;
+
+error:
+    log_stream_free(stream);
+    return NULL;
+}
+
+/* The main section of the returned log belongs to the producer, and must not
+ * be touched. Use log_stream_next_chunk() to get at its events instead. */
+ParsedLog * log_stream_get_log(LogStream *stream) {
+    return stream->parsed_log;
+}
+
+/* Returns the next chunk of the main section, or NULL once the end of the log
+ * has been reached or an error occurred */
+LogSection * log_stream_next_chunk(LogStream *stream,
+                                   GError **error) {
+    LogStreamChunk *chunk;
+
+    if (stream->finished)
+        return NULL;
+
+    chunk = g_async_queue_pop(stream->filled_chunks);
+    if (chunk->last) {
+        stream->finished = TRUE;
+
+        if (chunk->error) {
+            g_propagate_error(error, chunk->error);
+            chunk->error = NULL;
+
+            log_stream_release_chunk(stream, &chunk->section);
+            return NULL;
+        }
+    }
+
+    return &chunk->section;
+}
+
+void log_stream_release_chunk(LogStream *stream,
+                              LogSection *chunk) {
+    log_section_reset(chunk);
+    g_async_queue_push(stream->free_chunks, chunk);
+}
+
+void log_stream_free(LogStream *stream) {
+    if (stream->producer) {
+        g_atomic_int_set(&stream->cancelled, TRUE);
+
+        /* Keep recycling chunks until the producer notices it's been
+         * cancelled */
+        while (!stream->finished) {
+            LogStreamChunk *chunk = g_async_queue_pop(stream->filled_chunks);
+
+            stream->finished = chunk->last;
+            g_clear_error(&chunk->error);
+            log_stream_release_chunk(stream, &chunk->section);
+        }
+
+        g_thread_join(stream->producer);
+    }
+
+    for (int i = 0; i < LOG_STREAM_CHUNK_COUNT; i++)
+        log_section_clear(&stream->chunks[i].section);
+
+    g_async_queue_unref(stream->free_chunks);
+    g_async_queue_unref(stream->filled_chunks);
+
+    if (stream->parsed_log)
+        log_free(stream->parsed_log);
+    if (stream->input)
+        log_input_free(stream->input);
+
+    g_free(stream);
+}
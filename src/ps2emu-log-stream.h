@@ -0,0 +1,45 @@
+/*
+ * ps2emu-log-stream.h
+ * Copyright (C) 2015 Red Hat
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public License for more
+ * details.
+ */
+
+#ifndef __PS2EMU_LOG_STREAM_H__
+#define __PS2EMU_LOG_STREAM_H__
+
+#include <glib.h>
+
+#include "ps2emu-log.h"
+
+/* How many events go into each chunk of the main section, and how many chunks
+ * the producer is allowed to parse ahead of the replay */
+#define LOG_STREAM_CHUNK_EVENTS 4096
+#define LOG_STREAM_CHUNK_COUNT  4
+
+typedef struct _LogStream LogStream;
+
+LogStream * log_stream_open(const gchar *path,
+                            gint *log_version,
+                            GError **error)
+G_GNUC_MALLOC;
+
+ParsedLog * log_stream_get_log(LogStream *stream);
+
+LogSection * log_stream_next_chunk(LogStream *stream,
+                                   GError **error);
+
+void log_stream_release_chunk(LogStream *stream,
+                              LogSection *chunk);
+
+void log_stream_free(LogStream *stream);
+
+#endif /* !__PS2EMU_LOG_STREAM_H__ */
@@ -14,6 +14,10 @@
  */
 
 #include "ps2emu-log.h"
+#include "ps2emu-log-binary.h"
+#include "ps2emu-log-input.h"
+#include "ps2emu-log-parallel.h"
+#include "ps2emu-scanner.h"
 #include "ps2emu-misc.h"
 
 #include <stdio.h>
@@ -27,21 +31,6 @@ void ps2_event_free(PS2Event *event) {
     g_slice_free(PS2Event, event);
 }
 
-static void log_line_free(LogLine *log_line) {
-    switch (log_line->type) {
-        case LINE_TYPE_NOTE:
-            g_free(log_line->note);
-            break;
-        case LINE_TYPE_EVENT:
-            ps2_event_free(log_line->ps2_event);
-            break;
-        default:
-            break;
-    }
-
-    g_slice_free(LogLine, log_line);
-}
-
 gchar * ps2_event_to_string(PS2Event *event,
                             time_t time) {
     gchar *event_str,
@@ -66,298 +55,842 @@ gchar * ps2_event_to_string(PS2Event *event,
     return event_str;
 }
 
-PS2Event * ps2_event_from_line(const gchar *str,
-                               int log_version,
-                               GError **error) {
-    gchar const *str_start = &str[strspn(str, " \t")];
-    int parsed_count;
-    char origin_char,
-         direction_char;
-    PS2Event *new_event = NULL;
+/* All of the scanners below work on [str, end) ranges instead of NUL
+ * terminated strings, so that they can be run directly on top of a mapped log
+ * file without having to copy each line out first. They accept the same input
+ * that the sscanf() formats they replaced used to accept. */
+static inline const gchar * scan_skip_space(const gchar *str,
+                                            const gchar *end) {
+    while (str < end && g_ascii_isspace(*str))
+        str++;
+
+    return str;
+}
 
-    if (*str_start == '#')
+static inline const gchar * scan_skip_blank(const gchar *str,
+                                            const gchar *end) {
+    while (str < end && (*str == ' ' || *str == '\t'))
+        str++;
+
+    return str;
+}
+
+const gchar * log_find_line_end(const gchar *str,
+                                const gchar *end) {
+    return scanner_find_line_end(str, end);
+}
+
+/* Equivalent to "%ld" */
+static const gchar * scan_long(const gchar *str,
+                               const gchar *end,
+                               glong *result,
+                               gboolean *overflow) {
+    gboolean negative = FALSE;
+    gulong value = 0,
+           limit;
+    const gchar *digits_start;
+
+    str = scan_skip_space(str, end);
+    if (str < end && (*str == '-' || *str == '+')) {
+        negative = (*str == '-');
+        str++;
+    }
+
+    limit = negative ? -(gulong)G_MINLONG : G_MAXLONG;
+
+    for (digits_start = str; str < end && g_ascii_isdigit(*str); str++) {
+        guint digit = *str - '0';
+
+        if (value > (limit - digit) / 10)
+            *overflow = TRUE;
+        else
+            value = value * 10 + digit;
+    }
+    if (str == digits_start)
         return NULL;
 
-    new_event = g_slice_alloc(sizeof(PS2Event));
+    *result = negative ? (glong)-value : (glong)value;
+    return str;
+}
+
+/* Equivalent to "%hhx" */
+static const gchar * scan_hex_byte(const gchar *str,
+                                   const gchar *end,
+                                   guchar *result,
+                                   gboolean *overflow) {
+    gboolean negative = FALSE;
+    gulong value = 0;
+    const gchar *digits_start;
+
+    str = scan_skip_space(str, end);
+    if (str < end && (*str == '-' || *str == '+')) {
+        negative = (*str == '-');
+        str++;
+    }
+
+    if (end - str >= 2 && str[0] == '0' && (str[1] == 'x' || str[1] == 'X')) {
+        /* A lone "0x" still counts as a 0 */
+        if (end - str == 2 || !g_ascii_isxdigit(str[2])) {
+            *result = 0;
+            return str + 2;
+        }
+
+        str += 2;
+    }
+
+    for (digits_start = str; str < end && g_ascii_isxdigit(*str); str++) {
+        if (value > (G_MAXULONG >> 4))
+            *overflow = TRUE;
+        else
+            value = (value << 4) | g_ascii_xdigit_value(*str);
+    }
+    if (str == digits_start)
+        return NULL;
+
+    *result = negative ? (guchar)-value : (guchar)value;
+    return str;
+}
+
+/* Equivalent to " %c" */
+static inline const gchar * scan_char(const gchar *str,
+                                      const gchar *end,
+                                      gchar *result) {
+    str = scan_skip_space(str, end);
+    if (str == end)
+        return NULL;
+
+    *result = *str;
+    return str + 1;
+}
 
-    errno = 0;
+static inline gboolean scan_is_comment(const gchar *str,
+                                       const gchar *end) {
+    str = scan_skip_blank(str, end);
+
+    return str < end && *str == '#';
+}
+
+static gboolean scan_event(const gchar *str,
+                           const gchar *end,
+                           int log_version,
+                           PS2Event *event,
+                           GError **error) {
+    const gchar *pos = scan_skip_blank(str, end);
+    gboolean overflow = FALSE;
+    gchar origin_char,
+          direction_char;
 
     /* In the first log version, we originally specified the origin device each
      * event was coming from. This ended up being uneccessary, and as of log
      * version 1 we no longer record this */
-    if (log_version == 0) {
-        parsed_count = sscanf(str_start, "%ld %c %c %hhx",
-                              &new_event->time, &origin_char, &direction_char,
-                              &new_event->data);
-        if (errno != 0 || parsed_count != 4) {
-            g_set_error(error, PS2EMU_ERROR, PS2EMU_ERROR_INPUT,
-                        "Invalid event line '%s'", str);
-            goto error;
-        }
+    pos = scan_long(pos, end, &event->time, &overflow);
+    if (pos)
+        pos = scan_char(pos, end, log_version == 0 ? &origin_char :
+                                                     &direction_char);
+    if (pos && log_version == 0)
+        pos = scan_char(pos, end, &direction_char);
+    if (pos)
+        pos = scan_hex_byte(pos, end, &event->data, &overflow);
+
+    if (!pos || overflow) {
+        g_set_error(error, PS2EMU_ERROR, PS2EMU_ERROR_INPUT,
+                    "Invalid event line '%.*s'", (int)(end - str), str);
+        return FALSE;
+    }
 
+    if (log_version == 0) {
         if (origin_char == 'K')
-            new_event->origin = PS2_PORT_KBD;
+            event->origin = PS2_PORT_KBD;
         else if (origin_char == 'A')
-            new_event->origin = PS2_PORT_AUX;
+            event->origin = PS2_PORT_AUX;
         else {
             g_set_error(error, PS2EMU_ERROR, PS2EMU_ERROR_INPUT,
-                        "Invalid event origin '%c' from '%s'", origin_char,
-                        str);
-            goto error;
-        }
-    } else {
-        parsed_count = sscanf(str_start, "%ld %c %hhx",
-                              &new_event->time, &direction_char,
-                              &new_event->data);
-        if (errno != 0 || parsed_count != 3) {
-            g_set_error(error, PS2EMU_ERROR, PS2EMU_ERROR_INPUT,
-                        "Invalid event line '%s'", str);
-            goto error;
+                        "Invalid event origin '%c' from '%.*s'", origin_char,
+                        (int)(end - str), str);
+            return FALSE;
         }
     }
 
     if (direction_char == 'S')
-        new_event->type = PS2_EVENT_TYPE_PARAMETER;
+        event->type = PS2_EVENT_TYPE_PARAMETER;
     /* It might also be a return, but the serio port doesn't care either way */
     else if (direction_char == 'R')
-        new_event->type = PS2_EVENT_TYPE_INTERRUPT;
+        event->type = PS2_EVENT_TYPE_INTERRUPT;
     else {
         g_set_error(error, PS2EMU_ERROR, PS2EMU_ERROR_INPUT,
-                    "Invalid event direction '%c' from '%s'",
-                    direction_char, str);
-        goto error;
+                    "Invalid event direction '%c' from '%.*s'",
+                    direction_char, (int)(end - str), str);
+        return FALSE;
     }
 
-    return new_event;
+    return TRUE;
+}
 
-error:
-    if (new_event)
+PS2Event * ps2_event_from_line(const gchar *str,
+                               int log_version,
+                               GError **error) {
+    const gchar *end = str + strlen(str);
+    PS2Event *new_event;
+
+    if (scan_is_comment(str, end))
+        return NULL;
+
+    new_event = g_slice_alloc(sizeof(PS2Event));
+    if (!scan_event(str, end, log_version, new_event, error)) {
         ps2_event_free(new_event);
+        return NULL;
+    }
 
-    return NULL;
+    return new_event;
+}
+
+static LogLineType scan_line_type(const gchar *line,
+                                  const gchar *end,
+                                  const gchar **message_start,
+                                  GError **error) {
+    switch (*line) {
+        case LINE_TYPE_EVENT:
+        case LINE_TYPE_SECTION:
+        case LINE_TYPE_DEVICE_TYPE:
+        case LINE_TYPE_NOTE:
+            break;
+        default:
+            *message_start = NULL;
+
+            g_set_error(error, PS2EMU_ERROR, PS2EMU_ERROR_INPUT,
+                        "Invalid line type `%1c`", *line);
+            return LINE_TYPE_INVALID;
+    }
+
+    /* The ':' and the space following it aren't actually checked */
+    *message_start = MIN(line + LINE_TYPE_LENGTH, end);
+
+    return *line;
 }
 
 LogLineType log_get_line_type(gchar *line,
                               gchar **message_start,
                               GError **error) {
     LogLineType type;
-    gchar type_char;
-    int parse_count;
+    const gchar *msg_start;
 
-    errno = 0;
-    parse_count = sscanf(line, "%1c:", &type_char);
-    if (errno || parse_count != 1) {
+    if (*line == '\0') {
         g_set_error(error, PS2EMU_ERROR, PS2EMU_ERROR_INPUT,
                     "Invalid event line `%s`", line);
-        return -1;
+        return LINE_TYPE_INVALID;
     }
 
-    switch (type_char) {
+    type = scan_line_type(line, line + strlen(line), &msg_start, error);
+    *message_start = (gchar*)msg_start;
+
+    return type;
+}
+
+static LogSectionType scan_section_type(const gchar *line,
+                                        const gchar *end,
+                                        GError **error) {
+    const gchar *name_start = scan_skip_space(line, end),
+                *name_end = name_start;
+    gsize name_len;
+
+    while (name_end < end && !g_ascii_isspace(*name_end))
+        name_end++;
+
+    name_len = name_end - name_start;
+    if (name_len == 0) {
+        g_set_error_literal(error, PS2EMU_ERROR, PS2EMU_ERROR_INPUT,
+                            "Invalid section line");
+        return SECTION_TYPE_ERROR;
+    }
+
+    if (name_len == 4 && memcmp(name_start, "Init", 4) == 0)
+        return SECTION_TYPE_INIT;
+    else if (name_len == 4 && memcmp(name_start, "Main", 4) == 0)
+        return SECTION_TYPE_MAIN;
+
+    g_set_error(error, PS2EMU_ERROR, PS2EMU_ERROR_INPUT,
+                "Invalid section type `%.*s`", (int)name_len, name_start);
+    return SECTION_TYPE_ERROR;
+}
+
+LogSectionType log_get_section_type_from_line(const gchar *line,
+                                              GError **error) {
+    return scan_section_type(line, line + strlen(line), error);
+}
+
+void log_section_init(LogSection *section) {
+    section->events = g_array_new(FALSE, FALSE, sizeof(LogEvent));
+    section->notes = g_array_new(FALSE, FALSE, sizeof(LogNote));
+    log_arena_init(&section->arena);
+}
+
+void log_section_clear(LogSection *section) {
+    g_array_free(section->notes, TRUE);
+    g_array_free(section->events, TRUE);
+    log_arena_clear(&section->arena);
+}
+
+/* Empties the section, but keeps its memory around so it can be filled
+ * again */
+void log_section_reset(LogSection *section) {
+    g_array_set_size(section->events, 0);
+    g_array_set_size(section->notes, 0);
+    log_arena_reset(&section->arena);
+}
+
+static void log_section_add_event(LogSection *section,
+                                  time_t *last_time,
+                                  time_t time,
+                                  LogEventType type,
+                                  guchar data) {
+    gint64 delta = (gint64)time - *last_time;
+    LogEvent event;
+
+    /* Gaps that don't fit into a single delta get split up across as many
+     * delay events as needed */
+    while (delta > G_MAXINT32 || delta < G_MININT32) {
+        event = (LogEvent) {
+            .delta = delta > 0 ? G_MAXINT32 : G_MININT32,
+            .type = LOG_EVENT_TYPE_DELAY,
+        };
+        g_array_append_val(section->events, event);
+
+        delta -= event.delta;
+    }
+
+    event = (LogEvent) {
+        .delta = delta,
+        .type = type,
+        .data = data,
+    };
+    g_array_append_val(section->events, event);
+
+    *last_time = time;
+}
+
+static void log_section_add_note(LogSection *section,
+                                 const gchar *text,
+                                 gsize length) {
+    LogNote note = {
+        .position = section->events->len,
+        .text = log_arena_strndup(&section->arena, text, length),
+    };
+
+    g_array_append_val(section->notes, note);
+}
+
+void log_parse_set_section(LogParseState *state,
+                           LogSectionType type) {
+    if (type == SECTION_TYPE_INIT) {
+        state->section = &state->parsed_log->init_section;
+        state->section_time = &state->init_time;
+    } else {
+        state->section = &state->parsed_log->main_section;
+        state->section_time = &state->main_time;
+    }
+}
+
+/* Drops any notes that come before the next event in the section. Those are
+ * always the last things allocated from the arena, so their memory can
+ * usually be handed back too. */
+static void log_section_drop_pending_notes(LogSection *section) {
+    LogNote *note;
+
+    while (section->notes->len) {
+        note = &g_array_index(section->notes, LogNote,
+                              section->notes->len - 1);
+        if (note->position < section->events->len)
+            break;
+
+        log_arena_rewind(&section->arena, note->text);
+        g_array_set_size(section->notes, section->notes->len - 1);
+    }
+}
+
+void log_parse_set_window(LogParseState *state,
+                          time_t start,
+                          time_t end) {
+    state->windowed = TRUE;
+    state->window_start = start;
+    state->window_end = end;
+}
+
+gboolean log_parse_add_event(LogParseState *state,
+                             time_t time,
+                             LogEventType type,
+                             guchar data,
+                             GError **error) {
+    if (!state->section) {
+        g_set_error_literal(error, PS2EMU_ERROR, PS2EMU_ERROR_INPUT,
+                            "Event found before any section");
+        return FALSE;
+    }
+
+    if (state->windowed &&
+        state->section == &state->parsed_log->main_section) {
+        if (state->window_done) {
+            return TRUE;
+        } else if (time < state->window_start) {
+            /* Skipped events still move the clock forward, since the deltas
+             * in binary logs depend on it */
+            log_section_drop_pending_notes(state->section);
+            *state->section_time = time;
+            return TRUE;
+        } else if (time > state->window_end) {
+            state->window_done = TRUE;
+            return TRUE;
+        }
+
+        /* The window starts where the replay starts, not at the last event
+         * we skipped */
+        if (!state->window_started) {
+            *state->section_time = state->window_start;
+            state->window_started = TRUE;
+        }
+    }
+
+    log_section_add_event(state->section, state->section_time, time, type,
+                          data);
+    return TRUE;
+}
+
+gboolean log_parse_add_note(LogParseState *state,
+                            const gchar *text,
+                            gsize length,
+                            GError **error) {
+    if (length == 0) {
+        g_set_error_literal(error, PS2EMU_ERROR, PS2EMU_ERROR_INPUT,
+                            "Note is empty");
+        return FALSE;
+    }
+
+    if (!state->section) {
+        g_set_error_literal(error, PS2EMU_ERROR, PS2EMU_ERROR_INPUT,
+                            "Note found before any section");
+        return FALSE;
+    }
+
+    if (state->window_done &&
+        state->section == &state->parsed_log->main_section)
+        return TRUE;
+
+    log_section_add_note(state->section, text, length);
+    return TRUE;
+}
+
+gboolean log_parse_line(LogParseState *state,
+                        const gchar *line,
+                        const gchar *end,
+                        GError **error) {
+    ParsedLog *parsed_log = state->parsed_log;
+    LogLineType line_type;
+    LogSectionType section_type;
+    PS2Event event;
+    const gchar *msg_start;
+
+    line = scan_skip_space(line, end);
+    if (line == end || line[0] == '#')
+        return TRUE;
+
+    if (state->log_version < 1) {
+        line_type = LINE_TYPE_EVENT;
+        msg_start = line;
+        log_parse_set_section(state, SECTION_TYPE_MAIN);
+    } else
+        line_type = scan_line_type(line, end, &msg_start, error);
+
+    switch (line_type) {
+        case LINE_TYPE_DEVICE_TYPE:
+            switch (msg_start < end ? msg_start[0] : '\0') {
+                case 'K':
+                    parsed_log->port = PS2_PORT_KBD;
+                    break;
+                case 'A':
+                    parsed_log->port = PS2_PORT_AUX;
+                    break;
+                default:
+                    g_set_error(error, PS2EMU_ERROR, PS2EMU_ERROR_INPUT,
+                                "Invalid device type '%.1s'",
+                                msg_start < end ? msg_start : "");
+                    return FALSE;
+            }
+
+            break;
         case LINE_TYPE_EVENT:
+            if (scan_is_comment(msg_start, end))
+                break;
+
+            if (!scan_event(msg_start, end, state->log_version, &event,
+                            error))
+                return FALSE;
+
+            if (!log_parse_add_event(state, event.time,
+                                     event.type == PS2_EVENT_TYPE_INTERRUPT ?
+                                         LOG_EVENT_TYPE_INTERRUPT :
+                                         LOG_EVENT_TYPE_PARAMETER,
+                                     event.data, error))
+                return FALSE;
+            break;
         case LINE_TYPE_SECTION:
-        case LINE_TYPE_DEVICE_TYPE:
-        case LINE_TYPE_NOTE:
-            type = type_char;
+            section_type = scan_section_type(msg_start, end, error);
+            if (section_type == SECTION_TYPE_ERROR)
+                return FALSE;
+
+            log_parse_set_section(state, section_type);
             break;
-        default:
-            *message_start = NULL;
+        case LINE_TYPE_NOTE:
+            /* Remove the newline character from the end of the note */
+            while (end > msg_start && g_ascii_isspace(end[-1]))
+                end--;
 
-            g_set_error(error, PS2EMU_ERROR, PS2EMU_ERROR_INPUT,
-                        "Invalid line type `%1c`", type_char);
-            return -1;
+            if (!log_parse_add_note(state, msg_start, end - msg_start, error))
+                return FALSE;
+            break;
+        case LINE_TYPE_INVALID:
+            return FALSE;
     }
 
-    *message_start = line + LINE_TYPE_LENGTH;
+    return TRUE;
+}
 
-    return type;
+ParsedLog * log_parse_begin(LogParseState *state,
+                            int log_version) {
+    ParsedLog *parsed_log = g_new0(ParsedLog, 1);
+
+    log_section_init(&parsed_log->init_section);
+    log_section_init(&parsed_log->main_section);
+
+    /* We can't reliably play anything back from older logs except for
+     * touchpads, so just automatically set the port type to AUX */
+    if (log_version < 1)
+        parsed_log->port = PS2_PORT_AUX;
+
+    *state = (LogParseState) {
+        .parsed_log = parsed_log,
+        .log_version = log_version,
+    };
+
+    return parsed_log;
+}
+
+void log_free(ParsedLog *parsed_log) {
+    log_section_clear(&parsed_log->init_section);
+    log_section_clear(&parsed_log->main_section);
+
+    g_free(parsed_log);
 }
 
 ParsedLog *log_parse(GIOChannel *input_channel,
                      int log_version,
                      GError **error) {
     gchar *line;
-    LogLineType line_type;
-    LogLine *log_line;
-    PS2Event *event;
-    LogSectionType section_type;
-    gchar *msg_start;
-    GList **section_dest;
+    gsize length;
+    LogParseState state;
     ParsedLog *parsed_log;
     GIOStatus rc;
 
-    parsed_log = g_new0(ParsedLog, 1);
+    parsed_log = log_parse_begin(&state, log_version);
 
-    /* We can't reliably play anything back from older logs except for
-     * touchpads, so just automatically set the port type to AUX */
-    if (log_version < 1)
-        parsed_log->port = PS2_PORT_AUX;
+    if (log_version >= PS2EMU_LOG_VERSION_BINARY) {
+        gchar *contents;
+        gsize length;
+        gboolean ret;
 
-    while ((rc = g_io_channel_read_line(input_channel, &line, NULL, NULL,
-                                        error)) == G_IO_STATUS_NORMAL) {
-        g_strchug(line);
+        /* log_parse_version() already switched the channel to raw bytes, so
+         * none of what it buffered past the version line got decoded */
+        rc = g_io_channel_read_to_end(input_channel, &contents, &length,
+                                      error);
+        if (rc != G_IO_STATUS_NORMAL)
+            goto error;
 
-        if (line[0] == '#' || line[0] == '\0')
-            continue;
+        ret = log_binary_parse(&state, (guchar*)contents,
+                               (guchar*)contents + length, error);
+        g_free(contents);
+        if (!ret)
+            goto error;
 
-        if (log_version < 1) {
-            line_type = LINE_TYPE_EVENT;
-            msg_start = line;
-            section_dest = &parsed_log->main_section;
-        } else
-            line_type = log_get_line_type(line, &msg_start, error);
-
-        switch (line_type) {
-            case LINE_TYPE_DEVICE_TYPE:
-                switch (msg_start[0]) {
-                    case 'K':
-                        parsed_log->port = PS2_PORT_KBD;
-                        break;
-                    case 'A':
-                        parsed_log->port = PS2_PORT_AUX;
-                        break;
-                    default:
-                        g_set_error(error, PS2EMU_ERROR, PS2EMU_ERROR_INPUT,
-                                    "Invalid device type '%c'\n", msg_start[0]);
-                        goto error;
-                }
+        return parsed_log;
+    }
 
-                break;
-            case LINE_TYPE_EVENT:
-                event = ps2_event_from_line(msg_start, log_version, error);
-
-                if (!event) {
-                    if (!*error)
-                        continue;
-                    else
-                        goto error;
-                }
-
-                log_line = g_slice_alloc(sizeof(LogLine));
-                *log_line = (LogLine) {
-                    .type = line_type,
-                    .ps2_event = event,
-                };
-
-                *section_dest = g_list_prepend(*section_dest, log_line);
-                break;
-            case LINE_TYPE_SECTION:
-                section_type = log_get_section_type_from_line(msg_start, error);
-
-                switch (section_type) {
-                    case SECTION_TYPE_INIT:
-                        section_dest = &parsed_log->init_section;
-                        break;
-                    case SECTION_TYPE_MAIN:
-                        section_dest = &parsed_log->main_section;
-                        break;
-                    case SECTION_TYPE_ERROR:
-                        goto error;
-                }
-                break;
-            case LINE_TYPE_NOTE:
-                /* Remove the newline character from the end of the note */
-                g_strchomp(msg_start);
-
-                if (strlen(msg_start) == 0) {
-                    g_set_error_literal(error, PS2EMU_ERROR, PS2EMU_ERROR_INPUT,
-                                        "Note is empty");
-                    goto error;
-                }
-
-                log_line = g_slice_alloc(sizeof(LogLine));
-                *log_line = (LogLine) {
-                    .type = line_type,
-                    .note = g_strdup(msg_start),
-                };
-
-                *section_dest = g_list_prepend(*section_dest, log_line);
-                break;
-            case LINE_TYPE_INVALID:
-                goto error;
-        }
+    while ((rc = g_io_channel_read_line(input_channel, &line, &length, NULL,
+                                        error)) == G_IO_STATUS_NORMAL) {
+        gboolean ret = log_parse_line(&state, line, line + length, error);
+
+        g_free(line);
+        if (!ret)
+            goto error;
     }
     if (rc != G_IO_STATUS_EOF)
         goto error;
 
-    if (log_version >= 1) {
-        if (parsed_log->init_section)
-            parsed_log->init_section = g_list_reverse(parsed_log->init_section);
-    }
-
-    if (parsed_log->main_section)
-        parsed_log->main_section = g_list_reverse(parsed_log->main_section);
-
     return parsed_log;
 
 error:
-    if (parsed_log->init_section)
-        g_list_free_full(parsed_log->init_section, (GDestroyNotify)log_line_free);
-    if (parsed_log->main_section)
-        g_list_free_full(parsed_log->main_section, (GDestroyNotify)log_line_free);
-
-    g_free(parsed_log);
+    log_free(parsed_log);
     return NULL;
 }
 
+/* Equivalent to "# ps2emu-record V%d" */
+gint log_parse_version_line(const gchar *line,
+                            const gchar *end,
+                            GError **error) {
+    static const gchar magic[] = "ps2emu-record";
+    glong log_version;
+    gboolean overflow = FALSE;
+
+    if (line == end || *line++ != '#')
+        goto error;
+
+    line = scan_skip_space(line, end);
+    if (end - line < sizeof(magic) - 1 ||
+        memcmp(line, magic, sizeof(magic) - 1) != 0)
+        goto error;
+
+    line = scan_skip_space(line + sizeof(magic) - 1, end);
+    if (line == end || *line++ != 'V')
+        goto error;
+
+    line = scan_long(line, end, &log_version, &overflow);
+    if (!line || overflow || log_version < 0 || log_version > G_MAXINT)
+        goto error;
+
+    if (log_version > PS2EMU_LOG_VERSION_MAX) {
+        g_set_error(error, PS2EMU_ERROR, PS2EMU_ERROR_INPUT,
+                    "Log version is too new (found %ld, we only support up to "
+                    "%d)", log_version, PS2EMU_LOG_VERSION_MAX);
+        return -1;
+    }
+
+    return log_version;
+
+error:
+    g_set_error_literal(error, PS2EMU_ERROR, PS2EMU_ERROR_INPUT,
+                        "Invalid log file version");
+    return -1;
+}
+
 gint log_parse_version(GIOChannel *input_channel,
                        GError **error) {
     gchar *line = NULL;
-    int log_version,
-        parse_count;
+    gsize length;
+    int log_version;
     GIOStatus rc;
 
-    rc = g_io_channel_read_line(input_channel, &line, NULL, NULL, error);
+    /* Everything after the version line of a V2 log is binary, and whatever
+     * the channel reads ahead while looking for the end of this line would
+     * get mangled by the default UTF-8 encoding. The text formats are plain
+     * ASCII, so they don't need it either. */
+    if (g_io_channel_set_encoding(input_channel, NULL,
+                                  error) != G_IO_STATUS_NORMAL)
+        return -1;
+
+    rc = g_io_channel_read_line(input_channel, &line, &length, NULL, error);
     if (rc != G_IO_STATUS_NORMAL) {
         if (rc == G_IO_STATUS_EOF) {
             g_set_error_literal(error, PS2EMU_ERROR, PS2EMU_ERROR_NO_EVENTS,
                                 "Reached unexpected EOF");
         }
 
-        goto error;
+        g_free(line);
+        return -1;
     }
 
-    errno = 0;
-    parse_count = sscanf(line, "# ps2emu-record V%d\n", &log_version);
-    if (parse_count == 0 || errno != 0) {
-        g_set_error_literal(error, PS2EMU_ERROR, PS2EMU_ERROR_INPUT,
-                            "Invalid log file version");
-        goto error;
-    }
+    log_version = log_parse_version_line(line, line + length, error);
 
     g_free(line);
     return log_version;
+}
 
-error:
-    g_free(line);
-    return -1;
+/* Parses everything in [pos, end) that comes after the version line of a log,
+ * or up until the end of the window set on @state */
+gboolean log_parse_buffer(LogParseState *state,
+                          const gchar *pos,
+                          const gchar *end,
+                          GError **error) {
+    const gchar *line_end;
+
+    if (state->log_version >= PS2EMU_LOG_VERSION_BINARY)
+        return log_binary_parse(state, (const guchar*)pos,
+                                (const guchar*)end, error);
+
+    /* Lines are parsed in place, the buffer never gets copied */
+    for (; pos < end && !state->window_done; pos = line_end + 1) {
+        line_end = log_find_line_end(pos, end);
+
+        if (!log_parse_line(state, pos, line_end, error))
+            return FALSE;
+    }
+
+    return TRUE;
 }
 
-LogSectionType log_get_section_type_from_line(const gchar *line,
-                                              GError **error) {
-    int parsed_count;
-    gchar *section_string;
-    LogSectionType type;
+static ParsedLog * log_parse_compressed_file(const gchar *path,
+                                             gint *log_version,
+                                             GError **error) {
+    LogInput *input;
+    ParsedLog *parsed_log = NULL;
 
-    errno = 0;
-    parsed_count = sscanf(line, "%ms\n", &section_string);
-    if (errno || parsed_count != 1) {
-        g_set_error_literal(error, PS2EMU_ERROR, PS2EMU_ERROR_INPUT,
-                            "Invalid section line");
-        return -1;
+    input = log_input_open(path, error);
+    if (!input)
+        return NULL;
+
+    *log_version = log_input_parse_version(input, error);
+    if (*log_version >= 0)
+        parsed_log = log_input_parse(input, *log_version, error);
+
+    log_input_free(input);
+    return parsed_log;
+}
+
+ParsedLog *log_parse_file(const gchar *path,
+                          gint *log_version,
+                          GError **error) {
+    GMappedFile *mapped_file;
+    const gchar *pos,
+                *end,
+                *line_end;
+    LogParseState state;
+    ParsedLog *parsed_log = NULL;
+    gboolean ret;
+
+    mapped_file = g_mapped_file_new(path, FALSE, error);
+    if (!mapped_file)
+        return NULL;
+
+    pos = g_mapped_file_get_contents(mapped_file);
+    end = pos + g_mapped_file_get_length(mapped_file);
+
+    if (pos == end) {
+        g_set_error_literal(error, PS2EMU_ERROR, PS2EMU_ERROR_NO_EVENTS,
+                            "Reached unexpected EOF");
+        goto out;
     }
 
-    if (strcmp(section_string, "Init") == 0)
-        type = SECTION_TYPE_INIT;
-    else if (strcmp(section_string, "Main") == 0)
-        type = SECTION_TYPE_MAIN;
-    else {
-        g_set_error(error, PS2EMU_ERROR, PS2EMU_ERROR_INPUT,
-                    "Invalid section type `%s`", section_string);
+    /* Compressed logs can't be parsed in place, so decompress them on the
+     * fly instead */
+    if (log_input_detect_compression((const guchar*)pos,
+                                     end - pos) != LOG_COMPRESSION_NONE) {
+        g_mapped_file_unref(mapped_file);
+        return log_parse_compressed_file(path, log_version, error);
+    }
 
-        g_free(section_string);
-        return -1;
+    line_end = log_find_line_end(pos, end);
+    *log_version = log_parse_version_line(pos, line_end, error);
+    if (*log_version < 0)
+        goto out;
+
+    parsed_log = log_parse_begin(&state, *log_version);
+
+    if (*log_version < PS2EMU_LOG_VERSION_BINARY)
+        ret = log_parse_text_parallel(&state, MIN(line_end + 1, end), end,
+                                      g_get_num_processors(), error);
+    else
+        ret = log_parse_buffer(&state, MIN(line_end + 1, end), end, error);
+
+    if (!ret) {
+        log_free(parsed_log);
+        parsed_log = NULL;
     }
 
-    g_free(section_string);
-    return type;
+out:
+    g_mapped_file_unref(mapped_file);
+    return parsed_log;
+}
+
+static void write_text_notes(FILE *output,
+                             LogSection *section,
+                             guint *note_idx,
+                             guint position) {
+    for (; *note_idx < section->notes->len; (*note_idx)++) {
+        LogNote *note = &g_array_index(section->notes, LogNote, *note_idx);
+
+        if (note->position > position)
+            break;
+
+        fprintf(output, "N: %s\n", note->text);
+    }
+}
+
+/* Writes out all of the events in a section, with their timestamps shifted by
+ * @time_offset. Returns the time of the last event in the section. */
+static time_t write_text_section(FILE *output,
+                                 LogSection *section,
+                                 int log_version,
+                                 PS2Port port,
+                                 time_t time_offset) {
+    time_t time = time_offset;
+    guint note_idx = 0;
+
+    for (guint i = 0; i < section->events->len; i++) {
+        const LogEvent *event = &g_array_index(section->events, LogEvent, i);
+        gchar direction;
+
+        /* V0 logs don't have notes */
+        if (log_version >= 1)
+            write_text_notes(output, section, &note_idx, i);
+
+        time += event->delta;
+        if (event->type == LOG_EVENT_TYPE_DELAY)
+            continue;
+
+        if (event->type == LOG_EVENT_TYPE_INTERRUPT)
+            direction = 'R'; /* received */
+        else
+            direction = 'S'; /* sent */
+
+        if (log_version == 0) {
+            fprintf(output, "%-10ld %c %c %.2hhx\n",
+                    time, port == PS2_PORT_KBD ? 'K' : 'A', direction,
+                    event->data);
+        } else {
+            fprintf(output, "E: %-10ld %c %.2hhx\n",
+                    time, direction, event->data);
+        }
+    }
+
+    if (log_version >= 1)
+        write_text_notes(output, section, &note_idx, section->events->len);
+
+    return time;
+}
+
+gboolean log_write_text(FILE *output,
+                        ParsedLog *parsed_log,
+                        int log_version,
+                        GError **error) {
+    time_t init_end_time;
+
+    fprintf(output, "# ps2emu-record V%d\n", log_version);
+
+    if (log_version == 0) {
+        /* V0 logs don't have sections, so the main section just gets moved
+         * so that it starts after the init section. Leave the same half
+         * second gap between the two that ps2emu-replay would. */
+        init_end_time = write_text_section(output, &parsed_log->init_section,
+                                           0, parsed_log->port, 0);
+        if (parsed_log->init_section.events->len)
+            init_end_time += G_USEC_PER_SEC / 2;
+
+        write_text_section(output, &parsed_log->main_section, 0,
+                           parsed_log->port, init_end_time);
+    } else {
+        fprintf(output, "T: %c\n",
+                parsed_log->port == PS2_PORT_KBD ? 'K' : 'A');
+
+        fprintf(output, "S: Init\n");
+        write_text_section(output, &parsed_log->init_section, log_version,
+                           parsed_log->port, 0);
+
+        fprintf(output, "S: Main\n");
+        write_text_section(output, &parsed_log->main_section, log_version,
+                           parsed_log->port, 0);
+    }
+
+    if (fflush(output) != 0 || ferror(output)) {
+        g_set_error(error, G_FILE_ERROR, g_file_error_from_errno(errno),
+                    "While writing log: %s", strerror(errno));
+        return FALSE;
+    }
+
+    return TRUE;
 }
@@ -18,6 +18,7 @@
 
 #include <glib.h>
 
+#include "ps2emu-log-arena.h"
 #include "ps2emu-misc.h"
 
 #define PS2_KEYBOARD_PORT 0
@@ -51,17 +52,37 @@ typedef enum {
     LINE_TYPE_INVALID     = -1
 } LogLineType;
 
+typedef enum {
+    LOG_EVENT_TYPE_PARAMETER,
+    LOG_EVENT_TYPE_INTERRUPT,
+    /* Carries no data, only used to pad out gaps too long for a single
+     * delta */
+    LOG_EVENT_TYPE_DELAY
+} LogEventType;
+
+/* Parsed logs keep their events in one flat array, so each event needs to be
+ * as small as possible. Timestamps are stored as the difference in
+ * microseconds from the previous event in the same section. */
+typedef struct {
+    gint32 delta;
+    guint8 type;
+    guint8 data;
+} LogEvent;
+
+typedef struct {
+    guint  position; /* index of the event the note comes before */
+    gchar *text;     /* owned by the section's arena */
+} LogNote;
+
 typedef struct {
-    LogLineType type;
-    union {
-        PS2Event *ps2_event;
-        gchar    *note;
-    };
-} LogLine;
+    GArray  *events;
+    GArray  *notes;
+    LogArena arena;
+} LogSection;
 
 typedef struct {
-    GList   *init_section;
-    GList   *main_section;
+    LogSection init_section;
+    LogSection main_section;
 
     PS2Port  port;
 } ParsedLog;
@@ -72,13 +93,40 @@ typedef enum {
     SECTION_TYPE_ERROR = -1,
 } LogSectionType;
 
+/* State kept between lines while parsing a log */
+typedef struct {
+    ParsedLog  *parsed_log;
+    int         log_version;
+    LogSection *section;
+    time_t     *section_time;
+    time_t      init_time,
+                main_time;
+
+    /* Set with log_parse_set_window(), only main section events within the
+     * window get added to the log */
+    gboolean    windowed,
+                window_started,
+                window_done;
+    time_t      window_start,
+                window_end;
+} LogParseState;
+
 LogLineType log_get_line_type(gchar *line,
                               gchar **message_start,
                               GError **error);
 
+/* Switches @input_channel over to reading raw bytes, so that it can be handed
+ * to log_parse() afterwards no matter what version the log turns out to be */
 gint log_parse_version(GIOChannel *input_channel,
                        GError **error);
 
+gint log_parse_version_line(const gchar *line,
+                            const gchar *end,
+                            GError **error);
+
+const gchar * log_find_line_end(const gchar *str,
+                                const gchar *end);
+
 void ps2_event_free(PS2Event *event);
 
 gchar * ps2_event_to_string(PS2Event *event,
@@ -98,4 +146,52 @@ ParsedLog *log_parse(GIOChannel *input_channel,
                      GError **error)
 G_GNUC_MALLOC;
 
+ParsedLog *log_parse_file(const gchar *path,
+                          gint *log_version,
+                          GError **error)
+G_GNUC_MALLOC;
+
+void log_free(ParsedLog *parsed_log);
+
+gboolean log_write_text(FILE *output,
+                        ParsedLog *parsed_log,
+                        int log_version,
+                        GError **error);
+
+void log_section_init(LogSection *section);
+void log_section_clear(LogSection *section);
+void log_section_reset(LogSection *section);
+
+ParsedLog * log_parse_begin(LogParseState *state,
+                            int log_version)
+G_GNUC_MALLOC;
+
+void log_parse_set_section(LogParseState *state,
+                           LogSectionType type);
+
+gboolean log_parse_add_event(LogParseState *state,
+                             time_t time,
+                             LogEventType type,
+                             guchar data,
+                             GError **error);
+
+gboolean log_parse_add_note(LogParseState *state,
+                            const gchar *text,
+                            gsize length,
+                            GError **error);
+
+gboolean log_parse_line(LogParseState *state,
+                        const gchar *line,
+                        const gchar *end,
+                        GError **error);
+
+gboolean log_parse_buffer(LogParseState *state,
+                          const gchar *pos,
+                          const gchar *end,
+                          GError **error);
+
+void log_parse_set_window(LogParseState *state,
+                          time_t start,
+                          time_t end);
+
 #endif /* !__PS2EMU_LOG_H__ */
@@ -13,6 +13,7 @@
  * details.
  */
 
+#include <string.h>
 #include <glib.h>
 
 #include "ps2emu-misc.h"
@@ -25,3 +26,20 @@ gboolean print_version(const gchar *option_name,
     printf("ps2emu userspace tools v" VERSION "\n");
     exit(0);
 }
+
+gchar * json_escape(const gchar *str) {
+    GString *escaped = g_string_sized_new(strlen(str));
+
+    for (const gchar *pos = str; *pos; pos++) {
+        guchar c = *pos;
+
+        if (c == '"' || c == '\\')
+            g_string_append_printf(escaped, "\\%c", c);
+        else if (c < 0x20)
+            g_string_append_printf(escaped, "\\u%04x", c);
+        else
+            g_string_append_c(escaped, c);
+    }
+
+    return g_string_free(escaped, FALSE);
+}
@@ -22,6 +22,8 @@
 
 #define PS2EMU_ERROR (g_quark_from_static_string("ps2emu-error"))
 #define PS2EMU_LOG_VERSION 1
+#define PS2EMU_LOG_VERSION_BINARY 2
+#define PS2EMU_LOG_VERSION_MAX PS2EMU_LOG_VERSION_BINARY
 
 typedef enum {
     PS2EMU_ERROR_INPUT,
@@ -35,6 +37,11 @@ gboolean print_version(const gchar *option_name,
                        GError **error)
 G_GNUC_NORETURN;
 
+/* Escapes @str for use inside a JSON string. Anything that isn't a quote,
+ * backslash or control character gets copied as is, so UTF-8 stays UTF-8. */
+gchar * json_escape(const gchar *str)
+G_GNUC_MALLOC;
+
 static inline void exit_on_bad_argument(GOptionContext *option_context,
                                         gboolean print_help,
                                         const gchar *format,
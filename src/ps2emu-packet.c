@@ -0,0 +1,400 @@
+/*
+ * ps2emu-packet.c
+ * Copyright (C) 2015 Red Hat
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public License for more
+ * details.
+ */
+
+#include "ps2emu-packet.h"
+#include "ps2emu-log.h"
+
+#include <glib.h>
+
+/* The commands we need to know about to follow along */
+#define PS2_CMD_SET_RES        0xe8 /* aux, takes an argument */
+#define PS2_CMD_GET_INFO       0xe9 /* aux, 3 byte status */
+#define PS2_CMD_READ_DATA      0xeb /* aux, one packet */
+#define PS2_CMD_SET_LEDS       0xed /* kbd, takes an argument */
+#define PS2_CMD_ECHO           0xee /* kbd, answered with itself */
+#define PS2_CMD_SCANCODE_SET   0xf0 /* kbd, takes an argument */
+#define PS2_CMD_GET_ID         0xf2
+#define PS2_CMD_SET_RATE       0xf3 /* takes an argument */
+#define PS2_CMD_SET_DEFAULTS   0xf6
+#define PS2_CMD_RESET          0xff
+
+/* Synaptics touchpads get their mode set with four E8 arguments, two bits
+ * each, followed by setting the sample rate to this */
+#define SYNAPTICS_SET_MODE     0x14
+#define SYNAPTICS_MODE_ABS     0x80
+/* What the middle byte of the reply to an identify query always is */
+#define SYNAPTICS_MAGIC        0x47
+
+#define KBD_PREFIX_EXTENDED    0xe0
+#define KBD_PREFIX_PAUSE       0xe1
+#define KBD_PREFIX_BREAK       0xf0
+
+void packet_decoder_init(PacketDecoder *decoder,
+                         PS2Port port,
+                         guint packet_size) {
+    *decoder = (PacketDecoder) {
+        .port = port,
+        .fixed_size = packet_size,
+        .relative_size = 3,
+    };
+}
+
+guint packet_decoder_packet_size(const PacketDecoder *decoder) {
+    if (decoder->port == PS2_PORT_KBD)
+        return 1;
+
+    if (decoder->fixed_size)
+        return decoder->fixed_size;
+
+    return decoder->absolute ? 6 : decoder->relative_size;
+}
+
+static void emit(PacketDecoder *decoder,
+                 const Packet *packet) {
+    g_return_if_fail(decoder->ready_count < G_N_ELEMENTS(decoder->ready));
+
+    decoder->ready[decoder->ready_count++] = *packet;
+}
+
+static void emit_single(PacketDecoder *decoder,
+                        PacketKind kind,
+                        guint8 data,
+                        gboolean complete) {
+    Packet packet = {
+        .start = decoder->index,
+        .end = decoder->index + 1,
+        .time = decoder->time,
+        .kind = kind,
+        .length = 1,
+        .command = kind == PACKET_KIND_DATA ? 0 : decoder->command,
+        .complete = complete,
+        .bytes = { data },
+    };
+
+    emit(decoder, &packet);
+}
+
+static void start_packet(PacketDecoder *decoder,
+                         PacketKind kind,
+                         guint8 data) {
+    decoder->current = (Packet) {
+        .start = decoder->index,
+        .end = decoder->index + 1,
+        .time = decoder->time,
+        .kind = kind,
+        .length = 1,
+        .command = kind == PACKET_KIND_DATA ? 0 : decoder->command,
+        .bytes = { data },
+    };
+    decoder->in_progress = TRUE;
+}
+
+static void append_byte(PacketDecoder *decoder,
+                        guint8 data) {
+    Packet *packet = &decoder->current;
+
+    packet->bytes[packet->length++] = data;
+    packet->end = decoder->index + 1;
+}
+
+static void finish_packet(PacketDecoder *decoder,
+                          gboolean complete) {
+    if (!decoder->in_progress)
+        return;
+
+    decoder->current.complete = complete;
+    emit(decoder, &decoder->current);
+    decoder->in_progress = FALSE;
+    decoder->scancodes_left = 0;
+}
+
+static gboolean takes_argument(const PacketDecoder *decoder) {
+    if (decoder->port == PS2_PORT_AUX)
+        return decoder->command == PS2_CMD_SET_RES ||
+               decoder->command == PS2_CMD_SET_RATE;
+
+    return decoder->command == PS2_CMD_SET_LEDS ||
+           decoder->command == PS2_CMD_SCANCODE_SET ||
+           decoder->command == PS2_CMD_SET_RATE;
+}
+
+/* Called once the command and its argument, if any, have been acked */
+static void command_accepted(PacketDecoder *decoder) {
+    guint8 command = decoder->command;
+
+    if (decoder->port == PS2_PORT_KBD) {
+        if (command == PS2_CMD_GET_ID)
+            decoder->responses_left = 2;
+        else if (command == PS2_CMD_RESET)
+            decoder->responses_left = 1;
+        else if (command == PS2_CMD_SCANCODE_SET && decoder->argument == 0)
+            decoder->responses_left = 1;
+
+        return;
+    }
+
+    switch (command) {
+    case PS2_CMD_SET_RES:
+        decoder->knock = (decoder->knock << 2) | (decoder->argument & 3);
+        decoder->knocks = MIN(decoder->knocks + 1, 4);
+        return;
+    case PS2_CMD_SET_RATE:
+        if (decoder->synaptics && decoder->knocks == 4 &&
+            decoder->argument == SYNAPTICS_SET_MODE)
+            decoder->absolute = !!(decoder->knock & SYNAPTICS_MODE_ABS);
+        break;
+    case PS2_CMD_GET_ID:
+        decoder->responses_left = 1;
+        break;
+    case PS2_CMD_GET_INFO:
+        decoder->responses_left = 3;
+        break;
+    case PS2_CMD_READ_DATA:
+        decoder->responses_left = packet_decoder_packet_size(decoder);
+        break;
+    case PS2_CMD_SET_DEFAULTS:
+        decoder->absolute = FALSE;
+        break;
+    case PS2_CMD_RESET:
+        /* The self test result, then the device ID */
+        decoder->responses_left = 2;
+        break;
+    }
+
+    decoder->knocks = 0;
+}
+
+/* Called once the device has sent everything it answers the command with */
+static void response_done(PacketDecoder *decoder) {
+    const Packet *response = &decoder->current;
+
+    if (decoder->port != PS2_PORT_AUX)
+        return;
+
+    switch (decoder->command) {
+    case PS2_CMD_GET_ID:
+        /* 3 is an IntelliMouse, 4 an IntelliMouse Explorer */
+        decoder->relative_size =
+            (response->bytes[0] == 3 || response->bytes[0] == 4) ? 4 : 3;
+        break;
+    case PS2_CMD_GET_INFO:
+        if (response->bytes[1] == SYNAPTICS_MAGIC)
+            decoder->synaptics = TRUE;
+        break;
+    case PS2_CMD_RESET:
+        decoder->relative_size = 3;
+        decoder->absolute = FALSE;
+        break;
+    }
+}
+
+static void host_byte(PacketDecoder *decoder,
+                      guint8 data) {
+    /* Sending anything to the device interrupts whatever it was sending */
+    finish_packet(decoder, FALSE);
+
+    decoder->awaiting_ack = TRUE;
+    decoder->responses_left = 0;
+
+    if (decoder->argument_next) {
+        decoder->argument_next = FALSE;
+        decoder->argument = data;
+        decoder->has_argument = TRUE;
+        emit_single(decoder, PACKET_KIND_ARGUMENT, data, TRUE);
+        return;
+    }
+
+    decoder->command = data;
+    decoder->has_argument = FALSE;
+    emit_single(decoder, PACKET_KIND_COMMAND, data, TRUE);
+}
+
+/* Reports start with a byte that has bit 3 set, except for Synaptics absolute
+ * packets which have it cleared and the top two bits set to 10. Being given a
+ * packet size of 6 means an ALPS or Elantech touchpad or the like, which all
+ * have layouts of their own, so those don't get checked. 3 and 4 byte packets
+ * are the standard mouse ones, which still do. */
+static gboolean valid_first_byte(const PacketDecoder *decoder,
+                                 guint8 data) {
+    if (decoder->fixed_size == 6)
+        return TRUE;
+
+    if (decoder->absolute && !decoder->fixed_size)
+        return (data & 0xc8) == 0x80;
+
+    return data & 0x08;
+}
+
+static void aux_data_byte(PacketDecoder *decoder,
+                          guint8 data) {
+    if (decoder->in_progress) {
+        append_byte(decoder, data);
+        decoder->continued = TRUE;
+    } else if (valid_first_byte(decoder, data)) {
+        start_packet(decoder, PACKET_KIND_DATA, data);
+    } else {
+        emit_single(decoder, PACKET_KIND_DATA, data, FALSE);
+        return;
+    }
+
+    if (decoder->current.length >= packet_decoder_packet_size(decoder))
+        finish_packet(decoder, TRUE);
+}
+
+/* Scancodes are a single byte, optionally preceded by E0 for extended keys
+ * and F0 for releases in set 2. Pause starts with E1 and carries on for two
+ * more bytes that aren't prefixes. */
+static void kbd_data_byte(PacketDecoder *decoder,
+                          guint8 data) {
+    if (decoder->in_progress) {
+        append_byte(decoder, data);
+        decoder->continued = TRUE;
+    } else {
+        start_packet(decoder, PACKET_KIND_DATA, data);
+    }
+
+    if (data == KBD_PREFIX_EXTENDED || data == KBD_PREFIX_BREAK)
+        goto check_length;
+
+    if (data == KBD_PREFIX_PAUSE && decoder->current.length == 1) {
+        decoder->scancodes_left = 2;
+        return;
+    }
+
+    if (decoder->scancodes_left)
+        decoder->scancodes_left--;
+
+    if (!decoder->scancodes_left) {
+        finish_packet(decoder, TRUE);
+        return;
+    }
+
+check_length:
+    if (decoder->current.length == PACKET_MAX_BYTES)
+        finish_packet(decoder, FALSE);
+}
+
+static void device_byte(PacketDecoder *decoder,
+                        guint8 data) {
+    if (decoder->awaiting_ack) {
+        PacketKind kind;
+
+        switch (data) {
+        case PS2_ACK:
+            kind = PACKET_KIND_ACK;
+            break;
+        case PS2_RESEND:
+            kind = PACKET_KIND_RESEND;
+            break;
+        case PS2_ERROR:
+            kind = PACKET_KIND_ERROR;
+            break;
+        case PS2_CMD_ECHO:
+            if (decoder->port == PS2_PORT_KBD &&
+                decoder->command == PS2_CMD_ECHO && !decoder->has_argument) {
+                kind = PACKET_KIND_RESPONSE;
+                break;
+            }
+            /* fall through */
+        default:
+            /* Most likely a report that was already on its way when the
+             * driver sent the command */
+            goto data;
+        }
+
+        finish_packet(decoder, FALSE);
+        decoder->awaiting_ack = FALSE;
+        emit_single(decoder, kind, data, TRUE);
+
+        if (kind != PACKET_KIND_ACK)
+            decoder->argument_next = FALSE;
+        else if (!decoder->has_argument && takes_argument(decoder))
+            decoder->argument_next = TRUE;
+        else
+            command_accepted(decoder);
+
+        return;
+    }
+
+    if (decoder->responses_left) {
+        if (decoder->in_progress &&
+            decoder->current.kind != PACKET_KIND_RESPONSE)
+            finish_packet(decoder, FALSE);
+
+        if (decoder->in_progress)
+            append_byte(decoder, data);
+        else
+            start_packet(decoder, PACKET_KIND_RESPONSE, data);
+
+        if (--decoder->responses_left == 0) {
+            response_done(decoder);
+            finish_packet(decoder, TRUE);
+        }
+
+        return;
+    }
+
+data:
+    if (decoder->in_progress &&
+        (decoder->current.kind != PACKET_KIND_DATA ||
+         decoder->time - decoder->last_byte_time >= PACKET_RESYNC_GAP))
+        finish_packet(decoder, FALSE);
+
+    if (decoder->port == PS2_PORT_AUX)
+        aux_data_byte(decoder, data);
+    else
+        kbd_data_byte(decoder, data);
+}
+
+void packet_decoder_start_section(PacketDecoder *decoder) {
+    decoder->ready_count = decoder->ready_pos = 0;
+    decoder->in_progress = FALSE;
+    decoder->scancodes_left = 0;
+
+    decoder->time = decoder->last_byte_time = 0;
+    decoder->index = 0;
+}
+
+void packet_decoder_feed(PacketDecoder *decoder,
+                         const LogEvent *event) {
+    decoder->ready_count = decoder->ready_pos = 0;
+    decoder->continued = FALSE;
+    decoder->time += event->delta;
+
+    if (event->type == LOG_EVENT_TYPE_PARAMETER) {
+        host_byte(decoder, event->data);
+        decoder->last_byte_time = decoder->time;
+    } else if (event->type == LOG_EVENT_TYPE_INTERRUPT) {
+        device_byte(decoder, event->data);
+        decoder->last_byte_time = decoder->time;
+    }
+
+    decoder->index++;
+}
+
+void packet_decoder_flush(PacketDecoder *decoder) {
+    decoder->ready_count = decoder->ready_pos = 0;
+    finish_packet(decoder, FALSE);
+}
+
+gboolean packet_decoder_next(PacketDecoder *decoder,
+                             Packet *packet) {
+    if (decoder->ready_pos == decoder->ready_count)
+        return FALSE;
+
+    *packet = decoder->ready[decoder->ready_pos++];
+
+    return TRUE;
+}
@@ -0,0 +1,136 @@
+/*
+ * ps2emu-packet.h
+ * Copyright (C) 2015 Red Hat
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public License for more
+ * details.
+ */
+
+#ifndef __PS2EMU_PACKET_H__
+#define __PS2EMU_PACKET_H__
+
+#include <glib.h>
+
+#include "ps2emu-log.h"
+
+/* Long enough for a 6 byte absolute packet, or the longest scancode sequence
+ * a keyboard sends in one go */
+#define PACKET_MAX_BYTES 8
+
+/* A gap this long in the middle of a packet means we're out of sync with the
+ * device, the bytes of a packet always come in back to back. In
+ * microseconds. */
+#define PACKET_RESYNC_GAP (4 * 1000)
+
+#define PS2_ACK    0xfa
+#define PS2_RESEND 0xfe
+#define PS2_ERROR  0xfc
+
+typedef enum {
+    PACKET_KIND_DATA,     /* a report from the device: motion, buttons, keys */
+    PACKET_KIND_COMMAND,  /* a command from the driver */
+    PACKET_KIND_ARGUMENT, /* the byte a command takes from the driver */
+    PACKET_KIND_ACK,      /* the device accepting a command or argument */
+    PACKET_KIND_RESEND,   /* the device asking for one again */
+    PACKET_KIND_ERROR,    /* the device giving up on one */
+    PACKET_KIND_RESPONSE  /* what the device answers a command with */
+} PacketKind;
+
+/* A run of bytes from a section that belong together. Everything but data
+ * and responses is always a single byte. */
+typedef struct {
+    guint  start,   /* index of the packet's first event in the section */
+           end;     /* and one past its last, delays in between included */
+    time_t time;    /* of the first byte, relative to the start of the
+                       section */
+    guint8 kind,
+           length,
+           command, /* the command this is part of the exchange for, if it's
+                       anything other than data */
+           complete; /* FALSE if the packet got cut short */
+    guint8 bytes[PACKET_MAX_BYTES];
+} Packet;
+
+/* Groups the events of a section into packets as they're fed in, one event at
+ * a time. The size of the device's packets is worked out from the commands
+ * the driver sends it: 3 bytes to begin with, 4 once the device identifies as
+ * an IntelliMouse, and 6 once a Synaptics touchpad is put into absolute mode.
+ * Devices that can't be told apart like that, such as ALPS and Elantech
+ * touchpads, need the packet size to be given. Decoders are plain structs
+ * that never allocate, so they can be kept on the stack and run alongside
+ * whatever's reading or replaying the events. */
+typedef struct {
+    PS2Port port;
+    guint8  fixed_size,    /* 0 to work it out */
+            relative_size, /* 3 or 4 */
+            absolute,      /* in 6 byte absolute mode */
+            synaptics;     /* identified itself as a Synaptics touchpad */
+
+    /* The exchange in progress */
+    guint8  command,
+            awaiting_ack,
+            argument_next,  /* the next byte from the driver is an argument */
+            argument,
+            has_argument,
+            responses_left;
+    /* Arguments to E8 (set resolution) since the last other command, which
+     * is how Synaptics touchpads get sent a byte at a time */
+    guint8  knock,
+            knocks;
+    /* How many more non-prefix bytes a keyboard sequence needs */
+    guint8  scancodes_left;
+
+    time_t   time,
+             last_byte_time;
+    guint    index;     /* of the next event */
+    gboolean continued, /* see packet_decoder_continues() */
+             in_progress;
+    Packet   current;   /* the data or response packet being put together */
+
+    /* Packets that are done, waiting for packet_decoder_next() */
+    Packet   ready[2];
+    guint8   ready_count,
+             ready_pos;
+} PacketDecoder;
+
+/* @packet_size is 3, 4 or 6, or 0 to work it out from the init sequence */
+void packet_decoder_init(PacketDecoder *decoder,
+                         PS2Port port,
+                         guint packet_size);
+
+/* Decoders keep track of what the device's been told across sections, so
+ * the same one should be used for the init section and then the main
+ * section. This starts over at the beginning of the next one, anything left
+ * over from the last one should've been flushed first. */
+void packet_decoder_start_section(PacketDecoder *decoder);
+
+/* Feeds the section's next event to the decoder. Any packets it finishes
+ * can be picked up with packet_decoder_next() before feeding the next
+ * event. */
+void packet_decoder_feed(PacketDecoder *decoder,
+                         const LogEvent *event);
+
+/* Finishes whatever packet is still in progress at the end of the section */
+void packet_decoder_flush(PacketDecoder *decoder);
+
+gboolean packet_decoder_next(PacketDecoder *decoder,
+                             Packet *packet);
+
+/* Whether the event that was just fed carried on a data packet that was
+ * already in progress, rather than starting a new one */
+static inline gboolean packet_decoder_continues(const PacketDecoder *decoder) {
+    return decoder->continued;
+}
+
+/* The size of the data packets the device is sending right now. Scancodes
+ * don't have a fixed size, so for keyboards it's always 1. */
+guint packet_decoder_packet_size(const PacketDecoder *decoder);
+
+#endif /* !__PS2EMU_PACKET_H__ */
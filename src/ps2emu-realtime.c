@@ -0,0 +1,150 @@
+/*
+ * ps2emu-realtime.c
+ * Copyright (C) 2015 Red Hat
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public License for more
+ * details.
+ */
+
+/* For the CPU_* affinity macros */
+#define _GNU_SOURCE
+
+#include "ps2emu-realtime.h"
+#include "ps2emu-log.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sched.h>
+#include <glib.h>
+#include <sys/mman.h>
+
+static void prefault_memory(gconstpointer data,
+                            gsize size,
+                            gsize page_size) {
+    const volatile guchar *pos = data;
+
+    if (!size)
+        return;
+
+    for (gsize i = 0; i < size; i += page_size)
+        (void)pos[i];
+
+    (void)pos[size - 1];
+}
+
+static void prefault_section(LogSection *section,
+                             gsize page_size) {
+    GArray *events = section->events,
+           *notes = section->notes;
+
+    prefault_memory(events->data, events->len * sizeof(LogEvent), page_size);
+    prefault_memory(notes->data, notes->len * sizeof(LogNote), page_size);
+
+    for (guint i = 0; i < notes->len; i++) {
+        LogNote *note = &g_array_index(notes, LogNote, i);
+
+        prefault_memory(note->text, strlen(note->text) + 1, page_size);
+    }
+}
+
+void realtime_prefault_log(ParsedLog *log) {
+    gsize page_size = sysconf(_SC_PAGESIZE);
+
+    prefault_section(&log->init_section, page_size);
+    prefault_section(&log->main_section, page_size);
+}
+
+/* Kept out of line so the stack it grows into is actually below our caller's,
+ * which is where the replay loop will be running */
+static __attribute__((noinline)) void prefault_stack(void) {
+    volatile guchar stack[REALTIME_STACK_PREFAULT];
+
+    for (gsize i = 0; i < sizeof(stack); i += 1024)
+        stack[i] = 0;
+}
+
+static gboolean pin_to_cpu(gint cpu) {
+    cpu_set_t cpus;
+
+    CPU_ZERO(&cpus);
+    CPU_SET(cpu, &cpus);
+
+    if (sched_setaffinity(0, sizeof(cpus), &cpus) == -1) {
+        fprintf(stderr, "Warning: Couldn't pin the replay to CPU %d: %s\n",
+                cpu, g_strerror(errno));
+        return FALSE;
+    }
+
+    printf("Pinned to CPU %d\n", cpu);
+    return TRUE;
+}
+
+static gboolean lock_memory(void) {
+    if (mlockall(MCL_CURRENT | MCL_FUTURE) == -1) {
+        fprintf(stderr,
+                "Warning: Couldn't lock the replay into memory: %s%s\n",
+                g_strerror(errno),
+                errno == ENOMEM || errno == EPERM ?
+                    " (is RLIMIT_MEMLOCK too low?)" : "");
+        return FALSE;
+    }
+
+    printf("Locked into memory\n");
+    return TRUE;
+}
+
+static gboolean set_priority(gint priority) {
+    struct sched_param param = { .sched_priority = priority };
+    gint min = sched_get_priority_min(SCHED_FIFO),
+         max = sched_get_priority_max(SCHED_FIFO);
+
+    if (priority < min || priority > max) {
+        fprintf(stderr,
+                "Warning: SCHED_FIFO priority %d is out of range (%d-%d)\n",
+                priority, min, max);
+        return FALSE;
+    }
+
+    if (sched_setscheduler(0, SCHED_FIFO, &param) == -1) {
+        fprintf(stderr,
+                "Warning: Couldn't switch to SCHED_FIFO priority %d: %s%s\n",
+                priority, g_strerror(errno),
+                errno == EPERM ? " (is RLIMIT_RTPRIO too low?)" : "");
+        return FALSE;
+    }
+
+    printf("Running with SCHED_FIFO priority %d\n", priority);
+    return TRUE;
+}
+
+gboolean realtime_apply(const RealtimeOptions *options) {
+    gboolean ret = TRUE;
+
+    /* Pin first, so anything faulted in below is local to the CPU we'll be
+     * running on */
+    if (options->cpu >= 0)
+        ret &= pin_to_cpu(options->cpu);
+
+    ret &= lock_memory();
+
+    /* Even if we couldn't lock it, faulting in the stack now still saves us
+     * from doing it in the middle of replaying */
+    prefault_stack();
+
+    ret &= set_priority(options->priority);
+
+    if (!ret)
+        fprintf(stderr, "Warning: Replaying with only some of the realtime "
+                "settings applied, timing may not be as accurate\n");
+
+    return ret;
+}
@@ -0,0 +1,44 @@
+/*
+ * ps2emu-realtime.h
+ * Copyright (C) 2015 Red Hat
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public License for more
+ * details.
+ */
+
+#ifndef __PS2EMU_REALTIME_H__
+#define __PS2EMU_REALTIME_H__
+
+#include <glib.h>
+
+#include "ps2emu-log.h"
+
+#define REALTIME_DEFAULT_PRIORITY 50
+
+/* How much of the stack gets faulted in up front, which needs to cover
+ * everything the replay loop calls into */
+#define REALTIME_STACK_PREFAULT (256 * 1024)
+
+typedef struct {
+    gint cpu;      /* CPU to pin to, or -1 to leave the affinity alone */
+    gint priority; /* SCHED_FIFO priority */
+} RealtimeOptions;
+
+/* Touches every page of @log so that none of it gets faulted in while
+ * replaying */
+void realtime_prefault_log(ParsedLog *log);
+
+/* Makes the calling thread as hard to preempt as we're allowed to. None of
+ * this is fatal: anything that can't be applied gets a warning, and the
+ * replay goes ahead without it. Returns FALSE if anything couldn't be
+ * applied. */
+gboolean realtime_apply(const RealtimeOptions *options);
+
+#endif /* !__PS2EMU_REALTIME_H__ */
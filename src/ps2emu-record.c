@@ -24,19 +24,9 @@
 #include <linux/limits.h>
 
 #include "ps2emu-log.h"
+#include "ps2emu-kmsg.h"
 #include "ps2emu-misc.h"
 
-typedef struct {
-    GQuark type;
-
-    time_t dmesg_time;
-
-    union {
-        PS2Event event;
-        gint64 start_time;
-    };
-} LogMsgParseResult;
-
 static PS2Port recording_target = PS2_PORT_AUX;
 
 static gint64 start_time = 0;
@@ -44,176 +34,10 @@ static time_t dmesg_start_time = 0;
 
 static GHashTable *ports;
 
-#define I8042_OUTPUT  (g_quark_from_static_string("i8042: "))
-#define PS2EMU_OUTPUT (g_quark_from_static_string("ps2emu: "))
-
 #define I8042_DEV_DIR "/sys/devices/platform/i8042/"
 
 #define PS2EMU_INIT_TIMEOUT_SECS 5
 
-static GIOStatus get_next_module_line(GIOChannel *input_channel,
-                                      GQuark *match,
-                                      gchar **output,
-                                      gchar **start_pos,
-                                      GError **error) {
-    static const gchar *search_strings[] = { "i8042: ", "ps2emu: " };
-    int index;
-    gchar *current_line;
-    GIOStatus rc;
-
-    while ((rc = g_io_channel_read_line(input_channel, &current_line, NULL,
-                                        NULL, error)) == G_IO_STATUS_NORMAL) {
-        for (index = 0; index < G_N_ELEMENTS(search_strings); index++) {
-            *start_pos = strstr(current_line, search_strings[index]);
-            if (*start_pos)
-                break;
-        }
-        if (*start_pos)
-            break;
-
-        g_free(current_line);
-    }
-
-    if (rc != G_IO_STATUS_NORMAL) {
-        return rc;
-    }
-
-    /* Move the start position after the initial 'i8042: ' */
-    *start_pos += strlen(search_strings[index]);
-    *output = current_line;
-
-    *match = g_quark_from_static_string(search_strings[index]);
-
-    return rc;
-}
-
-static gboolean parse_normal_event(const gchar *start_pos,
-                                   PS2Event *event,
-                                   GError **error) {
-    gchar *type_str = NULL;
-    gchar **type_str_args = NULL;
-    int type_str_argc,
-        parsed_count,
-        port;
-
-    errno = 0;
-    parsed_count = sscanf(start_pos,
-                          "[%*d] %hhx %*1[-<]%*1[->] i8042 (%m[^)])\n",
-                          &event->data, &type_str);
-
-    if (errno != 0 || parsed_count != 2)
-        return FALSE;
-
-    type_str_args = g_strsplit(type_str, ",", 0);
-
-    if (strcmp(type_str_args[0], "interrupt") == 0) {
-        event->type = PS2_EVENT_TYPE_INTERRUPT;
-
-        type_str_argc = g_strv_length(type_str_args);
-        if (type_str_argc < 3) {
-            g_set_error(error, PS2EMU_ERROR, PS2EMU_ERROR_INPUT,
-                        "Got interrupt event, but had less arguments then "
-                        "expected");
-            goto error;
-        }
-
-        errno = 0;
-        port = strtol(type_str_args[1], NULL, 10);
-        if (errno != 0) {
-            g_set_error(error, PS2EMU_ERROR, PS2EMU_ERROR_INPUT,
-                        "Failed to parse port number from interrupt event: "
-                        "%s\n",
-                        strerror(errno));
-            goto error;
-        }
-
-        event->origin = port;
-    }
-    else if (strcmp(type_str, "command") == 0)
-        event->type = PS2_EVENT_TYPE_COMMAND;
-    else if (strcmp(type_str, "parameter") == 0)
-        event->type = PS2_EVENT_TYPE_PARAMETER;
-    else if (strcmp(type_str, "return") == 0)
-        event->type = PS2_EVENT_TYPE_RETURN;
-    else if (strcmp(type_str, "kbd-data") == 0)
-        event->type = PS2_EVENT_TYPE_KBD_DATA;
-
-    event->original_line = start_pos;
-
-    g_free(type_str);
-    g_strfreev(type_str_args);
-
-    return TRUE;
-
-error:
-    g_free(type_str);
-    g_strfreev(type_str_args);
-
-    return FALSE;
-}
-
-static gboolean parse_record_start_marker(const gchar *start_pos,
-                                          gint64 *start_time) {
-    gint parsed_count;
-
-    errno = 0;
-    parsed_count = sscanf(start_pos,
-                          "Start recording %ld\n",
-                          start_time);
-
-    if (errno != 0 || parsed_count != 1)
-        return FALSE;
-
-    return TRUE;
-}
-
-static GIOStatus parse_next_message(GIOChannel *input_channel,
-                                    LogMsgParseResult *res,
-                                    GError **error) {
-    gchar *start_pos;
-    gchar *current_line = NULL;
-    gint parsed_count;
-    GIOStatus rc;
-
-    while ((rc = get_next_module_line(input_channel, &res->type, &current_line,
-                                      &start_pos, error)) ==
-            G_IO_STATUS_NORMAL) {
-        if (res->type == I8042_OUTPUT) {
-            if (parse_normal_event(start_pos, &res->event, error))
-                break;
-
-            if (*error)
-                goto fail;
-        }
-        else if (res->type == PS2EMU_OUTPUT) {
-            if (parse_record_start_marker(start_pos, &res->start_time))
-                break;
-        }
-
-        g_free(current_line);
-    }
-
-    if (rc != G_IO_STATUS_NORMAL)
-        return rc;
-
-    /* Parse the time value at the beginning of the message */
-    errno = 0;
-    parsed_count = sscanf(current_line, "%*d,%*d,%ld", &res->dmesg_time);
-    if (parsed_count != 1 || errno != 0) {
-        g_set_error(error, PS2EMU_ERROR, PS2EMU_ERROR_INPUT,
-                    "Invalid/no time value received: %s", strerror(errno));
-
-        rc = G_IO_STATUS_ERROR;
-    }
-
-    res->type = res->type;
-
-fail:
-    g_free(current_line);
-
-    return rc;
-}
-
 static GIOStatus process_event(PS2Event *event,
                                time_t time,
                                GError **error) {
@@ -525,7 +349,9 @@ gboolean init_timeout_checker(void *data) {
 }
 
 typedef struct {
+    KmsgReader *reader;
     LogMsgParseResult *res;
+    guint64 lost_reported;
     gboolean *ret;
     GError **error;
 } DmesgEventHandlerArgs;
@@ -538,7 +364,8 @@ static gboolean dmesg_event_handler(GIOChannel *source,
 
     switch (condition) {
         case G_IO_IN:
-            while ((rc = parse_next_message(source, args->res, args->error)) ==
+            while ((rc = parse_next_message(args->reader, args->res,
+                                            args->error)) ==
                    G_IO_STATUS_NORMAL) {
                 if (args->res->type != I8042_OUTPUT)
                     continue;
@@ -551,6 +378,15 @@ static gboolean dmesg_event_handler(GIOChannel *source,
             if (rc != G_IO_STATUS_AGAIN)
                 goto error;
 
+            if (args->reader->lost != args->lost_reported) {
+                fprintf(stderr,
+                        "# Warning: the kernel dropped %" G_GUINT64_FORMAT " "
+                        "messages before they could be recorded, the "
+                        "recording may be missing events\n",
+                        args->reader->lost - args->lost_reported);
+                args->lost_reported = args->reader->lost;
+            }
+
             break;
         default:
             break;
@@ -762,6 +598,7 @@ static gboolean write_info(GError **error) {
 }
 
 static gboolean record(GError **error) {
+    KmsgReader *reader;
     GIOChannel *input_channel;
     LogMsgParseResult res;
     InitTimeoutCheckerArgs timeout_checker_args;
@@ -773,11 +610,11 @@ static gboolean record(GError **error) {
            "S: Init\n",
            (recording_target == PS2_PORT_KBD) ? 'K' : 'A');
 
-    input_channel = g_io_channel_new_file("/dev/kmsg", "r", error);
-    if (!input_channel)
+    reader = kmsg_reader_open("/dev/kmsg", error);
+    if (!reader)
         return FALSE;
 
-    while ((rc = parse_next_message(input_channel, &res, error)) ==
+    while ((rc = parse_next_message(reader, &res, error)) ==
            G_IO_STATUS_NORMAL) {
         if (res.type == I8042_OUTPUT)
             continue;
@@ -790,12 +627,17 @@ static gboolean record(GError **error) {
         return FALSE;
     }
 
-    rc = g_io_channel_set_flags(input_channel, G_IO_FLAG_NONBLOCK, error);
-    if (rc != G_IO_STATUS_NORMAL)
+    if (!kmsg_reader_set_nonblocking(reader, error))
         return FALSE;
 
+    /* The channel is only used to watch the reader's fd, all of the reading
+     * is done by the reader itself */
+    input_channel = g_io_channel_unix_new(reader->fd);
+
     dmesg_event_handler_args = (DmesgEventHandlerArgs) {
+        .reader = reader,
         .res = &res,
+        .lost_reported = reader->lost,
         .error = error,
         .ret = &ret,
     };
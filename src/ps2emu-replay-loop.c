@@ -0,0 +1,747 @@
+/*
+ * ps2emu-replay-loop.c
+ * Copyright (C) 2015 Red Hat
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public License for more
+ * details.
+ */
+
+#include "ps2emu-replay-loop.h"
+#include "ps2emu-replayer.h"
+#include "ps2emu-replay-stats.h"
+#include "ps2emu-scheduler.h"
+#include "ps2emu-log.h"
+#include "ps2emu-misc.h"
+
+#include <stdio.h>
+#include <unistd.h>
+#include <string.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <glib.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <linux/serio.h>
+#include <userio.h>
+
+#define REPLAY_LOOP_MAX_EVENTS 64
+
+typedef enum {
+    DEVICE_RUNNING,
+    DEVICE_WAIT_TIMER,
+    DEVICE_WAIT_RECEIVE,
+    DEVICE_WAIT_WRITABLE,
+    DEVICE_DONE,
+    DEVICE_FAILED,
+} ReplayDeviceState;
+
+typedef struct _ReplayDevice ReplayDevice;
+
+struct _ReplayDevice {
+    gchar              *name;
+    gint                fd;
+    ParsedLog          *log;
+    gboolean            no_events;
+    time_t              event_delay;
+
+    LogSection         *section;
+    ReplayOptions       init_options,
+                        main_options;
+    const ReplayOptions *options;
+    ReplayClock         clock;
+    guint               event_idx,
+                        note_idx;
+    gboolean            event_ready, /* the clock's already been advanced to
+                                        the event at event_idx */
+                        receiving;   /* and we've started waiting on the
+                                        data it expects */
+    gint64              receive_started;
+
+    ReplayDeviceState   state;
+    time_t              deadline;
+    time_t              wheel_tick;
+    gboolean            on_wheel;
+    ReplayDevice       *wheel_next;
+
+    guint64             sent,
+                        received;
+    gint64              started,
+                        finished;
+    gchar              *error;
+    ReplayStats         stats;
+};
+
+typedef struct {
+    ReplayDevice *slots[REPLAY_WHEEL_SLOTS];
+    time_t        tick; /* everything before this tick has expired */
+    guint         count;
+} ReplayWheel;
+
+struct _ReplayLoop {
+    gint         epoll_fd,
+                 timer_fd;
+    time_t       timer_deadline;
+    ReplayWheel  wheel;
+    GPtrArray   *devices;
+    guint        active;
+};
+
+static void wheel_init(ReplayWheel *wheel) {
+    *wheel = (ReplayWheel) {
+        .tick = g_get_monotonic_time() / REPLAY_WHEEL_TICK,
+    };
+}
+
+static void wheel_insert(ReplayWheel *wheel,
+                         ReplayDevice *device) {
+    time_t tick = MAX(device->deadline / REPLAY_WHEEL_TICK, wheel->tick);
+    ReplayDevice **slot = &wheel->slots[tick % REPLAY_WHEEL_SLOTS];
+
+    device->wheel_next = *slot;
+    device->wheel_tick = tick;
+    device->on_wheel = TRUE;
+    *slot = device;
+    wheel->count++;
+}
+
+static void wheel_remove(ReplayWheel *wheel,
+                         ReplayDevice *device) {
+    ReplayDevice **link =
+        &wheel->slots[device->wheel_tick % REPLAY_WHEEL_SLOTS];
+
+    for (; *link; link = &(*link)->wheel_next) {
+        if (*link == device) {
+            *link = device->wheel_next;
+            device->on_wheel = FALSE;
+            wheel->count--;
+            return;
+        }
+    }
+}
+
+/* Finds the earliest deadline on the wheel. Usually that's in the first
+ * non-empty slot of the current lap, otherwise all of the timers are more
+ * than a lap away and we just have to look at every one of them. */
+static time_t wheel_next_deadline(ReplayWheel *wheel) {
+    time_t earliest = G_MAXINT64;
+
+    if (!wheel->count)
+        return 0;
+
+    for (guint i = 0; i < REPLAY_WHEEL_SLOTS; i++) {
+        time_t tick = wheel->tick + i;
+        ReplayDevice *device = wheel->slots[tick % REPLAY_WHEEL_SLOTS];
+
+        for (; device; device = device->wheel_next) {
+            if (device->deadline / REPLAY_WHEEL_TICK <= tick)
+                earliest = MIN(earliest, device->deadline);
+        }
+
+        if (earliest != G_MAXINT64)
+            return earliest;
+    }
+
+    for (guint i = 0; i < REPLAY_WHEEL_SLOTS; i++) {
+        ReplayDevice *device = wheel->slots[i];
+
+        for (; device; device = device->wheel_next)
+            earliest = MIN(earliest, device->deadline);
+    }
+
+    return earliest;
+}
+
+/* Takes everything that's due by @now off of the wheel, and returns them as a
+ * list strung together through wheel_next */
+static ReplayDevice * wheel_expire(ReplayWheel *wheel,
+                                   time_t now) {
+    time_t now_tick = now / REPLAY_WHEEL_TICK,
+           last_tick = MIN(now_tick, wheel->tick + REPLAY_WHEEL_SLOTS - 1);
+    ReplayDevice *expired = NULL;
+
+    for (time_t tick = wheel->tick; tick <= last_tick; tick++) {
+        ReplayDevice **link = &wheel->slots[tick % REPLAY_WHEEL_SLOTS];
+
+        while (*link) {
+            ReplayDevice *device = *link;
+
+            if (device->deadline > now) {
+                link = &device->wheel_next;
+                continue;
+            }
+
+            *link = device->wheel_next;
+            device->wheel_next = expired;
+            device->on_wheel = FALSE;
+            expired = device;
+            wheel->count--;
+        }
+    }
+    wheel->tick = now_tick;
+
+    return expired;
+}
+
+static void device_fail(ReplayLoop *loop,
+                        ReplayDevice *device,
+                        const gchar *format,
+                        ...) G_GNUC_PRINTF(3, 4);
+
+static void device_fail(ReplayLoop *loop,
+                        ReplayDevice *device,
+                        const gchar *format,
+                        ...) {
+    va_list args;
+
+    va_start(args, format);
+    device->error = g_strdup_vprintf(format, args);
+    va_end(args);
+
+    fprintf(stderr, "%s: Error: %s\n", device->name, device->error);
+
+    /* A receive can fail to wait after its timeout's already been set */
+    if (device->on_wheel)
+        wheel_remove(&loop->wheel, device);
+
+    device->state = DEVICE_FAILED;
+    device->finished = g_get_monotonic_time();
+    loop->active--;
+}
+
+static void device_finish(ReplayLoop *loop,
+                          ReplayDevice *device) {
+    if (device->on_wheel)
+        wheel_remove(&loop->wheel, device);
+
+    device->state = DEVICE_DONE;
+    device->finished = g_get_monotonic_time();
+    loop->active--;
+}
+
+static gboolean device_write(ReplayDevice *device,
+                             guint8 type,
+                             guint8 data) {
+    struct userio_cmd cmd = {
+        .type = type,
+        .data = data,
+    };
+    gssize ret;
+
+    do {
+        ret = write(device->fd, &cmd, sizeof(cmd));
+    } while (ret < 0 && errno == EINTR);
+
+    return ret == sizeof(cmd);
+}
+
+/* Note delays just push the rest of the section back, since there's nobody
+ * else we can hold up by sleeping */
+static void device_replay_notes(ReplayDevice *device,
+                                guint position) {
+    LogSection *section = device->section;
+
+    for (; device->note_idx < section->notes->len; device->note_idx++) {
+        LogNote *note = &g_array_index(section->notes, LogNote,
+                                       device->note_idx);
+
+        if (note->position > position)
+            break;
+
+        /* Going through the tracer keeps the note in order with the sends
+         * and receives -v prints, it adds the device name the same way */
+        if (!device->options->quiet &&
+            (!device->options->trace ||
+             !tracer_push_note(device->options->trace,
+                               device->options->trace_device, note->text,
+                               scheduler_now())))
+            printf("%s: User note: %s\n", device->name, note->text);
+        device->clock.offset -= device->options->note_delay;
+    }
+}
+
+static gboolean device_next_section(ReplayDevice *device) {
+    if (device->section != &device->log->init_section || device->no_events)
+        return FALSE;
+
+    device->section = &device->log->main_section;
+    device->options = &device->main_options;
+    device->event_idx = 0;
+    device->note_idx = 0;
+
+    replay_clock_init(&device->clock,
+                      g_get_monotonic_time() + device->event_delay);
+
+    return TRUE;
+}
+
+/* Arms the device's fd for a single wakeup */
+static void device_wait(ReplayLoop *loop,
+                        ReplayDevice *device,
+                        ReplayDeviceState state,
+                        guint32 events) {
+    struct epoll_event epoll_event = {
+        .events = events | EPOLLONESHOT,
+        .data.ptr = device,
+    };
+
+    device->state = state;
+    if (epoll_ctl(loop->epoll_fd, EPOLL_CTL_MOD, device->fd,
+                  &epoll_event) < 0)
+        device_fail(loop, device, "While polling: %s", g_strerror(errno));
+}
+
+/* Replays as much of the device's log as it can without blocking, and then
+ * leaves the device waiting on whatever it needs next */
+static void device_step(ReplayLoop *loop,
+                        ReplayDevice *device) {
+    device->state = DEVICE_RUNNING;
+
+    for (;;) {
+        LogSection *section = device->section;
+        const LogEvent *event;
+        gint64 now;
+
+        if (!device->event_ready) {
+            if (device->event_idx >= section->events->len) {
+                device_replay_notes(device, section->events->len);
+
+                if (!device_next_section(device)) {
+                    device_finish(loop, device);
+                    return;
+                }
+                continue;
+            }
+
+            event = &g_array_index(section->events, LogEvent,
+                                   device->event_idx);
+
+            device_replay_notes(device, device->event_idx);
+            if (!replay_clock_advance(&device->clock, event,
+                                      device->options)) {
+                device->event_idx++;
+                continue;
+            }
+            device->event_ready = TRUE;
+        }
+
+        event = &g_array_index(section->events, LogEvent, device->event_idx);
+
+        if (event->type == LOG_EVENT_TYPE_INTERRUPT) {
+            if (!device->options->no_timing) {
+                device->deadline = replay_clock_deadline(&device->clock,
+                                                         device->options);
+
+                if (device->deadline > g_get_monotonic_time()) {
+                    device->state = DEVICE_WAIT_TIMER;
+                    wheel_insert(&loop->wheel, device);
+                    return;
+                }
+            }
+
+            if (!device_write(device, USERIO_CMD_SEND_INTERRUPT,
+                              event->data)) {
+                /* userio itself never blocks, but anything else we might be
+                 * writing to can */
+                if (errno == EAGAIN) {
+                    device_wait(loop, device, DEVICE_WAIT_WRITABLE, EPOLLOUT);
+                    return;
+                }
+
+                device_fail(loop, device, "While sending interrupt: %s",
+                            g_strerror(errno));
+                return;
+            }
+            device->sent++;
+            now = scheduler_now();
+
+            if (!device->options->no_timing)
+                replay_stats_add_send(&device->stats,
+                                      device->deadline * 1000, now);
+
+            if (device->options->trace)
+                tracer_push(device->options->trace, TRACE_SEND,
+                            device->options->trace_device, event->data, 0,
+                            now, device->options->no_timing ?
+                                     0 : device->deadline * 1000);
+        } else {
+            guchar data;
+            gssize ret;
+
+            if (!device->receiving) {
+                device->receiving = TRUE;
+                device->receive_started = scheduler_now();
+                device->deadline =
+                    replay_receive_deadline(&device->clock, device->options,
+                                            g_get_monotonic_time());
+            }
+
+            do {
+                ret = read(device->fd, &data, sizeof(data));
+            } while (ret < 0 && errno == EINTR);
+
+            if (ret < 0 && errno == EAGAIN) {
+                if (!device->deadline ||
+                    g_get_monotonic_time() < device->deadline) {
+                    if (device->deadline)
+                        wheel_insert(&loop->wheel, device);
+
+                    device_wait(loop, device, DEVICE_WAIT_RECEIVE, EPOLLIN);
+                    return;
+                }
+
+                /* Better to carry on without it than to hang forever */
+                fprintf(stderr,
+                        "%s: Timed out waiting for %.2hhx from the driver\n",
+                        device->name, event->data);
+                replay_stats_add_timeout(&device->stats, event->data);
+
+                if (device->options->trace)
+                    tracer_push(device->options->trace, TRACE_TIMEOUT,
+                                device->options->trace_device, 0,
+                                event->data, scheduler_now(),
+                                device->receive_started);
+            } else if (ret != sizeof(data)) {
+                device_fail(loop, device, "While receiving: %s",
+                            ret < 0 ? g_strerror(errno) : "Device closed");
+                return;
+            } else {
+                now = scheduler_now();
+                replay_stats_add_receive(&device->stats,
+                                         now - device->receive_started);
+                device->received++;
+
+                if (data != event->data) {
+                    if (!device->stats.receive_mismatches)
+                        fprintf(stderr,
+                                "%s: Expected %.2hhx, received %.2hhx, the "
+                                "device has probably gone out of sync with "
+                                "the recording\n",
+                                device->name, event->data, data);
+                    replay_stats_add_mismatch(&device->stats, event->data,
+                                              data);
+                }
+
+                if (device->options->trace)
+                    tracer_push(device->options->trace,
+                                data == event->data ?
+                                    TRACE_RECEIVE : TRACE_MISMATCH,
+                                device->options->trace_device, data,
+                                event->data, now, device->receive_started);
+            }
+
+            device->receiving = FALSE;
+        }
+
+        device->event_ready = FALSE;
+        device->event_idx++;
+    }
+}
+
+ReplayLoop * replay_loop_new(GError **error) {
+    ReplayLoop *loop = g_new0(ReplayLoop, 1);
+    struct epoll_event timer_event = {
+        .events = EPOLLIN,
+        .data.ptr = NULL,
+    };
+
+    loop->epoll_fd = -1;
+    loop->timer_fd = -1;
+    loop->devices = g_ptr_array_new();
+    wheel_init(&loop->wheel);
+
+    loop->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (loop->epoll_fd < 0)
+        goto error;
+
+    loop->timer_fd = timerfd_create(CLOCK_MONOTONIC,
+                                    TFD_NONBLOCK | TFD_CLOEXEC);
+    if (loop->timer_fd < 0)
+        goto error;
+
+    if (epoll_ctl(loop->epoll_fd, EPOLL_CTL_ADD, loop->timer_fd,
+                  &timer_event) < 0)
+        goto error;
+
+    return loop;
+
+error:
+    g_set_error(error, G_FILE_ERROR, g_file_error_from_errno(errno),
+                "While setting up the event loop: %s", g_strerror(errno));
+    replay_loop_free(loop);
+
+    return NULL;
+}
+
+gboolean replay_loop_add_device(ReplayLoop *loop,
+                                const gchar *name,
+                                const gchar *userio_path,
+                                ParsedLog *log,
+                                gint log_version,
+                                const ReplayOptions *init_options,
+                                const ReplayOptions *main_options,
+                                time_t event_delay,
+                                gboolean no_events,
+                                GError **error) {
+    ReplayDevice *device;
+    struct epoll_event epoll_event = { 0 };
+    __u8 port_type;
+
+    device = g_new0(ReplayDevice, 1);
+    device->name = g_strdup(name);
+    device->log = log;
+    device->no_events = no_events;
+    device->event_delay = event_delay;
+    device->init_options = *init_options;
+    device->main_options = *main_options;
+    replay_stats_init(&device->stats);
+
+    /* V0 logs don't have an init section, and get replayed all at once */
+    if (log_version == 0) {
+        device->section = &log->main_section;
+        device->options = &device->init_options;
+        device->no_events = TRUE;
+    } else {
+        device->section = &log->init_section;
+        device->options = &device->init_options;
+    }
+
+    device->fd = open(userio_path, O_RDWR | O_NONBLOCK | O_CLOEXEC);
+    if (device->fd < 0) {
+        g_set_error(error, G_FILE_ERROR, g_file_error_from_errno(errno),
+                    "While opening %s: %s", userio_path, g_strerror(errno));
+        goto error;
+    }
+
+    /* Only gets armed when the device is waiting on the driver */
+    epoll_event.data.ptr = device;
+    if (epoll_ctl(loop->epoll_fd, EPOLL_CTL_ADD, device->fd,
+                  &epoll_event) < 0) {
+        g_set_error(error, G_FILE_ERROR, g_file_error_from_errno(errno),
+                    "While polling %s: %s", userio_path, g_strerror(errno));
+        goto error;
+    }
+
+    port_type = (log->port == PS2_PORT_KBD) ? SERIO_8042_XL : SERIO_8042;
+    if (!device_write(device, USERIO_CMD_SET_PORT_TYPE, port_type)) {
+        g_set_error(error, G_FILE_ERROR, g_file_error_from_errno(errno),
+                    "While setting port type on %s: %s", userio_path,
+                    g_strerror(errno));
+        goto error;
+    }
+
+    if (!device_write(device, USERIO_CMD_REGISTER, 0)) {
+        g_set_error(error, G_FILE_ERROR, g_file_error_from_errno(errno),
+                    "While starting device on %s: %s", userio_path,
+                    g_strerror(errno));
+        goto error;
+    }
+
+    if (init_options->trace) {
+        device->init_options.trace_device =
+            tracer_add_device(init_options->trace, name);
+        device->main_options.trace_device = device->init_options.trace_device;
+    }
+
+    g_ptr_array_add(loop->devices, device);
+
+    return TRUE;
+
+error:
+    if (device->fd >= 0)
+        close(device->fd);
+    g_free(device->name);
+    g_free(device);
+
+    return FALSE;
+}
+
+static gboolean update_timer(ReplayLoop *loop) {
+    time_t deadline = wheel_next_deadline(&loop->wheel);
+    struct itimerspec spec = {
+        .it_value = {
+            .tv_sec = deadline / G_USEC_PER_SEC,
+            .tv_nsec = (deadline % G_USEC_PER_SEC) * 1000,
+        },
+    };
+
+    if (deadline == loop->timer_deadline)
+        return TRUE;
+
+    loop->timer_deadline = deadline;
+
+    return timerfd_settime(loop->timer_fd, TFD_TIMER_ABSTIME, &spec,
+                           NULL) == 0;
+}
+
+gboolean replay_loop_run(ReplayLoop *loop) {
+    struct epoll_event events[REPLAY_LOOP_MAX_EVENTS];
+    gboolean ret = TRUE;
+
+    loop->active = loop->devices->len;
+    for (guint i = 0; i < loop->devices->len; i++) {
+        ReplayDevice *device = g_ptr_array_index(loop->devices, i);
+
+        device->started = g_get_monotonic_time();
+        replay_clock_init(&device->clock, device->started);
+        device_step(loop, device);
+    }
+
+    while (loop->active) {
+        ReplayDevice *expired;
+        gint count;
+
+        if (!update_timer(loop)) {
+            fprintf(stderr, "Error: While setting the timer: %s\n",
+                    g_strerror(errno));
+            return FALSE;
+        }
+
+        count = epoll_wait(loop->epoll_fd, events, G_N_ELEMENTS(events), -1);
+        if (count < 0) {
+            if (errno == EINTR)
+                continue;
+
+            fprintf(stderr, "Error: While waiting on devices: %s\n",
+                    g_strerror(errno));
+            return FALSE;
+        }
+
+        for (gint i = 0; i < count; i++) {
+            ReplayDevice *device = events[i].data.ptr;
+            guint64 expirations;
+
+            if (!device) {
+                if (read(loop->timer_fd, &expirations,
+                         sizeof(expirations)) > 0)
+                    loop->timer_deadline = 0;
+                continue;
+            }
+
+            if (device->state != DEVICE_WAIT_RECEIVE &&
+                device->state != DEVICE_WAIT_WRITABLE)
+                continue;
+
+            /* Whatever it was waiting on came in before the timeout */
+            if (device->on_wheel)
+                wheel_remove(&loop->wheel, device);
+
+            device_step(loop, device);
+        }
+
+        expired = wheel_expire(&loop->wheel, g_get_monotonic_time());
+        while (expired) {
+            ReplayDevice *device = expired;
+
+            expired = device->wheel_next;
+
+            if (device->state != DEVICE_WAIT_TIMER &&
+                device->state != DEVICE_WAIT_RECEIVE)
+                continue;
+
+            device_step(loop, device);
+        }
+    }
+
+    for (guint i = 0; i < loop->devices->len; i++) {
+        ReplayDevice *device = g_ptr_array_index(loop->devices, i);
+
+        if (device->state == DEVICE_FAILED)
+            ret = FALSE;
+    }
+
+    return ret;
+}
+
+void replay_loop_print_summary(ReplayLoop *loop,
+                               gboolean print_stats,
+                               FILE *file) {
+    fprintf(file, "%-24s %10s %10s %10s %8s %8s %10s %10s %8s\n",
+            "Device", "Sent", "Received", "Mismatched", "Timeouts", "Late",
+            "p50 (us)", "p99 (us)", "Time (s)");
+
+    for (guint i = 0; i < loop->devices->len; i++) {
+        ReplayDevice *device = g_ptr_array_index(loop->devices, i);
+        const ReplayHistogram *jitter = &device->stats.send_jitter;
+
+        fprintf(file,
+                "%-24s %10" G_GUINT64_FORMAT " %10" G_GUINT64_FORMAT
+                " %10" G_GUINT64_FORMAT " %8" G_GUINT64_FORMAT
+                " %8" G_GUINT64_FORMAT " %10.1f %10.1f %8.1f%s\n",
+                device->name, device->sent, device->received,
+                device->stats.receive_mismatches,
+                device->stats.receive_timeouts, jitter->late,
+                replay_histogram_percentile(jitter, 50) / 1000.0,
+                replay_histogram_percentile(jitter, 99) / 1000.0,
+                (gdouble)(device->finished - device->started) /
+                G_USEC_PER_SEC,
+                device->state == DEVICE_FAILED ? " (failed)" : "");
+    }
+
+    if (!print_stats)
+        return;
+
+    for (guint i = 0; i < loop->devices->len; i++) {
+        ReplayDevice *device = g_ptr_array_index(loop->devices, i);
+
+        fprintf(file, "\n%s:\n", device->name);
+        replay_stats_print(&device->stats, file);
+    }
+}
+
+void replay_loop_print_json(ReplayLoop *loop,
+                            FILE *file) {
+    fprintf(file, "{\"devices\": [");
+
+    for (guint i = 0; i < loop->devices->len; i++) {
+        ReplayDevice *device = g_ptr_array_index(loop->devices, i);
+        gchar *name = json_escape(device->name),
+              *error = device->error ? json_escape(device->error) : NULL;
+
+        fprintf(file,
+                "%s{\"name\": \"%s\", \"sent\": %" G_GUINT64_FORMAT ", "
+                "\"received\": %" G_GUINT64_FORMAT ", "
+                "\"seconds\": %.6f, ",
+                i ? ", " : "", name, device->sent, device->received,
+                (gdouble)(device->finished - device->started) /
+                G_USEC_PER_SEC);
+
+        if (error)
+            fprintf(file, "\"error\": \"%s\", ", error);
+        else
+            fprintf(file, "\"error\": null, ");
+
+        fprintf(file, "\"stats\": ");
+        replay_stats_print_json(&device->stats, file);
+
+        g_free(name);
+        g_free(error);
+    }
+
+    fprintf(file, "]}\n");
+}
+
+void replay_loop_free(ReplayLoop *loop) {
+    for (guint i = 0; i < loop->devices->len; i++) {
+        ReplayDevice *device = g_ptr_array_index(loop->devices, i);
+
+        close(device->fd);
+        g_free(device->name);
+        g_free(device->error);
+        g_free(device);
+    }
+    g_ptr_array_free(loop->devices, TRUE);
+
+    if (loop->timer_fd >= 0)
+        close(loop->timer_fd);
+    if (loop->epoll_fd >= 0)
+        close(loop->epoll_fd);
+
+    g_free(loop);
+}
@@ -0,0 +1,66 @@
+/*
+ * ps2emu-replay-loop.h
+ * Copyright (C) 2015 Red Hat
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public License for more
+ * details.
+ */
+
+#ifndef __PS2EMU_REPLAY_LOOP_H__
+#define __PS2EMU_REPLAY_LOOP_H__
+
+#include <stdio.h>
+#include <glib.h>
+
+#include "ps2emu-log.h"
+#include "ps2emu-replayer.h"
+
+/* The timer wheel has one slot per tick, and wraps around every
+ * REPLAY_WHEEL_SLOTS ticks. Timers further out than that just sit in their
+ * slot until the wheel comes around to the right lap. */
+#define REPLAY_WHEEL_SLOTS 256
+#define REPLAY_WHEEL_TICK  1000 /* microseconds */
+
+/* Replays any number of devices at once from a single thread. Each device gets
+ * its own /dev/userio instance, and instead of blocking on it, the loop waits
+ * on all of them at once with epoll, along with a timerfd for whichever
+ * device's next interrupt is due first. */
+typedef struct _ReplayLoop ReplayLoop;
+
+ReplayLoop * replay_loop_new(GError **error)
+G_GNUC_MALLOC;
+
+/* @log has to stay around for as long as the loop does, but can be shared
+ * between devices. The options get copied. */
+gboolean replay_loop_add_device(ReplayLoop *loop,
+                                const gchar *name,
+                                const gchar *userio_path,
+                                ParsedLog *log,
+                                gint log_version,
+                                const ReplayOptions *init_options,
+                                const ReplayOptions *main_options,
+                                time_t event_delay,
+                                gboolean no_events,
+                                GError **error);
+
+/* Returns once every device has finished, or failed. Returns FALSE if any of
+ * them failed. */
+gboolean replay_loop_run(ReplayLoop *loop);
+
+void replay_loop_print_summary(ReplayLoop *loop,
+                               gboolean print_stats,
+                               FILE *file);
+
+void replay_loop_print_json(ReplayLoop *loop,
+                            FILE *file);
+
+void replay_loop_free(ReplayLoop *loop);
+
+#endif /* !__PS2EMU_REPLAY_LOOP_H__ */
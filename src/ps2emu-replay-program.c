@@ -0,0 +1,221 @@
+/*
+ * ps2emu-replay-program.c
+ * Copyright (C) 2015 Red Hat
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public License for more
+ * details.
+ */
+
+#include "ps2emu-replay-program.h"
+#include "ps2emu-replayer.h"
+#include "ps2emu-log.h"
+
+#include <stdio.h>
+#include <glib.h>
+
+/* Returns the index of the new op */
+static guint add_op(ReplayProgram *program,
+                    ReplayOpType type,
+                    time_t deadline,
+                    guint32 arg) {
+    ReplayOp op = {
+        .deadline = deadline,
+        .arg = arg,
+        .type = type,
+    };
+
+    g_array_append_val(program->ops, op);
+
+    return program->ops->len - 1;
+}
+
+ReplayProgram * replay_program_compile(LogSection *section,
+                                       const ReplayOptions *options) {
+    ReplayProgram *program = g_new0(ReplayProgram, 1);
+    GArray *events = section->events,
+           *notes = section->notes;
+    ReplayClock clock = { .first_event = TRUE };
+    PacketDecoder *packets = options->packets;
+    guint note_idx = 0,
+          batch = G_MAXUINT; /* the send op interrupts get batched into */
+
+    program->ops = g_array_sized_new(FALSE, FALSE, sizeof(ReplayOp),
+                                     events->len);
+    program->commands = g_array_sized_new(FALSE, FALSE,
+                                          sizeof(struct userio_cmd),
+                                          events->len);
+    program->deadlines = g_array_sized_new(FALSE, FALSE, sizeof(time_t),
+                                           events->len);
+    program->notes = g_ptr_array_sized_new(notes->len);
+
+    if (packets)
+        packet_decoder_start_section(packets);
+
+    for (guint i = 0; i <= events->len; i++) {
+        const LogEvent *event;
+        struct userio_cmd cmd;
+        time_t deadline;
+        gboolean continues;
+        guint count = 0;
+
+        /* Everything after a note gets pushed back by the time we spend
+         * pausing on it */
+        for (; note_idx < notes->len; note_idx++) {
+            LogNote *note = &g_array_index(notes, LogNote, note_idx);
+
+            if (note->position > i)
+                break;
+
+            clock.offset -= options->note_delay;
+            add_op(program, REPLAY_OP_PAUSE,
+                   replay_clock_deadline(&clock, options), program->notes->len);
+            g_ptr_array_add(program->notes, note->text);
+            batch = G_MAXUINT;
+        }
+
+        if (i == events->len)
+            break;
+
+        event = &g_array_index(events, LogEvent, i);
+        if (packets)
+            packet_decoder_feed(packets, event);
+
+        if (!replay_clock_advance(&clock, event, options))
+            continue;
+
+        deadline = replay_clock_deadline(&clock, options);
+
+        if (event->type != LOG_EVENT_TYPE_INTERRUPT) {
+            add_op(program, REPLAY_OP_RECEIVE, deadline, event->data);
+            batch = G_MAXUINT;
+            continue;
+        }
+
+        /* Same rules as collect_batch() in the replayer, except that the
+         * rest of a packet always goes along with its first byte, and
+         * packets don't get started in batches they won't fit in */
+        continues = packets && packet_decoder_continues(packets);
+        if (batch != G_MAXUINT)
+            count = g_array_index(program->ops, ReplayOp, batch).count;
+
+        if (batch == G_MAXUINT || count == REPLAY_BATCH_MAX ||
+            (packets && !continues &&
+             count + packet_decoder_packet_size(packets) > REPLAY_BATCH_MAX))
+            batch = add_op(program, REPLAY_OP_SEND, deadline,
+                           program->commands->len);
+        else if (!continues &&
+                 (!options->batch_window ||
+                  deadline -
+                  g_array_index(program->ops, ReplayOp, batch).deadline >
+                  options->batch_window))
+            batch = add_op(program, REPLAY_OP_SEND, deadline,
+                           program->commands->len);
+
+        g_array_index(program->ops, ReplayOp, batch).count++;
+
+        cmd = (struct userio_cmd) {
+            .type = USERIO_CMD_SEND_INTERRUPT,
+            .data = event->data,
+        };
+        g_array_append_val(program->commands, cmd);
+        g_array_append_val(program->deadlines, deadline);
+    }
+
+    if (packets)
+        packet_decoder_flush(packets);
+
+    return program;
+}
+
+static void record_sends(const ReplayOptions *options,
+                         const ReplayOp *op,
+                         const struct userio_cmd *cmds,
+                         const time_t *deadlines,
+                         time_t start,
+                         gint64 now) {
+    for (guint i = op->arg; i < op->arg + op->count; i++) {
+        gint64 due = options->no_timing ? 0 : (start + deadlines[i]) * 1000;
+
+        if (options->stats && due)
+            replay_stats_add_send(options->stats, due, now);
+
+        if (options->trace)
+            tracer_push(options->trace, TRACE_SEND, options->trace_device,
+                        cmds[i].data, 0, now, due);
+    }
+}
+
+gboolean replay_program_run(ReplayBackend *backend,
+                            const ReplayProgram *program,
+                            const ReplayOptions *options,
+                            GError **error) {
+    const ReplayOp *op = (const ReplayOp*)program->ops->data,
+                   *end = op + program->ops->len;
+    const struct userio_cmd *cmds =
+        (const struct userio_cmd*)program->commands->data;
+    const time_t *deadlines = (const time_t*)program->deadlines->data;
+    gboolean timing = !options->no_timing,
+             record = options->stats || options->trace;
+    time_t start = replay_backend_time(backend),
+           receive_deadline;
+
+    for (; op < end; op++) {
+        time_t deadline = start + op->deadline;
+
+        switch (op->type) {
+        case REPLAY_OP_SEND:
+            if (timing)
+                replay_backend_wait_until(backend, deadline);
+
+            if (record)
+                record_sends(options, op, cmds, deadlines, start,
+                             replay_backend_now(backend));
+
+            if (replay_backend_send_commands(backend, &cmds[op->arg],
+                                             op->count, error) !=
+                G_IO_STATUS_NORMAL)
+                return FALSE;
+            break;
+        case REPLAY_OP_RECEIVE:
+            receive_deadline = 0;
+            if (options->receive_timeout) {
+                receive_deadline = replay_backend_time(backend);
+                if (timing)
+                    receive_deadline = MAX(receive_deadline, deadline);
+
+                receive_deadline += options->receive_timeout;
+            }
+
+            if (!replay_simulate_receive(backend, op->arg, receive_deadline,
+                                         options, error))
+                return FALSE;
+            break;
+        case REPLAY_OP_PAUSE:
+            replay_print_note(backend, program->notes->pdata[op->arg],
+                              options);
+
+            if (timing)
+                replay_backend_wait_until(backend, deadline);
+            else
+                replay_backend_sleep(backend, options->note_delay);
+            break;
+        }
+    }
+
+    return TRUE;
+}
+
+void replay_program_free(ReplayProgram *program) {
+    g_array_free(program->ops, TRUE);
+    g_array_free(program->commands, TRUE);
+    g_array_free(program->deadlines, TRUE);
+    g_ptr_array_free(program->notes, TRUE);
+    g_free(program);
+}
@@ -0,0 +1,65 @@
+/*
+ * ps2emu-replay-program.h
+ * Copyright (C) 2015 Red Hat
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public License for more
+ * details.
+ */
+
+#ifndef __PS2EMU_REPLAY_PROGRAM_H__
+#define __PS2EMU_REPLAY_PROGRAM_H__
+
+#include <glib.h>
+#include <linux/types.h>
+#include <userio.h>
+
+#include "ps2emu-log.h"
+#include "ps2emu-replayer.h"
+
+typedef enum {
+    REPLAY_OP_SEND,    /* send @count commands, starting at @arg */
+    REPLAY_OP_RECEIVE, /* wait for @arg from the driver */
+    REPLAY_OP_PAUSE    /* print note @arg, then wait until @deadline */
+} ReplayOpType;
+
+typedef struct {
+    time_t  deadline; /* microseconds after the program starts */
+    guint32 arg;
+    guint8  type;
+    guint8  count;
+} ReplayOp;
+
+/* A section with every decision replay_section() would make along the way
+ * already made: max_wait, idle compression, the speed and user note delays
+ * are all folded into the deadlines, batches are already put together, and
+ * the interrupts are already encoded for userio. All that's left to do is run
+ * through it, as many times as needed. */
+typedef struct {
+    GArray *ops;
+    GArray *commands;  /* struct userio_cmd */
+    GArray *deadlines; /* time_t, one for each command */
+    GPtrArray *notes;  /* owned by the section */
+} ReplayProgram;
+
+/* Only the options that affect timing matter here, the rest get picked up
+ * by replay_program_run(). @section has to stay around for as long as the
+ * program does. */
+ReplayProgram * replay_program_compile(LogSection *section,
+                                       const ReplayOptions *options)
+G_GNUC_MALLOC;
+
+gboolean replay_program_run(ReplayBackend *backend,
+                            const ReplayProgram *program,
+                            const ReplayOptions *options,
+                            GError **error);
+
+void replay_program_free(ReplayProgram *program);
+
+#endif /* !__PS2EMU_REPLAY_PROGRAM_H__ */
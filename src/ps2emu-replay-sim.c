@@ -0,0 +1,218 @@
+/*
+ * ps2emu-replay-sim.c
+ * Copyright (C) 2015 Red Hat
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public License for more
+ * details.
+ */
+
+#include "ps2emu-replay-sim.h"
+#include "ps2emu-replayer.h"
+#include "ps2emu-scheduler.h"
+#include "ps2emu-misc.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <glib.h>
+
+typedef struct {
+    ReplayBackend backend;
+    gint64        now;   /* the virtual clock, in nanoseconds */
+    guint64       sent;
+
+    GArray       *script;
+    guint         script_pos;
+    gint64        ready; /* when the next byte in the script gets sent */
+} ReplayBackendSim;
+
+static GIOStatus sim_send(ReplayBackend *backend,
+                          guint8 type,
+                          guint8 data,
+                          GError **error) {
+    ReplayBackendSim *sim = (ReplayBackendSim*)backend;
+
+    sim->sent++;
+
+    return G_IO_STATUS_NORMAL;
+}
+
+static GIOStatus sim_send_commands(ReplayBackend *backend,
+                                   const struct userio_cmd *cmds,
+                                   guint count,
+                                   GError **error) {
+    ReplayBackendSim *sim = (ReplayBackendSim*)backend;
+
+    sim->sent += count;
+
+    return G_IO_STATUS_NORMAL;
+}
+
+static void sim_wait_until(ReplayBackend *backend,
+                           time_t deadline) {
+    ReplayBackendSim *sim = (ReplayBackendSim*)backend;
+
+    sim->now = MAX(sim->now, deadline * 1000);
+}
+
+static GIOStatus sim_receive(ReplayBackend *backend,
+                             guchar expected,
+                             guchar *data,
+                             time_t deadline,
+                             GError **error) {
+    ReplayBackendSim *sim = (ReplayBackendSim*)backend;
+    const ReplaySimResponse *response;
+
+    if (!sim->script) {
+        *data = expected;
+        return G_IO_STATUS_NORMAL;
+    }
+
+    if (sim->script_pos == sim->script->len ||
+        (deadline && sim->ready > deadline * 1000)) {
+        if (!deadline) {
+            g_set_error(error, PS2EMU_ERROR, PS2EMU_ERROR_MISC,
+                        "Waiting forever for %.2hhx from the driver, but the "
+                        "script has nothing left to send", expected);
+            return G_IO_STATUS_ERROR;
+        }
+
+        sim_wait_until(backend, deadline);
+        return G_IO_STATUS_AGAIN;
+    }
+
+    response = &g_array_index(sim->script, ReplaySimResponse,
+                              sim->script_pos++);
+    *data = response->data;
+    sim->now = MAX(sim->now, sim->ready);
+
+    if (sim->script_pos < sim->script->len)
+        sim->ready = sim->now +
+            g_array_index(sim->script, ReplaySimResponse,
+                          sim->script_pos).delay * 1000;
+
+    return G_IO_STATUS_NORMAL;
+}
+
+static gint64 sim_now(ReplayBackend *backend) {
+    ReplayBackendSim *sim = (ReplayBackendSim*)backend;
+
+    return sim->now;
+}
+
+static void sim_free(ReplayBackend *backend) {
+    ReplayBackendSim *sim = (ReplayBackendSim*)backend;
+
+    if (sim->script)
+        g_array_free(sim->script, TRUE);
+    g_free(sim);
+}
+
+ReplayBackend * replay_backend_sim_new(GArray *script) {
+    ReplayBackendSim *sim = g_new0(ReplayBackendSim, 1);
+
+    sim->backend = (ReplayBackend) {
+        .send = sim_send,
+        .send_commands = sim_send_commands,
+        .receive = sim_receive,
+        .wait_until = sim_wait_until,
+        .now = sim_now,
+        .free = sim_free,
+    };
+
+    /* Virtual time starts out the same as real time, so it still looks
+     * right next to anything that went on before the replay */
+    sim->now = scheduler_now();
+    sim->script = script;
+    if (script && script->len)
+        sim->ready = sim->now +
+            g_array_index(script, ReplaySimResponse, 0).delay * 1000;
+
+    return &sim->backend;
+}
+
+static gboolean parse_script_token(const gchar *token,
+                                   time_t *delay,
+                                   GArray *script) {
+    ReplaySimResponse response;
+    gchar *end;
+    glong value;
+
+    if (token[0] == '+') {
+        value = strtol(token + 1, &end, 10);
+        if (end == token + 1 || *end || value < 0)
+            return FALSE;
+
+        *delay += value;
+        return TRUE;
+    }
+
+    value = strtol(token, &end, 16);
+    if (end == token || *end || value < 0 || value > G_MAXUINT8)
+        return FALSE;
+
+    response = (ReplaySimResponse) {
+        .delay = *delay,
+        .data = value,
+    };
+    g_array_append_val(script, response);
+    *delay = 0;
+
+    return TRUE;
+}
+
+GArray * replay_sim_load_script(const gchar *path,
+                                GError **error) {
+    GArray *script = g_array_new(FALSE, FALSE, sizeof(ReplaySimResponse));
+    gchar *contents,
+          **lines;
+    time_t delay = 0;
+    gboolean ret = TRUE;
+
+    if (!g_file_get_contents(path, &contents, NULL, error)) {
+        g_array_free(script, TRUE);
+        return NULL;
+    }
+
+    lines = g_strsplit(contents, "\n", -1);
+    for (guint i = 0; lines[i] && ret; i++) {
+        gchar *comment = strchr(lines[i], '#'),
+              **tokens;
+
+        if (comment)
+            *comment = '\0';
+
+        tokens = g_strsplit_set(lines[i], " \t\r", -1);
+        for (guint j = 0; tokens[j] && ret; j++) {
+            if (!*tokens[j])
+                continue;
+
+            ret = parse_script_token(tokens[j], &delay, script);
+            if (!ret)
+                g_set_error(error, PS2EMU_ERROR, PS2EMU_ERROR_INPUT,
+                            "%s:%u: Invalid token \"%s\"", path, i + 1,
+                            tokens[j]);
+        }
+        g_strfreev(tokens);
+    }
+
+    g_strfreev(lines);
+    g_free(contents);
+
+    if (!ret) {
+        g_array_free(script, TRUE);
+        return NULL;
+    }
+
+    return script;
+}
+
+guint64 replay_backend_sim_get_sent(ReplayBackend *backend) {
+    return ((ReplayBackendSim*)backend)->sent;
+}
@@ -0,0 +1,55 @@
+/*
+ * ps2emu-replay-sim.h
+ * Copyright (C) 2015 Red Hat
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public License for more
+ * details.
+ */
+
+#ifndef __PS2EMU_REPLAY_SIM_H__
+#define __PS2EMU_REPLAY_SIM_H__
+
+#include <glib.h>
+
+#include "ps2emu-replayer.h"
+
+/* One byte the simulated driver sends, @delay microseconds after the one
+ * before it was received */
+typedef struct {
+    time_t delay;
+    guint8 data;
+} ReplaySimResponse;
+
+/* A backend that stands in for both /dev/userio and the driver on the other
+ * side of it, without ever touching the kernel. The driver either sends
+ * exactly what the log expects it to, as soon as it's expected, or follows
+ * @script if one's given. Time is virtual: waiting jumps the clock straight
+ * to the deadline, so a replay takes as long as it takes to go through the
+ * events and no longer. @script is a GArray of ReplaySimResponse, and the
+ * backend takes ownership of it. */
+ReplayBackend * replay_backend_sim_new(GArray *script)
+G_GNUC_MALLOC;
+
+/* Scripts are text files with one hex byte for each byte the driver sends,
+ * separated by whitespace. "+n" makes the driver wait n microseconds before
+ * sending the next byte, and everything from a # to the end of the line is
+ * ignored. For example:
+ *
+ *   # reset, then ask for the device id
+ *   ff +500 f2
+ */
+GArray * replay_sim_load_script(const gchar *path,
+                                GError **error)
+G_GNUC_MALLOC;
+
+/* How many commands the backend has been sent so far */
+guint64 replay_backend_sim_get_sent(ReplayBackend *backend);
+
+#endif /* !__PS2EMU_REPLAY_SIM_H__ */
@@ -0,0 +1,257 @@
+/*
+ * ps2emu-replay-stats.c
+ * Copyright (C) 2015 Red Hat
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public License for more
+ * details.
+ */
+
+#include "ps2emu-replay-stats.h"
+
+#include <stdio.h>
+#include <glib.h>
+
+#define REPLAY_STATS_BAR_WIDTH 40
+
+static void histogram_init(ReplayHistogram *histogram) {
+    *histogram = (ReplayHistogram) {
+        .min = G_MAXINT64,
+        .max = G_MININT64,
+    };
+}
+
+static guint histogram_bucket(gint64 value) {
+    guint msb, octave, sub;
+
+    /* Nothing can be sent early on purpose, but if it is it's as good as on
+     * time as far as the histogram is concerned */
+    if (value < REPLAY_HISTOGRAM_SUB_BUCKETS)
+        return MAX(value, 0);
+
+    msb = 63 - __builtin_clzll(value);
+    octave = msb - REPLAY_HISTOGRAM_SUB_BITS + 1;
+    if (octave >= REPLAY_HISTOGRAM_OCTAVES)
+        return REPLAY_HISTOGRAM_BUCKETS - 1;
+
+    sub = (value >> (msb - REPLAY_HISTOGRAM_SUB_BITS)) &
+          (REPLAY_HISTOGRAM_SUB_BUCKETS - 1);
+
+    return octave * REPLAY_HISTOGRAM_SUB_BUCKETS + sub;
+}
+
+/* The first value that no longer fits in @bucket */
+static gint64 histogram_bucket_end(guint bucket) {
+    guint octave = bucket / REPLAY_HISTOGRAM_SUB_BUCKETS,
+          sub = bucket % REPLAY_HISTOGRAM_SUB_BUCKETS;
+
+    if (octave == 0)
+        return bucket + 1;
+
+    return (gint64)(REPLAY_HISTOGRAM_SUB_BUCKETS + sub + 1) << (octave - 1);
+}
+
+static void histogram_add(ReplayHistogram *histogram,
+                          gint64 value,
+                          gboolean late) {
+    histogram->count++;
+    histogram->sum += value;
+    histogram->min = MIN(histogram->min, value);
+    histogram->max = MAX(histogram->max, value);
+    histogram->buckets[histogram_bucket(value)]++;
+
+    if (late)
+        histogram->late++;
+}
+
+gint64 replay_histogram_percentile(const ReplayHistogram *histogram,
+                                   gdouble percentile) {
+    guint64 rank, seen = 0;
+
+    if (!histogram->count)
+        return 0;
+
+    rank = MAX(1, (guint64)(percentile / 100.0 * histogram->count + 0.5));
+    for (guint i = 0; i < REPLAY_HISTOGRAM_BUCKETS; i++) {
+        seen += histogram->buckets[i];
+        if (seen >= rank)
+            return CLAMP(histogram_bucket_end(i) - 1,
+                         histogram->min, histogram->max);
+    }
+
+    return histogram->max;
+}
+
+/* Powers of two are a fine enough resolution for eyeballing, so the
+ * sub-buckets get folded together for printing */
+static guint64 histogram_octave_count(const ReplayHistogram *histogram,
+                                      guint octave) {
+    guint64 count = 0;
+
+    for (guint i = 0; i < REPLAY_HISTOGRAM_SUB_BUCKETS; i++)
+        count += histogram->buckets[octave * REPLAY_HISTOGRAM_SUB_BUCKETS + i];
+
+    return count;
+}
+
+static gint64 histogram_octave_start(guint octave) {
+    return octave ? (gint64)REPLAY_HISTOGRAM_SUB_BUCKETS << (octave - 1) : 0;
+}
+
+static gint64 histogram_octave_end(guint octave) {
+    return (gint64)REPLAY_HISTOGRAM_SUB_BUCKETS << octave;
+}
+
+static const gchar * format_duration(gint64 ns,
+                                     gchar *buf,
+                                     gsize len) {
+    gint64 magnitude = ABS(ns);
+
+    if (magnitude < 1000)
+        g_snprintf(buf, len, "%" G_GINT64_FORMAT " ns", ns);
+    else if (magnitude < 1000 * 1000)
+        g_snprintf(buf, len, "%.1f us", ns / 1000.0);
+    else if (magnitude < 1000 * 1000 * 1000)
+        g_snprintf(buf, len, "%.1f ms", ns / (1000.0 * 1000));
+    else
+        g_snprintf(buf, len, "%.1f s", ns / (1000.0 * 1000 * 1000));
+
+    return buf;
+}
+
+static void histogram_print(const ReplayHistogram *histogram,
+                            const gchar *name,
+                            gboolean show_late,
+                            FILE *file) {
+    gchar a[32], b[32], c[32], d[32];
+    guint64 most = 0;
+
+    fprintf(file, "%s: %" G_GUINT64_FORMAT " events", name, histogram->count);
+    if (show_late)
+        fprintf(file, ", %" G_GUINT64_FORMAT " late (> %s)", histogram->late,
+                format_duration(REPLAY_STATS_LATE_THRESHOLD, a, sizeof(a)));
+    fprintf(file, "\n");
+
+    if (!histogram->count)
+        return;
+
+    fprintf(file, "  min %s, p50 %s, p99 %s, max %s\n",
+            format_duration(histogram->min, a, sizeof(a)),
+            format_duration(replay_histogram_percentile(histogram, 50),
+                            b, sizeof(b)),
+            format_duration(replay_histogram_percentile(histogram, 99),
+                            c, sizeof(c)),
+            format_duration(histogram->max, d, sizeof(d)));
+
+    for (guint i = 0; i < REPLAY_HISTOGRAM_OCTAVES; i++)
+        most = MAX(most, histogram_octave_count(histogram, i));
+
+    for (guint i = 0; i < REPLAY_HISTOGRAM_OCTAVES; i++) {
+        guint64 count = histogram_octave_count(histogram, i);
+        gint bar;
+
+        if (!count)
+            continue;
+
+        /* Always show at least a sliver, so rare outliers stand out */
+        bar = MAX(1, count * REPLAY_STATS_BAR_WIDTH / most);
+
+        fprintf(file, "  %9s - %-9s %10" G_GUINT64_FORMAT " %.*s\n",
+                format_duration(histogram_octave_start(i), a, sizeof(a)),
+                format_duration(histogram_octave_end(i), b, sizeof(b)),
+                count, bar,
+                "########################################");
+    }
+}
+
+static void histogram_print_json(const ReplayHistogram *histogram,
+                                 FILE *file) {
+    gboolean first = TRUE;
+
+    fprintf(file,
+            "{\"count\": %" G_GUINT64_FORMAT ", "
+            "\"late\": %" G_GUINT64_FORMAT ", "
+            "\"min_ns\": %" G_GINT64_FORMAT ", "
+            "\"p50_ns\": %" G_GINT64_FORMAT ", "
+            "\"p99_ns\": %" G_GINT64_FORMAT ", "
+            "\"max_ns\": %" G_GINT64_FORMAT ", "
+            "\"mean_ns\": %.1f, "
+            "\"histogram\": [",
+            histogram->count, histogram->late,
+            histogram->count ? histogram->min : 0,
+            replay_histogram_percentile(histogram, 50),
+            replay_histogram_percentile(histogram, 99),
+            histogram->count ? histogram->max : 0,
+            histogram->count ? (gdouble)histogram->sum / histogram->count : 0);
+
+    for (guint i = 0; i < REPLAY_HISTOGRAM_OCTAVES; i++) {
+        guint64 count = histogram_octave_count(histogram, i);
+
+        if (!count)
+            continue;
+
+        fprintf(file,
+                "%s{\"from_ns\": %" G_GINT64_FORMAT ", "
+                "\"to_ns\": %" G_GINT64_FORMAT ", "
+                "\"count\": %" G_GUINT64_FORMAT "}",
+                first ? "" : ", ",
+                histogram_octave_start(i), histogram_octave_end(i), count);
+        first = FALSE;
+    }
+
+    fprintf(file, "]}");
+}
+
+void replay_stats_init(ReplayStats *stats) {
+    histogram_init(&stats->send_jitter);
+    histogram_init(&stats->receive_latency);
+    stats->receive_mismatches = 0;
+    stats->receive_timeouts = 0;
+    stats->desynced = FALSE;
+    stats->desync_timed_out = FALSE;
+    stats->desync_position = 0;
+    stats->desync_expected = 0;
+    stats->desync_received = 0;
+}
+
+/* Both times are CLOCK_MONOTONIC nanoseconds */
+void replay_stats_add_send(ReplayStats *stats,
+                           gint64 scheduled,
+                           gint64 actual) {
+    gint64 jitter = actual - scheduled;
+
+    histogram_add(&stats->send_jitter, jitter,
+                  jitter > REPLAY_STATS_LATE_THRESHOLD);
+}
+
+void replay_stats_add_receive(ReplayStats *stats,
+                              gint64 latency) {
+    histogram_add(&stats->receive_latency, latency, FALSE);
+}
+
+void replay_stats_print(const ReplayStats *stats,
+                        FILE *file) {
+    histogram_print(&stats->send_jitter, "Interrupt send jitter", TRUE, file);
+    histogram_print(&stats->receive_latency, "Receive latency", FALSE, file);
+    fprintf(file, "Receive mismatches: %" G_GUINT64_FORMAT ", "
+            "timeouts: %" G_GUINT64_FORMAT "\n",
+            stats->receive_mismatches, stats->receive_timeouts);
+}
+
+void replay_stats_print_json(const ReplayStats *stats,
+                             FILE *file) {
+    fprintf(file, "{\"late_threshold_ns\": %d, \"send_jitter\": ",
+            REPLAY_STATS_LATE_THRESHOLD);
+    histogram_print_json(&stats->send_jitter, file);
+    fprintf(file, ", \"receive_latency\": ");
+    histogram_print_json(&stats->receive_latency, file);
+    fprintf(file, ", \"receive_mismatches\": %" G_GUINT64_FORMAT ", "
+            "\"receive_timeouts\": %" G_GUINT64_FORMAT "}\n",
+            stats->receive_mismatches, stats->receive_timeouts);
+}
@@ -0,0 +1,110 @@
+/*
+ * ps2emu-replay-stats.h
+ * Copyright (C) 2015 Red Hat
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public License for more
+ * details.
+ */
+
+#ifndef __PS2EMU_REPLAY_STATS_H__
+#define __PS2EMU_REPLAY_STATS_H__
+
+#include <stdio.h>
+#include <glib.h>
+
+/* Interrupts sent later than this after they were scheduled count as late,
+ * in nanoseconds */
+#define REPLAY_STATS_LATE_THRESHOLD (10 * 1000)
+
+/* Each power of two gets split into this many linear sub-buckets, which keeps
+ * the percentiles within 1/8th of the real value */
+#define REPLAY_HISTOGRAM_SUB_BITS    3
+#define REPLAY_HISTOGRAM_SUB_BUCKETS (1 << REPLAY_HISTOGRAM_SUB_BITS)
+/* Enough to cover values below 2^42 nanoseconds, a little over 73 minutes,
+ * anything past that goes into the last bucket */
+#define REPLAY_HISTOGRAM_OCTAVES     40
+#define REPLAY_HISTOGRAM_BUCKETS \
+    (REPLAY_HISTOGRAM_OCTAVES * REPLAY_HISTOGRAM_SUB_BUCKETS)
+
+/* A fixed size, log-linear histogram of durations in nanoseconds. Adding a
+ * sample never allocates or takes a lock, so recording doesn't get in the way
+ * of the timing it's measuring. It's only ever touched from the thread doing
+ * the replay. */
+typedef struct {
+    guint64 count,
+            late;
+    gint64  min,
+            max,
+            sum;
+    guint64 buckets[REPLAY_HISTOGRAM_BUCKETS];
+} ReplayHistogram;
+
+typedef struct {
+    ReplayHistogram send_jitter,     /* actual - scheduled interrupt time */
+                    receive_latency; /* time spent waiting on the device */
+    guint64         receive_mismatches,
+                    receive_timeouts;
+
+    /* The first byte from the driver that didn't match or never came, so
+     * there's something to go on once a replay's gone out of sync */
+    gboolean        desynced,
+                    desync_timed_out;
+    guint64         desync_position; /* bytes from the driver before it */
+    guint8          desync_expected,
+                    desync_received;
+} ReplayStats;
+
+void replay_stats_init(ReplayStats *stats);
+
+void replay_stats_add_send(ReplayStats *stats,
+                           gint64 scheduled,
+                           gint64 actual);
+
+void replay_stats_add_receive(ReplayStats *stats,
+                              gint64 latency);
+
+/* Goes after the replay_stats_add_receive() for the byte */
+static inline void replay_stats_add_mismatch(ReplayStats *stats,
+                                             guint8 expected,
+                                             guint8 received) {
+    if (!stats->desynced) {
+        stats->desynced = TRUE;
+        stats->desync_position = stats->receive_latency.count - 1 +
+                                 stats->receive_timeouts;
+        stats->desync_expected = expected;
+        stats->desync_received = received;
+    }
+
+    stats->receive_mismatches++;
+}
+
+static inline void replay_stats_add_timeout(ReplayStats *stats,
+                                            guint8 expected) {
+    if (!stats->desynced) {
+        stats->desynced = TRUE;
+        stats->desync_timed_out = TRUE;
+        stats->desync_position = stats->receive_latency.count +
+                                 stats->receive_timeouts;
+        stats->desync_expected = expected;
+    }
+
+    stats->receive_timeouts++;
+}
+
+gint64 replay_histogram_percentile(const ReplayHistogram *histogram,
+                                   gdouble percentile);
+
+void replay_stats_print(const ReplayStats *stats,
+                        FILE *file);
+
+void replay_stats_print_json(const ReplayStats *stats,
+                             FILE *file);
+
+#endif /* !__PS2EMU_REPLAY_STATS_H__ */
@@ -14,6 +14,15 @@
  */
 
 #include "ps2emu-log.h"
+#include "ps2emu-log-stream.h"
+#include "ps2emu-log-index.h"
+#include "ps2emu-log-gaps.h"
+#include "ps2emu-daemon.h"
+#include "ps2emu-replayer.h"
+#include "ps2emu-replay-loop.h"
+#include "ps2emu-replay-program.h"
+#include "ps2emu-replay-sim.h"
+#include "ps2emu-realtime.h"
 #include "ps2emu-misc.h"
 
 #include <stdio.h>
@@ -25,121 +34,369 @@
 #include <linux/serio.h>
 #include <userio.h>
 
-#define PS2EMU_MIN_EVENT_DELAY (0.5 * G_USEC_PER_SEC)
+/* How long past when the log says it should've shown up we wait for data from
+ * the driver by default, in milliseconds */
+#define PS2EMU_DEFAULT_RECEIVE_TIMEOUT 1000
+
+/* Compiles @section once, then replays it @loops times, or forever if @loops
+ * is 0. With --packets, the decoder only goes through the section the once
+ * too, which is what we want: every pass sends the same bytes, so they split
+ * into the same packets, and those were worked out from the init section that
+ * came before them in the log. Decoding the section again would start from
+ * wherever the end of the last pass left the decoder instead. */
+static gboolean replay_compiled_section(ReplayBackend *backend,
+                                        LogSection *section,
+                                        const ReplayOptions *options,
+                                        gint loops,
+                                        GError **error) {
+    ReplayProgram *program = replay_program_compile(section, options);
+    gboolean ret = TRUE;
+
+    for (gint i = 0; ret && (loops == 0 || i < loops); i++) {
+        if (loops != 1)
+            printf("Pass %d...\n", i + 1);
+
+        ret = replay_program_run(backend, program, options, error);
+    }
 
-static GIOStatus send_userio_cmd(GIOChannel *userio_channel,
-                                 guint8 type,
-                                 guint8 data,
-                                 GError **error) {
-    GIOStatus rc;
-    struct userio_cmd cmd = {
-        .type = type,
-        .data = data,
-    };
+    replay_program_free(program);
 
-    rc = g_io_channel_write_chars(userio_channel, (gchar*)&cmd, sizeof(cmd),
-                                  NULL, error);
-    return rc;
+    return ret;
 }
 
-static gboolean simulate_interrupt(GIOChannel *userio_channel,
-                                   time_t start_time,
-                                   time_t offset,
-                                   PS2Event *event,
-                                   gboolean verbose,
-                                   GError **error) {
-    time_t current_time;
-    GIOStatus rc;
+static gboolean replay_main_section(ReplayBackend *backend,
+                                    ParsedLog *log,
+                                    LogStream *stream,
+                                    const ReplayOptions *options,
+                                    gint loops,
+                                    GError **error) {
+    LogSection *chunk;
+    ReplayClock clock;
+    GError *stream_error = NULL;
+
+    if (!stream)
+        return replay_compiled_section(backend, &log->main_section, options,
+                                       loops, error);
+
+    replay_clock_init(&clock, replay_backend_time(backend));
+    while ((chunk = log_stream_next_chunk(stream, &stream_error))) {
+        gboolean ret = replay_section(backend, chunk, &clock, options,
+                                      error);
+
+        log_stream_release_chunk(stream, chunk);
+        if (!ret)
+            return FALSE;
+    }
+    if (stream_error) {
+        g_propagate_prefixed_error(error, stream_error,
+                                   "While streaming the log: ");
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+/* The statistics go to stdout if @path is "-" */
+static FILE * open_stats_file(const gchar *path,
+                              GError **error) {
+    FILE *file;
+
+    if (strcmp(path, "-") == 0)
+        return stdout;
 
-    current_time = g_get_monotonic_time() - start_time + offset;
-    if (current_time < event->time)
-        g_usleep(event->time - current_time);
+    file = fopen(path, "w");
+    if (!file)
+        g_set_error(error, G_FILE_ERROR, g_file_error_from_errno(errno),
+                    "While writing statistics to %s: %s", path,
+                    strerror(errno));
 
-    if (verbose)
-        printf("Send\t-> %.2hhx\n", event->data);
+    return file;
+}
+
+static gboolean close_stats_file(FILE *file,
+                                 const gchar *path,
+                                 GError **error) {
+    if (file == stdout)
+        return TRUE;
 
-    rc = send_userio_cmd(userio_channel, USERIO_CMD_SEND_INTERRUPT,
-                         event->data, error);
-    if (rc != G_IO_STATUS_NORMAL)
+    if (fclose(file) != 0) {
+        g_set_error(error, G_FILE_ERROR, g_file_error_from_errno(errno),
+                    "While writing statistics to %s: %s", path,
+                    strerror(errno));
         return FALSE;
+    }
 
     return TRUE;
 }
 
-static gboolean simulate_receive(GIOChannel *userio_channel,
-                                 PS2Event *event,
-                                 gboolean verbose,
-                                 GError **error) {
-    guchar data;
-    gsize count;
-    static gboolean sync_warning_printed = FALSE;
-    GIOStatus rc;
+static gboolean write_stats(const ReplayStats *stats,
+                            gboolean print_stats,
+                            const gchar *json_path,
+                            GError **error) {
+    FILE *file;
 
-    rc = g_io_channel_read_chars(userio_channel, (gchar*)&data,
-                                 sizeof(event->data), &count, error);
+    if (print_stats)
+        replay_stats_print(stats, stdout);
 
-    if (rc != G_IO_STATUS_NORMAL)
+    if (!json_path)
+        return TRUE;
+
+    file = open_stats_file(json_path, error);
+    if (!file)
         return FALSE;
 
-    if (verbose && event->data == data)
-        printf("Receive\t<- %.2hhx\n", data);
-    else if (event->data != data) {
-        fprintf(stderr, "Expected %.2hhx, received %.2hhx\n",
-                event->data, data);
-
-        if (!sync_warning_printed) {
-            fprintf(stderr,
-                    "The device has gone out of sync with the recording, "
-                    "playback from this point forward will probably fail.\n");
-            sync_warning_printed = TRUE;
-        }
+    replay_stats_print_json(stats, file);
+
+    return close_stats_file(file, json_path, error);
+}
+
+static void setup_idle_compression(ParsedLog *log,
+                                   time_t target,
+                                   ReplayOptions *options) {
+    LogGapStats stats;
+
+    if (!log_gaps_analyze(&log->main_section, &stats)) {
+        fprintf(stderr, "Warning: Not enough events to find the idle time "
+                        "in, not compressing it\n");
+        return;
     }
 
-    return TRUE;
+    /* Gaps no longer than the target are left alone regardless */
+    options->idle_threshold = MAX(stats.idle_threshold, target + 1);
+    options->idle_target = target;
+
+    printf("Compressing %" G_GUINT64_FORMAT " idle gaps of %.2fs or longer "
+           "(%.1fs in total) down to %.2fs each\n",
+           stats.count[LOG_GAP_IDLE],
+           (gdouble)options->idle_threshold / G_USEC_PER_SEC,
+           (gdouble)stats.total[LOG_GAP_IDLE] / G_USEC_PER_SEC,
+           (gdouble)target / G_USEC_PER_SEC);
 }
 
-static gboolean replay_line_list(GIOChannel *userio_channel,
-                                 GList *event_list,
-                                 time_t max_wait,
-                                 time_t note_delay,
-                                 gboolean verbose,
-                                 GError **error) {
-    LogLine *log_line;
-    const time_t start_time = g_get_monotonic_time();
-    long offset = 0;
+/* Uses the log's seek index if it has one, otherwise the index gets built
+ * from scratch which means reading through the whole log */
+static ParsedLog * parse_log_range(const gchar *path,
+                                   time_t start,
+                                   time_t end,
+                                   int *log_version,
+                                   GError **error) {
+    LogIndex *index;
+    ParsedLog *log;
+    GError *index_error = NULL;
 
-    for (GList *l = event_list; l != NULL; l = l->next) {
-        log_line = l->data;
+    index = log_index_load(path, &index_error);
+    if (!index) {
+        if (!g_error_matches(index_error, G_FILE_ERROR, G_FILE_ERROR_NOENT))
+            fprintf(stderr, "Warning: %s\n", index_error->message);
+        g_error_free(index_error);
 
-        if (log_line->type == LINE_TYPE_NOTE) {
-            printf("User note: %s\n",
-                   log_line->note);
+        fprintf(stderr, "Warning: No usable index for %s, reading the whole "
+                        "log (run ps2emu-index to speed this up)\n", path);
 
-            g_usleep(note_delay);
-            offset -= note_delay;
+        index = log_index_build(path, error);
+        if (!index)
+            return NULL;
+    }
 
-            continue;
-        }
+    if (index->log_version < 1) {
+        g_set_error_literal(error, PS2EMU_ERROR, PS2EMU_ERROR_INPUT,
+                            "V0 logs don't have an init section, so they "
+                            "can't be replayed from the middle");
+        log_index_free(index);
+        return NULL;
+    }
+
+    log = log_index_parse_range(index, path, start, end, log_version, error);
+    log_index_free(index);
 
-        if (max_wait && l->prev) {
-            LogLine *last_line = l->prev->data;
-            time_t wait_time =
-                log_line->ps2_event->time - last_line->ps2_event->time;
+    return log;
+}
+
+static ParsedLog * parse_log(const gchar *path,
+                             gdouble start_at,
+                             gdouble end_at,
+                             gint *log_version,
+                             GError **error) {
+    ParsedLog *log;
+
+    if (start_at > 0 || end_at >= 0)
+        log = parse_log_range(path, start_at * G_USEC_PER_SEC,
+                              end_at >= 0 ? end_at * G_USEC_PER_SEC :
+                                            G_MAXINT64,
+                              log_version, error);
+    else
+        log = log_parse_file(path, log_version, error);
+
+    if (!log)
+        g_prefix_error(error, "While parsing %s: ", path);
+
+    return log;
+}
 
-            /* If necessary, time-travel to the future */
-            if (wait_time > max_wait)
-                offset += wait_time - max_wait;
+/* Stops *@tracer if there is one, and waits for everything in it to be
+ * written out. The tracer is freed and *@tracer cleared even if that fails. */
+static gboolean stop_tracer(Tracer **tracer,
+                            GError **error) {
+    Tracer *stopping = *tracer;
+
+    *tracer = NULL;
+    return !stopping || tracer_free(stopping, error);
+}
+
+/* Replays every log in @paths, @fan_out times each, all at once. If there's a
+ * tracer in @init_options, it gets started and freed here, whether or not the
+ * replay succeeds. */
+static gboolean replay_devices(gchar **paths,
+                               gint fan_out,
+                               gdouble start_at,
+                               gdouble end_at,
+                               gint compress_idle,
+                               const ReplayOptions *init_options,
+                               const ReplayOptions *main_options,
+                               time_t event_delay,
+                               gboolean no_events,
+                               gboolean keep_running,
+                               gboolean print_stats,
+                               const gchar *stats_json,
+                               const RealtimeOptions *realtime,
+                               GError **error) {
+    GPtrArray *logs = g_ptr_array_new_with_free_func((GDestroyNotify)log_free);
+    Tracer *tracer = init_options->trace;
+    GError *trace_error = NULL;
+    ReplayLoop *loop;
+    gboolean ret = FALSE,
+             all_ok;
+    FILE *file;
+
+    loop = replay_loop_new(error);
+    if (!loop)
+        goto out;
+
+    for (gchar **path = paths; *path; path++) {
+        ReplayOptions options = *main_options;
+        gchar *basename;
+        ParsedLog *log;
+        gint log_version;
+
+        log = parse_log(*path, start_at, end_at, &log_version, error);
+        if (!log)
+            goto out;
+        g_ptr_array_add(logs, log);
+
+        if (compress_idle >= 0 && log_version == 0) {
+            g_set_error(error, PS2EMU_ERROR, PS2EMU_ERROR_INPUT,
+                        "%s is a V0 log, --compress-idle only works with V1 "
+                        "logs and later", *path);
+            goto out;
         }
 
-        if (log_line->ps2_event->type == PS2_EVENT_TYPE_INTERRUPT) {
-            if (!simulate_interrupt(userio_channel, start_time, offset,
-                                    log_line->ps2_event, verbose, error))
-                return FALSE;
-        } else {
-            if (!simulate_receive(userio_channel, log_line->ps2_event, verbose,
-                                  error))
-                return FALSE;
+        if (compress_idle >= 0)
+            setup_idle_compression(log, compress_idle * 1000, &options);
+
+        basename = g_path_get_basename(*path);
+        for (gint i = 0; i < fan_out; i++) {
+            gchar *name = fan_out > 1 ? g_strdup_printf("%s#%d", basename, i) :
+                                        g_strdup(basename);
+            gboolean added;
+
+            added = replay_loop_add_device(loop, name, "/dev/userio", log,
+                                          log_version, init_options,
+                                          &options, event_delay, no_events,
+                                          error);
+            g_free(name);
+
+            if (!added) {
+                g_free(basename);
+                goto out;
+            }
         }
+        g_free(basename);
+    }
+
+    if (tracer)
+        tracer_start(tracer);
+
+    if (realtime) {
+        for (guint i = 0; i < logs->len; i++)
+            realtime_prefault_log(logs->pdata[i]);
+
+        realtime_apply(realtime);
+    }
+
+    printf("Replaying %u devices...\n", logs->len * fan_out);
+    all_ok = replay_loop_run(loop);
+
+    if (!stop_tracer(&tracer, error))
+        goto out;
+
+    replay_loop_print_summary(loop, print_stats, stdout);
+    if (stats_json) {
+        file = open_stats_file(stats_json, error);
+        if (!file)
+            goto out;
+
+        replay_loop_print_json(loop, file);
+        if (!close_stats_file(file, stats_json, error))
+            goto out;
+    }
+
+    if (!all_ok) {
+        g_set_error_literal(error, PS2EMU_ERROR, PS2EMU_ERROR_MISC,
+                            "Not every device finished replaying");
+        goto out;
+    }
+
+    if (keep_running)
+        pause();
+
+    ret = TRUE;
+
+out:
+    /* Whatever got traced up until a failure is what matters most */
+    if (!stop_tracer(&tracer, &trace_error)) {
+        fprintf(stderr, "Error: %s\n", trace_error->message);
+        g_error_free(trace_error);
+    }
+
+    if (loop)
+        replay_loop_free(loop);
+    g_ptr_array_free(logs, TRUE);
+
+    return ret;
+}
+
+/* Has ps2emu-replayd replay every log in @paths, one after another */
+static gboolean submit_to_daemon(gchar **paths,
+                                 const gchar *socket_path,
+                                 GError **error) {
+    guint failed = 0;
+
+    for (gchar **path = paths; *path; path++) {
+        DaemonResult result;
+        GError *submit_error = NULL;
+
+        if (!daemon_submit(socket_path, *path, &result, &submit_error)) {
+            fprintf(stderr, "%s: %s\n", *path, submit_error->message);
+            g_error_free(submit_error);
+            failed++;
+            continue;
+        }
+
+        printf("%s: replayed on a %s device in %.3fs, %" G_GUINT64_FORMAT
+               " interrupts sent, %" G_GUINT64_FORMAT " bytes received, %"
+               G_GUINT64_FORMAT " mismatches, %" G_GUINT64_FORMAT
+               " timeouts\n", *path, result.warm ? "warm" : "cold",
+               result.seconds, result.sent, result.received,
+               result.mismatches, result.timeouts);
+
+        if (result.mismatches || result.timeouts)
+            failed++;
+    }
+
+    if (failed) {
+        g_set_error(error, PS2EMU_ERROR, PS2EMU_ERROR_MISC,
+                    "%u logs didn't replay cleanly", failed);
+        return FALSE;
     }
 
     return TRUE;
@@ -148,19 +405,51 @@ static gboolean replay_line_list(GIOChannel *userio_channel,
 gint main(gint argc,
           gchar *argv[]) {
     GOptionContext *main_context =
-        g_option_context_new("<event_log> - replay PS/2 devices");
-    GIOChannel *input_channel,
-               *userio_channel;
+        g_option_context_new("<event_log>... - replay PS/2 devices");
+    ReplayBackend *backend;
     GIOStatus rc;
     int log_version;
     time_t max_wait = 0,
            event_delay = 0,
            note_delay = 0;
-    GError *error = NULL;
+    gint batch_window = 0,
+         packet_size = 0,
+         compress_idle = -1,
+         fan_out = 1,
+         loops = 1,
+         receive_timeout = PS2EMU_DEFAULT_RECEIVE_TIMEOUT;
+    gdouble start_at = 0,
+            end_at = -1,
+            speed = 1.0;
+    GError *error = NULL,
+           *trace_error = NULL;
     gboolean no_events = FALSE,
              keep_running = FALSE,
+             stream_log = FALSE,
+             no_timing = FALSE,
              verbose = FALSE;
     ParsedLog *log;
+    LogStream *stream = NULL;
+    gchar *stats_json = NULL,
+          *trace_path = NULL;
+    Tracer *tracer = NULL;
+    gboolean print_stats = FALSE;
+    gboolean realtime = FALSE,
+             simulate = FALSE;
+    gchar *simulate_script = NULL;
+    gboolean daemon = FALSE,
+             whole_packets = FALSE;
+    PacketDecoder packets;
+    gchar *socket_path = NULL;
+    time_t real_start,
+           virtual_start;
+    RealtimeOptions realtime_options = {
+        .cpu = -1,
+        .priority = REALTIME_DEFAULT_PRIORITY,
+    };
+    ReplayStats stats;
+    ReplayOptions init_options,
+                  main_options;
     __u8 port_type;
 
     GOptionEntry options[] = {
@@ -181,6 +470,69 @@ gint main(gint argc,
         { "note-delay", 'D', G_OPTION_FLAG_NONE, G_OPTION_ARG_INT,
           &note_delay, "Wait n seconds after printing a user note",
           "n" },
+        { "stream", 's', G_OPTION_FLAG_NONE, G_OPTION_ARG_NONE,
+          &stream_log, "Parse the events while replaying them, instead of "
+          "loading the whole log first", NULL },
+        { "start-at", 'S', G_OPTION_FLAG_NONE, G_OPTION_ARG_DOUBLE,
+          &start_at, "Start replaying events n seconds into the log", "n" },
+        { "end-at", 'E', G_OPTION_FLAG_NONE, G_OPTION_ARG_DOUBLE,
+          &end_at, "Stop replaying events n seconds into the log", "n" },
+        { "receive-timeout", 't', G_OPTION_FLAG_NONE, G_OPTION_ARG_INT,
+          &receive_timeout, "Give up on data from the driver that's n "
+          "milliseconds late, 0 to wait forever (defaults to 1000)", "n" },
+        { "loop", 'l', G_OPTION_FLAG_NONE, G_OPTION_ARG_INT,
+          &loops, "Replay the events n times over, or until interrupted if n "
+          "is 0", "n" },
+        { "fan-out", 'f', G_OPTION_FLAG_NONE, G_OPTION_ARG_INT,
+          &fan_out, "Replay each log on n devices at once", "n" },
+        { "speed", 0, G_OPTION_FLAG_NONE, G_OPTION_ARG_DOUBLE,
+          &speed, "Replay n times faster than the events were recorded",
+          "n" },
+        { "no-timing", 0, G_OPTION_FLAG_NONE, G_OPTION_ARG_NONE,
+          &no_timing, "Replay events as fast as the driver can keep up with "
+          "them, ignoring the timing in the log", NULL },
+        { "compress-idle", 'c', G_OPTION_FLAG_NONE, G_OPTION_ARG_INT,
+          &compress_idle, "Shorten the idle time between gestures to n "
+          "milliseconds", "n" },
+        { "batch-window", 'b', G_OPTION_FLAG_NONE, G_OPTION_ARG_INT,
+          &batch_window, "Send interrupts that are due within n microseconds "
+          "of each other with a single write", "n" },
+        { "packets", 0, G_OPTION_FLAG_NONE, G_OPTION_ARG_NONE,
+          &whole_packets, "Send each packet from the device in one go, as "
+          "soon as its first byte is due", NULL },
+        { "packet-size", 0, G_OPTION_FLAG_NONE, G_OPTION_ARG_INT,
+          &packet_size, "With --packets, how many bytes each packet has (3, "
+          "4 or 6), instead of working it out from the init sequence", "n" },
+        { "simulate", 0, G_OPTION_FLAG_NONE, G_OPTION_ARG_NONE,
+          &simulate, "Don't use /dev/userio, simulate the driver instead "
+          "and skip over all the waiting", NULL },
+        { "simulate-script", 0, G_OPTION_FLAG_NONE, G_OPTION_ARG_FILENAME,
+          &simulate_script, "With --simulate, have the driver send what's in "
+          "file instead of what the log expects", "file" },
+        { "daemon", 0, G_OPTION_FLAG_NONE, G_OPTION_ARG_NONE,
+          &daemon, "Have ps2emu-replayd replay the logs on devices it's "
+          "already initialized", NULL },
+        { "socket", 0, G_OPTION_FLAG_NONE, G_OPTION_ARG_FILENAME,
+          &socket_path, "With --daemon, the socket ps2emu-replayd is "
+          "listening on (defaults to " PS2EMU_DAEMON_SOCKET ")", "path" },
+        { "realtime", 0, G_OPTION_FLAG_NONE, G_OPTION_ARG_NONE,
+          &realtime, "Lock everything into memory and replay with a realtime "
+          "priority, as far as we're allowed to", NULL },
+        { "cpu", 0, G_OPTION_FLAG_NONE, G_OPTION_ARG_INT,
+          &realtime_options.cpu, "With --realtime, pin the replay to CPU n",
+          "n" },
+        { "priority", 0, G_OPTION_FLAG_NONE, G_OPTION_ARG_INT,
+          &realtime_options.priority, "With --realtime, the SCHED_FIFO "
+          "priority to replay with (defaults to 50)", "n" },
+        { "trace", 0, G_OPTION_FLAG_NONE, G_OPTION_ARG_FILENAME,
+          &trace_path, "Write everything sent to and received from the "
+          "driver to file as a binary trace", "file" },
+        { "stats", 0, G_OPTION_FLAG_NONE, G_OPTION_ARG_NONE,
+          &print_stats, "Print how closely the replay kept to the log's "
+          "timing once it's done", NULL },
+        { "stats-json", 0, G_OPTION_FLAG_NONE, G_OPTION_ARG_FILENAME,
+          &stats_json, "Write the timing statistics to file as JSON, or to "
+          "stdout if file is -", "file" },
         { 0 }
     };
 
@@ -197,86 +549,298 @@ gint main(gint argc,
                              "No filename specified! Use --help for more "
                              "information");
 
+    if (start_at < 0 || (end_at >= 0 && end_at < start_at))
+        exit_on_bad_argument(main_context, FALSE,
+                             "Invalid time range given");
+
+    if (speed <= 0)
+        exit_on_bad_argument(main_context, FALSE,
+                             "The speed must be greater than 0");
+
+    if (no_timing && speed != 1.0)
+        exit_on_bad_argument(main_context, FALSE,
+                             "--speed can't be used along with --no-timing");
+
+    if (compress_idle < -1)
+        exit_on_bad_argument(main_context, FALSE,
+                             "The idle time can't be negative");
+
+    if (stream_log && compress_idle >= 0)
+        exit_on_bad_argument(main_context, FALSE,
+                             "--stream can't be used along with "
+                             "--compress-idle");
+
+    if (receive_timeout < 0)
+        exit_on_bad_argument(main_context, FALSE,
+                             "The receive timeout can't be negative");
+
+    if (fan_out < 1)
+        exit_on_bad_argument(main_context, FALSE,
+                             "The fan out must be at least 1");
+
+    if (stream_log && (argc > 2 || fan_out > 1))
+        exit_on_bad_argument(main_context, FALSE,
+                             "--stream can only be used with a single "
+                             "device");
+
+    if (loops < 0)
+        exit_on_bad_argument(main_context, FALSE,
+                             "The number of loops can't be negative");
+
+    if (loops != 1 && (stream_log || argc > 2 || fan_out > 1))
+        exit_on_bad_argument(main_context, FALSE,
+                             "--loop can only be used with a single device, "
+                             "and not along with --stream");
+
+    if (batch_window < 0)
+        exit_on_bad_argument(main_context, FALSE,
+                             "The batch window can't be negative");
+
+    if (batch_window && (argc > 2 || fan_out > 1))
+        exit_on_bad_argument(main_context, FALSE,
+                             "--batch-window can only be used with a single "
+                             "device");
+
+    if (stream_log && (start_at > 0 || end_at >= 0))
+        exit_on_bad_argument(main_context, FALSE,
+                             "--stream can't be used along with --start-at "
+                             "or --end-at");
+
+    if (packet_size && !whole_packets)
+        exit_on_bad_argument(main_context, FALSE,
+                             "--packet-size can only be used along with "
+                             "--packets");
+
+    if (packet_size != 0 && packet_size != 3 && packet_size != 4 &&
+        packet_size != 6)
+        exit_on_bad_argument(main_context, FALSE,
+                             "Packets are either 3, 4 or 6 bytes long");
+
+    if (whole_packets && (stream_log || argc > 2 || fan_out > 1))
+        exit_on_bad_argument(main_context, FALSE,
+                             "--packets can only be used with a single device, "
+                             "and not along with --stream");
+
+    if (simulate_script && !simulate)
+        exit_on_bad_argument(main_context, FALSE,
+                             "--simulate-script can only be used along with "
+                             "--simulate");
+
+    if (simulate && (argc > 2 || fan_out > 1 || keep_running))
+        exit_on_bad_argument(main_context, FALSE,
+                             "--simulate can only be used with a single "
+                             "device, and not along with --keep-running");
+
+    if (!realtime && (realtime_options.cpu != -1 ||
+                      realtime_options.priority != REALTIME_DEFAULT_PRIORITY))
+        exit_on_bad_argument(main_context, FALSE,
+                             "--cpu and --priority can only be used along "
+                             "with --realtime");
+
+    if (realtime && realtime_options.cpu < -1)
+        exit_on_bad_argument(main_context, FALSE,
+                             "Invalid CPU given");
+
+    if (socket_path && !daemon)
+        exit_on_bad_argument(main_context, FALSE,
+                             "--socket can only be used along with --daemon");
+
+    /* Everything else about how the logs get replayed is up to the daemon */
+    if (daemon && (stream_log || simulate || realtime || keep_running ||
+                   no_events || fan_out > 1 || loops != 1 || start_at > 0 ||
+                   end_at >= 0 || verbose || trace_path || print_stats ||
+                   stats_json || whole_packets || speed != 1.0 || no_timing ||
+                   max_wait || event_delay || note_delay || batch_window ||
+                   compress_idle >= 0 ||
+                   receive_timeout != PS2EMU_DEFAULT_RECEIVE_TIMEOUT))
+        exit_on_bad_argument(main_context, FALSE,
+                             "--daemon can't be used along with options that "
+                             "change how the logs get replayed, those are up "
+                             "to ps2emu-replayd");
+
+    if (daemon) {
+        if (!submit_to_daemon(&argv[1], socket_path ? socket_path :
+                                                      PS2EMU_DAEMON_SOCKET,
+                              &error))
+            goto error;
+
+        return 0;
+    }
+
     max_wait *= G_USEC_PER_SEC;
     event_delay = event_delay * G_USEC_PER_SEC + PS2EMU_MIN_EVENT_DELAY;
     note_delay *= G_USEC_PER_SEC;
 
-    input_channel = g_io_channel_new_file(argv[1], "r", &error);
-    if (!input_channel) {
-        g_prefix_error(&error, "While opening %s: ", argv[1]);
-        goto error;
+    /* Formatting and writing the trace is left to another thread, so that
+     * it can never hold up the replay */
+    if (verbose || trace_path) {
+        tracer = tracer_new(verbose ? stdout : NULL, trace_path, &error);
+        if (!tracer)
+            goto error;
     }
 
-    log_version = log_parse_version(input_channel, &error);
-    if (log_version > PS2EMU_LOG_VERSION) {
-        g_set_error(&error, PS2EMU_ERROR, PS2EMU_ERROR_INPUT,
-                    "Log version is too new (found %d, we only support up to "
-                    "%d)", log_version, PS2EMU_LOG_VERSION);
-        goto error;
+    replay_stats_init(&stats);
+    init_options = (ReplayOptions) {
+        .trace = tracer,
+        .speed = speed,
+        .no_timing = no_timing,
+        .receive_timeout = (time_t)receive_timeout * 1000,
+        /* Even if they don't get printed, they're how we know whether we've
+         * already warned about going out of sync */
+        .stats = &stats,
+    };
+    main_options = init_options;
+    main_options.max_wait = max_wait;
+    main_options.note_delay = note_delay;
+    main_options.batch_window = batch_window;
+
+    if (argc > 2 || fan_out > 1) {
+        /* replay_devices() takes care of the tracer from here on */
+        tracer = NULL;
+
+        if (!replay_devices(&argv[1], fan_out, start_at, end_at,
+                            compress_idle, &init_options, &main_options,
+                            event_delay, no_events, keep_running,
+                            print_stats, stats_json,
+                            realtime ? &realtime_options : NULL, &error))
+            goto error;
+
+        return 0;
     }
 
-    log = log_parse(input_channel, log_version, &error);
-    if (!log)
-        goto error;
+    if (stream_log) {
+        stream = log_stream_open(argv[1], &log_version, &error);
+        log = stream ? log_stream_get_log(stream) : NULL;
+
+        if (!log) {
+            g_prefix_error(&error, "While parsing %s: ", argv[1]);
+            goto error;
+        }
+    } else {
+        log = parse_log(argv[1], start_at, end_at, &log_version, &error);
+        if (!log)
+            goto error;
+    }
 
-    g_io_channel_unref(input_channel);
+    /* V0 logs are replayed as a single init section, which never gets its
+     * idle time shortened */
+    if (log_version == 0 && compress_idle >= 0)
+        exit_on_bad_argument(main_context, FALSE,
+                             "--compress-idle can't be used with V0 logs");
 
-    userio_channel = g_io_channel_new_file("/dev/userio", "r+", &error);
-    if (!userio_channel) {
-        g_prefix_error(&error, "While opening /dev/userio: ");
-        goto error;
+    if (whole_packets) {
+        packet_decoder_init(&packets, log->port, packet_size);
+        init_options.packets = &packets;
+        main_options.packets = &packets;
     }
 
-    rc = g_io_channel_set_encoding(userio_channel, NULL, &error);
-    if (rc != G_IO_STATUS_NORMAL) {
-        g_prefix_error(&error, "While opening /dev/userio: ");
-        goto error;
+    if (tracer) {
+        gchar *basename = g_path_get_basename(argv[1]);
+
+        init_options.trace_device = tracer_add_device(tracer, basename);
+        main_options.trace_device = init_options.trace_device;
+        tracer_start(tracer);
+
+        g_free(basename);
+    }
+
+    if (realtime) {
+        realtime_prefault_log(log);
+        realtime_apply(&realtime_options);
     }
-    g_io_channel_set_buffered(userio_channel, FALSE);
+
+    if (simulate) {
+        GArray *script = NULL;
+
+        if (simulate_script) {
+            script = replay_sim_load_script(simulate_script, &error);
+            if (!script)
+                goto error;
+        }
+
+        backend = replay_backend_sim_new(script);
+    } else {
+        backend = replay_backend_userio_new("/dev/userio", &error);
+        if (!backend) {
+            g_prefix_error(&error, "While opening /dev/userio: ");
+            goto error;
+        }
+    }
+    real_start = g_get_monotonic_time();
+    virtual_start = replay_backend_time(backend);
 
     port_type = (log->port == PS2_PORT_KBD) ? SERIO_8042_XL : SERIO_8042;
-    rc = send_userio_cmd(userio_channel, USERIO_CMD_SET_PORT_TYPE, port_type,
-                         &error);
+    rc = replay_backend_send(backend, USERIO_CMD_SET_PORT_TYPE, port_type,
+                             &error);
     if (rc != G_IO_STATUS_NORMAL) {
         g_prefix_error(&error, "While setting port type on /dev/userio: ");
         goto error;
     }
 
-    rc = send_userio_cmd(userio_channel, USERIO_CMD_REGISTER, 0, &error);
+    rc = replay_backend_send(backend, USERIO_CMD_REGISTER, 0, &error);
     if (rc != G_IO_STATUS_NORMAL) {
         g_prefix_error(&error, "While starting device on /dev/userio: ");
         goto error;
     }
 
     if (log_version == 0) {
-        if (!replay_line_list(userio_channel, log->main_section, 0, 0, verbose,
-                              &error))
+        if (!replay_main_section(backend, log, stream, &init_options, loops,
+                                 &error))
+            goto error;
+
+        if (!stop_tracer(&tracer, &error))
+            goto error;
+
+        if (!write_stats(&stats, print_stats, stats_json, &error))
             goto error;
     } else {
         printf("Replaying initialization sequence...\n");
-        if (!replay_line_list(userio_channel, log->init_section, 0, 0, verbose,
-                              &error))
+        if (!replay_compiled_section(backend, &log->init_section,
+                                     &init_options, 1, &error))
             goto error;
 
         printf("Device initialized\n");
 
         if (!no_events) {
             /* Sleep for half a second so we don't throw the driver out of sync */
-            g_usleep(event_delay);
+            replay_backend_sleep(backend, event_delay);
+
+            if (compress_idle >= 0)
+                setup_idle_compression(log, compress_idle * 1000,
+                                       &main_options);
 
             printf("Replaying event sequence...\n");
-            if (!replay_line_list(userio_channel, log->main_section, max_wait,
-                                  note_delay, verbose, &error))
+            if (!replay_main_section(backend, log, stream, &main_options,
+                                     loops, &error))
                 goto error;
         }
 
+        if (!stop_tracer(&tracer, &error))
+            goto error;
+
+        if (!write_stats(&stats, print_stats, stats_json, &error))
+            goto error;
+
         if (keep_running)
             pause();
     }
 
+    if (simulate)
+        printf("Simulated %.3f seconds of replaying in %.3f seconds\n",
+               (gdouble)(replay_backend_time(backend) - virtual_start) /
+               G_USEC_PER_SEC,
+               (gdouble)(g_get_monotonic_time() - real_start) /
+               G_USEC_PER_SEC);
+
     return 0;
 
 error:
+    /* Whatever got traced up until the failure is what matters most */
+    if (!stop_tracer(&tracer, &trace_error)) {
+        fprintf(stderr, "Error: %s\n", trace_error->message);
+        g_error_free(trace_error);
+    }
+
     fprintf(stderr, "Error: %s\n", error->message);
 
     return 1;
@@ -0,0 +1,536 @@
+/*
+ * ps2emu-replayd.c
+ * Copyright (C) 2015 Red Hat
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public License for more
+ * details.
+ */
+
+#include "ps2emu-log.h"
+#include "ps2emu-daemon.h"
+#include "ps2emu-replayer.h"
+#include "ps2emu-replay-program.h"
+#include "ps2emu-replay-sim.h"
+#include "ps2emu-misc.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <signal.h>
+#include <errno.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <glib.h>
+#include <linux/serio.h>
+#include <userio.h>
+
+#define PS2EMU_DEFAULT_MAX_DEVICES 16
+#define PS2EMU_DEFAULT_RECEIVE_TIMEOUT 1000
+
+/* A device that's been registered and had an init section replayed on it.
+ * Devices are only ever used by one job at a time, and are only ever reused
+ * for logs with the exact same init section. */
+typedef struct {
+    gchar         *key;
+    ReplayBackend *backend;
+} WarmDevice;
+
+typedef struct {
+    GMutex         lock;
+    GQueue         idle;  /* of WarmDevice, least recently used first */
+    guint          count; /* devices that are open, idle or not */
+    guint          max_devices;
+    gboolean       simulate;
+    time_t         event_delay;
+    ReplayOptions  init_options,
+                   main_options;
+} Daemon;
+
+static volatile sig_atomic_t quit_requested = FALSE;
+
+static void quit_on_signal(int signum) {
+    quit_requested = TRUE;
+}
+
+/* Two logs can share a device if the driver saw the same thing while
+ * initializing it, which only depends on the port and the bytes in the init
+ * section. The timing between them doesn't matter. */
+static gchar * init_section_key(const ParsedLog *log) {
+    GChecksum *checksum = g_checksum_new(G_CHECKSUM_SHA256);
+    GArray *events = log->init_section.events;
+    guint8 port = log->port;
+    gchar *key;
+
+    g_checksum_update(checksum, &port, sizeof(port));
+    for (guint i = 0; i < events->len; i++) {
+        LogEvent *event = &g_array_index(events, LogEvent, i);
+        guint8 bytes[] = { event->type, event->data };
+
+        g_checksum_update(checksum, bytes, sizeof(bytes));
+    }
+
+    key = g_strdup(g_checksum_get_string(checksum));
+    g_checksum_free(checksum);
+
+    return key;
+}
+
+static void warm_device_free(WarmDevice *device) {
+    replay_backend_free(device->backend);
+    g_free(device->key);
+    g_free(device);
+}
+
+/* Takes an idle device that was initialized with @key out of the pool, or
+ * reserves room for a new one if there isn't any. Running jobs never
+ * outnumber the devices we're allowed, so if we're out of room there's always
+ * an idle device to close. */
+static WarmDevice * pool_take(Daemon *daemon,
+                              const gchar *key) {
+    WarmDevice *device = NULL,
+               *evicted = NULL;
+
+    g_mutex_lock(&daemon->lock);
+
+    for (GList *l = daemon->idle.head; l; l = l->next) {
+        WarmDevice *idle = l->data;
+
+        if (strcmp(idle->key, key) == 0) {
+            device = idle;
+            g_queue_delete_link(&daemon->idle, l);
+            break;
+        }
+    }
+
+    if (!device) {
+        if (daemon->count >= daemon->max_devices) {
+            evicted = g_queue_pop_head(&daemon->idle);
+            g_warn_if_fail(evicted != NULL);
+        } else {
+            daemon->count++;
+        }
+    }
+
+    g_mutex_unlock(&daemon->lock);
+
+    /* Closing the device can take a while, the kernel has to unregister it */
+    if (evicted)
+        warm_device_free(evicted);
+
+    return device;
+}
+
+static void pool_release(Daemon *daemon,
+                         WarmDevice *device) {
+    g_mutex_lock(&daemon->lock);
+    g_queue_push_tail(&daemon->idle, device);
+    g_mutex_unlock(&daemon->lock);
+}
+
+/* For devices that can't be trusted to be in the state their key says they
+ * are, and room that was reserved for a device that never got set up */
+static void pool_discard(Daemon *daemon,
+                         WarmDevice *device) {
+    g_mutex_lock(&daemon->lock);
+    daemon->count--;
+    g_mutex_unlock(&daemon->lock);
+
+    if (device)
+        warm_device_free(device);
+}
+
+static WarmDevice * warm_device_new(Daemon *daemon,
+                                    ParsedLog *log,
+                                    const gchar *key,
+                                    GError **error) {
+    WarmDevice *device = g_new0(WarmDevice, 1);
+    ReplayProgram *program;
+    __u8 port_type;
+    GIOStatus rc;
+    gboolean ret;
+
+    if (daemon->simulate) {
+        device->backend = replay_backend_sim_new(NULL);
+    } else {
+        device->backend = replay_backend_userio_new("/dev/userio", error);
+        if (!device->backend) {
+            g_prefix_error(error, "While opening /dev/userio: ");
+            goto error;
+        }
+    }
+    device->key = g_strdup(key);
+
+    port_type = (log->port == PS2_PORT_KBD) ? SERIO_8042_XL : SERIO_8042;
+    rc = replay_backend_send(device->backend, USERIO_CMD_SET_PORT_TYPE,
+                             port_type, error);
+    if (rc != G_IO_STATUS_NORMAL) {
+        g_prefix_error(error, "While setting port type on /dev/userio: ");
+        goto error;
+    }
+
+    rc = replay_backend_send(device->backend, USERIO_CMD_REGISTER, 0, error);
+    if (rc != G_IO_STATUS_NORMAL) {
+        g_prefix_error(error, "While starting device on /dev/userio: ");
+        goto error;
+    }
+
+    program = replay_program_compile(&log->init_section,
+                                     &daemon->init_options);
+    ret = replay_program_run(device->backend, program, &daemon->init_options,
+                             error);
+    replay_program_free(program);
+    if (!ret) {
+        g_prefix_error(error, "While initializing the device: ");
+        goto error;
+    }
+
+    /* So we don't throw the driver out of sync */
+    replay_backend_sleep(device->backend, daemon->event_delay);
+
+    return device;
+
+error:
+    if (device->backend)
+        replay_backend_free(device->backend);
+    g_free(device->key);
+    g_free(device);
+
+    return NULL;
+}
+
+/* Returns the reply line for the job */
+static gchar * run_job(Daemon *daemon,
+                       const gchar *path,
+                       GError **error) {
+    ReplayOptions options = daemon->main_options;
+    ReplayProgram *program;
+    ReplayStats stats;
+    DaemonResult result = { 0 };
+    WarmDevice *device;
+    gchar *reply = NULL;
+    ParsedLog *log;
+    gchar *key;
+    gint log_version;
+    time_t start;
+    gboolean ret;
+
+    if (!g_path_is_absolute(path)) {
+        g_set_error(error, PS2EMU_ERROR, PS2EMU_ERROR_INPUT,
+                    "%s isn't an absolute path", path);
+        return NULL;
+    }
+
+    log = log_parse_file(path, &log_version, error);
+    if (!log) {
+        /* Errors about what's in the file quote the line they choke on,
+         * which isn't something to hand back to whoever asked for it. That
+         * stays in our own output. */
+        if ((*error)->domain == PS2EMU_ERROR) {
+            fprintf(stderr, "%s: %s\n", path, (*error)->message);
+            g_clear_error(error);
+            g_set_error(error, PS2EMU_ERROR, PS2EMU_ERROR_INPUT,
+                        "%s isn't a valid log", path);
+        } else {
+            g_prefix_error(error, "While parsing %s: ", path);
+        }
+
+        return NULL;
+    }
+
+    if (log_version < 1) {
+        g_set_error(error, PS2EMU_ERROR, PS2EMU_ERROR_INPUT,
+                    "%s is a V0 log, which doesn't have an init section to "
+                    "keep a device warm with", path);
+        log_free(log);
+        return NULL;
+    }
+
+    key = init_section_key(log);
+    device = pool_take(daemon, key);
+    result.warm = device != NULL;
+
+    if (!device) {
+        device = warm_device_new(daemon, log, key, error);
+        if (!device) {
+            pool_discard(daemon, NULL);
+            goto out;
+        }
+    }
+
+    replay_stats_init(&stats);
+    options.stats = &stats;
+
+    program = replay_program_compile(&log->main_section, &options);
+    start = g_get_monotonic_time();
+    ret = replay_program_run(device->backend, program, &options, error);
+    result.seconds = (gdouble)(g_get_monotonic_time() - start) /
+                     G_USEC_PER_SEC;
+    replay_program_free(program);
+
+    /* Whatever state the driver's left in after a desync isn't something the
+     * next log with this init section should have to start from */
+    if (!ret || stats.receive_mismatches || stats.receive_timeouts)
+        pool_discard(daemon, device);
+    else
+        pool_release(daemon, device);
+
+    if (!ret)
+        goto out;
+
+    result.sent = stats.send_jitter.count;
+    result.received = stats.receive_latency.count;
+    result.mismatches = stats.receive_mismatches;
+    result.timeouts = stats.receive_timeouts;
+    reply = daemon_format_result(&result);
+
+out:
+    g_free(key);
+    log_free(log);
+
+    return reply;
+}
+
+static void handle_connection(gpointer data,
+                              gpointer user_data) {
+    Daemon *daemon = user_data;
+    gint fd = GPOINTER_TO_INT(data);
+    GString *request = g_string_new(NULL);
+    gchar *reply = NULL;
+    GError *error = NULL;
+
+    if (!daemon_read_line(fd, request, &error)) {
+        fprintf(stderr, "Warning: While reading a request: %s\n",
+                error->message);
+        goto out;
+    }
+
+    if (g_str_has_prefix(request->str, "REPLAY ")) {
+        const gchar *path = request->str + strlen("REPLAY ");
+
+        printf("Replaying %s...\n", path);
+        reply = run_job(daemon, path, &error);
+        if (reply)
+            printf("%s: %s\n", path, reply);
+        else
+            fprintf(stderr, "%s: %s\n", path, error->message);
+    } else {
+        g_set_error(&error, PS2EMU_ERROR, PS2EMU_ERROR_INPUT,
+                    "Unknown request \"%s\"", request->str);
+    }
+
+    if (!reply)
+        reply = g_strconcat("ERROR ", error->message, NULL);
+    g_clear_error(&error);
+
+    if (!daemon_write_line(fd, reply, &error))
+        fprintf(stderr, "Warning: While replying to a request: %s\n",
+                error->message);
+
+out:
+    g_clear_error(&error);
+    g_free(reply);
+    g_string_free(request, TRUE);
+    close(fd);
+}
+
+static gint listen_on(const gchar *path,
+                      GError **error) {
+    struct sockaddr_un addr = { .sun_family = AF_UNIX };
+    mode_t old_umask;
+    gint fd,
+         ret;
+
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        g_set_error(error, PS2EMU_ERROR, PS2EMU_ERROR_INPUT,
+                    "Socket path %s is too long", path);
+        return -1;
+    }
+    strcpy(addr.sun_path, path);
+
+    /* Left over from a daemon that didn't get to clean up after itself */
+    if (unlink(path) < 0 && errno != ENOENT)
+        goto error;
+
+    fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0)
+        goto error;
+
+    /* Anyone who can connect gets us to open whatever file they like, so
+     * only the user we're running as gets to. Doing this through the umask
+     * means there's never a moment where the socket is open to everyone. */
+    old_umask = umask(S_IRWXG | S_IRWXO | S_IXUSR);
+    ret = bind(fd, (struct sockaddr*)&addr, sizeof(addr));
+    umask(old_umask);
+
+    if (ret < 0 || listen(fd, SOMAXCONN) < 0) {
+        close(fd);
+        goto error;
+    }
+
+    return fd;
+
+error:
+    g_set_error(error, G_FILE_ERROR, g_file_error_from_errno(errno),
+                "While listening on %s: %s", path, g_strerror(errno));
+    return -1;
+}
+
+gint main(gint argc,
+          gchar *argv[]) {
+    GOptionContext *main_context =
+        g_option_context_new("- keep initialized PS/2 devices around for "
+                             "replaying logs on");
+    gchar *socket_path = NULL;
+    gint max_devices = PS2EMU_DEFAULT_MAX_DEVICES,
+         receive_timeout = PS2EMU_DEFAULT_RECEIVE_TIMEOUT,
+         batch_window = 0;
+    time_t max_wait = 0,
+           event_delay = 0;
+    gboolean no_timing = FALSE,
+             simulate = FALSE;
+    struct sigaction sigaction_struct;
+    GThreadPool *workers;
+    GError *error = NULL;
+    WarmDevice *device;
+    Daemon daemon;
+    gint listen_fd;
+
+    GOptionEntry options[] = {
+        { "version", 'V', G_OPTION_FLAG_NO_ARG, G_OPTION_ARG_CALLBACK,
+          print_version, "Show the version of the application", NULL },
+        { "socket", 's', G_OPTION_FLAG_NONE, G_OPTION_ARG_FILENAME,
+          &socket_path, "Listen for logs to replay on path (defaults to "
+          PS2EMU_DAEMON_SOCKET ")", "path" },
+        { "max-devices", 'm', G_OPTION_FLAG_NONE, G_OPTION_ARG_INT,
+          &max_devices, "Keep no more than n devices around at once, which is "
+          "also how many logs get replayed at once (defaults to 16)", "n" },
+        { "max-wait", 'w', G_OPTION_FLAG_NONE, G_OPTION_ARG_INT,
+          &max_wait, "Don't wait for longer then n seconds between events",
+          "n", },
+        { "event-delay", 'd', G_OPTION_FLAG_NONE, G_OPTION_ARG_INT,
+          &event_delay, "Wait n seconds after initializing a new device "
+          "before playing events", "n" },
+        { "receive-timeout", 't', G_OPTION_FLAG_NONE, G_OPTION_ARG_INT,
+          &receive_timeout, "Give up on data from the driver that's n "
+          "milliseconds late, 0 to wait forever (defaults to 1000)", "n" },
+        { "no-timing", 0, G_OPTION_FLAG_NONE, G_OPTION_ARG_NONE,
+          &no_timing, "Replay events as fast as the driver can keep up with "
+          "them, ignoring the timing in the log", NULL },
+        { "batch-window", 'b', G_OPTION_FLAG_NONE, G_OPTION_ARG_INT,
+          &batch_window, "Send interrupts that are due within n microseconds "
+          "of each other with a single write", "n" },
+        { "simulate", 0, G_OPTION_FLAG_NONE, G_OPTION_ARG_NONE,
+          &simulate, "Don't use /dev/userio, simulate the driver instead "
+          "and skip over all the waiting", NULL },
+        { 0 }
+    };
+
+    g_option_context_add_main_entries(main_context, options, NULL);
+    g_option_context_set_help_enabled(main_context, TRUE);
+    g_option_context_set_description(main_context,
+        "Replays logs created with ps2emu-record on devices that have already "
+        "been initialized.\nLogs are submitted with ps2emu-replay --daemon.\n");
+
+    if (!g_option_context_parse(main_context, &argc, &argv, &error))
+        exit_on_bad_argument(main_context, TRUE, error->message);
+
+    if (argc > 1)
+        exit_on_bad_argument(main_context, TRUE, "Too many arguments");
+
+    if (max_devices < 1)
+        exit_on_bad_argument(main_context, FALSE,
+                             "There has to be room for at least one device");
+
+    if (receive_timeout < 0)
+        exit_on_bad_argument(main_context, FALSE,
+                             "The receive timeout can't be negative");
+
+    if (batch_window < 0)
+        exit_on_bad_argument(main_context, FALSE,
+                             "The batch window can't be negative");
+
+    daemon = (Daemon) {
+        .max_devices = max_devices,
+        .simulate = simulate,
+        .event_delay = event_delay * G_USEC_PER_SEC + PS2EMU_MIN_EVENT_DELAY,
+        .init_options = {
+            .speed = 1.0,
+            .no_timing = no_timing,
+            .receive_timeout = (time_t)receive_timeout * 1000,
+        },
+    };
+    g_mutex_init(&daemon.lock);
+    g_queue_init(&daemon.idle);
+    daemon.main_options = daemon.init_options;
+    daemon.main_options.max_wait = max_wait * G_USEC_PER_SEC;
+    daemon.main_options.batch_window = batch_window;
+
+    if (!socket_path)
+        socket_path = g_strdup(PS2EMU_DAEMON_SOCKET);
+
+    listen_fd = listen_on(socket_path, &error);
+    if (listen_fd < 0)
+        goto error;
+
+    /* No SA_RESTART, so that accept() gets interrupted */
+    memset(&sigaction_struct, 0, sizeof(sigaction_struct));
+    sigaction_struct.sa_handler = quit_on_signal;
+
+    g_warn_if_fail(sigaction(SIGINT, &sigaction_struct, NULL) == 0);
+    g_warn_if_fail(sigaction(SIGTERM, &sigaction_struct, NULL) == 0);
+
+    /* Clients going away before we reply shouldn't take us with them */
+    sigaction_struct.sa_handler = SIG_IGN;
+    g_warn_if_fail(sigaction(SIGPIPE, &sigaction_struct, NULL) == 0);
+
+    /* One thread per device, so that jobs that come in while every device is
+     * busy wait in the pool's queue */
+    workers = g_thread_pool_new(handle_connection, &daemon, max_devices,
+                                FALSE, &error);
+    if (!workers)
+        goto error;
+
+    printf("Listening on %s\n", socket_path);
+    while (!quit_requested) {
+        gint fd = accept(listen_fd, NULL, NULL);
+
+        if (fd < 0) {
+            if (errno == EINTR || errno == ECONNABORTED)
+                continue;
+
+            g_set_error(&error, G_FILE_ERROR, g_file_error_from_errno(errno),
+                        "While accepting connections: %s", g_strerror(errno));
+            break;
+        }
+
+        g_thread_pool_push(workers, GINT_TO_POINTER(fd), NULL);
+    }
+
+    close(listen_fd);
+    unlink(socket_path);
+
+    /* Finish whatever we've already accepted */
+    g_thread_pool_free(workers, FALSE, TRUE);
+
+    while ((device = g_queue_pop_head(&daemon.idle)))
+        warm_device_free(device);
+
+    if (error)
+        goto error;
+
+    return 0;
+
+error:
+    fprintf(stderr, "Error: %s\n", error->message);
+
+    return 1;
+}
@@ -0,0 +1,651 @@
+/*
+ * ps2emu-replayer.c
+ * Copyright (C) 2015 Red Hat
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public License for more
+ * details.
+ */
+
+#include "ps2emu-replayer.h"
+#include "ps2emu-log.h"
+#include "ps2emu-scheduler.h"
+
+#include <stdio.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <errno.h>
+#include <glib.h>
+#include <sys/uio.h>
+#include <sys/timerfd.h>
+#include <linux/serio.h>
+#include <userio.h>
+
+/* Anything past this many bytes from the driver that we weren't ready for
+ * yet gets dropped */
+#define USERIO_INPUT_SIZE 256
+
+typedef struct {
+    ReplayBackend backend;
+    GIOChannel   *channel;
+    gint          fd,
+                  timer_fd;
+    Scheduler     scheduler;
+
+    /* Whatever the driver sent while we were waiting to send something,
+     * waiting to be matched up against what the log expects */
+    guint8        input[USERIO_INPUT_SIZE];
+    guint         input_start,
+                  input_len;
+} ReplayBackendUserio;
+
+static GIOStatus userio_send(ReplayBackend *backend,
+                             guint8 type,
+                             guint8 data,
+                             GError **error) {
+    ReplayBackendUserio *userio = (ReplayBackendUserio*)backend;
+    struct userio_cmd cmd = {
+        .type = type,
+        .data = data,
+    };
+
+    return g_io_channel_write_chars(userio->channel, (gchar*)&cmd,
+                                    sizeof(cmd), NULL, error);
+}
+
+/* userio only takes one command per write(), but writev() on a device without
+ * write_iter() hands each iovec to write() in turn, so a whole batch still
+ * only costs one syscall */
+static GIOStatus userio_send_commands(ReplayBackend *backend,
+                                      const struct userio_cmd *cmds,
+                                      guint count,
+                                      GError **error) {
+    ReplayBackendUserio *userio = (ReplayBackendUserio*)backend;
+    struct iovec iov[REPLAY_BATCH_MAX];
+    guint sent = 0;
+
+    g_assert(count <= REPLAY_BATCH_MAX);
+
+    for (guint i = 0; i < count; i++) {
+        iov[i] = (struct iovec) {
+            .iov_base = (gpointer)&cmds[i],
+            .iov_len = sizeof(cmds[i]),
+        };
+    }
+
+    while (sent < count) {
+        gssize ret = writev(userio->fd, &iov[sent], count - sent);
+
+        if (ret < 0) {
+            if (errno == EINTR)
+                continue;
+
+            g_set_error(error, G_IO_CHANNEL_ERROR,
+                        g_io_channel_error_from_errno(errno),
+                        "%s", g_strerror(errno));
+            return G_IO_STATUS_ERROR;
+        }
+
+        sent += ret / sizeof(struct userio_cmd);
+    }
+
+    return G_IO_STATUS_NORMAL;
+}
+
+static GIOStatus userio_send_interrupts(ReplayBackend *backend,
+                                        const guint8 *data,
+                                        guint count,
+                                        GError **error) {
+    struct userio_cmd cmds[REPLAY_BATCH_MAX];
+
+    g_assert(count <= REPLAY_BATCH_MAX);
+
+    for (guint i = 0; i < count; i++) {
+        cmds[i] = (struct userio_cmd) {
+            .type = USERIO_CMD_SEND_INTERRUPT,
+            .data = data[i],
+        };
+    }
+
+    return userio_send_commands(backend, cmds, count, error);
+}
+
+static void userio_push_input(ReplayBackendUserio *userio,
+                              guint8 data) {
+    if (userio->input_len == USERIO_INPUT_SIZE) {
+        userio->input_start = (userio->input_start + 1) % USERIO_INPUT_SIZE;
+        userio->input_len--;
+    }
+
+    userio->input[(userio->input_start + userio->input_len) %
+                  USERIO_INPUT_SIZE] = data;
+    userio->input_len++;
+}
+
+/* Reads everything the driver's sent so far without blocking */
+static GIOStatus userio_read_input(ReplayBackendUserio *userio,
+                                   GError **error) {
+    guint8 buf[64];
+    gssize ret;
+
+    for (;;) {
+        ret = read(userio->fd, buf, sizeof(buf));
+        if (ret > 0) {
+            for (gssize i = 0; i < ret; i++)
+                userio_push_input(userio, buf[i]);
+            continue;
+        }
+
+        if (ret == 0)
+            return G_IO_STATUS_EOF;
+        if (errno == EINTR)
+            continue;
+        if (errno == EAGAIN)
+            return G_IO_STATUS_NORMAL;
+
+        g_set_error(error, G_IO_CHANNEL_ERROR,
+                    g_io_channel_error_from_errno(errno),
+                    "%s", g_strerror(errno));
+        return G_IO_STATUS_ERROR;
+    }
+}
+
+static GIOStatus userio_receive(ReplayBackend *backend,
+                                guchar expected,
+                                guchar *data,
+                                time_t deadline,
+                                GError **error) {
+    ReplayBackendUserio *userio = (ReplayBackendUserio*)backend;
+    struct pollfd pollfd = {
+        .fd = userio->fd,
+        .events = POLLIN,
+    };
+    GIOStatus rc;
+
+    for (;;) {
+        time_t remaining;
+
+        if (userio->input_len) {
+            *data = userio->input[userio->input_start];
+            userio->input_start = (userio->input_start + 1) %
+                                  USERIO_INPUT_SIZE;
+            userio->input_len--;
+
+            return G_IO_STATUS_NORMAL;
+        }
+
+        rc = userio_read_input(userio, error);
+        if (rc != G_IO_STATUS_NORMAL)
+            return rc;
+        if (userio->input_len)
+            continue;
+
+        if (!deadline) {
+            poll(&pollfd, 1, -1);
+            continue;
+        }
+
+        remaining = deadline - g_get_monotonic_time();
+        if (remaining <= 0)
+            return G_IO_STATUS_AGAIN;
+
+        /* Timeouts don't need to be precise, just rounded up */
+        poll(&pollfd, 1, (remaining + 999) / 1000);
+    }
+}
+
+/* Sleeps on a timerfd instead of clock_nanosleep(), so that anything the
+ * driver sends in the meantime gets read right away instead of waiting for
+ * us to get around to it */
+static void userio_sleep_until(gint64 wake_time,
+                               gpointer user_data) {
+    ReplayBackendUserio *userio = user_data;
+    struct itimerspec spec = {
+        .it_value = {
+            .tv_sec = wake_time / (1000 * G_USEC_PER_SEC),
+            .tv_nsec = wake_time % (1000 * G_USEC_PER_SEC),
+        },
+    };
+    struct pollfd pollfds[] = {
+        { .fd = userio->timer_fd, .events = POLLIN },
+        { .fd = userio->fd, .events = POLLIN },
+    };
+
+    timerfd_settime(userio->timer_fd, TFD_TIMER_ABSTIME, &spec, NULL);
+
+    for (;;) {
+        guint64 expirations;
+
+        if (poll(pollfds, G_N_ELEMENTS(pollfds), -1) < 0) {
+            if (errno == EINTR)
+                continue;
+            return;
+        }
+
+        /* Errors get reported once someone actually tries to receive
+         * something, until then we just stop listening */
+        if (pollfds[1].revents & (POLLERR | POLLHUP | POLLNVAL) ||
+            (pollfds[1].revents & POLLIN &&
+             userio_read_input(userio, NULL) != G_IO_STATUS_NORMAL))
+            pollfds[1].fd = -1;
+
+        if (pollfds[0].revents & POLLIN) {
+            if (read(userio->timer_fd, &expirations,
+                     sizeof(expirations)) < 0 && errno == EAGAIN)
+                continue;
+            return;
+        }
+    }
+}
+
+static void userio_wait_until(ReplayBackend *backend,
+                              time_t deadline) {
+    ReplayBackendUserio *userio = (ReplayBackendUserio*)backend;
+
+    scheduler_wait_until_with(&userio->scheduler, deadline * 1000,
+                              userio_sleep_until, userio);
+}
+
+static void userio_free(ReplayBackend *backend) {
+    ReplayBackendUserio *userio = (ReplayBackendUserio*)backend;
+
+    g_io_channel_unref(userio->channel);
+    close(userio->timer_fd);
+    g_free(userio);
+}
+
+ReplayBackend * replay_backend_userio_new(const gchar *path,
+                                          GError **error) {
+    ReplayBackendUserio *userio;
+    GIOChannel *channel;
+    gint fd,
+         timer_fd;
+
+    channel = g_io_channel_new_file(path, "r+", error);
+    if (!channel)
+        return NULL;
+
+    if (g_io_channel_set_encoding(channel, NULL, error) !=
+        G_IO_STATUS_NORMAL) {
+        g_io_channel_unref(channel);
+        return NULL;
+    }
+    g_io_channel_set_buffered(channel, FALSE);
+
+    /* Reads happen straight on the fd, and never block */
+    fd = g_io_channel_unix_get_fd(channel);
+    timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (timer_fd < 0 ||
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK) < 0) {
+        g_set_error(error, G_FILE_ERROR, g_file_error_from_errno(errno),
+                    "%s", g_strerror(errno));
+        if (timer_fd >= 0)
+            close(timer_fd);
+        g_io_channel_unref(channel);
+        return NULL;
+    }
+
+    userio = g_new0(ReplayBackendUserio, 1);
+    userio->backend = (ReplayBackend) {
+        .send = userio_send,
+        .send_interrupts = userio_send_interrupts,
+        .send_commands = userio_send_commands,
+        .receive = userio_receive,
+        .wait_until = userio_wait_until,
+        .free = userio_free,
+    };
+    userio->channel = channel;
+    userio->fd = fd;
+    userio->timer_fd = timer_fd;
+    scheduler_init(&userio->scheduler);
+
+    return &userio->backend;
+}
+
+/* The null backend drops everything sent to it, always receives exactly what
+ * the log expects and never sleeps. All that's left is the replay loop
+ * itself, which is what the benchmarks want to measure. */
+
+static GIOStatus null_send(ReplayBackend *backend,
+                           guint8 type,
+                           guint8 data,
+                           GError **error) {
+    return G_IO_STATUS_NORMAL;
+}
+
+static GIOStatus null_receive(ReplayBackend *backend,
+                              guchar expected,
+                              guchar *data,
+                              time_t deadline,
+                              GError **error) {
+    *data = expected;
+
+    return G_IO_STATUS_NORMAL;
+}
+
+static void null_wait_until(ReplayBackend *backend,
+                            time_t deadline) {
+}
+
+static void null_free(ReplayBackend *backend) {
+    g_free(backend);
+}
+
+ReplayBackend * replay_backend_null_new(void) {
+    ReplayBackend *backend = g_new0(ReplayBackend, 1);
+
+    *backend = (ReplayBackend) {
+        .send = null_send,
+        .receive = null_receive,
+        .wait_until = null_wait_until,
+        .free = null_free,
+    };
+
+    return backend;
+}
+
+GIOStatus replay_backend_send_interrupts(ReplayBackend *backend,
+                                        const guint8 *data,
+                                        guint count,
+                                        GError **error) {
+    GIOStatus rc = G_IO_STATUS_NORMAL;
+
+    if (backend->send_interrupts)
+        return backend->send_interrupts(backend, data, count, error);
+
+    for (guint i = 0; i < count && rc == G_IO_STATUS_NORMAL; i++)
+        rc = backend->send(backend, USERIO_CMD_SEND_INTERRUPT, data[i], error);
+
+    return rc;
+}
+
+GIOStatus replay_backend_send_commands(ReplayBackend *backend,
+                                       const struct userio_cmd *cmds,
+                                       guint count,
+                                       GError **error) {
+    GIOStatus rc = G_IO_STATUS_NORMAL;
+
+    if (backend->send_commands)
+        return backend->send_commands(backend, cmds, count, error);
+
+    for (guint i = 0; i < count && rc == G_IO_STATUS_NORMAL; i++)
+        rc = backend->send(backend, cmds[i].type, cmds[i].data, error);
+
+    return rc;
+}
+
+/* Sends @count interrupts at once, as soon as the first one is due */
+static gboolean simulate_interrupts(ReplayBackend *backend,
+                                    const time_t *deadlines,
+                                    const guint8 *data,
+                                    guint count,
+                                    const ReplayOptions *options,
+                                    GError **error) {
+    GIOStatus rc;
+
+    /* Without timing, the only thing holding us back is the driver, and
+     * replay_simulate_receive() already blocks until it's sent what we
+     * expect */
+    if (!options->no_timing)
+        replay_backend_wait_until(backend, deadlines[0]);
+
+    if (options->stats && !options->no_timing) {
+        gint64 now = replay_backend_now(backend);
+
+        for (guint i = 0; i < count; i++)
+            replay_stats_add_send(options->stats, deadlines[i] * 1000, now);
+    }
+
+    if (options->trace) {
+        gint64 now = replay_backend_now(backend);
+
+        for (guint i = 0; i < count; i++)
+            tracer_push(options->trace, TRACE_SEND, options->trace_device,
+                        data[i], 0, now,
+                        options->no_timing ? 0 : deadlines[i] * 1000);
+    }
+
+    rc = replay_backend_send_interrupts(backend, data, count, error);
+    if (rc != G_IO_STATUS_NORMAL)
+        return FALSE;
+
+    return TRUE;
+}
+
+gboolean replay_simulate_receive(ReplayBackend *backend,
+                                 guchar event_data,
+                                 time_t deadline,
+                                 const ReplayOptions *options,
+                                 GError **error) {
+    guchar data;
+    gint64 start = 0,
+           end = 0;
+    GIOStatus rc;
+
+    if (options->stats || options->trace)
+        start = replay_backend_now(backend);
+
+    rc = replay_backend_receive(backend, event_data, &data, deadline, error);
+
+    if (options->stats || options->trace)
+        end = replay_backend_now(backend);
+
+    /* Better to carry on without it than to hang forever */
+    if (rc == G_IO_STATUS_AGAIN) {
+        if (!options->quiet)
+            fprintf(stderr, "Timed out waiting for %.2hhx from the driver\n",
+                    event_data);
+
+        if (options->trace)
+            tracer_push(options->trace, TRACE_TIMEOUT, options->trace_device,
+                        0, event_data, end, start);
+
+        if (options->stats)
+            replay_stats_add_timeout(options->stats, event_data);
+
+        return TRUE;
+    }
+
+    if (rc != G_IO_STATUS_NORMAL)
+        return FALSE;
+
+    if (options->stats)
+        replay_stats_add_receive(options->stats, end - start);
+
+    if (options->trace)
+        tracer_push(options->trace,
+                    event_data == data ? TRACE_RECEIVE : TRACE_MISMATCH,
+                    options->trace_device, data, event_data, end, start);
+
+    if (event_data != data) {
+        if (!options->quiet)
+            fprintf(stderr, "Expected %.2hhx, received %.2hhx\n",
+                    event_data, data);
+
+        /* The stats are what keeps track of whether this run's already
+         * gone out of sync, so they only get the warning once */
+        if (options->stats) {
+            replay_stats_add_mismatch(options->stats, event_data, data);
+
+            if (options->stats->receive_mismatches == 1 && !options->quiet)
+                fprintf(stderr,
+                        "The device has gone out of sync with the recording, "
+                        "playback from this point forward will probably "
+                        "fail.\n");
+        }
+    }
+
+    return TRUE;
+}
+
+void replay_clock_init(ReplayClock *clock,
+                       time_t start_time) {
+    *clock = (ReplayClock) {
+        .start_time = start_time,
+        .first_event = TRUE,
+    };
+}
+
+void replay_print_note(ReplayBackend *backend,
+                       const gchar *text,
+                       const ReplayOptions *options) {
+    if (options->quiet)
+        return;
+
+    /* With -v the sends and receives before this are still on their way
+     * through the tracer, so the note has to go the same way to come out
+     * after them */
+    if (options->trace &&
+        tracer_push_note(options->trace, options->trace_device, text,
+                         replay_backend_now(backend)))
+        return;
+
+    printf("User note: %s\n",
+           text);
+}
+
+static void replay_notes(ReplayBackend *backend,
+                         LogSection *section,
+                         guint *note_idx,
+                         guint position,
+                         const ReplayOptions *options,
+                         ReplayClock *clock) {
+    for (; *note_idx < section->notes->len; (*note_idx)++) {
+        LogNote *note = &g_array_index(section->notes, LogNote, *note_idx);
+
+        if (note->position > position)
+            break;
+
+        replay_print_note(backend, note->text, options);
+
+        replay_backend_sleep(backend, options->note_delay);
+        clock->offset -= options->note_delay;
+    }
+}
+
+/* Moves the clock up to @event, returns FALSE if there's nothing to replay
+ * for it */
+gboolean replay_clock_advance(ReplayClock *clock,
+                              const LogEvent *event,
+                              const ReplayOptions *options) {
+    clock->event_time += event->delta;
+    if (event->type == LOG_EVENT_TYPE_DELAY)
+        return FALSE;
+
+    if (!clock->first_event) {
+        time_t wait_time = clock->event_time - clock->last_event_time,
+               new_wait_time = wait_time;
+
+        if (options->max_wait)
+            new_wait_time = MIN(new_wait_time, options->max_wait);
+
+        if (options->idle_threshold && wait_time >= options->idle_threshold)
+            new_wait_time = MIN(new_wait_time, options->idle_target);
+
+        /* If necessary, time-travel to the future */
+        if (new_wait_time != wait_time)
+            clock->offset += (wait_time - new_wait_time) / options->speed;
+    }
+    clock->last_event_time = clock->event_time;
+    clock->first_event = FALSE;
+
+    return TRUE;
+}
+
+/* Adds the interrupts right after event @i to the batch, for as long as they
+ * fall within the batch window of the first one. Anything that has to happen
+ * in between, like a receive or a user note, ends the batch. Returns the index
+ * of the last event in the batch. */
+static guint collect_batch(LogSection *section,
+                           guint i,
+                           guint note_idx,
+                           ReplayClock *clock,
+                           const ReplayOptions *options,
+                           time_t *deadlines,
+                           guint8 *data,
+                           guint *count) {
+    ReplayClock next_clock = *clock;
+    guint last = i;
+
+    while (*count < REPLAY_BATCH_MAX && ++i < section->events->len) {
+        const LogEvent *event = &g_array_index(section->events, LogEvent, i);
+        time_t deadline;
+
+        if (note_idx < section->notes->len &&
+            g_array_index(section->notes, LogNote, note_idx).position <= i)
+            break;
+
+        if (!replay_clock_advance(&next_clock, event, options))
+            continue;
+
+        if (event->type != LOG_EVENT_TYPE_INTERRUPT)
+            break;
+
+        deadline = replay_clock_deadline(&next_clock, options);
+        if (deadline - deadlines[0] > options->batch_window)
+            break;
+
+        deadlines[*count] = deadline;
+        data[*count] = event->data;
+        (*count)++;
+
+        *clock = next_clock;
+        last = i;
+    }
+
+    return last;
+}
+
+gboolean replay_section(ReplayBackend *backend,
+                        LogSection *section,
+                        ReplayClock *clock,
+                        const ReplayOptions *options,
+                        GError **error) {
+    time_t deadlines[REPLAY_BATCH_MAX];
+    guint8 data[REPLAY_BATCH_MAX];
+    guint note_idx = 0;
+
+    for (guint i = 0; i < section->events->len; i++) {
+        const LogEvent *event = &g_array_index(section->events, LogEvent, i);
+
+        replay_notes(backend, section, &note_idx, i, options, clock);
+
+        if (!replay_clock_advance(clock, event, options))
+            continue;
+
+        if (event->type == LOG_EVENT_TYPE_INTERRUPT) {
+            guint count = 1;
+
+            deadlines[0] = replay_clock_deadline(clock, options);
+            data[0] = event->data;
+
+            if (options->batch_window)
+                i = collect_batch(section, i, note_idx, clock, options,
+                                  deadlines, data, &count);
+
+            if (!simulate_interrupts(backend, deadlines, data, count,
+                                     options, error))
+                return FALSE;
+        } else {
+            time_t deadline =
+                replay_receive_deadline(clock, options,
+                                        replay_backend_time(backend));
+
+            if (!replay_simulate_receive(backend, event->data, deadline,
+                                         options, error))
+                return FALSE;
+        }
+    }
+
+    replay_notes(backend, section, &note_idx, section->events->len,
+                 options, clock);
+
+    return TRUE;
+}
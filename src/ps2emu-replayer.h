@@ -0,0 +1,224 @@
+/*
+ * ps2emu-replayer.h
+ * Copyright (C) 2015 Red Hat
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public License for more
+ * details.
+ */
+
+#ifndef __PS2EMU_REPLAYER_H__
+#define __PS2EMU_REPLAYER_H__
+
+#include <glib.h>
+
+#include "ps2emu-log.h"
+#include "ps2emu-replay-stats.h"
+#include "ps2emu-trace.h"
+#include "ps2emu-scheduler.h"
+#include "ps2emu-packet.h"
+
+/* How long to leave the driver alone between initializing a device and
+ * replaying events on it, at the very least */
+#define PS2EMU_MIN_EVENT_DELAY (0.5 * G_USEC_PER_SEC)
+
+/* The most interrupts that get sent in one go when batching */
+#define REPLAY_BATCH_MAX 16
+
+/* Whatever the events get replayed into. Normally that's /dev/userio, but the
+ * null and simulated backends are there so the replay loop can be run without
+ * one. Backends also decide what time it is, so the simulated one can skip
+ * ahead instead of actually waiting. */
+typedef struct _ReplayBackend ReplayBackend;
+
+struct userio_cmd;
+
+struct _ReplayBackend {
+    GIOStatus (*send)(ReplayBackend *backend,
+                      guint8 type,
+                      guint8 data,
+                      GError **error);
+    /* Optional, backends that can't do any better than calling send() for
+     * each interrupt can leave this out */
+    GIOStatus (*send_interrupts)(ReplayBackend *backend,
+                                 const guint8 *data,
+                                 guint count,
+                                 GError **error);
+    /* Optional, the same thing for commands that have already been encoded */
+    GIOStatus (*send_commands)(ReplayBackend *backend,
+                               const struct userio_cmd *cmds,
+                               guint count,
+                               GError **error);
+    /* Returns G_IO_STATUS_AGAIN if nothing arrived by @deadline, which is in
+     * the same time base as g_get_monotonic_time(), or 0 to wait forever */
+    GIOStatus (*receive)(ReplayBackend *backend,
+                         guchar expected,
+                         guchar *data,
+                         time_t deadline,
+                         GError **error);
+    /* @deadline is in the same time base as g_get_monotonic_time() */
+    void      (*wait_until)(ReplayBackend *backend,
+                            time_t deadline);
+    /* Optional, in the same time base as scheduler_now(). Backends that
+     * leave this out run on the real clock. */
+    gint64    (*now)(ReplayBackend *backend);
+    void      (*free)(ReplayBackend *backend);
+};
+
+/* Keeps track of where we are in time while replaying a section, so that
+ * replaying can be split up across multiple calls to replay_section() */
+typedef struct {
+    time_t   start_time;
+    long     offset;    /* in wall clock time, not log time */
+    time_t   event_time,
+             last_event_time;
+    gboolean first_event;
+} ReplayClock;
+
+/* How replay_section() should go about replaying things */
+typedef struct {
+    time_t       max_wait,
+                 note_delay,
+                 batch_window; /* send interrupts due this close together
+                                  at once, 0 to disable batching */
+    time_t       receive_timeout; /* how long past its time to wait for data
+                                     from the driver, 0 to wait forever */
+    time_t       idle_threshold, /* gaps this long or longer get shortened */
+                 idle_target;    /* to this, if idle_threshold isn't 0 */
+    gdouble      speed;        /* how much faster than the log to replay */
+    gboolean     no_timing,    /* send interrupts as soon as possible, only
+                                  waiting on data from the driver */
+                 quiet;        /* don't print user notes, or anything about
+                                  data from the driver that didn't match or
+                                  never came. For replaying several logs at
+                                  once, where none of that could be told
+                                  apart; the stats still keep track. */
+    PacketDecoder *packets; /* if not NULL, each packet from the device gets
+                               sent in one go, when its first byte is due.
+                               Only compiled programs do this. */
+    ReplayStats *stats; /* if not NULL, timing gets recorded here. The
+                           warning about going out of sync only gets
+                           printed for the first mismatch counted in
+                           these, and not at all without them. */
+    Tracer      *trace; /* if not NULL, everything we send and receive gets
+                           recorded here */
+    guint16      trace_device;
+} ReplayOptions;
+
+ReplayBackend * replay_backend_userio_new(const gchar *path,
+                                          GError **error)
+G_GNUC_MALLOC;
+
+ReplayBackend * replay_backend_null_new(void)
+G_GNUC_MALLOC;
+
+static inline GIOStatus replay_backend_send(ReplayBackend *backend,
+                                            guint8 type,
+                                            guint8 data,
+                                            GError **error) {
+    return backend->send(backend, type, data, error);
+}
+
+GIOStatus replay_backend_send_interrupts(ReplayBackend *backend,
+                                        const guint8 *data,
+                                        guint count,
+                                        GError **error);
+
+GIOStatus replay_backend_send_commands(ReplayBackend *backend,
+                                       const struct userio_cmd *cmds,
+                                       guint count,
+                                       GError **error);
+
+static inline GIOStatus replay_backend_receive(ReplayBackend *backend,
+                                               guchar expected,
+                                               guchar *data,
+                                               time_t deadline,
+                                               GError **error) {
+    return backend->receive(backend, expected, data, deadline, error);
+}
+
+static inline void replay_backend_wait_until(ReplayBackend *backend,
+                                             time_t deadline) {
+    backend->wait_until(backend, deadline);
+}
+
+/* In nanoseconds */
+static inline gint64 replay_backend_now(ReplayBackend *backend) {
+    return backend->now ? backend->now(backend) : scheduler_now();
+}
+
+/* In microseconds, like g_get_monotonic_time() */
+static inline time_t replay_backend_time(ReplayBackend *backend) {
+    return replay_backend_now(backend) / 1000;
+}
+
+static inline void replay_backend_sleep(ReplayBackend *backend,
+                                        time_t duration) {
+    backend->wait_until(backend, replay_backend_time(backend) + duration);
+}
+
+static inline void replay_backend_free(ReplayBackend *backend) {
+    backend->free(backend);
+}
+
+void replay_clock_init(ReplayClock *clock,
+                       time_t start_time);
+
+gboolean replay_clock_advance(ReplayClock *clock,
+                              const LogEvent *event,
+                              const ReplayOptions *options);
+
+/* When the event the clock was last advanced to is due, in the same time base
+ * as g_get_monotonic_time() */
+static inline time_t replay_clock_deadline(const ReplayClock *clock,
+                                           const ReplayOptions *options) {
+    time_t event_time = clock->event_time;
+
+    if (options->speed != 1.0)
+        event_time /= options->speed;
+
+    return clock->start_time - clock->offset + event_time;
+}
+
+/* When to give up on the data from the driver that the event the clock was
+ * last advanced to expects, or 0 to wait forever */
+static inline time_t replay_receive_deadline(const ReplayClock *clock,
+                                             const ReplayOptions *options,
+                                             time_t now) {
+    time_t due = now;
+
+    if (!options->receive_timeout)
+        return 0;
+
+    if (!options->no_timing)
+        due = MAX(due, replay_clock_deadline(clock, options));
+
+    return due + options->receive_timeout;
+}
+
+/* Prints a note the user left in the log, unless we're being quiet */
+void replay_print_note(ReplayBackend *backend,
+                       const gchar *text,
+                       const ReplayOptions *options);
+
+/* Waits for @expected from the driver, and complains if something else shows
+ * up instead. Timing out only gets reported, it isn't an error. */
+gboolean replay_simulate_receive(ReplayBackend *backend,
+                                 guchar expected,
+                                 time_t deadline,
+                                 const ReplayOptions *options,
+                                 GError **error);
+
+gboolean replay_section(ReplayBackend *backend,
+                        LogSection *section,
+                        ReplayClock *clock,
+                        const ReplayOptions *options,
+                        GError **error);
+
+#endif /* !__PS2EMU_REPLAYER_H__ */
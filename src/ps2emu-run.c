@@ -0,0 +1,710 @@
+/*
+ * ps2emu-run.c
+ * Copyright (C) 2015 Red Hat
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public License for more
+ * details.
+ */
+
+#include "ps2emu-log.h"
+#include "ps2emu-daemon.h"
+#include "ps2emu-replayer.h"
+#include "ps2emu-replay-program.h"
+#include "ps2emu-replay-sim.h"
+#include "ps2emu-misc.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <glib.h>
+#include <glib/gstdio.h>
+#include <linux/serio.h>
+#include <userio.h>
+
+#define PS2EMU_DEFAULT_RECEIVE_TIMEOUT 1000
+
+typedef enum {
+    RUN_PASS,  /* replayed, and the driver sent everything it was supposed to */
+    RUN_FAIL,  /* replayed, but the driver didn't keep in sync with the log */
+    RUN_ERROR  /* couldn't be replayed at all */
+} RunResult;
+
+static const gchar *run_result_names[] = {
+    [RUN_PASS]  = "pass",
+    [RUN_FAIL]  = "fail",
+    [RUN_ERROR] = "error",
+};
+
+typedef struct {
+    gchar     *path;
+    goffset    size;
+    RunResult  result;
+    gchar     *message;
+    gboolean   warm;
+    guint64    sent,
+               received,
+               mismatches,
+               timeouts;
+    gdouble    init_seconds,
+               main_seconds,
+               seconds;
+    gchar     *desync;  /* where it first went wrong, if we know */
+} RunJob;
+
+/* Each worker has its own deque of jobs that it takes from the front of. Once
+ * that's empty, it steals from the back of everyone else's. Jobs are never
+ * added once the workers have started, so a worker that can't find anything
+ * to steal is done. */
+typedef struct {
+    GMutex lock;
+    GQueue jobs;
+} RunDeque;
+
+typedef struct {
+    RunDeque      *deques;
+    guint          workers;
+    gboolean       simulate;
+    const gchar   *socket_path; /* replay on ps2emu-replayd if not NULL */
+    time_t         event_delay;
+    ReplayOptions  init_options,
+                   main_options;
+    GMutex         output_lock;
+    guint          done,
+                   total;
+} Runner;
+
+typedef struct {
+    Runner *runner;
+    guint   id;
+} RunWorker;
+
+static void run_job_free(RunJob *job) {
+    g_free(job->path);
+    g_free(job->message);
+    g_free(job->desync);
+    g_free(job);
+}
+
+static gboolean is_recording(const gchar *name) {
+    return g_str_has_suffix(name, ".log") ||
+           g_str_has_suffix(name, ".log.gz") ||
+           g_str_has_suffix(name, ".log.zst");
+}
+
+static void add_job(GPtrArray *jobs,
+                    const gchar *path) {
+    RunJob *job = g_new0(RunJob, 1);
+    GStatBuf buf;
+
+    job->path = g_strdup(path);
+    if (g_stat(path, &buf) == 0)
+        job->size = buf.st_size;
+
+    g_ptr_array_add(jobs, job);
+}
+
+/* Picks up every recording in @path and the directories under it */
+static gboolean add_directory(GPtrArray *jobs,
+                              const gchar *path,
+                              GError **error) {
+    GDir *dir = g_dir_open(path, 0, error);
+    const gchar *name;
+
+    if (!dir) {
+        g_prefix_error(error, "While reading %s: ", path);
+        return FALSE;
+    }
+
+    while ((name = g_dir_read_name(dir))) {
+        gchar *child;
+        gboolean ret = TRUE;
+
+        if (name[0] == '.')
+            continue;
+
+        child = g_build_filename(path, name, NULL);
+        if (g_file_test(child, G_FILE_TEST_IS_DIR))
+            ret = add_directory(jobs, child, error);
+        else if (is_recording(name))
+            add_job(jobs, child);
+
+        g_free(child);
+        if (!ret) {
+            g_dir_close(dir);
+            return FALSE;
+        }
+    }
+
+    g_dir_close(dir);
+    return TRUE;
+}
+
+/* Manifests have one recording on each line, relative to the manifest.
+ * Blank lines and lines starting with # are skipped. */
+static gboolean add_manifest(GPtrArray *jobs,
+                             const gchar *path,
+                             GError **error) {
+    gchar *contents,
+          *dirname;
+    gchar **lines;
+
+    if (!g_file_get_contents(path, &contents, NULL, error)) {
+        g_prefix_error(error, "While reading %s: ", path);
+        return FALSE;
+    }
+
+    dirname = g_path_get_dirname(path);
+    lines = g_strsplit(contents, "\n", 0);
+    for (gchar **line = lines; *line; line++) {
+        gchar *entry = g_strstrip(*line);
+
+        if (*entry == '\0' || *entry == '#')
+            continue;
+
+        if (g_path_is_absolute(entry)) {
+            add_job(jobs, entry);
+        } else {
+            gchar *child = g_build_filename(dirname, entry, NULL);
+
+            add_job(jobs, child);
+            g_free(child);
+        }
+    }
+
+    g_strfreev(lines);
+    g_free(dirname);
+    g_free(contents);
+
+    return TRUE;
+}
+
+static gint compare_job_size(gconstpointer a,
+                             gconstpointer b) {
+    const RunJob *job_a = *(RunJob**)a,
+                 *job_b = *(RunJob**)b;
+
+    return job_a->size < job_b->size ? 1 : job_a->size > job_b->size ? -1 : 0;
+}
+
+static RunJob * take_job(Runner *runner,
+                         guint id) {
+    RunJob *job;
+
+    g_mutex_lock(&runner->deques[id].lock);
+    job = g_queue_pop_head(&runner->deques[id].jobs);
+    g_mutex_unlock(&runner->deques[id].lock);
+
+    for (guint i = 1; !job && i < runner->workers; i++) {
+        RunDeque *victim = &runner->deques[(id + i) % runner->workers];
+
+        g_mutex_lock(&victim->lock);
+        job = g_queue_pop_tail(&victim->jobs);
+        g_mutex_unlock(&victim->lock);
+    }
+
+    return job;
+}
+
+static gboolean replay_on_device(Runner *runner,
+                                 RunJob *job,
+                                 GError **error) {
+    ReplayOptions options;
+    ReplayBackend *backend;
+    ReplayProgram *program;
+    ReplayStats stats;
+    ParsedLog *log;
+    gint log_version;
+    __u8 port_type;
+    time_t start;
+    GIOStatus rc;
+    gboolean ret = FALSE;
+
+    log = log_parse_file(job->path, &log_version, error);
+    if (!log) {
+        g_prefix_error(error, "While parsing %s: ", job->path);
+        return FALSE;
+    }
+
+    if (runner->simulate) {
+        backend = replay_backend_sim_new(NULL);
+    } else {
+        backend = replay_backend_userio_new("/dev/userio", error);
+        if (!backend) {
+            g_prefix_error(error, "While opening /dev/userio: ");
+            log_free(log);
+            return FALSE;
+        }
+    }
+
+    port_type = (log->port == PS2_PORT_KBD) ? SERIO_8042_XL : SERIO_8042;
+    rc = replay_backend_send(backend, USERIO_CMD_SET_PORT_TYPE, port_type,
+                             error);
+    if (rc != G_IO_STATUS_NORMAL) {
+        g_prefix_error(error, "While setting port type on /dev/userio: ");
+        goto out;
+    }
+
+    rc = replay_backend_send(backend, USERIO_CMD_REGISTER, 0, error);
+    if (rc != G_IO_STATUS_NORMAL) {
+        g_prefix_error(error, "While starting device on /dev/userio: ");
+        goto out;
+    }
+
+    replay_stats_init(&stats);
+
+    /* V0 logs are all one section, replayed the way init sections are */
+    if (log_version > 0) {
+        options = runner->init_options;
+        options.stats = &stats;
+
+        start = g_get_monotonic_time();
+        program = replay_program_compile(&log->init_section, &options);
+        ret = replay_program_run(backend, program, &options, error);
+        replay_program_free(program);
+        job->init_seconds = (gdouble)(g_get_monotonic_time() - start) /
+                            G_USEC_PER_SEC;
+        if (!ret) {
+            g_prefix_error(error, "While initializing the device: ");
+            goto out;
+        }
+
+        replay_backend_sleep(backend, runner->event_delay);
+        options = runner->main_options;
+    } else {
+        options = runner->init_options;
+    }
+    options.stats = &stats;
+
+    start = g_get_monotonic_time();
+    program = replay_program_compile(&log->main_section, &options);
+    ret = replay_program_run(backend, program, &options, error);
+    replay_program_free(program);
+    job->main_seconds = (gdouble)(g_get_monotonic_time() - start) /
+                        G_USEC_PER_SEC;
+
+    job->sent = stats.send_jitter.count;
+    job->received = stats.receive_latency.count;
+    job->mismatches = stats.receive_mismatches;
+    job->timeouts = stats.receive_timeouts;
+
+    if (stats.desynced && stats.desync_timed_out)
+        job->desync = g_strdup_printf(
+            "timed out waiting for %.2hhx after %" G_GUINT64_FORMAT " bytes",
+            stats.desync_expected, stats.desync_position);
+    else if (stats.desynced)
+        job->desync = g_strdup_printf(
+            "expected %.2hhx but received %.2hhx after %" G_GUINT64_FORMAT
+            " bytes", stats.desync_expected, stats.desync_received,
+            stats.desync_position);
+
+out:
+    replay_backend_free(backend);
+    log_free(log);
+
+    return ret;
+}
+
+static gboolean replay_on_daemon(Runner *runner,
+                                 RunJob *job,
+                                 GError **error) {
+    DaemonResult result;
+
+    if (!daemon_submit(runner->socket_path, job->path, &result, error))
+        return FALSE;
+
+    job->warm = result.warm;
+    job->sent = result.sent;
+    job->received = result.received;
+    job->mismatches = result.mismatches;
+    job->timeouts = result.timeouts;
+    job->main_seconds = result.seconds;
+
+    return TRUE;
+}
+
+static void run_job(Runner *runner,
+                    RunJob *job) {
+    GError *error = NULL;
+    time_t start = g_get_monotonic_time();
+    gboolean ret;
+
+    if (runner->socket_path)
+        ret = replay_on_daemon(runner, job, &error);
+    else
+        ret = replay_on_device(runner, job, &error);
+
+    job->seconds = (gdouble)(g_get_monotonic_time() - start) /
+                   G_USEC_PER_SEC;
+
+    if (!ret) {
+        job->result = RUN_ERROR;
+        job->message = g_strdup(error->message);
+        g_error_free(error);
+    } else if (job->mismatches || job->timeouts) {
+        job->result = RUN_FAIL;
+        job->message = g_strdup_printf(
+            "Out of sync with the driver: %" G_GUINT64_FORMAT " mismatches, "
+            "%" G_GUINT64_FORMAT " timeouts%s%s", job->mismatches,
+            job->timeouts, job->desync ? ", first " : "",
+            job->desync ? job->desync : "");
+    } else {
+        job->result = RUN_PASS;
+    }
+
+    g_mutex_lock(&runner->output_lock);
+    runner->done++;
+    printf("[%u/%u] %s %s (%.2fs)%s%s\n", runner->done, runner->total,
+           job->result == RUN_PASS ? "PASS " :
+           job->result == RUN_FAIL ? "FAIL " : "ERROR",
+           job->path, job->seconds, job->message ? ": " : "",
+           job->message ? job->message : "");
+    fflush(stdout);
+    g_mutex_unlock(&runner->output_lock);
+}
+
+static gpointer worker_thread(gpointer data) {
+    RunWorker *worker = data;
+    RunJob *job;
+
+    while ((job = take_job(worker->runner, worker->id)))
+        run_job(worker->runner, job);
+
+    return NULL;
+}
+
+/* Biggest logs go first, dealt out round robin so that every worker starts
+ * with about the same amount of work */
+static void run_jobs(Runner *runner,
+                     GPtrArray *jobs) {
+    GPtrArray *order = g_ptr_array_sized_new(jobs->len);
+    RunWorker *workers = g_new0(RunWorker, runner->workers);
+    GThread **threads = g_new0(GThread*, runner->workers);
+
+    for (guint i = 0; i < jobs->len; i++)
+        g_ptr_array_add(order, jobs->pdata[i]);
+    g_ptr_array_sort(order, compare_job_size);
+
+    runner->deques = g_new0(RunDeque, runner->workers);
+    for (guint i = 0; i < runner->workers; i++) {
+        g_mutex_init(&runner->deques[i].lock);
+        g_queue_init(&runner->deques[i].jobs);
+    }
+
+    for (guint i = 0; i < order->len; i++)
+        g_queue_push_tail(&runner->deques[i % runner->workers].jobs,
+                          order->pdata[i]);
+
+    for (guint i = 0; i < runner->workers; i++) {
+        workers[i] = (RunWorker) { .runner = runner, .id = i };
+        threads[i] = g_thread_new("ps2emu-run", worker_thread, &workers[i]);
+    }
+
+    for (guint i = 0; i < runner->workers; i++)
+        g_thread_join(threads[i]);
+
+    for (guint i = 0; i < runner->workers; i++)
+        g_mutex_clear(&runner->deques[i].lock);
+    g_free(runner->deques);
+    g_free(threads);
+    g_free(workers);
+    g_ptr_array_free(order, FALSE);
+}
+
+static gboolean close_report(FILE *file,
+                             const gchar *path,
+                             GError **error) {
+    if (fclose(file) != 0) {
+        g_set_error(error, G_FILE_ERROR, g_file_error_from_errno(errno),
+                    "While writing %s: %s", path, g_strerror(errno));
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+static FILE * open_report(const gchar *path,
+                          GError **error) {
+    FILE *file = fopen(path, "w");
+
+    if (!file)
+        g_set_error(error, G_FILE_ERROR, g_file_error_from_errno(errno),
+                    "While writing %s: %s", path, g_strerror(errno));
+
+    return file;
+}
+
+static gboolean write_junit(GPtrArray *jobs,
+                            const guint *counts,
+                            gdouble seconds,
+                            const gchar *path,
+                            GError **error) {
+    FILE *file = open_report(path, error);
+
+    if (!file)
+        return FALSE;
+
+    fprintf(file,
+            "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
+            "<testsuites>\n"
+            "  <testsuite name=\"ps2emu-run\" tests=\"%u\" failures=\"%u\" "
+            "errors=\"%u\" time=\"%.3f\">\n",
+            jobs->len, counts[RUN_FAIL], counts[RUN_ERROR], seconds);
+
+    for (guint i = 0; i < jobs->len; i++) {
+        RunJob *job = jobs->pdata[i];
+        gchar *name = g_markup_escape_text(job->path, -1);
+
+        fprintf(file,
+                "    <testcase classname=\"ps2emu-run\" name=\"%s\" "
+                "time=\"%.3f\"", name, job->seconds);
+
+        if (job->result == RUN_PASS) {
+            fprintf(file, "/>\n");
+        } else {
+            gchar *message = g_markup_escape_text(job->message, -1);
+
+            fprintf(file, ">\n      <%s message=\"%s\"/>\n    </testcase>\n",
+                    job->result == RUN_FAIL ? "failure" : "error", message);
+            g_free(message);
+        }
+
+        g_free(name);
+    }
+
+    fprintf(file, "  </testsuite>\n</testsuites>\n");
+
+    return close_report(file, path, error);
+}
+
+static gboolean write_json(GPtrArray *jobs,
+                           const guint *counts,
+                           gdouble seconds,
+                           const gchar *path,
+                           GError **error) {
+    FILE *file = open_report(path, error);
+
+    if (!file)
+        return FALSE;
+
+    fprintf(file, "{\"passed\": %u, \"failed\": %u, \"errors\": %u, "
+                  "\"seconds\": %.6f, \"logs\": [",
+            counts[RUN_PASS], counts[RUN_FAIL], counts[RUN_ERROR], seconds);
+
+    for (guint i = 0; i < jobs->len; i++) {
+        RunJob *job = jobs->pdata[i];
+        gchar *name = json_escape(job->path),
+              *message = job->message ? json_escape(job->message) : NULL;
+
+        fprintf(file,
+                "%s{\"path\": \"%s\", \"result\": \"%s\", "
+                "\"sent\": %" G_GUINT64_FORMAT ", "
+                "\"received\": %" G_GUINT64_FORMAT ", "
+                "\"mismatches\": %" G_GUINT64_FORMAT ", "
+                "\"timeouts\": %" G_GUINT64_FORMAT ", "
+                "\"init_seconds\": %.6f, \"main_seconds\": %.6f, "
+                "\"seconds\": %.6f, ",
+                i ? ", " : "", name, run_result_names[job->result],
+                job->sent, job->received, job->mismatches, job->timeouts,
+                job->init_seconds, job->main_seconds, job->seconds);
+
+        if (message)
+            fprintf(file, "\"message\": \"%s\"}", message);
+        else
+            fprintf(file, "\"message\": null}");
+
+        g_free(name);
+        g_free(message);
+    }
+
+    fprintf(file, "]}\n");
+
+    return close_report(file, path, error);
+}
+
+gint main(gint argc,
+          gchar *argv[]) {
+    GOptionContext *main_context =
+        g_option_context_new("[<directory>|<event_log>]... - replay a suite "
+                             "of PS/2 recordings");
+    GPtrArray *jobs = g_ptr_array_new_with_free_func((GDestroyNotify)
+                                                     run_job_free);
+    gchar **manifests = NULL;
+    gchar *junit_path = NULL,
+          *json_path = NULL,
+          *socket_path = NULL;
+    gint workers = g_get_num_processors(),
+         receive_timeout = PS2EMU_DEFAULT_RECEIVE_TIMEOUT,
+         batch_window = 0;
+    time_t max_wait = 0,
+           event_delay = 0;
+    gboolean no_timing = FALSE,
+             simulate = FALSE,
+             daemon = FALSE;
+    guint counts[G_N_ELEMENTS(run_result_names)] = { 0 };
+    time_t start;
+    gdouble seconds,
+            replay_seconds = 0;
+    GError *error = NULL;
+    Runner runner;
+
+    GOptionEntry options[] = {
+        { "version", 'V', G_OPTION_FLAG_NO_ARG, G_OPTION_ARG_CALLBACK,
+          print_version, "Show the version of the application", NULL },
+        { "manifest", 'M', G_OPTION_FLAG_NONE, G_OPTION_ARG_FILENAME_ARRAY,
+          &manifests, "Also replay the logs listed in file, one per line",
+          "file" },
+        { "jobs", 'j', G_OPTION_FLAG_NONE, G_OPTION_ARG_INT,
+          &workers, "Replay n logs at once (defaults to the number of CPUs)",
+          "n" },
+        { "junit", 0, G_OPTION_FLAG_NONE, G_OPTION_ARG_FILENAME,
+          &junit_path, "Write a JUnit XML report to file", "file" },
+        { "json", 0, G_OPTION_FLAG_NONE, G_OPTION_ARG_FILENAME,
+          &json_path, "Write a JSON report to file", "file" },
+        { "max-wait", 'w', G_OPTION_FLAG_NONE, G_OPTION_ARG_INT,
+          &max_wait, "Don't wait for longer then n seconds between events",
+          "n", },
+        { "event-delay", 'd', G_OPTION_FLAG_NONE, G_OPTION_ARG_INT,
+          &event_delay, "Wait n seconds after init before playing events",
+          "n" },
+        { "receive-timeout", 't', G_OPTION_FLAG_NONE, G_OPTION_ARG_INT,
+          &receive_timeout, "Give up on data from the driver that's n "
+          "milliseconds late, 0 to wait forever (defaults to 1000)", "n" },
+        { "no-timing", 0, G_OPTION_FLAG_NONE, G_OPTION_ARG_NONE,
+          &no_timing, "Replay events as fast as the driver can keep up with "
+          "them, ignoring the timing in the log", NULL },
+        { "batch-window", 'b', G_OPTION_FLAG_NONE, G_OPTION_ARG_INT,
+          &batch_window, "Send interrupts that are due within n microseconds "
+          "of each other with a single write", "n" },
+        { "simulate", 0, G_OPTION_FLAG_NONE, G_OPTION_ARG_NONE,
+          &simulate, "Don't use /dev/userio, simulate the driver instead "
+          "and skip over all the waiting", NULL },
+        { "daemon", 0, G_OPTION_FLAG_NONE, G_OPTION_ARG_NONE,
+          &daemon, "Have ps2emu-replayd replay the logs on devices it's "
+          "already initialized", NULL },
+        { "socket", 0, G_OPTION_FLAG_NONE, G_OPTION_ARG_FILENAME,
+          &socket_path, "With --daemon, the socket ps2emu-replayd is "
+          "listening on (defaults to " PS2EMU_DAEMON_SOCKET ")", "path" },
+        { 0 }
+    };
+
+    g_option_context_add_main_entries(main_context, options, NULL);
+    g_option_context_set_help_enabled(main_context, TRUE);
+    g_option_context_set_description(main_context,
+        "Replays every log in each directory given, along with any other logs "
+        "given,\nand reports which ones the driver didn't keep in sync "
+        "with.\n");
+
+    if (!g_option_context_parse(main_context, &argc, &argv, &error))
+        exit_on_bad_argument(main_context, TRUE, error->message);
+
+    if (argc < 2 && !manifests)
+        exit_on_bad_argument(main_context, FALSE,
+                             "No logs specified! Use --help for more "
+                             "information");
+
+    if (workers < 1)
+        exit_on_bad_argument(main_context, FALSE,
+                             "There has to be at least one job");
+
+    if (receive_timeout < 0)
+        exit_on_bad_argument(main_context, FALSE,
+                             "The receive timeout can't be negative");
+
+    if (batch_window < 0)
+        exit_on_bad_argument(main_context, FALSE,
+                             "The batch window can't be negative");
+
+    if (socket_path && !daemon)
+        exit_on_bad_argument(main_context, FALSE,
+                             "--socket can only be used along with --daemon");
+
+    if (daemon && (simulate || no_timing || max_wait || event_delay ||
+                   batch_window ||
+                   receive_timeout != PS2EMU_DEFAULT_RECEIVE_TIMEOUT))
+        exit_on_bad_argument(main_context, FALSE,
+                             "--daemon can't be used along with options that "
+                             "change how the logs get replayed, those are up "
+                             "to ps2emu-replayd");
+
+    for (gint i = 1; i < argc; i++) {
+        if (g_file_test(argv[i], G_FILE_TEST_IS_DIR)) {
+            if (!add_directory(jobs, argv[i], &error))
+                goto error;
+        } else {
+            add_job(jobs, argv[i]);
+        }
+    }
+
+    for (gchar **manifest = manifests; manifest && *manifest; manifest++)
+        if (!add_manifest(jobs, *manifest, &error))
+            goto error;
+
+    if (jobs->len == 0) {
+        g_set_error_literal(&error, PS2EMU_ERROR, PS2EMU_ERROR_INPUT,
+                            "No logs found");
+        goto error;
+    }
+
+    runner = (Runner) {
+        .workers = MIN((guint)workers, jobs->len),
+        .simulate = simulate,
+        .socket_path = !daemon ? NULL :
+                       socket_path ? socket_path : PS2EMU_DAEMON_SOCKET,
+        .event_delay = event_delay * G_USEC_PER_SEC + PS2EMU_MIN_EVENT_DELAY,
+        /* With several logs going at once, anything printed about a
+         * single byte couldn't be told apart. Where each log went out of
+         * sync ends up in its result instead. */
+        .init_options = {
+            .speed = 1.0,
+            .no_timing = no_timing,
+            .quiet = TRUE,
+            .receive_timeout = (time_t)receive_timeout * 1000,
+        },
+        .total = jobs->len,
+    };
+    runner.main_options = runner.init_options;
+    runner.main_options.max_wait = max_wait * G_USEC_PER_SEC;
+    runner.main_options.batch_window = batch_window;
+    g_mutex_init(&runner.output_lock);
+
+    printf("Replaying %u logs, %u at a time...\n", jobs->len, runner.workers);
+
+    start = g_get_monotonic_time();
+    run_jobs(&runner, jobs);
+    seconds = (gdouble)(g_get_monotonic_time() - start) / G_USEC_PER_SEC;
+
+    for (guint i = 0; i < jobs->len; i++) {
+        RunJob *job = jobs->pdata[i];
+
+        counts[job->result]++;
+        replay_seconds += job->seconds;
+    }
+
+    printf("%u passed, %u failed, %u couldn't be replayed. Took %.2fs, "
+           "%.2fs if they'd been replayed one at a time\n",
+           counts[RUN_PASS], counts[RUN_FAIL], counts[RUN_ERROR], seconds,
+           replay_seconds);
+
+    if (junit_path && !write_junit(jobs, counts, seconds, junit_path, &error))
+        goto error;
+
+    if (json_path && !write_json(jobs, counts, seconds, json_path, &error))
+        goto error;
+
+    g_ptr_array_free(jobs, TRUE);
+
+    return counts[RUN_PASS] == runner.total ? 0 : 1;
+
+error:
+    fprintf(stderr, "Error: %s\n", error->message);
+
+    return 1;
+}
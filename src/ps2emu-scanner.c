@@ -0,0 +1,228 @@
+/*
+ * ps2emu-scanner.c
+ * Copyright (C) 2015 Red Hat
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public License for more
+ * details.
+ */
+
+#include "ps2emu-scanner.h"
+
+#include <string.h>
+#include <glib.h>
+
+#ifdef __x86_64__
+#include <immintrin.h>
+#define SCANNER_HAVE_X86
+#endif
+
+static const gchar * find_line_end_scalar(const gchar *str,
+                                          const gchar *end) {
+    while (str < end && *str != '\n' && *str != '\r')
+        str++;
+
+    return str;
+}
+
+static const gchar * find_scalar(const gchar *str,
+                                 const gchar *end,
+                                 const gchar *needle,
+                                 gsize needle_len) {
+    for (; end - str >= (gssize)needle_len; str++) {
+        if (*str == needle[0] && memcmp(str, needle, needle_len) == 0)
+            return str;
+    }
+
+    return NULL;
+}
+
+static const ScannerImpl scanner_scalar = {
+    .name = "scalar",
+    .find_line_end = find_line_end_scalar,
+    .find = find_scalar,
+};
+
+#ifdef SCANNER_HAVE_X86
+/* The vector loops only ever do full width loads, so they never read past
+ * @end. Whatever's left at the end gets handled by the scalar versions. */
+
+static const gchar * find_line_end_sse2(const gchar *str,
+                                        const gchar *end) {
+    const __m128i newline = _mm_set1_epi8('\n'),
+                  carriage_return = _mm_set1_epi8('\r');
+
+    for (; end - str >= 16; str += 16) {
+        __m128i chunk = _mm_loadu_si128((const __m128i*)str);
+        guint mask = _mm_movemask_epi8(
+            _mm_or_si128(_mm_cmpeq_epi8(chunk, newline),
+                         _mm_cmpeq_epi8(chunk, carriage_return)));
+
+        if (mask)
+            return str + __builtin_ctz(mask);
+    }
+
+    return find_line_end_scalar(str, end);
+}
+
+/* Compares the first and last bytes of the needle against 16 positions at
+ * once, and only does a full comparison where both of them match */
+static const gchar * find_sse2(const gchar *str,
+                               const gchar *end,
+                               const gchar *needle,
+                               gsize needle_len) {
+    const __m128i first = _mm_set1_epi8(needle[0]),
+                  last = _mm_set1_epi8(needle[needle_len - 1]);
+
+    for (; end - str >= (gssize)(needle_len + 15); str += 16) {
+        __m128i start_chunk = _mm_loadu_si128((const __m128i*)str),
+                end_chunk = _mm_loadu_si128(
+                    (const __m128i*)(str + needle_len - 1));
+        guint mask = _mm_movemask_epi8(
+            _mm_and_si128(_mm_cmpeq_epi8(start_chunk, first),
+                          _mm_cmpeq_epi8(end_chunk, last)));
+
+        for (; mask; mask &= mask - 1) {
+            const gchar *match = str + __builtin_ctz(mask);
+
+            if (memcmp(match, needle, needle_len) == 0)
+                return match;
+        }
+    }
+
+    return find_scalar(str, end, needle, needle_len);
+}
+
+static const ScannerImpl scanner_sse2 = {
+    .name = "sse2",
+    .find_line_end = find_line_end_sse2,
+    .find = find_sse2,
+};
+
+__attribute__((target("avx2")))
+static const gchar * find_line_end_avx2(const gchar *str,
+                                        const gchar *end) {
+    const __m256i newline = _mm256_set1_epi8('\n'),
+                  carriage_return = _mm256_set1_epi8('\r');
+
+    for (; end - str >= 32; str += 32) {
+        __m256i chunk = _mm256_loadu_si256((const __m256i*)str);
+        guint mask = _mm256_movemask_epi8(
+            _mm256_or_si256(_mm256_cmpeq_epi8(chunk, newline),
+                            _mm256_cmpeq_epi8(chunk, carriage_return)));
+
+        if (mask)
+            return str + __builtin_ctz(mask);
+    }
+
+    return find_line_end_sse2(str, end);
+}
+
+__attribute__((target("avx2")))
+static const gchar * find_avx2(const gchar *str,
+                               const gchar *end,
+                               const gchar *needle,
+                               gsize needle_len) {
+    const __m256i first = _mm256_set1_epi8(needle[0]),
+                  last = _mm256_set1_epi8(needle[needle_len - 1]);
+
+    for (; end - str >= (gssize)(needle_len + 31); str += 32) {
+        __m256i start_chunk = _mm256_loadu_si256((const __m256i*)str),
+                end_chunk = _mm256_loadu_si256(
+                    (const __m256i*)(str + needle_len - 1));
+        guint mask = _mm256_movemask_epi8(
+            _mm256_and_si256(_mm256_cmpeq_epi8(start_chunk, first),
+                             _mm256_cmpeq_epi8(end_chunk, last)));
+
+        for (; mask; mask &= mask - 1) {
+            const gchar *match = str + __builtin_ctz(mask);
+
+            if (memcmp(match, needle, needle_len) == 0)
+                return match;
+        }
+    }
+
+    return find_sse2(str, end, needle, needle_len);
+}
+
+static const ScannerImpl scanner_avx2 = {
+    .name = "avx2",
+    .find_line_end = find_line_end_avx2,
+    .find = find_avx2,
+};
+#endif /* SCANNER_HAVE_X86 */
+
+/* Returns the implementation called @name ("scalar", "sse2" or "avx2"), or
+ * NULL if there isn't one or the CPU doesn't support it */
+const ScannerImpl * scanner_lookup_impl(const gchar *name) {
+    if (g_strcmp0(name, "scalar") == 0)
+        return &scanner_scalar;
+
+#ifdef SCANNER_HAVE_X86
+    if (g_strcmp0(name, "sse2") == 0)
+        return &scanner_sse2;
+
+    __builtin_cpu_init();
+    if (g_strcmp0(name, "avx2") == 0 && __builtin_cpu_supports("avx2"))
+        return &scanner_avx2;
+#endif
+
+    return NULL;
+}
+
+static const ScannerImpl * scanner_pick_impl(void) {
+    /* Mostly useful for comparing implementations against each other */
+    const ScannerImpl *forced =
+        scanner_lookup_impl(g_getenv("PS2EMU_SCANNER"));
+
+    if (forced)
+        return forced;
+
+#ifdef SCANNER_HAVE_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+        return &scanner_avx2;
+
+    return &scanner_sse2;
+#else
+    return &scanner_scalar;
+#endif
+}
+
+static inline const ScannerImpl * scanner_get_impl(void) {
+    static const ScannerImpl *impl = NULL;
+
+    if (g_once_init_enter(&impl))
+        g_once_init_leave(&impl, scanner_pick_impl());
+
+    return impl;
+}
+
+/* Returns a pointer to the first '\n' or '\r' in [str, end), or @end if there
+ * isn't one */
+const gchar * scanner_find_line_end(const gchar *str,
+                                    const gchar *end) {
+    return scanner_get_impl()->find_line_end(str, end);
+}
+
+/* Returns a pointer to the first occurrence of @needle in [str, end), or NULL
+ * if there isn't one */
+const gchar * scanner_find(const gchar *str,
+                           const gchar *end,
+                           const gchar *needle,
+                           gsize needle_len) {
+    if (needle_len == 0)
+        return str;
+
+    return scanner_get_impl()->find(str, end, needle, needle_len);
+}
+
+const gchar * scanner_get_impl_name(void) {
+    return scanner_get_impl()->name;
+}
@@ -0,0 +1,51 @@
+/*
+ * ps2emu-scanner.h
+ * Copyright (C) 2015 Red Hat
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public License for more
+ * details.
+ */
+
+#ifndef __PS2EMU_SCANNER_H__
+#define __PS2EMU_SCANNER_H__
+
+#include <glib.h>
+
+/* Byte scanning routines shared by everything that reads logs or kernel
+ * messages. On x86-64 these use SSE2 or AVX2 (whichever is the best the CPU
+ * supports, picked the first time one of them is called), everywhere else
+ * they're plain C. */
+
+const gchar * scanner_find_line_end(const gchar *str,
+                                    const gchar *end);
+
+const gchar * scanner_find(const gchar *str,
+                           const gchar *end,
+                           const gchar *needle,
+                           gsize needle_len);
+
+const gchar * scanner_get_impl_name(void);
+
+/* One implementation of the routines above. None of them handle empty
+ * needles, scanner_find() takes care of those before calling them. */
+typedef struct {
+    const gchar *name;
+
+    const gchar * (*find_line_end)(const gchar *str,
+                                   const gchar *end);
+    const gchar * (*find)(const gchar *str,
+                          const gchar *end,
+                          const gchar *needle,
+                          gsize needle_len);
+} ScannerImpl;
+
+const ScannerImpl * scanner_lookup_impl(const gchar *name);
+
+#endif /* !__PS2EMU_SCANNER_H__ */
@@ -0,0 +1,121 @@
+/*
+ * ps2emu-scheduler.c
+ * Copyright (C) 2015 Red Hat
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public License for more
+ * details.
+ */
+
+#include "ps2emu-scheduler.h"
+
+#include <time.h>
+#include <errno.h>
+#include <glib.h>
+
+#define SCHEDULER_CALIBRATION_ROUNDS 16
+#define SCHEDULER_CALIBRATION_SLEEP  (50 * 1000)
+
+#define NSEC_PER_SEC G_GINT64_CONSTANT(1000000000)
+
+static inline void cpu_relax(void) {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#endif
+}
+
+/* Current CLOCK_MONOTONIC time in nanoseconds. This is the same clock
+ * g_get_monotonic_time() uses, just with more precision. */
+gint64 scheduler_now(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec * NSEC_PER_SEC + ts.tv_nsec;
+}
+
+static void scheduler_sleep_until(gint64 time,
+                                  gpointer user_data) {
+    struct timespec ts = {
+        .tv_sec = time / NSEC_PER_SEC,
+        .tv_nsec = time % NSEC_PER_SEC,
+    };
+
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) ==
+           EINTR);
+}
+
+/* Keeps a running average of the wakeup latency and of how much it varies,
+ * the same way TCP estimates round trip times, and spins for long enough to
+ * cover nearly all of the wakeups. Anything later than we'd ever spin for was
+ * probably us getting preempted, which spinning wouldn't have helped with, so
+ * those don't get to skew the estimate. */
+static void scheduler_update(Scheduler *scheduler,
+                             gint64 latency) {
+    gint64 error;
+
+    latency = MIN(latency, SCHEDULER_MAX_SPIN);
+    error = latency - scheduler->latency;
+
+    scheduler->latency += error / 8;
+    scheduler->deviation += (ABS(error) - scheduler->deviation) / 4;
+
+    scheduler->spin = CLAMP(scheduler->latency + 4 * scheduler->deviation,
+                            SCHEDULER_MIN_SPIN, SCHEDULER_MAX_SPIN);
+}
+
+/* Takes a few short naps to get an idea of how late wakeups are on this
+ * machine before the first real deadline comes along */
+void scheduler_init(Scheduler *scheduler) {
+    gint64 wake_time;
+
+    *scheduler = (Scheduler) {
+        .spin = SCHEDULER_MIN_SPIN,
+    };
+
+    for (int i = 0; i < SCHEDULER_CALIBRATION_ROUNDS; i++) {
+        wake_time = scheduler_now() + SCHEDULER_CALIBRATION_SLEEP;
+
+        scheduler_sleep_until(wake_time, NULL);
+        scheduler_update(scheduler, scheduler_now() - wake_time);
+    }
+}
+
+/* Like scheduler_wait_until(), but the sleeping part is left up to
+ * @sleep_func, for callers that have other things to keep an eye on while they
+ * wait. It shouldn't return much before the time it's given. */
+gint64 scheduler_wait_until_with(Scheduler *scheduler,
+                                 gint64 deadline,
+                                 SchedulerSleepFunc sleep_func,
+                                 gpointer user_data) {
+    gint64 wake_time = deadline - scheduler->spin,
+           now = scheduler_now();
+
+    if (now < wake_time) {
+        sleep_func(wake_time, user_data);
+
+        now = scheduler_now();
+        scheduler_update(scheduler, now - wake_time);
+    }
+
+    while (now < deadline) {
+        cpu_relax();
+        now = scheduler_now();
+    }
+
+    return now;
+}
+
+/* Returns the time we actually stopped waiting at, which is never before
+ * @deadline */
+gint64 scheduler_wait_until(Scheduler *scheduler,
+                            gint64 deadline) {
+    return scheduler_wait_until_with(scheduler, deadline,
+                                     scheduler_sleep_until, NULL);
+}
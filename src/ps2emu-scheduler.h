@@ -0,0 +1,51 @@
+/*
+ * ps2emu-scheduler.h
+ * Copyright (C) 2015 Red Hat
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public License for more
+ * details.
+ */
+
+#ifndef __PS2EMU_SCHEDULER_H__
+#define __PS2EMU_SCHEDULER_H__
+
+#include <glib.h>
+
+/* Bounds for how long we busy-wait before a deadline, in nanoseconds */
+#define SCHEDULER_MIN_SPIN (5 * 1000)
+#define SCHEDULER_MAX_SPIN (500 * 1000)
+
+/* Waits for absolute CLOCK_MONOTONIC deadlines. Most of the wait is spent in
+ * clock_nanosleep(), but the kernel usually wakes us up a little late, so we
+ * wake up early instead and spin for the rest. How early is tuned on the fly
+ * from how late the previous wakeups were. */
+typedef struct {
+    gint64 latency,   /* how late the kernel's been waking us up */
+           deviation, /* and by how much that varies */
+           spin;      /* how early we ask to be woken up */
+} Scheduler;
+
+/* Sleeps until @wake_time, in CLOCK_MONOTONIC nanoseconds */
+typedef void (*SchedulerSleepFunc)(gint64 wake_time,
+                                   gpointer user_data);
+
+void scheduler_init(Scheduler *scheduler);
+
+gint64 scheduler_wait_until(Scheduler *scheduler,
+                            gint64 deadline);
+
+gint64 scheduler_wait_until_with(Scheduler *scheduler,
+                                 gint64 deadline,
+                                 SchedulerSleepFunc sleep_func,
+                                 gpointer user_data);
+
+gint64 scheduler_now(void);
+
+#endif /* !__PS2EMU_SCHEDULER_H__ */
@@ -0,0 +1,188 @@
+/*
+ * ps2emu-test-packet.c
+ * Copyright (C) 2015 Red Hat
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public License for more
+ * details.
+ */
+
+/* Feeds known exchanges between a driver and a device through the packet
+ * decoder, and checks which data packets come out of it */
+
+#include "ps2emu-packet.h"
+#include "ps2emu-log.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <glib.h>
+
+/* How far apart the bytes are unless the test says otherwise, in
+ * microseconds. Well within PACKET_RESYNC_GAP. */
+#define TEST_BYTE_INTERVAL 100
+
+typedef struct {
+    const gchar *name;
+    PS2Port      port;
+    guint        packet_size;
+
+    /* "S xx" is a byte from the driver and "R xx" one from the device. "+n"
+     * puts n microseconds before the next byte instead of the usual
+     * interval. */
+    const gchar *events;
+    /* For each byte, '+' if it carried on a data packet that was already in
+     * progress and '.' if it didn't. Spaces are ignored. */
+    const gchar *continued;
+    /* The length of each data packet that comes out, with a ! after the ones
+     * that got cut short */
+    const gchar *packets;
+} TestCase;
+
+static const TestCase test_cases[] = {
+    {
+        "mouse", PS2_PORT_AUX, 0,
+        "S ff R fa R aa R 00 "
+        "S f4 R fa "
+        "R 08 R 01 R 02 "
+        "R 18 R ff R 00",
+        ".... .. .++ .++",
+        "3 3",
+    },
+    {
+        /* Setting the sample rate to 200, 100 and then 80 switches on the
+         * scroll wheel, after which the device identifies as 3 */
+        "intellimouse", PS2_PORT_AUX, 0,
+        "S f3 R fa S c8 R fa "
+        "S f3 R fa S 64 R fa "
+        "S f3 R fa S 50 R fa "
+        "S f2 R fa R 03 "
+        "S f4 R fa "
+        "R 08 R 01 R 02 R 01 "
+        "R 09 R 00 R 00 R ff",
+        ".... .... .... ... .. .+++ .+++",
+        "4 4",
+    },
+    {
+        /* Identify (E8 00 00 00 00, E9), then set the mode to 0x80 (E8 02 00
+         * 00 00, F3 14) to put the touchpad in absolute mode */
+        "synaptics-absolute", PS2_PORT_AUX, 0,
+        "S e8 R fa S 00 R fa S e8 R fa S 00 R fa "
+        "S e8 R fa S 00 R fa S e8 R fa S 00 R fa "
+        "S e9 R fa R 01 R 47 R 18 "
+        "S e8 R fa S 02 R fa S e8 R fa S 00 R fa "
+        "S e8 R fa S 00 R fa S e8 R fa S 00 R fa "
+        "S f3 R fa S 14 R fa "
+        "S f4 R fa "
+        "R 80 R 00 R 00 R c0 R 00 R 00 "
+        "R 80 R 10 R 20 R c0 R 30 R 40",
+        "........ ........ ..... ........ ........ .... .. "
+        ".+++++ .+++++",
+        "6 6",
+    },
+    {
+        /* Bytes without bit 3 set can't start a packet, so they get sent on
+         * their own until one that can comes along */
+        "resync-first-byte", PS2_PORT_AUX, 0,
+        "S f4 R fa "
+        "R 00 R 01 "
+        "R 08 R 01 R 02 "
+        "R 08 R 01 R 02",
+        ".. . . .++ .++",
+        "1! 1! 3 3",
+    },
+    {
+        /* The bytes of a packet always come back to back, so a long gap
+         * means we lost some of them */
+        "resync-gap", PS2_PORT_AUX, 0,
+        "S f4 R fa "
+        "R 08 R 01 +5000 "
+        "R 08 R 01 R 02",
+        ".. .+ .++",
+        "2! 3",
+    },
+};
+
+static void append_packet(GString *packets,
+                          const Packet *packet) {
+    if (packet->kind != PACKET_KIND_DATA)
+        return;
+
+    g_string_append_printf(packets, "%s%u%s", packets->len ? " " : "",
+                           packet->length, packet->complete ? "" : "!");
+}
+
+static void test_packets(gconstpointer data) {
+    const TestCase *test = data;
+    gchar **tokens = g_strsplit(test->events, " ", -1),
+          **expected_continued = g_strsplit(test->continued, " ", -1),
+          *expected_continued_str = g_strjoinv("", expected_continued);
+    GString *continued = g_string_new(NULL),
+            *packets = g_string_new(NULL);
+    PacketDecoder decoder;
+    gint32 delta = TEST_BYTE_INTERVAL;
+    Packet packet;
+
+    packet_decoder_init(&decoder, test->port, test->packet_size);
+    packet_decoder_start_section(&decoder);
+
+    for (gchar **token = tokens; *token; token++) {
+        LogEvent event;
+
+        if (**token == '+') {
+            delta = atoi(*token + 1);
+            continue;
+        }
+
+        g_assert_true(strcmp(*token, "S") == 0 || strcmp(*token, "R") == 0);
+        g_assert_nonnull(token[1]);
+
+        event = (LogEvent) {
+            .delta = delta,
+            .type = **token == 'S' ? LOG_EVENT_TYPE_PARAMETER :
+                                     LOG_EVENT_TYPE_INTERRUPT,
+            .data = strtoul(token[1], NULL, 16),
+        };
+        delta = TEST_BYTE_INTERVAL;
+        token++;
+
+        packet_decoder_feed(&decoder, &event);
+        g_string_append_c(continued,
+                          packet_decoder_continues(&decoder) ? '+' : '.');
+
+        while (packet_decoder_next(&decoder, &packet))
+            append_packet(packets, &packet);
+    }
+
+    packet_decoder_flush(&decoder);
+    while (packet_decoder_next(&decoder, &packet))
+        append_packet(packets, &packet);
+
+    g_assert_cmpstr(continued->str, ==, expected_continued_str);
+    g_assert_cmpstr(packets->str, ==, test->packets);
+
+    g_string_free(continued, TRUE);
+    g_string_free(packets, TRUE);
+    g_free(expected_continued_str);
+    g_strfreev(expected_continued);
+    g_strfreev(tokens);
+}
+
+int main(int argc,
+         char *argv[]) {
+    g_test_init(&argc, &argv, NULL);
+
+    for (gsize i = 0; i < G_N_ELEMENTS(test_cases); i++) {
+        gchar *path = g_strdup_printf("/packet/%s", test_cases[i].name);
+
+        g_test_add_data_func(path, &test_cases[i], test_packets);
+        g_free(path);
+    }
+
+    return g_test_run();
+}
@@ -0,0 +1,262 @@
+/*
+ * ps2emu-test-parallel.c
+ * Copyright (C) 2015 Red Hat
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public License for more
+ * details.
+ */
+
+/* Checks that parsing a text log across multiple threads gives exactly the
+ * same result as parsing it on one, wherever the chunk boundaries happen to
+ * land */
+
+#include "ps2emu-log.h"
+#include "ps2emu-log-parallel.h"
+#include "ps2emu-misc.h"
+
+#include <stdarg.h>
+#include <glib.h>
+
+#define TEST_SEEDS 4
+
+typedef enum {
+    /* Switch between the two sections and port types every so often */
+    TEST_LOG_SECTIONS       = 1 << 0,
+    /* Have a run of notes in the middle that's longer than a whole chunk */
+    TEST_LOG_NOTE_RUN       = 1 << 1,
+    TEST_LOG_CRLF           = 1 << 2,
+    /* Start with events before any S: line, which is an error */
+    TEST_LOG_NO_SECTION     = 1 << 3,
+    /* Start with a note before any S: line, which is also an error */
+    TEST_LOG_LEADING_NOTE   = 1 << 4,
+    /* Have an invalid event three quarters of the way through */
+    TEST_LOG_INVALID_EVENT  = 1 << 5,
+} TestLogFlags;
+
+#define TEST_LOG_ERRORS \
+    (TEST_LOG_NO_SECTION | TEST_LOG_LEADING_NOTE | TEST_LOG_INVALID_EVENT)
+
+typedef struct {
+    const gchar  *name;
+    TestLogFlags  flags;
+} TestLog;
+
+static const TestLog test_logs[] = {
+    { "plain", 0 },
+    { "sections", TEST_LOG_SECTIONS },
+    { "note-run", TEST_LOG_SECTIONS | TEST_LOG_NOTE_RUN },
+    { "crlf", TEST_LOG_SECTIONS | TEST_LOG_CRLF },
+    { "no-section", TEST_LOG_NO_SECTION },
+    { "leading-note", TEST_LOG_LEADING_NOTE },
+    { "invalid-event", TEST_LOG_SECTIONS | TEST_LOG_INVALID_EVENT },
+};
+
+static void append_line(GString *log,
+                        TestLogFlags flags,
+                        const gchar *format,
+                        ...)
+G_GNUC_PRINTF(3, 4);
+
+static void append_line(GString *log,
+                        TestLogFlags flags,
+                        const gchar *format,
+                        ...) {
+    va_list args;
+
+    va_start(args, format);
+    g_string_append_vprintf(log, format, args);
+    va_end(args);
+
+    g_string_append(log, flags & TEST_LOG_CRLF ? "\r\n" : "\n");
+}
+
+static void append_event(GString *log,
+                         TestLogFlags flags,
+                         GRand *rand,
+                         time_t *time) {
+    *time += g_rand_int_range(rand, 0, 20000);
+
+    append_line(log, flags, "E: %-10" G_GINT64_FORMAT " %c %02x",
+                (gint64)*time, g_rand_boolean(rand) ? 'R' : 'S',
+                g_rand_int_range(rand, 0, 256));
+}
+
+/* Generates everything that comes after the version line of a V1 log. Each
+ * seed gives a different size, so the logs get split into different numbers
+ * of chunks. */
+static GString * generate_log(TestLogFlags flags,
+                              guint32 seed) {
+    GRand *rand = g_rand_new_with_seed(seed);
+    GString *log = g_string_new(NULL);
+    gsize size = LOG_PARALLEL_MIN_SIZE +
+                 seed * LOG_PARALLEL_MIN_CHUNK_SIZE * 4 / 3;
+    time_t times[2] = { 0, 0 };
+    guint section = SECTION_TYPE_INIT,
+          notes = 0;
+    gboolean note_run_done = FALSE,
+             invalid_done = FALSE;
+
+    /* Moves all of the chunk boundaries along by a few bytes */
+    append_line(log, flags, "#%*s", g_rand_int_range(rand, 0, 64), "");
+
+    if (flags & TEST_LOG_LEADING_NOTE)
+        append_line(log, flags, "N: Note %u", notes++);
+
+    if (!(flags & TEST_LOG_NO_SECTION)) {
+        append_line(log, flags, "T: A");
+        append_line(log, flags, "S: Init");
+
+        for (guint i = 0; i < 20; i++)
+            append_event(log, flags, rand, &times[SECTION_TYPE_INIT]);
+
+        append_line(log, flags, "S: Main");
+        section = SECTION_TYPE_MAIN;
+    }
+
+    while (log->len < size) {
+        guint roll = g_rand_int_range(rand, 0, 1000);
+
+        if ((flags & TEST_LOG_NOTE_RUN) && !note_run_done &&
+            log->len > size / 2) {
+            while (log->len < size / 2 + LOG_PARALLEL_MIN_CHUNK_SIZE * 2)
+                append_line(log, flags, "N: Note %u", notes++);
+
+            note_run_done = TRUE;
+        } else if ((flags & TEST_LOG_INVALID_EVENT) && !invalid_done &&
+                   log->len > size / 4 * 3) {
+            append_line(log, flags, "E: invalid");
+            invalid_done = TRUE;
+        } else if ((flags & TEST_LOG_SECTIONS) && roll == 0) {
+            section = section == SECTION_TYPE_INIT ?
+                SECTION_TYPE_MAIN : SECTION_TYPE_INIT;
+            append_line(log, flags, "S: %s",
+                        section == SECTION_TYPE_INIT ? "Init" : "Main");
+        } else if ((flags & TEST_LOG_SECTIONS) && roll == 1) {
+            append_line(log, flags, "T: %c",
+                        g_rand_boolean(rand) ? 'K' : 'A');
+        } else if (roll == 2) {
+            /* Too long to fit in a single delta */
+            times[section] += (time_t)G_MAXINT32 +
+                              g_rand_int_range(rand, 0, G_MAXINT32);
+        } else if (roll < 20) {
+            for (gint i = g_rand_int_range(rand, 1, 40); i > 0; i--)
+                append_line(log, flags, "N: Note %u", notes++);
+        } else if (roll < 30) {
+            append_line(log, flags, "%s", roll < 25 ? "# Comment" : "");
+        } else {
+            append_event(log, flags, rand, &times[section]);
+        }
+    }
+
+    g_rand_free(rand);
+    return log;
+}
+
+static ParsedLog * parse(const GString *log,
+                         guint n_threads,
+                         GError **error) {
+    LogParseState state;
+    ParsedLog *parsed_log;
+    gboolean ret;
+
+    parsed_log = log_parse_begin(&state, PS2EMU_LOG_VERSION);
+
+    if (n_threads > 1)
+        ret = log_parse_text_parallel(&state, log->str, log->str + log->len,
+                                      n_threads, error);
+    else
+        ret = log_parse_buffer(&state, log->str, log->str + log->len, error);
+
+    if (!ret) {
+        log_free(parsed_log);
+        return NULL;
+    }
+
+    return parsed_log;
+}
+
+static void assert_sections_equal(const LogSection *expected,
+                                  const LogSection *section) {
+    g_assert_cmpuint(section->events->len, ==, expected->events->len);
+    for (guint i = 0; i < expected->events->len; i++) {
+        const LogEvent *a = &g_array_index(expected->events, LogEvent, i),
+                       *b = &g_array_index(section->events, LogEvent, i);
+
+        g_assert_cmpint(b->delta, ==, a->delta);
+        g_assert_cmpuint(b->type, ==, a->type);
+        g_assert_cmpuint(b->data, ==, a->data);
+    }
+
+    g_assert_cmpuint(section->notes->len, ==, expected->notes->len);
+    for (guint i = 0; i < expected->notes->len; i++) {
+        const LogNote *a = &g_array_index(expected->notes, LogNote, i),
+                      *b = &g_array_index(section->notes, LogNote, i);
+
+        g_assert_cmpuint(b->position, ==, a->position);
+        g_assert_cmpstr(b->text, ==, a->text);
+    }
+}
+
+static void test_parallel_parse(gconstpointer data) {
+    const TestLog *test_log = data;
+    const guint thread_counts[] = { 2, 3, 8 };
+
+    for (guint32 seed = 1; seed <= TEST_SEEDS; seed++) {
+        GString *log = generate_log(test_log->flags, seed);
+        ParsedLog *expected,
+                  *parsed_log;
+        GError *expected_error = NULL;
+
+        expected = parse(log, 1, &expected_error);
+        g_assert_cmpint(expected_error != NULL, ==,
+                        (test_log->flags & TEST_LOG_ERRORS) != 0);
+
+        for (gsize i = 0; i < G_N_ELEMENTS(thread_counts); i++) {
+            GError *error = NULL;
+
+            parsed_log = parse(log, thread_counts[i], &error);
+
+            if (expected_error) {
+                g_assert_null(parsed_log);
+                g_assert_nonnull(error);
+                g_assert_cmpstr(error->message, ==, expected_error->message);
+                g_error_free(error);
+                continue;
+            }
+
+            g_assert_no_error(error);
+            g_assert_cmpint(parsed_log->port, ==, expected->port);
+            assert_sections_equal(&expected->init_section,
+                                  &parsed_log->init_section);
+            assert_sections_equal(&expected->main_section,
+                                  &parsed_log->main_section);
+            log_free(parsed_log);
+        }
+
+        if (expected)
+            log_free(expected);
+        g_clear_error(&expected_error);
+        g_string_free(log, TRUE);
+    }
+}
+
+int main(int argc,
+         char *argv[]) {
+    g_test_init(&argc, &argv, NULL);
+
+    for (gsize i = 0; i < G_N_ELEMENTS(test_logs); i++) {
+        gchar *path = g_strdup_printf("/log/parallel/%s", test_logs[i].name);
+
+        g_test_add_data_func(path, &test_logs[i], test_parallel_parse);
+        g_free(path);
+    }
+
+    return g_test_run();
+}
@@ -0,0 +1,189 @@
+/*
+ * ps2emu-test-scanner.c
+ * Copyright (C) 2015 Red Hat
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public License for more
+ * details.
+ */
+
+/* Checks every scanner implementation the CPU supports on buffers of every
+ * length up to a few vectors, with whatever's being looked for at every
+ * position in them. That covers matches on either side of and straddling
+ * every 16 and 32 byte boundary, and matches cut off by the end of the
+ * buffer. */
+
+#include "ps2emu-scanner.h"
+
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <glib.h>
+
+#define TEST_MAX_LENGTH        100
+#define TEST_MAX_NEEDLE_LENGTH 40
+
+/* How far the end of the buffer is from the end of the readable memory. When
+ * it's right up against it, reading past the end crashes. Otherwise, whatever
+ * comes after the end would match if it were looked at. */
+static const gsize test_tails[] = { 0, 1, 17, 32 };
+
+/* What the buffer is filled with around the needle */
+static const gchar test_fills[] = { '.', 'E' };
+
+static const gchar *impl_names[] = { "scalar", "sse2", "avx2" };
+
+/* Returns the start of a page that's followed by one that can't be read */
+static gchar * map_guarded_page(gsize *page_size) {
+    gchar *page;
+
+    *page_size = sysconf(_SC_PAGESIZE);
+
+    page = mmap(NULL, *page_size * 2, PROT_READ | PROT_WRITE,
+                MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    g_assert(page != MAP_FAILED);
+    g_assert_cmpint(mprotect(page + *page_size, *page_size, PROT_NONE),
+                    ==, 0);
+
+    return page;
+}
+
+static const ScannerImpl * get_impl(gconstpointer data) {
+    const ScannerImpl *impl = scanner_lookup_impl(data);
+
+    if (!impl)
+        g_test_skip("Not supported on this CPU");
+
+    return impl;
+}
+
+static void test_find_line_end(gconstpointer data) {
+    const ScannerImpl *impl = get_impl(data);
+    const gchar line_ends[] = { '\n', '\r' };
+    gsize page_size;
+    gchar *page;
+
+    if (!impl)
+        return;
+
+    page = map_guarded_page(&page_size);
+
+    for (gsize t = 0; t < G_N_ELEMENTS(test_tails); t++) {
+        gchar *end = page + page_size - test_tails[t];
+
+        memset(end, '\n', test_tails[t]);
+
+        for (gsize length = 0; length <= TEST_MAX_LENGTH; length++) {
+            gchar *str = end - length;
+
+            memset(str, 'x', length);
+            g_assert_true(impl->find_line_end(str, end) == end);
+
+            for (gsize pos = 0; pos < length; pos++) {
+                for (gsize i = 0; i < G_N_ELEMENTS(line_ends); i++) {
+                    memset(str, 'x', length);
+                    str[pos] = line_ends[i];
+
+                    /* Only the first one counts */
+                    if (pos + 1 < length)
+                        str[length - 1] = line_ends[!i];
+
+                    g_assert_true(impl->find_line_end(str, end) ==
+                                  str + pos);
+                }
+            }
+        }
+    }
+
+    munmap(page, page_size * 2);
+}
+
+/* Writes as much of @needle at @pos as fits before @limit */
+static void write_needle(gchar *pos,
+                         const gchar *limit,
+                         const gchar *needle,
+                         gsize needle_len) {
+    memcpy(pos, needle, MIN(needle_len, (gsize)(limit - pos)));
+}
+
+static void test_find(gconstpointer data) {
+    const ScannerImpl *impl = get_impl(data);
+    gchar needle[TEST_MAX_NEEDLE_LENGTH];
+    gsize page_size;
+    gchar *page,
+          *limit;
+
+    if (!impl)
+        return;
+
+    page = map_guarded_page(&page_size);
+    limit = page + page_size;
+
+    for (gsize needle_len = 1; needle_len <= TEST_MAX_NEEDLE_LENGTH;
+         needle_len++) {
+        /* The first and last bytes are the same, and nothing in between is,
+         * so a buffer full of the first byte matches both of them everywhere
+         * without ever matching the whole needle */
+        for (gsize i = 0; i < needle_len; i++)
+            needle[i] = 'a' + i % 26;
+        needle[0] = needle[needle_len - 1] = 'E';
+
+        for (gsize t = 0; t < G_N_ELEMENTS(test_tails); t++) {
+            gchar *end = limit - test_tails[t];
+
+            for (gsize length = 0; length <= TEST_MAX_LENGTH; length++) {
+                gchar *str = end - length;
+
+                for (gsize f = 0; f < G_N_ELEMENTS(test_fills); f++) {
+                    gchar fill = test_fills[f];
+
+                    if (fill == needle[0] && needle_len < 3)
+                        continue;
+
+                    memset(str, fill, limit - str);
+                    g_assert_null(impl->find(str, end, needle, needle_len));
+
+                    /* Past length - needle_len, the needle gets cut off by
+                     * the end of the buffer and can't be found */
+                    for (gsize pos = 0; pos < length; pos++) {
+                        gboolean fits = pos + needle_len <= length;
+
+                        memset(str, fill, limit - str);
+                        write_needle(str + pos, limit, needle, needle_len);
+
+                        g_assert_true(impl->find(str, end, needle,
+                                                 needle_len) ==
+                                      (fits ? str + pos : NULL));
+                    }
+                }
+            }
+        }
+    }
+
+    munmap(page, page_size * 2);
+}
+
+int main(int argc,
+         char *argv[]) {
+    g_test_init(&argc, &argv, NULL);
+
+    for (gsize i = 0; i < G_N_ELEMENTS(impl_names); i++) {
+        gchar *path;
+
+        path = g_strdup_printf("/scanner/%s/find-line-end", impl_names[i]);
+        g_test_add_data_func(path, impl_names[i], test_find_line_end);
+        g_free(path);
+
+        path = g_strdup_printf("/scanner/%s/find", impl_names[i]);
+        g_test_add_data_func(path, impl_names[i], test_find);
+        g_free(path);
+    }
+
+    return g_test_run();
+}
@@ -0,0 +1,56 @@
+/*
+ * ps2emu-trace-print.c
+ * Copyright (C) 2015 Red Hat
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public License for more
+ * details.
+ */
+
+#include "ps2emu-trace.h"
+#include "ps2emu-misc.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <glib.h>
+
+gint main(gint argc,
+          gchar *argv[]) {
+    GOptionContext *main_context =
+        g_option_context_new("<trace> - print ps2emu-replay traces");
+    GError *error = NULL;
+
+    GOptionEntry options[] = {
+        { "version", 'V', G_OPTION_FLAG_NO_ARG, G_OPTION_ARG_CALLBACK,
+          print_version, "Show the version of the application", NULL },
+        { 0 }
+    };
+
+    g_option_context_add_main_entries(main_context, options, NULL);
+    g_option_context_set_help_enabled(main_context, TRUE);
+    g_option_context_set_description(main_context,
+        "Prints a trace written by ps2emu-replay --trace, along with how late\n"
+        "each interrupt was sent and how long each byte from the driver took\n"
+        "to arrive.\n");
+
+    if (!g_option_context_parse(main_context, &argc, &argv, &error))
+        exit_on_bad_argument(main_context, TRUE, error->message);
+
+    if (argc != 2)
+        exit_on_bad_argument(main_context, FALSE,
+                             "Exactly one trace needs to be given! Use --help "
+                             "for more information");
+
+    if (!trace_file_print(argv[1], stdout, &error)) {
+        fprintf(stderr, "Error: %s\n", error->message);
+        return 1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,464 @@
+/*
+ * ps2emu-trace.c
+ * Copyright (C) 2015 Red Hat
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public License for more
+ * details.
+ */
+
+#include "ps2emu-trace.h"
+#include "ps2emu-misc.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <glib.h>
+
+#define TRACE_RING_MASK (TRACE_RING_SIZE - 1)
+
+/* How much of the binary trace gets buffered up before it's written out */
+#define TRACE_WRITE_SIZE (64 * 1024)
+
+static const gchar trace_magic[8] = "PS2EMUTR";
+
+struct _Tracer {
+    TraceRecord *ring;
+    gint         head, /* only ever written by the replay thread */
+                 tail; /* only ever written by the writer thread */
+    guint64      dropped;
+    gint         stopping;
+    GThread     *writer;
+
+    GPtrArray   *devices;
+    FILE        *text;
+    FILE        *file;
+    gchar       *path;
+    GByteArray  *buffer;
+    GError      *error;
+};
+
+static inline void append_u16(GByteArray *array,
+                              guint16 value) {
+    value = GUINT16_TO_LE(value);
+    g_byte_array_append(array, (guint8*)&value, sizeof(value));
+}
+
+static inline void append_u32(GByteArray *array,
+                              guint32 value) {
+    value = GUINT32_TO_LE(value);
+    g_byte_array_append(array, (guint8*)&value, sizeof(value));
+}
+
+static inline void append_u64(GByteArray *array,
+                              guint64 value) {
+    value = GUINT64_TO_LE(value);
+    g_byte_array_append(array, (guint8*)&value, sizeof(value));
+}
+
+static inline guint16 read_u16(const gchar **pos) {
+    guint16 value;
+
+    memcpy(&value, *pos, sizeof(value));
+    *pos += sizeof(value);
+
+    return GUINT16_FROM_LE(value);
+}
+
+static inline guint32 read_u32(const gchar **pos) {
+    guint32 value;
+
+    memcpy(&value, *pos, sizeof(value));
+    *pos += sizeof(value);
+
+    return GUINT32_FROM_LE(value);
+}
+
+static inline guint64 read_u64(const gchar **pos) {
+    guint64 value;
+
+    memcpy(&value, *pos, sizeof(value));
+    *pos += sizeof(value);
+
+    return GUINT64_FROM_LE(value);
+}
+
+/* Only the first error gets kept, after that we stop writing */
+static void tracer_flush(Tracer *tracer) {
+    if (!tracer->file || tracer->error || !tracer->buffer->len)
+        return;
+
+    if (fwrite(tracer->buffer->data, tracer->buffer->len, 1,
+               tracer->file) != 1)
+        g_set_error(&tracer->error, G_FILE_ERROR,
+                    g_file_error_from_errno(errno),
+                    "While writing %s: %s", tracer->path, g_strerror(errno));
+
+    g_byte_array_set_size(tracer->buffer, 0);
+}
+
+static void tracer_print_record(Tracer *tracer,
+                                const TraceRecord *record) {
+    const gchar *name = tracer->devices->len > 1 ?
+                        tracer->devices->pdata[record->device] : NULL;
+
+    switch (record->type) {
+    case TRACE_SEND:
+        fprintf(tracer->text, "%s%sSend\t-> %.2hhx\n",
+                name ? name : "", name ? ": " : "", record->data);
+        break;
+    case TRACE_RECEIVE:
+        fprintf(tracer->text, "%s%sReceive\t<- %.2hhx\n",
+                name ? name : "", name ? ": " : "", record->data);
+        break;
+    case TRACE_NOTE:
+        fprintf(tracer->text, "%s%sUser note: %s\n",
+                name ? name : "", name ? ": " : "", record->note);
+        break;
+    /* These already get printed to stderr as they happen */
+    case TRACE_MISMATCH:
+    case TRACE_TIMEOUT:
+        break;
+    }
+}
+
+static void tracer_write_record(Tracer *tracer,
+                                const TraceRecord *record) {
+    static const guint8 padding[3] = { 0 };
+
+    if (tracer->text)
+        tracer_print_record(tracer, record);
+
+    if (record->type == TRACE_NOTE) {
+        g_free(record->note);
+        return;
+    }
+
+    if (!tracer->file)
+        return;
+
+    append_u64(tracer->buffer, record->time);
+    append_u64(tracer->buffer, record->due);
+    append_u16(tracer->buffer, record->device);
+    g_byte_array_append(tracer->buffer, &record->type, 1);
+    g_byte_array_append(tracer->buffer, &record->data, 1);
+    g_byte_array_append(tracer->buffer, &record->expected, 1);
+    g_byte_array_append(tracer->buffer, padding, sizeof(padding));
+
+    if (tracer->buffer->len >= TRACE_WRITE_SIZE)
+        tracer_flush(tracer);
+}
+
+static gpointer tracer_write(gpointer data) {
+    Tracer *tracer = data;
+
+    for (;;) {
+        /* Has to be checked before draining the ring, so that nothing pushed
+         * before we were told to stop gets missed */
+        gboolean stopping = g_atomic_int_get(&tracer->stopping);
+        guint tail = tracer->tail,
+              head = g_atomic_int_get(&tracer->head);
+
+        if (tail == head) {
+            if (stopping)
+                break;
+
+            if (tracer->text)
+                fflush(tracer->text);
+
+            g_usleep(TRACE_POLL_INTERVAL);
+            continue;
+        }
+
+        for (; tail != head; tail++) {
+            tracer_write_record(tracer, &tracer->ring[tail & TRACE_RING_MASK]);
+            g_atomic_int_set(&tracer->tail, tail + 1);
+        }
+    }
+
+    tracer_flush(tracer);
+    if (tracer->text)
+        fflush(tracer->text);
+
+    return NULL;
+}
+
+Tracer * tracer_new(FILE *text,
+                    const gchar *path,
+                    GError **error) {
+    Tracer *tracer = g_new0(Tracer, 1);
+
+    tracer->text = text;
+    tracer->devices = g_ptr_array_new_with_free_func(g_free);
+    tracer->buffer = g_byte_array_sized_new(TRACE_WRITE_SIZE);
+
+    if (path) {
+        tracer->file = fopen(path, "wb");
+        if (!tracer->file) {
+            g_set_error(error, G_FILE_ERROR, g_file_error_from_errno(errno),
+                        "While opening %s: %s", path, g_strerror(errno));
+            tracer_free(tracer, NULL);
+            return NULL;
+        }
+
+        tracer->path = g_strdup(path);
+    }
+
+    /* Written to now so every page of it gets faulted in, and the replay
+     * thread doesn't take page faults on it later. g_new0() wouldn't do,
+     * since calloc() hands back untouched zero pages for anything this
+     * big. */
+    tracer->ring = g_new(TraceRecord, TRACE_RING_SIZE);
+    memset(tracer->ring, 0, sizeof(TraceRecord) * TRACE_RING_SIZE);
+
+    return tracer;
+}
+
+guint16 tracer_add_device(Tracer *tracer,
+                          const gchar *name) {
+    g_assert(!tracer->writer);
+    g_assert(tracer->devices->len <= G_MAXUINT16);
+
+    g_ptr_array_add(tracer->devices, g_strdup(name));
+
+    return tracer->devices->len - 1;
+}
+
+void tracer_start(Tracer *tracer) {
+    if (tracer->file) {
+        g_byte_array_append(tracer->buffer, (guint8*)trace_magic,
+                            sizeof(trace_magic));
+        append_u32(tracer->buffer, TRACE_VERSION);
+        append_u32(tracer->buffer, tracer->devices->len);
+
+        for (guint i = 0; i < tracer->devices->len; i++) {
+            const gchar *name = tracer->devices->pdata[i];
+
+            append_u32(tracer->buffer, strlen(name));
+            g_byte_array_append(tracer->buffer, (guint8*)name, strlen(name));
+        }
+    }
+
+    tracer->writer = g_thread_new("trace-writer", tracer_write, tracer);
+}
+
+static gboolean tracer_push_record(Tracer *tracer,
+                                   const TraceRecord *record) {
+    guint head = tracer->head,
+          tail = g_atomic_int_get(&tracer->tail);
+
+    if (head - tail == TRACE_RING_SIZE)
+        return FALSE;
+
+    tracer->ring[head & TRACE_RING_MASK] = *record;
+    g_atomic_int_set(&tracer->head, head + 1);
+
+    return TRUE;
+}
+
+void tracer_push(Tracer *tracer,
+                 TraceType type,
+                 guint16 device,
+                 guint8 data,
+                 guint8 expected,
+                 gint64 time,
+                 gint64 due) {
+    TraceRecord record = {
+        .time = time,
+        .due = due,
+        .device = device,
+        .type = type,
+        .data = data,
+        .expected = expected,
+    };
+
+    if (!tracer_push_record(tracer, &record))
+        tracer->dropped++;
+}
+
+gboolean tracer_push_note(Tracer *tracer,
+                          guint16 device,
+                          const gchar *text,
+                          gint64 time) {
+    TraceRecord record = {
+        .time = time,
+        .device = device,
+        .type = TRACE_NOTE,
+    };
+
+    if (!tracer->text)
+        return FALSE;
+
+    /* Copied, since the log it came from could be gone by the time the
+     * writer thread gets to it. Notes are few and far between, and get
+     * followed by a delay anyway. */
+    record.note = g_strdup(text);
+    if (!tracer_push_record(tracer, &record)) {
+        g_free(record.note);
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+gboolean tracer_free(Tracer *tracer,
+                     GError **error) {
+    gboolean ret = TRUE;
+
+    if (tracer->writer) {
+        g_atomic_int_set(&tracer->stopping, TRUE);
+        g_thread_join(tracer->writer);
+    }
+
+    if (tracer->dropped)
+        fprintf(stderr,
+                "Warning: %" G_GUINT64_FORMAT " trace records were dropped "
+                "because they couldn't be written out fast enough\n",
+                tracer->dropped);
+
+    if (tracer->file) {
+        tracer_flush(tracer);
+
+        if (fclose(tracer->file) != 0 && !tracer->error)
+            g_set_error(&tracer->error, G_FILE_ERROR,
+                        g_file_error_from_errno(errno),
+                        "While writing %s: %s", tracer->path,
+                        g_strerror(errno));
+    }
+
+    if (tracer->error) {
+        g_propagate_error(error, tracer->error);
+        ret = FALSE;
+    }
+
+    g_ptr_array_free(tracer->devices, TRUE);
+    g_byte_array_free(tracer->buffer, TRUE);
+    g_free(tracer->ring);
+    g_free(tracer->path);
+    g_free(tracer);
+
+    return ret;
+}
+
+gboolean trace_file_print(const gchar *path,
+                          FILE *output,
+                          GError **error) {
+    GPtrArray *devices = g_ptr_array_new_with_free_func(g_free);
+    gchar *contents = NULL;
+    const gchar *pos,
+                *end;
+    gsize length;
+    guint32 device_count;
+    gint64 start = 0;
+    gboolean ret = FALSE;
+
+    if (!g_file_get_contents(path, &contents, &length, error))
+        goto out;
+
+    pos = contents;
+    end = contents + length;
+    if (length < sizeof(trace_magic) + 2 * sizeof(guint32) ||
+        memcmp(pos, trace_magic, sizeof(trace_magic)) != 0) {
+        g_set_error(error, PS2EMU_ERROR, PS2EMU_ERROR_INPUT,
+                    "%s isn't a ps2emu trace", path);
+        goto out;
+    }
+    pos += sizeof(trace_magic);
+
+    if (read_u32(&pos) != TRACE_VERSION) {
+        g_set_error(error, PS2EMU_ERROR, PS2EMU_ERROR_INPUT,
+                    "%s was made by a different version of ps2emu-replay",
+                    path);
+        goto out;
+    }
+
+    device_count = read_u32(&pos);
+    for (guint32 i = 0; i < device_count; i++) {
+        guint32 name_length;
+
+        if (end - pos < (gssize)sizeof(guint32))
+            goto corrupted;
+
+        name_length = read_u32(&pos);
+        if ((gsize)(end - pos) < name_length)
+            goto corrupted;
+
+        g_ptr_array_add(devices, g_strndup(pos, name_length));
+        pos += name_length;
+    }
+
+    if ((end - pos) % TRACE_RECORD_SIZE != 0)
+        goto corrupted;
+
+    fprintf(output, "%12s  %-16s  %s\n", "Time", "Device", "Event");
+
+    while (pos < end) {
+        TraceRecord record;
+        const gchar *device;
+        gdouble waited;
+
+        record.time = read_u64(&pos);
+        record.due = read_u64(&pos);
+        record.device = read_u16(&pos);
+        record.type = *pos++;
+        record.data = *pos++;
+        record.expected = *pos++;
+        pos += 3;
+
+        if (record.device >= devices->len)
+            goto corrupted;
+
+        if (!start)
+            start = record.time;
+
+        device = devices->pdata[record.device];
+        waited = (record.time - record.due) / 1000.0;
+
+        fprintf(output, "%12.6f  %-16s  ",
+                (record.time - start) / 1e9, device);
+
+        switch (record.type) {
+        case TRACE_SEND:
+            /* Sends only have a due time if the replay kept to the timing */
+            if (record.due)
+                fprintf(output, "Send     -> %.2hhx  %.1fus late\n",
+                        record.data, waited);
+            else
+                fprintf(output, "Send     -> %.2hhx\n", record.data);
+            break;
+        case TRACE_RECEIVE:
+            fprintf(output, "Receive  <- %.2hhx  waited %.1fus\n",
+                    record.data, waited);
+            break;
+        case TRACE_MISMATCH:
+            fprintf(output, "Mismatch <- %.2hhx  expected %.2hhx, waited "
+                    "%.1fus\n", record.data, record.expected, waited);
+            break;
+        case TRACE_TIMEOUT:
+            fprintf(output, "Timeout         expected %.2hhx, waited "
+                    "%.1fus\n", record.expected, waited);
+            break;
+        default:
+            goto corrupted;
+        }
+    }
+
+    ret = TRUE;
+    goto out;
+
+corrupted:
+    g_set_error(error, PS2EMU_ERROR, PS2EMU_ERROR_INPUT,
+                "%s is corrupted", path);
+
+out:
+    g_ptr_array_free(devices, TRUE);
+    g_free(contents);
+
+    return ret;
+}
@@ -0,0 +1,115 @@
+/*
+ * ps2emu-trace.h
+ * Copyright (C) 2015 Red Hat
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public License for more
+ * details.
+ */
+
+#ifndef __PS2EMU_TRACE_H__
+#define __PS2EMU_TRACE_H__
+
+#include <stdio.h>
+#include <glib.h>
+
+/* How many records fit in the ring, has to be a power of two. Anything the
+ * writer thread can't keep up with past this gets dropped. */
+#define TRACE_RING_SIZE 65536
+
+/* How long the writer thread sleeps for when the ring is empty, in
+ * microseconds */
+#define TRACE_POLL_INTERVAL 1000
+
+/* Trace files are a header:
+ *
+ *   magic "PS2EMUTR", guint32 trace version, guint32 device count
+ *
+ * followed by each device's name as a guint32 length and that many bytes, and
+ * then the records, each one being:
+ *
+ *   gint64 time, gint64 due, guint16 device, guint8 type, guint8 data,
+ *   guint8 expected, and 3 bytes of padding
+ *
+ * Everything is stored in little endian. */
+#define TRACE_VERSION     1
+#define TRACE_RECORD_SIZE 24
+
+typedef enum {
+    TRACE_SEND,     /* an interrupt went out */
+    TRACE_RECEIVE,  /* the driver sent what we expected */
+    TRACE_MISMATCH, /* the driver sent something else */
+    TRACE_TIMEOUT,  /* the driver didn't send anything */
+    TRACE_NOTE      /* a user note came up, these only ever get printed */
+} TraceType;
+
+typedef struct {
+    gint64  time;     /* CLOCK_MONOTONIC nanoseconds */
+    gint64  due;      /* when a send was scheduled for (0 with
+                         --no-timing), or when we started waiting on a
+                         receive */
+    guint16 device;
+    guint8  type,
+            data,
+            expected; /* only for mismatches */
+    gchar  *note;     /* only for notes, freed once it's printed */
+} TraceRecord;
+
+/* Collects trace records from the replay thread, and hands them off to a
+ * writer thread that formats them. The ring between the two has exactly one
+ * producer and one consumer, so pushing a record never takes a lock or makes
+ * a system call, and a slow terminal can only ever cost us records, not
+ * timing. */
+typedef struct _Tracer Tracer;
+
+/* Either of @text and @path can be NULL. The records are printed to @text in
+ * the same format -v has always used, and written to @path as a binary trace
+ * file. */
+Tracer * tracer_new(FILE *text,
+                    const gchar *path,
+                    GError **error)
+G_GNUC_MALLOC;
+
+/* Devices have to be added before tracer_start(). Returns the device's id,
+ * which goes in its records. The name is only used to prefix the text output
+ * when there's more than one device. */
+guint16 tracer_add_device(Tracer *tracer,
+                          const gchar *name);
+
+void tracer_start(Tracer *tracer);
+
+/* Only ever call this from one thread. @time and @due are in the same time
+ * base as scheduler_now(). */
+void tracer_push(Tracer *tracer,
+                 TraceType type,
+                 guint16 device,
+                 guint8 data,
+                 guint8 expected,
+                 gint64 time,
+                 gint64 due);
+
+/* Has the writer thread print a user note, so it comes out in order with the
+ * records around it. Returns FALSE if the tracer isn't printing anything or
+ * the ring's full, in which case printing the note is up to the caller.
+ * Notes don't go in trace files, there's no room for them in a record. */
+gboolean tracer_push_note(Tracer *tracer,
+                          guint16 device,
+                          const gchar *text,
+                          gint64 time);
+
+/* Writes out whatever's left in the ring and stops the writer thread */
+gboolean tracer_free(Tracer *tracer,
+                     GError **error);
+
+/* Prints a binary trace file in a human readable format */
+gboolean trace_file_print(const gchar *path,
+                          FILE *output,
+                          GError **error);
+
+#endif /* !__PS2EMU_TRACE_H__ */
@@ -0,0 +1,18 @@
+#!/bin/sh
+# Replays a recording against a simulated driver that answers the first
+# command with the wrong byte and then stops sending anything. The replay has
+# to keep going, and count one mismatch followed by a timeout for each of the
+# six commands left in the initialization sequence.
+
+set -e
+
+stats=tests/replay-desync.json
+
+./ps2emu-replay --simulate --simulate-script="$srcdir/tests/desync.script" \
+    --receive-timeout=10 --stats-json="$stats" \
+    "$srcdir/tests/mouse.log" > /dev/null 2>&1
+
+if ! grep -q '"receive_mismatches": 1, "receive_timeouts": 6' "$stats"; then
+    cat "$stats"
+    exit 1
+fi
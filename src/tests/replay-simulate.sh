@@ -0,0 +1,16 @@
+#!/bin/sh
+# Replays a recording against the simulated driver without a script. The
+# driver sends exactly what the recording expects, so nothing should ever go
+# out of sync.
+
+set -e
+
+stats=tests/replay-simulate.json
+
+./ps2emu-replay --simulate --stats-json="$stats" \
+    "$srcdir/tests/mouse.log" > /dev/null
+
+if ! grep -q '"receive_mismatches": 0, "receive_timeouts": 0' "$stats"; then
+    cat "$stats"
+    exit 1
+fi